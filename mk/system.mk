@@ -36,7 +36,7 @@ $(DEV_OUT)/%.o: $(DEV_SRC)/%.c $(deps_emcc)
 DEV_OBJS := $(patsubst $(DEV_SRC)/%.c, $(DEV_OUT)/%.o, $(wildcard $(DEV_SRC)/*.c))
 deps := $(DEV_OBJS:%.o=%.o.d)
 
-OBJS_EXT += system.o
+OBJS_EXT += system.o snapshot.o
 OBJS_EXT += dtc/libfdt/fdt.o dtc/libfdt/fdt_ro.o dtc/libfdt/fdt_rw.o dtc/libfdt/fdt_wip.o
 
 # system target execution by using default dependencies
@@ -6,12 +6,17 @@ MAP_TEST_SRCDIR := tests/map
 MAP_TEST_OUTDIR:= build/map
 MAP_TEST_TARGET := $(MAP_TEST_OUTDIR)/test-map
 
+DECODE_TEST_SRCDIR := tests/decode
+DECODE_TEST_OUTDIR := build/decode
+DECODE_TEST_TARGET := $(DECODE_TEST_OUTDIR)/test-decode
+
 PATH_TEST_SRCDIR := tests/path
 PATH_TEST_OUTDIR := build/path
 PATH_TEST_TARGET := $(PATH_TEST_OUTDIR)/test-path
 
 CACHE_TEST_OBJS := \
-	test-cache.o
+	test-cache.o \
+	cache-legacy.o
 
 MAP_TEST_OBJS := \
 	test-map.o \
@@ -20,6 +25,9 @@ MAP_TEST_OBJS := \
 PATH_TEST_OBJS := \
 	test-path.o 
 
+DECODE_TEST_OBJS := \
+	test-decode.o
+
 CACHE_TEST_OBJS := $(addprefix $(CACHE_TEST_OUTDIR)/, $(CACHE_TEST_OBJS)) \
 		   $(OUT)/cache.o $(OUT)/mpool.o
 OBJS += $(CACHE_TEST_OBJS)
@@ -35,17 +43,24 @@ PATH_TEST_OBJS := $(addprefix $(PATH_TEST_OUTDIR)/, $(PATH_TEST_OBJS)) \
 OBJS += $(PATH_TEST_OBJS)
 deps += $(PATH_TEST_OBJS:%.o=%.o.d)
 
+DECODE_TEST_OBJS := $(addprefix $(DECODE_TEST_OUTDIR)/, $(DECODE_TEST_OBJS)) \
+		    $(OUT)/decode.o
+OBJS += $(DECODE_TEST_OBJS)
+deps += $(DECODE_TEST_OBJS:%.o=%.o.d)
+
 CACHE_TEST_ACTIONS := \
 	cache-new \
 	cache-put \
 	cache-get \
-	cache-replace
+	cache-replace \
+	cache-freq
 
 CACHE_TEST_OUT = $(addprefix $(CACHE_TEST_OUTDIR)/, $(CACHE_TEST_ACTIONS:%=%.out))
 MAP_TEST_OUT = $(MAP_TEST_TARGET).out
 PATH_TEST_OUT = $(PATH_TEST_TARGET).out
+DECODE_TEST_OUT = $(DECODE_TEST_TARGET).out
 
-tests : run-test-cache run-test-map run-test-path
+tests : run-test-cache run-test-map run-test-path run-test-decode
 
 run-test-cache: $(CACHE_TEST_OUT)
 	$(Q)$(foreach e,$(CACHE_TEST_ACTIONS),\
@@ -113,3 +128,101 @@ $(PATH_TEST_OUTDIR)/%.o: $(PATH_TEST_SRCDIR)/%.c
 	$(VECHO) "  CC\t$@\n"
 	$(Q)mkdir -p $(dir $@)
 	$(Q)$(CC) -o $@ $(CFLAGS) -I./src -c -MMD -MF $@.d $<
+
+run-test-decode: $(DECODE_TEST_OUT)
+	$(VECHO) "Running test-decode ... "
+	$(Q)if $(DECODE_TEST_TARGET) > /dev/null; then \
+	$(call notice, [OK]); \
+	else \
+	$(PRINTF) "Failed.\n"; \
+	exit 1; \
+	fi;
+
+$(DECODE_TEST_OUT): $(DECODE_TEST_TARGET)
+	$(Q)touch $@
+
+$(DECODE_TEST_TARGET): $(DECODE_TEST_OBJS)
+	$(VECHO) "  CC\t$@\n"
+	$(Q)$(CC) $^ -o $@ $(LDFLAGS)
+
+$(DECODE_TEST_OUTDIR)/%.o: $(DECODE_TEST_SRCDIR)/%.c | $(DECODE_GEN)
+	$(VECHO) "  CC\t$@\n"
+	$(Q)mkdir -p $(dir $@)
+	$(Q)$(CC) -o $@ $(CFLAGS) -I./src -c -MMD -MF $@.d $<
+
+# The virtio devices are only built for system emulation.
+ifeq ($(call has, SYSTEM), 1)
+VBLK_TEST_SRCDIR := tests/virtio-blk
+VBLK_TEST_OUTDIR := build/virtio-blk
+VBLK_TEST_TARGET := $(VBLK_TEST_OUTDIR)/test-virtio-blk
+
+VBLK_TEST_OBJS := \
+	test-virtio-blk.o
+
+VBLK_TEST_OBJS := $(addprefix $(VBLK_TEST_OUTDIR)/, $(VBLK_TEST_OBJS)) \
+		  $(DEV_OUT)/virtio-blk.o $(DEV_OUT)/virtio-queue.o \
+		  $(DEV_OUT)/vblk-overlay.o $(OUT)/log.o
+OBJS += $(VBLK_TEST_OBJS)
+deps += $(VBLK_TEST_OBJS:%.o=%.o.d)
+
+VBLK_TEST_IMG := $(VBLK_TEST_OUTDIR)/disk.img
+
+tests : run-test-vblk
+
+# The requests are served on the mapped image, by the I/O worker, and then
+# through an overlay over the image.
+run-test-vblk: $(VBLK_TEST_TARGET)
+	$(Q)$(foreach mode,sync async overlay,\
+	    $(PRINTF) "Running test-virtio-blk ($(mode)) ... "; \
+	    dd if=/dev/zero of=$(VBLK_TEST_IMG) bs=1024 count=1024 2>/dev/null; \
+	    if $(VBLK_TEST_TARGET) $(VBLK_TEST_IMG) $(mode); then \
+	    $(call notice, [OK]); \
+	    else \
+	    $(PRINTF) "Failed.\n"; \
+	    exit 1; \
+	    fi; \
+	)
+
+$(VBLK_TEST_TARGET): $(VBLK_TEST_OBJS)
+	$(VECHO) "  CC\t$@\n"
+	$(Q)$(CC) $^ -o $@ $(LDFLAGS)
+
+$(VBLK_TEST_OUTDIR)/%.o: $(VBLK_TEST_SRCDIR)/%.c
+	$(VECHO) "  CC\t$@\n"
+	$(Q)mkdir -p $(dir $@)
+	$(Q)$(CC) -o $@ $(CFLAGS) -I./src -c -MMD -MF $@.d $<
+
+VNET_TEST_SRCDIR := tests/virtio-net
+VNET_TEST_OUTDIR := build/virtio-net
+VNET_TEST_TARGET := $(VNET_TEST_OUTDIR)/test-virtio-net
+
+VNET_TEST_OBJS := \
+	test-virtio-net.o
+
+VNET_TEST_OBJS := $(addprefix $(VNET_TEST_OUTDIR)/, $(VNET_TEST_OBJS)) \
+		  $(DEV_OUT)/virtio-net.o $(DEV_OUT)/virtio-queue.o \
+		  $(DEV_OUT)/vnet-backend.o $(OUT)/log.o
+OBJS += $(VNET_TEST_OBJS)
+deps += $(VNET_TEST_OBJS:%.o=%.o.d)
+
+tests : run-test-vnet
+
+# The links, and the captures replayed, are files in the output directory.
+run-test-vnet: $(VNET_TEST_TARGET)
+	$(Q)$(PRINTF) "Running test-virtio-net ... "; \
+	if $(VNET_TEST_TARGET) $(VNET_TEST_OUTDIR); then \
+	$(call notice, [OK]); \
+	else \
+	$(PRINTF) "Failed.\n"; \
+	exit 1; \
+	fi;
+
+$(VNET_TEST_TARGET): $(VNET_TEST_OBJS)
+	$(VECHO) "  CC\t$@\n"
+	$(Q)$(CC) $^ -o $@ $(LDFLAGS)
+
+$(VNET_TEST_OUTDIR)/%.o: $(VNET_TEST_SRCDIR)/%.c
+	$(VECHO) "  CC\t$@\n"
+	$(Q)mkdir -p $(dir $@)
+	$(Q)$(CC) -o $@ $(CFLAGS) -I./src -c -MMD -MF $@.d $<
+endif
@@ -22,6 +22,7 @@ HIST_OBJS := \
 
 HIST_OBJS := $(addprefix $(OUT)/, $(HIST_OBJS))
 deps += $(HIST_OBJS:%.o=%.o.d)
+$(HIST_OBJS): | $(DECODE_GEN)
 
 $(OUT)/%.o: tools/%.c
 	$(VECHO) "  CC\t$@\n"
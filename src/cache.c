@@ -11,190 +11,240 @@
 #include <string.h>
 
 #include "cache.h"
-#include "mpool.h"
 #include "utils.h"
 
-static uint32_t cache_size, cache_size_bits;
+/* hash function for the cache, whose slots are indexed by the upper bits of
+ * the hash, i.e., cache_hash(key) >> cache_t::shift
+ */
+HASH_FUNC_IMPL(cache_hash, 32, 1ULL << 32)
+
+/* An entry of the cache, stored in place in the hash table. A ghost keeps the
+ * frequency of an evicted entry, and the slot is empty if freq is 0. Thus the
+ * frequency saturates at CACHE_FREQ_MAX rather than wrapping around to 0, see
+ * cache_bump().
+ */
+typedef struct {
+    uint32_t key;
+    uint32_t freq;
+    void *value; /* NULL for a ghost */
+} cache_entry_t;
 
-/* hash function for the cache */
-HASH_FUNC_IMPL(cache_hash, cache_size_bits, cache_size)
+#define CACHE_FREQ_MAX UINT32_MAX
 
-struct hlist_head {
-    struct hlist_node *first;
-};
+/* the lists of ARC, see cache_t */
+enum { CACHE_T1, CACHE_T2, CACHE_B1, CACHE_B2, CACHE_N_LISTS };
 
-struct hlist_node {
-    struct hlist_node *next, **pprev;
-};
+/* the bookkeeping of an entry, apart from the slots read by the lookups */
+typedef struct {
+    uint32_t seq;  /* the position of the entry in its list */
+    uint32_t mark; /* the frequency when the reference bit was last cleared */
+    uint8_t list;
+} cache_meta_t;
 
+/* a position in the order of a list */
 typedef struct {
-    void *value;
-    bool alive; /* indicates whether this cache is alive or a history of evicted
-                   cache in hash map */
     uint32_t key;
-    uint32_t freq;
-    struct list_head list;
-    struct hlist_node ht_list;
-} cache_entry_t;
+    uint32_t seq; /* matches cache_meta_t::seq unless the entry moved */
+} cache_order_t;
 
+/* Ring buffer of positions, from the oldest at head to the newest at tail.
+ * Rather than being removed, the positions are left behind when an entry
+ * moves, and skipped later on.
+ */
 typedef struct {
-    struct hlist_head *ht_list_head;
-} hashtable_t;
+    cache_order_t *item;
+    uint32_t head, tail, mask;
+} cache_ring_t;
 
 /*
- * The cache utilizes the degenerated adaptive replacement cache (ARC), which
- * has only least-recently-used (LRU) and ignores least-frequently-used (LFU)
- * part. The frequently used cache will be compiled to the binary of target
- * platform by the just-in-time (JIT) compiler, so that it doesn't need to be
- * preserved in cache anymore. When the cache is full, the least used cache is
- * going to be evicted to the ghost list as the history. If the key of the
- * inserted entry matches the one in the ghost list, the history will be
- * detached and freed, and the stored information will be inherited by the new
- * entry.
+ * The cache implements the adaptive replacement cache (ARC) with clocks, i.e.,
+ * CAR (Bansal and Modha, FAST 2004). T1 holds the blocks looked up once since
+ * they were inserted, and T2 the ones looked up again. The ghosts of the
+ * blocks evicted from them are kept in B1 and B2 respectively. An insertion
+ * which matches a ghost in B1 means that T1 was too small, one in B2 that T2
+ * was, and the target size p of T1 is adapted accordingly. Then T1 and T2 are
+ * swept like clocks: a block referenced since the last sweep moves to the tail
+ * of T2, and the first one which is not gets evicted. Thus, the blocks which
+ * are hot but not recent stay in the cache rather than being profiled and
+ * compiled again by the JIT compiler. A lookup only bumps the frequency of
+ * the block, which tells whether it was referenced since the last sweep.
+ *
+ * Both the live entries and the ghosts are held in place in a flat hash table
+ * with linear probing, so that a lookup reads a few consecutive slots rather
+ * than chasing pointers. The table has 4 slots per live entry, and ARC keeps
+ * no more ghosts than live entries.
  */
 typedef struct cache {
-    struct list_head list;       /* list of live cache */
-    struct list_head ghost_list; /* list of evicted cache */
-    hashtable_t map; /* hash map which contains both live and evicted cache */
-    uint32_t size;
-    uint32_t ghost_list_size;
+    cache_entry_t *table;
+    cache_meta_t *meta;
+    uint32_t shift, mask;
+    cache_ring_t ring[CACHE_N_LISTS];
+    uint32_t n[CACHE_N_LISTS]; /* number of entries in each list */
+    uint32_t p;                /* target number of entries in T1 */
     uint32_t capacity;
+    uint32_t next_seq;
+#if RV32_HAS(CACHE_TRACE)
+    FILE *trace; /* records the keys looked up, see cache_trace() */
+#endif
 } cache_t;
 
-#define INIT_HLIST_HEAD(ptr) ((ptr)->first = NULL)
-
-static inline void INIT_HLIST_NODE(struct hlist_node *h)
+/* count a reference to @entry */
+static inline void cache_bump(cache_entry_t *entry)
 {
-    h->next = NULL;
-    h->pprev = NULL;
+    if (entry->freq != CACHE_FREQ_MAX)
+        entry->freq++;
 }
 
-static inline int hlist_empty(const struct hlist_head *h)
+/* the slot holding @key, or the empty one where it would be inserted */
+static inline uint32_t cache_slot(const cache_t *cache, uint32_t key)
 {
-    return !h->first;
+    uint32_t i = (uint32_t) cache_hash(key) >> cache->shift;
+    while (cache->table[i].freq && cache->table[i].key != key)
+        i = (i + 1) & cache->mask;
+    return i;
 }
 
-static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+/* empty slot @i, and move back the entries probed past it */
+static void cache_slot_clear(cache_t *cache, uint32_t i)
 {
-#ifndef __clang_analyzer__
-    struct hlist_node *first = h->first;
-    n->next = first;
-    if (first)
-        first->pprev = &n->next;
-
-    h->first = n;
-    n->pprev = &h->first;
-#endif
+    for (uint32_t j = (i + 1) & cache->mask; cache->table[j].freq;
+         j = (j + 1) & cache->mask) {
+        const uint32_t home = (uint32_t) cache_hash(cache->table[j].key) >>
+                              cache->shift;
+        if (((j - home) & cache->mask) < ((j - i) & cache->mask))
+            continue;
+        cache->table[i] = cache->table[j];
+        cache->meta[i] = cache->meta[j];
+        i = j;
+    }
+    cache->table[i].freq = 0;
+    cache->table[i].value = NULL;
 }
 
-static inline bool hlist_unhashed(const struct hlist_node *h)
+/* the slot of the entry at position @pos of @ring, or ~0U if it moved */
+static uint32_t cache_ring_slot(const cache_t *cache,
+                                const cache_ring_t *ring,
+                                uint32_t pos)
 {
-    return !h->pprev;
+    const cache_order_t *item = &ring->item[pos & ring->mask];
+    const uint32_t i = cache_slot(cache, item->key);
+    if (!cache->table[i].freq || cache->meta[i].seq != item->seq)
+        return ~0U;
+    return i;
 }
 
-static inline void hlist_del(struct hlist_node *n)
+/* remove the entry at the head of @list and return its slot */
+static uint32_t cache_list_pop(cache_t *cache, int list)
 {
-    struct hlist_node *next = n->next;
-    struct hlist_node **pprev = n->pprev;
-
-    *pprev = next;
-    if (next)
-        next->pprev = pprev;
+    cache_ring_t *ring = &cache->ring[list];
+    while (ring->head != ring->tail) {
+        const uint32_t i = cache_ring_slot(cache, ring, ring->head++);
+        if (i != ~0U) {
+            cache->n[list]--;
+            cache->meta[i].list = CACHE_N_LISTS;
+            return i;
+        }
+    }
+    assert(NULL);
+    __UNREACHABLE;
 }
 
-static inline void hlist_del_init(struct hlist_node *n)
+/* move the entry in slot @i to the tail of @list */
+static void cache_list_push(cache_t *cache, int list, uint32_t i)
 {
-    if (hlist_unhashed(n))
-        return;
-    hlist_del(n);
-    INIT_HLIST_NODE(n);
+    cache_ring_t *ring = &cache->ring[list];
+
+    /* drop the positions left behind to make room */
+    if (ring->tail - ring->head > ring->mask) {
+        uint32_t tail = ring->head;
+        for (uint32_t pos = ring->head; pos != ring->tail; pos++) {
+            if (cache_ring_slot(cache, ring, pos) != ~0U)
+                ring->item[tail++ & ring->mask] = ring->item[pos & ring->mask];
+        }
+        ring->tail = tail;
+    }
+
+    cache_meta_t *meta = &cache->meta[i];
+    if (meta->list != CACHE_N_LISTS)
+        cache->n[meta->list]--;
+    cache->n[list]++;
+    meta->list = list;
+    meta->seq = cache->next_seq++;
+    ring->item[ring->tail++ & ring->mask] = (cache_order_t){
+        .key = cache->table[i].key,
+        .seq = meta->seq,
+    };
 }
 
-#define hlist_entry(ptr, type, member) container_of(ptr, type, member)
-
-#ifdef __HAVE_TYPEOF
-#define hlist_entry_safe(ptr, type, member)                  \
-    ({                                                       \
-        typeof(ptr) ____ptr = (ptr);                         \
-        ____ptr ? hlist_entry(____ptr, type, member) : NULL; \
-    })
-#else
-#define hlist_entry_safe(ptr, type, member) \
-    (ptr) ? hlist_entry(ptr, type, member) : NULL
-#endif
+/* Sweep T1 or T2 for a block to evict to B1 or B2, depending on whether T1 is
+ * larger than its target size, and return its value.
+ */
+static void *cache_replace(cache_t *cache)
+{
+    while (true) {
+        const int list =
+            cache->n[CACHE_T1] >= (cache->p ? cache->p : 1) ? CACHE_T1
+                                                            : CACHE_T2;
+        const uint32_t i = cache_list_pop(cache, list);
+        cache_entry_t *entry = &cache->table[i];
+
+        if (entry->freq == cache->meta[i].mark) {
+            void *value = entry->value;
+            entry->value = NULL;
+            cache_list_push(cache, list == CACHE_T1 ? CACHE_B1 : CACHE_B2, i);
+            return value;
+        }
 
-/* clang-format off */
-#ifdef __HAVE_TYPEOF
-#define hlist_for_each_entry(pos, head, member)                              \
-    for (pos = hlist_entry_safe((head)->first, typeof(*(pos)), member); pos; \
-         pos = hlist_entry_safe((pos)->member.next, typeof(*(pos)), member))
-
-#define hlist_for_each_entry_safe(pos, n, head, member)               \
-    for (pos = hlist_entry_safe((head)->first, typeof(*pos), member); \
-         pos && ({ n = pos->member.next; 1; });                       \
-         pos = hlist_entry_safe(n, typeof(*pos), member))
-#else
-#define hlist_for_each_entry(pos, head, member, type)              \
-    for (pos = hlist_entry_safe((head)->first, type, member); pos; \
-         pos = hlist_entry_safe((pos)->member.next, type, member))
-
-#define hlist_for_each_entry_safe(pos, n, head, member, type) \
-    for (pos = hlist_entry_safe((head)->first, type, member); \
-         pos && ({ n = pos->member.next; 1; });               \
-         pos = hlist_entry_safe(n, type, member))
-#endif
-/* clang-format on */
+        /* referenced since the last sweep, and the next reference has to
+         * show even once the frequency saturates
+         */
+        if (entry->freq == CACHE_FREQ_MAX)
+            entry->freq--;
+        cache->meta[i].mark = entry->freq;
+        cache_list_push(cache, CACHE_T2, i);
+    }
+}
 
 cache_t *cache_create(uint32_t size_bits)
 {
-    cache_t *cache = malloc(sizeof(cache_t));
+    cache_t *cache = calloc(1, sizeof(cache_t));
     if (!cache)
         return NULL;
 
-    cache_size_bits = size_bits;
-    cache_size = 1 << size_bits;
-
-    INIT_LIST_HEAD(&cache->list);
-    INIT_LIST_HEAD(&cache->ghost_list);
-    cache->size = 0;
-    cache->ghost_list_size = 0;
-    cache->capacity = cache_size;
-
-    cache->map.ht_list_head = malloc(cache_size * sizeof(struct hlist_head));
-    if (!cache->map.ht_list_head) {
-        free(cache);
-        return NULL;
+    cache->capacity = 1 << size_bits;
+    cache->shift = 32 - (size_bits + 2);
+    cache->mask = (4 << size_bits) - 1;
+    cache->table = calloc(4 << size_bits, sizeof(cache_entry_t));
+    cache->meta = calloc(4 << size_bits, sizeof(cache_meta_t));
+    if (!cache->table || !cache->meta)
+        goto fail;
+
+    /* a list holds up to twice the capacity, B2 in particular */
+    for (int list = 0; list < CACHE_N_LISTS; list++) {
+        cache_ring_t *ring = &cache->ring[list];
+        ring->item = malloc((4 << size_bits) * sizeof(cache_order_t));
+        ring->mask = (4 << size_bits) - 1;
+        if (!ring->item)
+            goto fail;
     }
-
-    for (uint32_t i = 0; i < cache_size; i++)
-        INIT_HLIST_HEAD(&cache->map.ht_list_head[i]);
-
     return cache;
+
+fail:
+    cache_free(cache);
+    return NULL;
 }
 
 void *cache_get(const cache_t *cache, uint32_t key, bool update)
 {
-    if (unlikely(!cache->capacity))
-        return NULL;
-
-    if (hlist_empty(&cache->map.ht_list_head[cache_hash(key)]))
-        return NULL;
-
-    cache_entry_t *entry = NULL;
-#ifdef __HAVE_TYPEOF
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list)
-#else
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list, cache_entry_t)
+#if RV32_HAS(CACHE_TRACE)
+    if (cache->trace && update)
+        fwrite(&key, sizeof(key), 1, cache->trace);
 #endif
-    {
-        if (entry->key == key)
-            break;
-    }
 
-    /* return NULL if cache miss */
-    if (!entry || entry->key != key || !entry->alive)
+    cache_entry_t *entry = &cache->table[cache_slot(cache, key)];
+
+    /* return NULL if cache miss, including the ghosts */
+    if (!entry->value)
         return NULL;
 
     /*
@@ -208,167 +258,110 @@ void *cache_get(const cache_t *cache, uint32_t key, bool update)
      * target compiler.
      */
     if (update)
-        entry->freq++;
+        cache_bump(entry);
 
     return entry->value;
 }
 
-/*
- * When the size of ghost list reaches the limit, the oldest history is going to
- * be dropped. The stored information will be lost forever.
- */
-FORCE_INLINE void cache_ghost_list_update(cache_t *cache)
-{
-    if (cache->ghost_list_size <= cache->capacity)
-        return;
-
-    cache_entry_t *entry =
-        list_last_entry(&cache->ghost_list, cache_entry_t, list);
-    assert(!entry->alive);
-    hlist_del_init(&entry->ht_list);
-    list_del_init(&entry->list);
-    cache->ghost_list_size--;
-    free(entry);
-}
-
 /*
  * For a cache insertion, it might be the one which:
- * - evicts the least recently used cache
+ * - evicts a block, chosen by the clock sweep of T1 or T2, to the ghosts
  * - updates the existing cache
- * - retrieves the information from the history in the glost list
+ * - retrieves the information from the history in the ghosts, and adapts the
+ *   target size of T1
  */
 void *cache_put(cache_t *cache, uint32_t key, void *value)
 {
-    assert(cache->size <= cache->capacity);
-
-    cache_entry_t *replaced = NULL, *revived = NULL, *entry;
-#ifdef __HAVE_TYPEOF
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list)
-#else
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list, cache_entry_t)
-#endif
-    {
-        if (entry->key != key)
-            continue;
-        if (!entry->alive) {
-            revived = entry;
-            break;
-        }
-        /* update the existing cache */
-        if (entry->value != value) {
-            replaced = entry;
-            break;
-        }
+    assert(value);
+
+    uint32_t i = cache_slot(cache, key);
+    cache_entry_t *entry = &cache->table[i];
+
+    if (entry->value) {
         /* should not put an identical block to cache */
-        assert(NULL);
-        __UNREACHABLE;
-    }
+        assert(entry->value != value);
 
-    /* get the entry to be replaced if cache is full */
-    if (!replaced && cache->size == cache->capacity) {
-        replaced = list_last_entry(&cache->list, cache_entry_t, list);
-        assert(replaced);
+        /* update the existing cache */
+        void *replaced_value = entry->value;
+        entry->value = value;
+        entry->freq = cache->meta[i].mark = 1;
+        return replaced_value;
     }
 
+    const int ghost = entry->freq ? cache->meta[i].list : CACHE_N_LISTS;
     void *replaced_value = NULL;
-    if (replaced) {
-        assert(replaced->alive);
-
-        replaced_value = replaced->value;
-        replaced->alive = false;
-        list_del_init(&replaced->list);
-        cache->size--;
-        list_add(&replaced->list, &cache->ghost_list);
-        cache->ghost_list_size++;
+    if (cache->n[CACHE_T1] + cache->n[CACHE_T2] == cache->capacity) {
+        replaced_value = cache_replace(cache);
+
+        /* keep as many ghosts as the capacity, the history is lost forever */
+        if (ghost == CACHE_N_LISTS) {
+            if (cache->n[CACHE_T1] + cache->n[CACHE_B1] == cache->capacity)
+                cache_slot_clear(cache, cache_list_pop(cache, CACHE_B1));
+            else if (cache->n[CACHE_T1] + cache->n[CACHE_T2] +
+                         cache->n[CACHE_B1] + cache->n[CACHE_B2] ==
+                     2 * cache->capacity)
+                cache_slot_clear(cache, cache_list_pop(cache, CACHE_B2));
+            i = cache_slot(cache, key);
+            entry = &cache->table[i];
+        }
     }
 
-    cache_entry_t *new_entry = calloc(1, sizeof(cache_entry_t));
-    assert(new_entry);
-
-    INIT_LIST_HEAD(&new_entry->list);
-    INIT_HLIST_NODE(&new_entry->ht_list);
-    new_entry->key = key;
-    new_entry->value = value;
-    new_entry->alive = true;
+    if (ghost == CACHE_N_LISTS) {
+        entry->key = key;
+        entry->freq = 1;
+        entry->value = value;
+        cache->meta[i] = (cache_meta_t){.mark = 1, .list = CACHE_N_LISTS};
+        cache_list_push(cache, CACHE_T1, i);
+        return replaced_value;
+    }
 
-    if (!revived) {
-        new_entry->freq = 1;
+    /* revive the ghost, and grow the list it was evicted from */
+    const uint32_t n_b1 = cache->n[CACHE_B1], n_b2 = cache->n[CACHE_B2];
+    if (ghost == CACHE_B1) {
+        const uint32_t delta = n_b2 > n_b1 ? n_b2 / n_b1 : 1;
+        cache->p = cache->p + delta < cache->capacity ? cache->p + delta
+                                                      : cache->capacity;
     } else {
-        new_entry->freq = revived->freq + 1;
-        hlist_del_init(&revived->ht_list);
-        list_del_init(&revived->list);
-        cache->ghost_list_size--;
-        free(revived);
+        const uint32_t delta = n_b1 > n_b2 ? n_b1 / n_b2 : 1;
+        cache->p = cache->p > delta ? cache->p - delta : 0;
     }
-
-    list_add(&new_entry->list, &cache->list);
-    hlist_add_head(&new_entry->ht_list,
-                   &cache->map.ht_list_head[cache_hash(key)]);
-
-    cache->size++;
-
-    cache_ghost_list_update(cache);
-
-    assert(cache->size <= cache->capacity);
-    assert(cache->ghost_list_size <= cache->capacity);
+    if (entry->freq < CACHE_FREQ_MAX - 1)
+        entry->freq++;
+    entry->value = value;
+    cache->meta[i].mark = entry->freq;
+    cache_list_push(cache, CACHE_T2, i);
     return replaced_value;
 }
 
 void cache_free(cache_t *cache)
 {
-    free(cache->map.ht_list_head);
+    for (int list = 0; list < CACHE_N_LISTS; list++)
+        free(cache->ring[list].item);
+    free(cache->meta);
+    free(cache->table);
     free(cache);
 }
 
-uint32_t cache_freq(const struct cache *cache, uint32_t key)
+#if RV32_HAS(CACHE_TRACE)
+void cache_trace(struct cache *cache, FILE *trace)
 {
-    if (unlikely(!cache->capacity))
-        return 0;
-
-    if (hlist_empty(&cache->map.ht_list_head[cache_hash(key)]))
-        return 0;
-
-    cache_entry_t *entry = NULL;
-#ifdef __HAVE_TYPEOF
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list)
-#else
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list, cache_entry_t)
+    cache->trace = trace;
+}
 #endif
-    {
-        if (entry->key == key && entry->alive)
-            return entry->freq;
-    }
-    return 0;
+
+uint32_t cache_freq(const struct cache *cache, uint32_t key)
+{
+    const cache_entry_t *entry = &cache->table[cache_slot(cache, key)];
+    return entry->value ? entry->freq : 0;
 }
 
 #if RV32_HAS(JIT)
 bool cache_hot(const struct cache *cache, uint32_t key)
 {
-    if (unlikely(!cache->capacity))
-        return false;
-
-    if (hlist_empty(&cache->map.ht_list_head[cache_hash(key)]))
-        return false;
-
-    cache_entry_t *entry = NULL;
-#ifdef __HAVE_TYPEOF
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list)
-#else
-    hlist_for_each_entry (entry, &cache->map.ht_list_head[cache_hash(key)],
-                          ht_list, cache_entry_t)
-#endif
-    {
-        if (entry->key == key && entry->alive && entry->freq >= THRESHOLD) {
-            return true;
-        }
-    }
-    return false;
+    const cache_entry_t *entry = &cache->table[cache_slot(cache, key)];
+    return entry->value && entry->freq >= THRESHOLD;
 }
+
 void cache_profile(const struct cache *cache,
                    FILE *output_file,
                    prof_func_t func)
@@ -377,14 +370,13 @@ void cache_profile(const struct cache *cache,
     assert(func);
     assert(output_file);
 
-    cache_entry_t *entry;
-#ifdef __HAVE_TYPEOF
-    list_for_each_entry (entry, &cache->list, list)
-#else
-    list_for_each_entry (entry, &cache->list, list, cache_entry_t)
-#endif
-    {
-        func(entry->value, entry->freq, output_file);
+    for (int list = CACHE_T1; list <= CACHE_T2; list++) {
+        const cache_ring_t *ring = &cache->ring[list];
+        for (uint32_t pos = ring->tail; pos != ring->head; pos--) {
+            const uint32_t i = cache_ring_slot(cache, ring, pos - 1);
+            if (i != ~0U)
+                func(cache->table[i].value, cache->table[i].freq, output_file);
+        }
     }
 }
 
@@ -393,14 +385,13 @@ void clear_cache_hot(const struct cache *cache, clear_func_t func)
     assert(cache);
     assert(func);
 
-    cache_entry_t *entry = NULL;
-#ifdef __HAVE_TYPEOF
-    list_for_each_entry (entry, &cache->list, list)
-#else
-    list_for_each_entry (entry, &cache->list, list, cache_entry_t)
-#endif
-    {
-        func(entry->value);
+    for (int list = CACHE_T1; list <= CACHE_T2; list++) {
+        const cache_ring_t *ring = &cache->ring[list];
+        for (uint32_t pos = ring->tail; pos != ring->head; pos--) {
+            const uint32_t i = cache_ring_slot(cache, ring, pos - 1);
+            if (i != ~0U)
+                func(cache->table[i].value);
+        }
     }
 }
 #endif
@@ -48,6 +48,16 @@ void *cache_put(struct cache *cache, uint32_t key, void *value);
  */
 void cache_free(struct cache *cache);
 
+#if RV32_HAS(CACHE_TRACE)
+/**
+ * cache_trace - record the keys of the lookups which update the frequency
+ * @cache: a pointer points to target cache
+ * @trace: the file the keys are written to, as 32-bit words in host byte
+ *         order, or NULL to stop recording
+ */
+void cache_trace(struct cache *cache, FILE *trace);
+#endif
+
 #if RV32_HAS(JIT)
 /**
  * cache_hot - check whether the frequency of the cache entry exceeds the
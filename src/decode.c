@@ -5,6 +5,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "decode.h"
 #include "riscv_private.h"
@@ -385,1636 +386,324 @@ static inline void decode_r4type(rv_insn_t *ir, const uint32_t insn)
 }
 #endif
 
-/* LOAD: I-type
- *  31       20 19   15 14    12 11   7 6      0
- * | imm[11:0] |  rs1  | funct3 |  rd  | opcode |
- */
-static inline bool op_load(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst imm[11:0] rs1 funct3 rd opcode
-     * ----+---------+---+------+--+-------
-     * LB   imm[11:0] rs1 000    rd 0000011
-     * LH   imm[11:0] rs1 001    rd 0000011
-     * LW   imm[11:0] rs1 010    rd 0000011
-     * LD   imm[11:0] rs1 011    rd 0000011
-     * LBU  imm[11:0] rs1 100    rd 0000011
-     * LHU  imm[11:0] rs1 101    rd 0000011
-     * LWU  imm[11:0] rs1 110    rd 0000011
-     */
-
-    /* decode I-type */
-    decode_itype(ir, insn);
-
-    /* dispatch from funct3 field */
-    switch (decode_funct3(insn)) {
-    case 0: /* LB: Load Byte */
-        ir->opcode = rv_insn_lb;
-        break;
-    case 1: /* LH: Load Halfword */
-        ir->opcode = rv_insn_lh;
-        break;
-    case 2: /* LW: Load Word */
-        ir->opcode = rv_insn_lw;
-        break;
-    case 4: /* LBU: Load Byte Unsigned */
-        ir->opcode = rv_insn_lbu;
-        break;
-    case 5: /* LHU: Load Halfword Unsigned */
-        ir->opcode = rv_insn_lhu;
-        break;
-    default: /* illegal instruction */
-        return false;
-    }
-    return true;
-}
-
-/* OP-IMM: I-type
- *  31       20 19   15 14    12 11   7 6      0
- * | imm[11:0] |  rs1  | funct3 |  rd  | opcode |
- */
-static inline bool op_op_imm(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst  imm[11:5] imm[4:0]   rs1 funct3 rd opcode
-     * -----+---------+----------+---+------+--+-------
-     * ADDI  imm[11:0]            rs1 000    rd 0010011
-     * SLLI  0000000   shamt[4:0] rs1 001    rd 0010011
-     * SLTI  imm[11:0]            rs1 010    rd 0010011
-     * SLTIU imm[11:0]            rs1 011    rd 0010011
-     * XORI  imm[11:0]            rs1 100    rd 0010011
-     * SLRI  0000000   shamt[4:0] rs1 101    rd 0010011
-     * SRAI  0100000   shamt[4:0] rs1 101    rd 0010011
-     * ORI   imm[11:0]            rs1 110    rd 0010011
-     * ANDI  imm[11:0]            rs1 111    rd 0010011
-     */
-
-    /* decode I-type */
-    decode_itype(ir, insn);
-
-    /* nop can be implemented as "addi x0, x0, 0".
-     * Any integer computational instruction writing into "x0" is NOP.
-     */
-    if (unlikely(ir->rd == rv_reg_zero)) {
-        ir->opcode = rv_insn_nop;
-        return true;
-    }
-
-    /* dispatch from funct3 field */
-    switch (decode_funct3(insn)) {
-    case 0: /* ADDI: Add Immediate */
-        ir->opcode = rv_insn_addi;
-        break;
-    case 1: /* SLLI: Shift Left Logical */
-#if RV32_HAS(Zbb)
-        if (ir->imm == 0b011000000000) { /* clz */
-            ir->opcode = rv_insn_clz;
-            return true;
-        }
-        if (ir->imm == 0b011000000001) { /* ctz */
-            ir->opcode = rv_insn_ctz;
-            return true;
-        }
-        if (ir->imm == 0b011000000010) { /* cpop */
-            ir->opcode = rv_insn_cpop;
-            return true;
-        }
-        if (ir->imm == 0b011000000100) { /* sext.b */
-            ir->opcode = rv_insn_sextb;
-            return true;
-        }
-        if (ir->imm == 0b011000000101) { /* sext.h */
-            ir->opcode = rv_insn_sexth;
-            return true;
-        }
-#endif
-#if RV32_HAS(Zbs)
-        if (ir->imm >> 5 == 0b0100100) { /* bclri */
-            ir->opcode = rv_insn_bclri;
-            return true;
-        }
-        if (ir->imm >> 5 == 0b0110100) { /* binvi */
-            ir->opcode = rv_insn_binvi;
-            return true;
-        }
-        if (ir->imm >> 5 == 0b0010100) { /* bseti */
-            ir->opcode = rv_insn_bseti;
-            return true;
-        }
-#endif
-        ir->opcode = rv_insn_slli;
-        if (unlikely(ir->imm & (1 << 5)))
-            return false;
-        break;
-    case 2: /* SLTI: Set on Less Than Immediate */
-        ir->opcode = rv_insn_slti;
-        break;
-    case 3: /* SLTIU: Set on Less Than Immediate Unsigned */
-        ir->opcode = rv_insn_sltiu;
-        break;
-    case 4: /* XORI: Exclusive OR Immediate */
-        ir->opcode = rv_insn_xori;
-        break;
-    case 5:
-#if RV32_HAS(Zbb)
-        if (ir->imm >> 5 == 0b0110000) { /* rori */
-            ir->opcode = rv_insn_rori;
-            return true;
-        }
-        if (ir->imm == 0b001010000111) { /* orc.b */
-            ir->opcode = rv_insn_orcb;
-            return true;
-        }
-        if (ir->imm == 0b011010011000) { /* rev8 */
-            ir->opcode = rv_insn_rev8;
-            return true;
-        }
-#endif
-#if RV32_HAS(Zbs)
-        if (ir->imm >> 5 == 0b0100100) { /* bexti */
-            ir->opcode = rv_insn_bexti;
-            return true;
-        }
-#endif
-        /* SLL, SRL, and SRA perform logical left, logical right, and
-         * arithmetic right shifts on the value in register rs1.
-         */
-        ir->opcode = (ir->imm & ~0x1f)
-                         ? rv_insn_srai  /* SRAI: Shift Right Arithmetic */
-                         : rv_insn_srli; /* SRLI: Shift Right Logical */
-        if (unlikely(ir->imm & (1 << 5)))
-            return false;
-        break;
-    case 6: /* ORI: OR Immediate */
-        ir->opcode = rv_insn_ori;
-        break;
-    case 7: /* ANDI: AND Immediate */
-        ir->opcode = rv_insn_andi;
-        break;
-    default: /* illegal instruction */
-        return false;
-    }
-    return true;
-}
-
-/* AUIPC: U-type
- *  31        12 11   7 6      0
- * | imm[31:12] |  rd  | opcode |
- */
-static inline bool op_auipc(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst  imm[31:12] rd opcode
-     * -----+----------+--+-------
-     * AUPIC imm[31:12] rd 0010111
-     */
-
-    /* decode U-type */
-    decode_utype(ir, insn);
-
-    /* Any integer computational instruction writing into "x0" is NOP. */
-    if (unlikely(ir->rd == rv_reg_zero)) {
-        ir->opcode = rv_insn_nop;
-        return true;
-    }
-
-    ir->opcode = rv_insn_auipc;
-    return true;
-}
-
-/* STORE: S-type
- *  31       25 24   20 19   15 14    12 11       7 6      0
- * | imm[11:5] |  rs2  |  rs1  | funct3 | imm[4:0] | opcode |
- */
-static inline bool op_store(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst imm[11:5] rs2 rs1 funct3 imm[4:0] opcode
-     * ----+---------+---+---+------+--------+-------
-     * SB   imm[11:5] rs2 rs1 000    imm[4:0] 0100011
-     * SH   imm[11:5] rs2 rs1 001    imm[4:0] 0100011
-     * SW   imm[11:5] rs2 rs1 010    imm[4:0] 0100011
-     * SD   imm[11:5] rs2 rs1 011    imm[4:0] 0100011
-     */
-
-    /* decode S-type */
-    decode_stype(ir, insn);
-
-    /* dispatch from funct3 field */
-    switch (decode_funct3(insn)) {
-    case 0: /* SB: Store Byte */
-        ir->opcode = rv_insn_sb;
-        break;
-    case 1: /* SH: Store Halfword */
-        ir->opcode = rv_insn_sh;
-        break;
-    case 2: /* SW: Store Word */
-        ir->opcode = rv_insn_sw;
-        break;
-    default: /* illegal instruction */
-        return false;
-    }
-    return true;
-}
-
-/* OP: R-type
- *  31    25 24   20 19   15 14    12 11   7 6      0
- * | funct7 |  rs2  |  rs1  | funct3 |  rd  | opcode |
- */
-static inline bool op_op(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst funct7  rs2 rs1 funct3 rd opcode
-     * ----+-------+---+---+------+--+-------
-     * ADD  0000000 rs2 rs1 000    rd 0110011
-     * SUB  0100000 rs2 rs1 000    rd 0110011
-     * SLL  0000000 rs2 rs1 001    rd 0110011
-     * SLT  0000000 rs2 rs1 010    rd 0110011
-     * SLTU 0000000 rs2 rs1 011    rd 0110011
-     * XOR  0000000 rs2 rs1 100    rd 0110011
-     * SRL  0000000 rs2 rs1 101    rd 0110011
-     * SRA  0100000 rs2 rs1 101    rd 0110011
-     * OR   0000000 rs2 rs1 110    rd 0110011
-     * AND  0000000 rs2 rs1 111    rd 0110011
-     */
-
-    /* decode R-type */
-    decode_rtype(ir, insn);
-
-    /* nop can be implemented as "add x0, x1, x2" */
-    if (unlikely(ir->rd == rv_reg_zero)) {
-        ir->opcode = rv_insn_nop;
-        return true;
-    }
-
-    uint8_t funct3 = decode_funct3(insn);
-
-    /* dispatch from funct7 field */
-    switch (decode_funct7(insn)) {
-    case 0b0000000:
-        switch (funct3) {
-        case 0b000: /* ADD */
-            ir->opcode = rv_insn_add;
-            break;
-        case 0b001: /* SLL: Shift Left Logical */
-            ir->opcode = rv_insn_sll;
-            break;
-        case 0b010: /* SLT: Set on Less Than */
-            ir->opcode = rv_insn_slt;
-            break;
-        case 0b011: /* SLTU: Set on Less Than Unsigned */
-            ir->opcode = rv_insn_sltu;
-            break;
-        case 0b100: /* XOR: Exclusive OR */
-            ir->opcode = rv_insn_xor;
-            break;
-        case 0b101: /* SRL: Shift Right Logical */
-            ir->opcode = rv_insn_srl;
-            break;
-        case 0b110: /* OR */
-            ir->opcode = rv_insn_or;
-            break;
-        case 0b111: /* AND */
-            ir->opcode = rv_insn_and;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-
-#if RV32_HAS(EXT_M)
-    /* inst   funct7  rs2 rs1 funct3 rd opcode
-     * ------+-------+---+---+------+--+-------
-     * MUL    0000001 rs2 rs1 000    rd 0110011
-     * MULH   0000001 rs2 rs1 001    rd 0110011
-     * MULHSU 0000001 rs2 rs1 010    rd 0110011
-     * MULHU  0000001 rs2 rs1 011    rd 0110011
-     * DIV    0000001 rs2 rs1 100    rd 0110011
-     * DIVU   0000001 rs2 rs1 101    rd 0110011
-     * REM    0000001 rs2 rs1 110    rd 0110011
-     * REMU   0000001 rs2 rs1 111    rd 0110011
-     */
-    case 0b0000001: /* RV32M instructions */
-        switch (funct3) {
-        case 0b000: /* MUL: Multiply */
-            ir->opcode = rv_insn_mul;
-            break;
-        case 0b001: /* MULH: Multiply High Signed Signed */
-            ir->opcode = rv_insn_mulh;
-            break;
-        case 0b010: /* MULHSU: Multiply High Signed Unsigned */
-            ir->opcode = rv_insn_mulhsu;
-            break;
-        case 0b011: /* MULHU: Multiply High Unsigned Unsigned */
-            ir->opcode = rv_insn_mulhu;
-            break;
-        case 0b100: /* DIV: Divide Signed */
-            ir->opcode = rv_insn_div;
-            break;
-        case 0b101: /* DIVU: Divide Unsigned */
-            ir->opcode = rv_insn_divu;
-            break;
-        case 0b110: /* REM: Remainder Signed */
-            ir->opcode = rv_insn_rem;
-            break;
-        case 0b111: /* REMU: Remainder Unsigned */
-            ir->opcode = rv_insn_remu;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-#endif /* RV32_HAS(EXT_M) */
-
-#if RV32_HAS(Zba)
-    /* inst   funct7  rs2 rs1 funct3 rd opcode
-     * ------+-------+---+---+------+--+-------
-     * SH1ADD 0010000 rs2 rs1 010    rd 0110011
-     * SH2ADD 0010000 rs2 rs1 100    rd 0110011
-     * SH3ADD 0010000 rs2 rs1 110    rd 0110011
-     */
-    case 0b0010000:
-        switch (funct3) {
-        case 0b010: /* sh1add */
-            ir->opcode = rv_insn_sh1add;
-            break;
-        case 0b100: /* sh2add */
-            ir->opcode = rv_insn_sh2add;
-            break;
-        case 0b110: /* sh3add */
-            ir->opcode = rv_insn_sh3add;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-#endif /* RV32_HAS(Zba) */
-
-#if RV32_HAS(Zbb) || RV32_HAS(Zbc)
-    /* inst   funct7  rs2 rs1 funct3 rd opcode
-     * ------+-------+---+---+------+--+-------
-     * MAX    0000101 rs2 rs1 110    rd 0110011
-     * MIN    0000101 rs2 rs1 100    rd 0110011
-     * MAXU   0000101 rs2 rs1 111    rd 0110011
-     * MINU   0000101 rs2 rs1 101    rd 0110011
-     * ROL    0110000 rs2 rs1 001    rd 0110011
-     * ROR    0110000 rs2 rs1 101    rd 0110011
-     */
-    case 0b0000101:
-        switch (funct3) {
-#if RV32_HAS(Zbb)
-        case 0b110: /* max */
-            ir->opcode = rv_insn_max;
-            break;
-        case 0b100: /* min */
-            ir->opcode = rv_insn_min;
-            break;
-        case 0b111: /* maxu */
-            ir->opcode = rv_insn_maxu;
-            break;
-        case 0b101: /* minu */
-            ir->opcode = rv_insn_minu;
-            break;
-#endif
-#if RV32_HAS(Zbc)
-        case 0b001: /*clmul */
-            ir->opcode = rv_insn_clmul;
-            break;
-        case 0b011: /*clmulh */
-            ir->opcode = rv_insn_clmulh;
-            break;
-        case 0b010: /*clmulr */
-            ir->opcode = rv_insn_clmulr;
-            break;
-#endif
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-#endif
-#if RV32_HAS(Zbb)
-    case 0b0110000:
-        switch (funct3) {
-        case 0b001: /* rol */
-            ir->opcode = rv_insn_rol;
-            break;
-        case 0b101: /* ror */
-            ir->opcode = rv_insn_ror;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-    case 0b0000100:
-        if (unlikely(ir->rs2))
-            return false;
-        ir->opcode = rv_insn_zexth;
-        break;
-#endif /* RV32_HAS(Zbb) */
-
-#if RV32_HAS(Zbs)
-    case 0b0100100:
-        switch (funct3) {
-        case 0b001: /* bclr */
-            ir->opcode = rv_insn_bclr;
-            break;
-        case 0b101: /* bext */
-            ir->opcode = rv_insn_bext;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-    case 0b0110100:
-        if (unlikely(funct3 != 0b001))
-            return false;
-        ir->opcode = rv_insn_binv;
-        break;
-    case 0b0010100:
-        if (unlikely(funct3 != 0b001))
-            return false;
-        ir->opcode = rv_insn_bset;
-        break;
-#endif /* RV32_HAS(Zbs) */
-
-    case 0b0100000:
-        switch (funct3) {
-        case 0b000: /* SUB: Substract */
-            ir->opcode = rv_insn_sub;
-            break;
-        case 0b101: /* SRA: Shift Right Arithmetic */
-            ir->opcode = rv_insn_sra;
-            break;
-#if RV32_HAS(Zbb)
-        case 0b111: /* ANDN */
-            ir->opcode = rv_insn_andn;
-            break;
-        case 0b110: /* ORN */
-            ir->opcode = rv_insn_orn;
-            break;
-        case 0b100: /* XNOR */
-            ir->opcode = rv_insn_xnor;
-            break;
-#endif /* RV32_HAS(Zbb) */
-
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-    default: /* illegal instruction */
-        return false;
-    }
-    return true;
-}
-
-/* LUI: U-type
- *  31        12 11   7 6      0
- * | imm[31:12] |  rd  | opcode |
- */
-static inline bool op_lui(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst imm[31:12] rd opcode
-     * ----+----------+--+-------
-     * LUI  imm[31:12] rd 0110111
-     */
-
-    /* decode U-type */
-    decode_utype(ir, insn);
-
-    /* Any integer computational instruction writing into "x0" is NOP. */
-    if (unlikely(ir->rd == rv_reg_zero)) {
-        ir->opcode = rv_insn_nop;
-        return true;
-    }
-
-    ir->opcode = rv_insn_lui;
-    return true;
-}
-
-/* Branch: B-type
- *     31     30     25   24 20 19 15 14    12 11       8     7     6      0
- * | imm[12] | imm[10:5] | rs2 | rs1 | funct3 | imm[4:1] | imm[11] | opcode |
- */
-static inline bool op_branch(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst imm[12] imm[10:5] rs2 rs1 funct3 imm[4:1] imm[11] opcode
-     * ----+-------+---------+---+---+------+--------+-------+-------
-     * BEQ  imm[12  imm[10:5] rs2 rs1 000    imm[4:1  imm[11] 1100011
-     * BNE  imm[12  imm[10:5] rs2 rs1 001    imm[4:1  imm[11] 1100011
-     * BLT  imm[12  imm[10:5] rs2 rs1 100    imm[4:1  imm[11] 1100011
-     * BGE  imm[12  imm[10:5] rs2 rs1 101    imm[4:1  imm[11] 1100011
-     * BLTU imm[12  imm[10:5] rs2 rs1 110    imm[4:1  imm[11] 1100011
-     * BGEU imm[12  imm[10:5] rs2 rs1 111    imm[4:1  imm[11] 1100011
-     */
-
-    /* decode B-type */
-    decode_btype(ir, insn);
-
-    /* dispatch from funct3 field */
-    switch (decode_funct3(insn)) {
-    case 0: /* BEQ: Branch if Equal */
-        ir->opcode = rv_insn_beq;
-        break;
-    case 1: /* BNE: Branch if Not Equal */
-        ir->opcode = rv_insn_bne;
-        break;
-    case 4: /* BLT: Branch if Less Than */
-        ir->opcode = rv_insn_blt;
-        break;
-    case 5: /* BGE: Branch if Greater Than */
-        ir->opcode = rv_insn_bge;
-        break;
-    case 6: /* BLTU: Branch if Less Than Unsigned */
-        ir->opcode = rv_insn_bltu;
-        break;
-    case 7: /* BGEU: Branch if Greater Than Unsigned */
-        ir->opcode = rv_insn_bgeu;
-        break;
-    default: /* illegal instruction */
-        return false;
-    }
-    return true;
-}
-
-/* JALR: I-type
- *  31       20 19   15 14    12 11   7 6      0
- * | imm[11:0] |  rs1  | funct3 |  rd  | opcode |
- */
-static inline bool op_jalr(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst imm[11:0] rs1 funct3 rd opcode
-     * ----+---------+---+------+--+-------
-     * JALR imm[11:0] rs1 000    rd 1100111
-     */
-
-    /* decode I-type */
-    decode_itype(ir, insn);
-
-    ir->opcode = rv_insn_jalr;
-    return true;
-}
-
-/* JAL: J-type
- *     31     30       21     20    19        12 11   7 6      0
- * | imm[20] | imm[10:1] | imm[11] | imm[19:12] |  rd  | opcode |
- */
-static inline bool op_jal(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst imm[20] imm[10:1] imm[11] imm[19:12] rd opcode
-     * ----+-------+---------+-------+----------+--+-------
-     * JALR imm[20] imm[10:1] imm[11] imm[19:12] rd 1101111
-     */
-
-    /* decode J-type */
-    decode_jtype(ir, insn);
-
-    ir->opcode = rv_insn_jal;
-    return true;
-}
-
-FORCE_INLINE bool csr_is_writable(const uint32_t csr)
+/* decode an instruction without operands, e.g., FENCE */
+static inline void decode_none(rv_insn_t *ir UNUSED,
+                               const uint32_t insn UNUSED)
 {
-    return csr < 0xc00;
-}
-
-/* SYSTEM: I-type
- *  31       20 19   15 14    12 11   7 6      0
- * | imm[11:0] |  rs1  | funct3 |  rd  | opcode |
- */
-static inline bool op_system(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst   imm[11:0]    rs1   funct3 rd    opcode
-     * ------+------------+-----+------+-----+-------
-     * ECALL  000000000000 00000 000    00000 1110011
-     * EBREAK 000000000001 00000 000    00000 1110011
-     * WFI    000100000101 00000 000    00000 1110011
-     * URET   000000000010 00000 000    00000 1110011
-     * SRET   000100000010 00000 000    00000 1110011
-     * HRET   001000000010 00000 000    00000 1110011
-     * MRET   001100000010 00000 000    00000 1110011
-     */
-
-    /* inst        funct7  rs2 rs1 funct3 rd     opcode
-     * -----------+-------+---+---+------+------+-------
-     * SFENCE.VMA  0001001 rs2 rs1  000   00000  1110011
-     */
-
-    /* decode I-type */
-    decode_itype(ir, insn);
-
-    /* dispatch from funct3 field */
-    switch (decode_funct3(insn)) {
-    case 0:
-        if ((insn >> 25) == 0b0001001) { /* SFENCE.VMA */
-            ir->opcode = rv_insn_sfencevma;
-            break;
-        }
-
-        /* dispatch from imm field */
-        switch (ir->imm) {
-        case 0: /* ECALL: Environment Call */
-            ir->opcode = rv_insn_ecall;
-            break;
-        case 1: /* EBREAK: Environment Break */
-            ir->opcode = rv_insn_ebreak;
-            break;
-        case 0x105: /* WFI: Wait for Interrupt */
-            ir->opcode = rv_insn_wfi;
-            break;
-        case 0x002: /* URET: return from traps in U-mode */
-        case 0x202: /* HRET: return from traps in H-mode */
-            /* illegal instruction */
-            return false;
-#if RV32_HAS(SYSTEM)
-        case 0x102: /* SRET: return from traps in S-mode */
-            ir->opcode = rv_insn_sret;
-            break;
-#endif
-        case 0x302: /* MRET */
-            ir->opcode = rv_insn_mret;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-
-#if RV32_HAS(Zicsr)
-    /* All CSR instructions atomically read-modify-write a single CSR.
-     * Register operand
-     * ---------------------------------------------------------
-     * Instruction         rd          rs1        Read    Write
-     * -------------------+-----------+----------+-------+------
-     * CSRRW               x0          -          no      yes
-     * CSRRW               !x0         -          yes     yes
-     * CSRRS/C             -           x0         yes     no
-     * CSRRS/C             -           !x0        yes     yes
-     *
-     * Immediate operand
-     * --------------------------------------------------------
-     * Instruction         rd          uimm       Read    Write
-     * -------------------+-----------+----------+-------+------
-     * CSRRWI              x0          -          no      yes
-     * CSRRWI              !x0         -          yes     yes
-     * CSRRS/CI            -           0          yes     no
-     * CSRRS/CI            -           !0         yes     yes
-     */
-
-    /* inst   imm[11:0] rs1  funct3 rd opcode
-     * ------+---------+----+------+--+--------
-     * CSRRW  csr       rs1  001    rd 1110011
-     * CSRRS  csr       rs1  010    rd 1110011
-     * CSRRC  csr       rs1  011    rd 1110011
-     * CSRRWI csr       uimm 101    rd 1110011
-     * CSRRSI csr       uimm 110    rd 1110011
-     * CSRRCI csr       uimm 111    rd 1110011
-     */
-    case 1: /* CSRRW: Atomic Read/Write CSR */
-        ir->opcode = rv_insn_csrrw;
-        break;
-    case 2: /* CSRRS: Atomic Read and Set Bits in CSR */
-        ir->opcode = rv_insn_csrrs;
-        break;
-    case 3: /* CSRRC: Atomic Read and Clear Bits in CSR */
-        ir->opcode = rv_insn_csrrc;
-        break;
-    case 5: /* CSRRWI */
-        ir->opcode = rv_insn_csrrwi;
-        break;
-    case 6: /* CSRRSI */
-        ir->opcode = rv_insn_csrrsi;
-        break;
-    case 7: /* CSRRCI */
-        ir->opcode = rv_insn_csrrci;
-        break;
-#endif /* RV32_HAS(Zicsr) */
-
-    default: /* illegal instruction */
-        return false;
-    }
-
-    return csr_is_writable(ir->imm) || (ir->rs1 == rv_reg_zero);
-}
-
-/* MISC-MEM: I-type
- *  31       20 19   15 14    12 11   7 6      0
- * | imm[11:0] |  rs1  | funct3 |  rd  | opcode |
- */
-static inline bool op_misc_mem(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst      fm       pred      succ       rs1   funct3  rd   opcode
-     * ------+---------+----------+-----------+-----+-------+----+-------
-     * FENCE   FM[3:0]   pred[3:0]  succ[3:0]  rs1   000     rd   0001111
-     * FENCEI            imm[11:0]             rs1   001     rd   0001111
-     */
-
-    const uint32_t funct3 = decode_funct3(insn);
-
-    switch (funct3) {
-    case 0b000:
-        ir->opcode = rv_insn_fence;
-        return true;
-#if RV32_HAS(Zifencei)
-    case 0b001:
-        ir->opcode = rv_insn_fencei;
-        return true;
-#endif       /* RV32_HAS(Zifencei) */
-    default: /* illegal instruction */
-        return false;
-    }
-
-    return false;
-}
-
-#if RV32_HAS(EXT_A)
-/* AMO: R-type
- *  31    27  26   25  24   20 19   15 14    12 11   7 6      0
- * | funct5 | aq | rl |  rs2  |  rs1  | funct3 |  rd  | opcode |
- */
-static inline bool op_amo(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst      funct5 aq rl rs2   rs1 funct3 rd  opcode
-     * ---------+------+--+--+-----+---+------+---+-------
-     * LR.W      00010  aq rl 00000 rs1 010    rd  0101111
-     * SC.W      00011  aq rl rs2   rs1 010    rd  0101111
-     * AMOSWAP.W 00001  aq rl rs2   rs1 010    rd  0101111
-     * AMOADD.W  00000  aq rl rs2   rs1 010    rd  0101111
-     * AMOXOR.W  00100  aq rl rs2   rs1 010    rd  0101111
-     * AMOAND.W  01100  aq rl rs2   rs1 010    rd  0101111
-     * AMOOR.W   01000  aq rl rs2   rs1 010    rd  0101111
-     * AMOMIN.W  10000  aq rl rs2   rs1 010    rd  0101111
-     * AMOMAX.W  10100  aq rl rs2   rs1 010    rd  0101111
-     * AMOMINU.W 11000  aq rl rs2   rs1 010    rd  0101111
-     * AMOMAXU.W 11100  aq rl rs2   rs1 010    rd  0101111
-     */
-
-    /* decode R-type */
-    decode_rtype(ir, insn);
-
-    /* compute funct5 field */
-    const uint32_t funct5 = (decode_funct7(insn) >> 2) & 0x1f;
-
-    /* dispatch from funct5 field */
-    switch (funct5) {
-    case 0b00010: /* LR.W: Load Reserved */
-        ir->opcode = rv_insn_lrw;
-        break;
-    case 0b00011: /* SC.W: Store Conditional */
-        ir->opcode = rv_insn_scw;
-        break;
-    case 0b00001: /* AMOSWAP.W: Atomic Swap */
-        ir->opcode = rv_insn_amoswapw;
-        break;
-    case 0b00000: /* AMOADD.W: Atomic ADD */
-        ir->opcode = rv_insn_amoaddw;
-        break;
-    case 0b00100: /* AMOXOR.W: Atomic XOR */
-        ir->opcode = rv_insn_amoxorw;
-        break;
-    case 0b01100: /* AMOAND.W: Atomic AND */
-        ir->opcode = rv_insn_amoandw;
-        break;
-    case 0b01000: /* AMOOR.W: Atomic OR */
-        ir->opcode = rv_insn_amoorw;
-        break;
-    case 0b10000: /* AMOMIN.W: Atomic MIN */
-        ir->opcode = rv_insn_amominw;
-        break;
-    case 0b10100: /* AMOMAX.W: Atomic MAX */
-        ir->opcode = rv_insn_amomaxw;
-        break;
-    case 0b11000: /* AMOMINU.W */
-        ir->opcode = rv_insn_amominuw;
-        break;
-    case 0b11100: /* AMOMAXU.W */
-        ir->opcode = rv_insn_amomaxuw;
-        break;
-    default: /* illegal instruction */
-        return false;
-    }
-    return true;
 }
-#else
-#define op_amo OP_UNIMP
-#endif /* RV32_HAS(EXT_A) */
 
 #if RV32_HAS(EXT_F)
-/* LOAD-FP: I-type
- *  31       20 19   15 14   12 11   7 6      0
- * | imm[11:0] |  rs1  | width |  rd  | opcode |
- */
-static inline bool op_load_fp(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst imm[11:0] rs1 width rd opcode
-     * ----+---------+---+-----+--+-------
-     * FLW  imm[11:0] rs1 010   rd 0000111
-     */
-
-    /* decode I-type */
-    decode_itype(ir, insn);
-
-    ir->opcode = rv_insn_flw;
-    return true;
-}
-
-/* STORE-FP: S-type
- *  31       25 24   20 19   15 14   12 11       7 6      0
- * | imm[11:5] |  rs2  |  rs1  | width | imm[4:0] | opcode |
- */
-static inline bool op_store_fp(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst imm[11:5] rs2 rs1 width imm[4:0] opcode
-     * ----+---------+---+---+-----+--------+-------
-     * FSW  imm[11:5] rs2 rs1 010   imm[4:0] 0100111
-     */
-
-    /* decode S-type */
-    decode_stype(ir, insn);
-
-    ir->opcode = rv_insn_fsw;
-    return true;
-}
-
-/* OP-FP: R-type
+/* decode R-type with a rounding mode, used by OP-FP
  *  31    27 26   25 24   20 19   15 14    12 11   7 6      0
  * | funct5 |  fmt  |  rs2  |  rs1  |   rm   |  rd  | opcode |
  */
-static inline bool op_op_fp(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_frtype(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst      funct7  rs2   rs1 rm  rd opcode
-     * ---------+-------+-----+---+---+--+-------
-     * FADD.S    0000000 rs2   rs1 rm  rd 1010011
-     * FSUB.S    0000100 rs2   rs1 rm  rd 1010011
-     * FMUL.S    0001000 rs2   rs1 rm  rd 1010011
-     * FDIV.S    0001100 rs2   rs1 rm  rd 1010011
-     * FSQRT.S   0101100 00000 rs1 rm  rd 1010011
-     * FMV.W.X   1111000 00000 rs1 000 rd 1010011
-     * FSGNJ.S   0010000 rs2   rs1 000 rd 1010011
-     * FSGNJN.S  0010000 rs2   rs1 001 rd 1010011
-     * FSGNJX.S  0010000 rs2   rs1 010 rd 1010011
-     * FCVT.W.S  1100000 00000 rs1 rm  rd 1010011
-     * FCVT.WU.S 1100000 00001 rs1 rm  rd 1010011
-     * FMIN.S    0010100 rs2   rs1 000 rd 1010011
-     * FMAX.S    0010100 rs2   rs1 001 rd 1010011
-     * FMV.X.W   1110000 00000 rs1 000 rd 1010011
-     * FCLASS.S  1110000 00000 rs1 001 rd 1010011
-     * FEQ.S     1010000 rs2   rs1 010 rd 1010011
-     * FLT.S     1010000 rs2   rs1 001 rd 1010011
-     * FLE.S     1010000 rs2   rs1 000 rd 1010011
-     * FCVT.S.W  1101000 00000 rs1 rm  rd 1010011
-     * FCVT.S.WU 1101000 00001 rs1 rm  rd 1010011
-     */
-
-    /* decode R-type */
     ir->rm = decode_funct3(insn);
     decode_rtype(ir, insn);
-
-    /* dispatch from funct7 field */
-    switch (decode_funct7(insn)) {
-    case 0b0000000: /* FADD.S */
-        ir->opcode = rv_insn_fadds;
-        break;
-    case 0b0000100: /* FSUB.S */
-        ir->opcode = rv_insn_fsubs;
-        break;
-    case 0b0001000: /* FMUL.S */
-        ir->opcode = rv_insn_fmuls;
-        break;
-    case 0b0001100: /* FDIV.S */
-        ir->opcode = rv_insn_fdivs;
-        break;
-    case 0b0101100: /* FSQRT.S */
-        ir->opcode = rv_insn_fsqrts;
-        break;
-    case 0b0010000:
-        /* dispatch from rm region */
-        switch (ir->rm) {
-        case 0b000: /* FSGNJ.S */
-            ir->opcode = rv_insn_fsgnjs;
-            break;
-        case 0b001: /* FSGNJN.S */
-            ir->opcode = rv_insn_fsgnjns;
-            break;
-        case 0b010: /* FSGNJX.S */
-            ir->opcode = rv_insn_fsgnjxs;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-    case 0b1100000:
-        /* dispatch from rs2 region */
-        switch (ir->rs2) {
-        case 0b00000: /* FCVT.W.S */
-            ir->opcode = rv_insn_fcvtws;
-            break;
-        case 0b00001: /* FCVT.WU.S */
-            ir->opcode = rv_insn_fcvtwus;
-            break;
-        }
-        break;
-    case 0b0010100:
-        /* dispatch from rm region */
-        switch (ir->rm) {
-        case 0b000: /* FMIN.S */
-            ir->opcode = rv_insn_fmins;
-            break;
-        case 0b001: /* FMAX.S */
-            ir->opcode = rv_insn_fmaxs;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-    case 0b1110000:
-        /* dispatch from rm region */
-        switch (ir->rm) {
-        case 0b000: /* FMV.X.W */
-            ir->opcode = rv_insn_fmvxw;
-            break;
-        case 0b001: /* FCLASS.S */
-            ir->opcode = rv_insn_fclasss;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-    case 0b1010000:
-        /* dispatch from rm region */
-        switch (ir->rm) {
-        case 0b010: /* FEQ.S */
-            ir->opcode = rv_insn_feqs;
-            break;
-        case 0b001: /* FLT.S */
-            ir->opcode = rv_insn_flts;
-            break;
-        case 0b000: /* FLE.S */
-            ir->opcode = rv_insn_fles;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-    case 0b1101000:
-        /* dispatch from rs2 region */
-        switch (ir->rs2) {
-        case 0b00000: /* FCVT.S.W */
-            ir->opcode = rv_insn_fcvtsw;
-            break;
-        case 0b00001: /* FCVT.S.WU */
-            ir->opcode = rv_insn_fcvtswu;
-            break;
-        default: /* illegal instruction */
-            return false;
-        }
-        break;
-    case 0b1111000: /* FMV.W.X */
-        ir->opcode = rv_insn_fmvwx;
-        break;
-    default: /* illegal instruction */
-        return false;
-    }
-    return true;
-}
-
-/* F-MADD: R4-type
- *  31   27 26   25 24   20 19   15 14    12 11   7 6      0
- * |  rs3  |  fmt  |  rs2  |  rs1  |   rm   |  rd  | opcode |
- */
-static inline bool op_madd(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst    rs3 fmt rs2 rs1 rm rd opcode
-     * -------+---+---+---+---+--+--+-------
-     * FMADD.S rs3 00  rs2 rs1 rm rd 1000011
-     */
-
-    /* decode R4-type */
-    decode_r4type(ir, insn);
-
-    ir->opcode = rv_insn_fmadds;
-    return true;
-}
-
-/* F-MSUB: R4-type
- *  31   27 26   25 24   20 19   15 14    12 11   7 6      0
- * |  rs3  |  fmt  |  rs2  |  rs1  |   rm   |  rd  | opcode |
- */
-static inline bool op_msub(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst    rs3 fmt rs2 rs1 rm rd opcode
-     * -------+---+---+---+---+--+--+-------
-     * FMSUB.S rs3 00  rs2 rs1 rm rd 1000111
-     */
-
-    /* decode R4-type */
-    decode_r4type(ir, insn);
-
-    ir->opcode = rv_insn_fmsubs;
-    return true;
-}
-
-/* F-NMADD: R4-type
- *  31   27 26   25 24   20 19   15 14    12 11   7 6      0
- * |  rs3  |  fmt  |  rs2  |  rs1  |   rm   |  rd  | opcode |
- */
-static inline bool op_nmadd(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst    rs3 fmt rs2 rs1 rm rd opcode
-     * -------+---+---+---+---+--+--+-------
-     * FMSUB.S rs3 00  rs2 rs1 rm rd 1001111
-     */
-
-    /* decode R4-type */
-    decode_r4type(ir, insn);
-
-    ir->opcode = rv_insn_fnmadds;
-    return true;
 }
+#endif
 
-/* F-NMSUB: R4-type
- *  31   27 26   25 24   20 19   15 14    12 11   7 6      0
- * |  rs3  |  fmt  |  rs2  |  rs1  |   rm   |  rd  | opcode |
+#if RV32_HAS(EXT_C)
+/* decode CL/CS-format word offset
+ * uimm[5:3] = inst[12:10]
+ * uimm[2] = inst[6]
+ * uimm[6] = inst[5]
  */
-static inline bool op_nmsub(rv_insn_t *ir, const uint32_t insn)
+static inline uint16_t c_decode_cltype_imm(const uint16_t insn)
 {
-    /* inst    rs3 fmt rs2 rs1 rm rd opcode
-     * -------+---+---+---+---+--+--+-------
-     * FMSUB.S rs3 00  rs2 rs1 rm rd 1001011
-     */
-
-    /* decode R4-type */
-    decode_r4type(ir, insn);
-
-    ir->opcode = rv_insn_fnmsubs;
-    return true;
+    uint16_t tmp = 0;
+    tmp |= (insn & 0b0000000001000000) >> 4;
+    tmp |= (insn & FC_IMM_12_10) >> 7;
+    tmp |= (insn & 0b0000000000100000) << 1;
+    return tmp;
 }
 
-#else /* !RV32_HAS(EXT_F) */
-#define op_load_fp OP_UNIMP
-#define op_store_fp OP_UNIMP
-#define op_op_fp OP_UNIMP
-#define op_madd OP_UNIMP
-#define op_msub OP_UNIMP
-#define op_nmadd OP_UNIMP
-#define op_nmsub OP_UNIMP
-#endif /* RV32_HAS(EXT_F) */
-
-#if RV32_HAS(EXT_C)
-/* C.ADDI: CI-format
- *  15    13    12    11       7 6        2 1  0
- * | funct3 | imm[5] |  rd/rs1  | imm[4:0] | op |
+/* decode C.LWSP offset
+ * uimm[5] = inst[12]
+ * uimm[4:2|7:6] = inst[6:2]
  */
-static inline bool op_caddi(rv_insn_t *ir, const uint32_t insn)
+static inline uint16_t c_decode_clwsp_imm(const uint16_t insn)
 {
-    /* inst   funct3 imm[5]   rd/rs1    imm[4:0]   op
-     * ------+------+--------+---------+----------+--
-     * C.NOP  000    nzimm[5] 00000     nzimm[4:0] 01
-     * C.ADDI 000    nzimm[5] rs1/rd!=0 nzimm[4:0] 01
-     */
-
-    ir->rd = c_decode_rd(insn);
-
-    /* dispatch from rd/rs1 field */
-    switch (ir->rd) {
-    case 0: /* C.NOP */
-        ir->opcode = rv_insn_cnop;
-        break;
-    default: /* C.ADDI */
-        /* Add 6-bit signed immediate to rds, serving as NOP for X0 register. */
-        ir->imm = c_decode_citype_imm(insn);
-        ir->opcode = rv_insn_caddi;
-        break;
-    }
-    return true;
+    uint16_t tmp = 0;
+    tmp |= (insn & 0x70) >> 2;
+    tmp |= (insn & 0x0c) << 4;
+    tmp |= (insn & 0x1000) >> 7;
+    return tmp;
 }
 
-/* C.ADDI4SPN: CIW-format
+/* decode CIW-format, used by C.ADDI4SPN
  *  15    13 12    5 4   2 1  0
  * | funct3 |  imm  | rd' | op |
  */
-static inline bool op_caddi4spn(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_ciw(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst       funct3 imm                 rd' op
-     * ----------+------+-------------------+---+--
-     * C.ADDI4SPN 000    nzuimm[5:4|9:6|2|3] rd' 00
-     */
-
     ir->imm = c_decode_caddi4spn_nzuimm(insn);
     ir->rd = c_decode_rdc(insn) | 0x08;
-
-    /* Code point: nzuimm = 0 is reserved */
-    if (!ir->imm)
-        return false;
-    ir->opcode = rv_insn_caddi4spn;
-    return true;
 }
 
-/* C.LI: CI-format
+/* decode CI-format
  *  15    13    12    11       7 6        2 1  0
  * | funct3 | imm[5] |  rd/rs1  | imm[4:0] | op |
  */
-static inline bool op_cli(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_ci(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst funct3 imm[5] rd/rs1    imm[4:0] op
-     * ----+------+------+---------+--------+--
-     * C.LI 010    imm[5] rs1/rd!=0 imm[4:0] 01
-     */
-
     ir->imm = c_decode_citype_imm(insn);
     ir->rd = c_decode_rd(insn);
-    ir->opcode = rv_insn_cli;
-    return true;
 }
 
-/* C.LUI: CI-format
- *  15    13    12    11       7 6        2 1  0
- * | funct3 | imm[5] |  rd/rs1  | imm[4:0] | op |
- */
-static inline bool op_clui(rv_insn_t *ir, const uint32_t insn)
+/* decode CI-format without immediate, used by the HINTs */
+static inline void decode_crd(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst       funct3 imm[5]    rd/rs1    imm[4:0]         op
-     * ----------+------+---------+---------+----------------+--
-     * C.ADDI16SP 011    nzimm[9]  2         nzimm[4|6|8:7|5] 01
-     * C.LUI      011    nzimm[17] rd!={0,2} nzimm[16:12]     01
-     */
-
     ir->rd = c_decode_rd(insn);
-    /* dispatch from rd/rs1 region */
-    switch (ir->rd) {
-    case 0: /* Code point: rd = x0 is HINTS */
-        ir->opcode = rv_insn_cnop;
-        break;
-    case 2: { /* C.ADDI16SP */
-        ir->imm = c_decode_caddi16sp_nzimm(insn);
-        /* Code point: nzimm = 0 is reserved */
-        if (!(uint32_t) ir->imm)
-            return false;
-        ir->opcode = rv_insn_caddi16sp;
-        break;
-    }
-    default: { /* C.LUI */
-        ir->imm = c_decode_clui_nzimm(insn);
-        /* Code point: nzimm = 0 is reserved */
-        if (!ir->imm)
-            return false;
-        ir->opcode = rv_insn_clui;
-        break;
-    }
-    }
-    return true;
-}
-
-/* MISC-ALU: CB-format CA-format
- *
- * C.SRLI C.SRAI C.ANDI: CB-format
- *  15    13     12     11    10 9        7 6            2 1  0
- * | funct3 | shamt[5] | funct2 | rd'/rs1' |  shamt[4:0]  | op |
- *
- * CA-format
- *  15                        10 9        7 6      5 4    2 1  0
- * |           funct6           | rd'/rs1' | funct2 | rs2' | op |
- */
-static inline bool op_cmisc_alu(rv_insn_t *ir, const uint32_t insn)
-{
-    /* inst   funct3 shamt[5]  funct2 rd'/rs1' shamt[4:0]  op
-     * ------+------+---------+------+--------+-----------+--
-     * C.SRLI 100    nzuimm[5] 00     rd'/rs1' nzuimm[4:0] 01
-     * C.SRAI 100    nzuimm[5] 01     rd'/rs1' nzuimm[4:0] 01
-     * C.ANDI 100    imm[5]    10     rd'/rs1' imm[4:0]    01
-     * C.SUB  100    0         11     rd'/rs1' 00 rs2'     01
-     * C.XOR  100    0         11     rd'/rs1' 01 rs2'     01
-     * C.OR   100    0         11     rd'/rs1' 10 rs2'     01
-     * C.AND  100    0         11     rd'/rs1' 11 rs2'     01
-     * C.SUBW 100    1         11     rd'/rs1' 00 rs2'     01
-     * C.ADDW 100    1         11     rd'/rs1' 01 rs2'     01
-     */
-
-    /* dispatch from funct2 field */
-    uint8_t funct2 = (insn & 0x0C00) >> 10;
-    switch (funct2) {
-    case 0: /* C.SRLI */
-        ir->shamt = c_decode_cbtype_shamt(insn);
-        ir->rs1 = c_decode_rs1c(insn) | 0x08;
-
-        /* Code point: shamt[5] = 1 is reserved */
-        if (ir->shamt & 0x20)
-            return false;
-
-        /* Code point: rd = x0 is HINTS
-         * Code point: shamt = 0 is HINTS
-         */
-        ir->opcode = (!ir->rs1 || !ir->shamt) ? rv_insn_cnop : rv_insn_csrli;
-        break;
-    case 1: /* C.SRAI */
-        ir->shamt = c_decode_cbtype_shamt(insn);
-        ir->rs1 = c_decode_rs1(insn);
-
-        /* Code point: shamt[5] = 1 is reserved */
-        if (ir->shamt & 0x20)
-            return false;
-        ir->opcode = rv_insn_csrai;
-        break;
-    case 2: /* C.ANDI */
-        ir->rs1 = c_decode_rs1c(insn) | 0x08;
-        ir->imm = c_decode_caddi_imm(insn);
-        ir->opcode = rv_insn_candi;
-        break;
-    case 3:; /* Arithmistic */
-        ir->rs1 = c_decode_rs1c(insn) | 0x08;
-        ir->rs2 = c_decode_rs2c(insn) | 0x08;
-        ir->rd = ir->rs1;
-
-        /* dispatch from funct6[2] | funct2[1:0] */
-        switch (((insn & 0x1000) >> 10) | ((insn & 0x0060) >> 5)) {
-        case 0: /* SUB */
-            ir->opcode = rv_insn_csub;
-            break;
-        case 1: /* XOR */
-            ir->opcode = rv_insn_cxor;
-            break;
-        case 2: /* OR */
-            ir->opcode = rv_insn_cor;
-            break;
-        case 3: /* AND */
-            ir->opcode = rv_insn_cand;
-            break;
-        case 4: /* SUBW */
-        case 5: /* ADDW */
-            assert(!"RV64/128C instructions");
-            break;
-        case 6: /* Reserved */
-        case 7: /* Reserved */
-            assert(!"Instruction reserved");
-            break;
-        default:
-            __UNREACHABLE;
-            break;
-        }
-        break;
-    }
-    return true;
 }
 
-/* C.SLLI: CI-format
+/* decode CI-format, used by C.SLLI
  *  15    13     12     11       7 6          2 1  0
  * | funct3 | shamt[5] |  rd/rs1  | shamt[4:0] | op |
  */
-static inline bool op_cslli(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_cishamt(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst   funct3 shamt[5]  rd/rs1    shamt[4:0]  op
-     * ------+------+---------+---------+-----------+--
-     * C.SLLI 000    nzuimm[5] rs1/rd!=0 nzuimm[4:0] 01
-     */
-    uint32_t tmp = 0;
-    tmp |= (insn & FCI_IMM_12) >> 7;
-    tmp |= (insn & FCI_IMM_6_2) >> 2;
-    ir->imm = tmp;
+    ir->imm = (insn & FCI_IMM_12) >> 7 | (insn & FCI_IMM_6_2) >> 2;
     ir->rd = c_decode_rd(insn);
-    ir->opcode = ir->rd ? rv_insn_cslli : rv_insn_cnop;
-    return true;
 }
 
-/* C.LWSP: CI-format
+/* decode CI-format, used by C.LWSP and C.FLWSP
  *  15    13  12   11   7 6   2 1  0
  * | funct3 | imm |  rd  | imm | op |
  */
-static inline bool op_clwsp(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_cilwsp(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst   funct3 imm     rd    imm           op
-     * ------+------+-------+-----+-------------+--
-     * C.LWSP 000    uimm[5] rd!=0 uimm[4:2|7:6] 01
-     */
-    uint16_t tmp = 0;
-    tmp |= (insn & 0x70) >> 2;
-    tmp |= (insn & 0x0c) << 4;
-    tmp |= (insn & 0x1000) >> 7;
-    ir->imm = tmp;
+    ir->imm = c_decode_clwsp_imm(insn);
     ir->rd = c_decode_rd(insn);
+}
 
-    /* reserved for rd = x0 */
-    ir->opcode = ir->rd ? rv_insn_clwsp : rv_insn_cnop;
-    return true;
+/* decode CI-format, used by C.LUI */
+static inline void decode_cilui(rv_insn_t *ir, const uint32_t insn)
+{
+    ir->imm = c_decode_clui_nzimm(insn);
+    ir->rd = c_decode_rd(insn);
 }
 
-/* C.SWSP: CSS-Format
+/* decode CI-format, used by C.ADDI16SP */
+static inline void decode_ci16sp(rv_insn_t *ir, const uint32_t insn)
+{
+    ir->imm = c_decode_caddi16sp_nzimm(insn);
+    ir->rd = c_decode_rd(insn);
+}
+
+/* decode CSS-format, used by C.SWSP and C.FSWSP
  *  15    13 12    7 6   2 1  0
  * | funct3 |  imm  | rs2 | op |
  */
-static inline bool op_cswsp(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_css(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst   funct3 imm           rs2 op
-     * ------+------+-------------+---+--
-     * C.LWSP 110    uimm[5:2|7:6] rs2 10
-     */
     ir->imm = (insn & 0x1e00) >> 7 | (insn & 0x180) >> 1;
     ir->rs2 = c_decode_rs2(insn);
-    ir->opcode = rv_insn_cswsp;
-    return true;
 }
 
-/* C.LW: CL-format
+/* decode CL-format
  *  15    13 12   10 9    7 6   5 4   2 1  0
  * | funct3 |  imm  | rs1' | imm | rd' | op |
  */
-static inline bool op_clw(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_cl(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst funct3 imm       rs1' imm       rd' op
-     * ----+------+---------+----+---------+---+--
-     * C.LW 010    uimm[5:3] rs1' uimm[7:6] rd' 00
-     */
-    uint16_t tmp = 0;
-    tmp |= (insn & 0b0000000001000000) >> 4;
-    tmp |= (insn & FC_IMM_12_10) >> 7;
-    tmp |= (insn & 0b0000000000100000) << 1;
-    ir->imm = tmp;
+    ir->imm = c_decode_cltype_imm(insn);
     ir->rd = c_decode_rdc(insn) | 0x08;
     ir->rs1 = c_decode_rs1c(insn) | 0x08;
-    ir->opcode = rv_insn_clw;
-    return true;
 }
 
-/* C.SW: CS-format
+/* decode CS-format
  *  15    13 12   10 9    7 6   5 4    2 1  0
  * | funct3 |  imm  | rs1' | imm | rs2' | op |
  */
-static inline bool op_csw(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_cs(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst funct3 imm       rs1' imm       rs2' op
-     * ----+------+---------+----+---------+----+--
-     * C.SW 110    uimm[5:3] rs1' uimm[2|6] rs2' 00
-     */
-    uint32_t tmp = 0;
-    /*               ....xxxx....xxxx     */
-    tmp |= (insn & 0b0000000001000000) >> 4;
-    tmp |= (insn & FC_IMM_12_10) >> 7;
-    tmp |= (insn & 0b0000000000100000) << 1;
-    ir->imm = tmp;
+    ir->imm = c_decode_cltype_imm(insn);
     ir->rs1 = c_decode_rs1c(insn) | 0x08;
     ir->rs2 = c_decode_rs2c(insn) | 0x08;
-    ir->opcode = rv_insn_csw;
-    return true;
 }
 
-/* C.J: CR-format
+/* decode CJ-format
  *  15    13 12    2 1  0
  * | funct3 |  imm  | op |
  */
-static inline bool op_cj(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_cj(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst funct3 imm                        op
-     * ----+------+--------------------------+--
-     * C.J  101    imm[11|4|9:8|10|6|7|3:1|5] 01
-     */
     ir->imm = c_decode_cjtype_imm(insn);
-    ir->opcode = rv_insn_cj;
-    return true;
 }
 
-/* C.JAL: CR-format
- *  15    13 12    2 1  0
- * | funct3 |  imm  | op |
+/* decode CB-format, used by C.BEQZ and C.BNEZ
+ *  15    13 12     10 9    7 6       2 1  0
+ * | funct3 |   imm   | rs1' |   imm   | op |
  */
-static inline bool op_cjal(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_cb(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst  funct3 imm                        op
-     * -----+------+--------------------------+--
-     * C.JAL 001    imm[11|4|9:8|10|6|7|3:1|5] 01
-     */
-    ir->imm = sign_extend_h(c_decode_cjtype_imm(insn));
-    ir->opcode = rv_insn_cjal;
-    return true;
+    ir->imm = sign_extend_h(c_decode_cbtype_imm(insn));
+    ir->rs1 = c_decode_rs1c(insn) | 0x08;
 }
 
-/* C.CR: CR-format
- *  15    12 11    7 6    2 1  0
- * | funct4 |  rs1  |  rs2 | op |
+/* decode CB-format, used by C.SRLI and C.SRAI
+ *  15    13     12     11    10 9        7 6            2 1  0
+ * | funct3 | shamt[5] | funct2 | rd'/rs1' |  shamt[4:0]  | op |
  */
-static inline bool op_ccr(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_cbshamt(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst     funct4 rs1       rs2    op
-     * --------+------+---------+------+--
-     * C.JR     100    rs1!=0    0      10
-     * C.MV     100    rd!=0     rs2!=0 10
-     * C.EBREAK 100    0         0      10
-     * C.JALR   100    rs1!=0    0      10
-     * C.ADD    100    rs1/rd!=0 rs2!=0 10
-     */
-    ir->rs1 = c_decode_rs1(insn);
-    ir->rs2 = c_decode_rs2(insn);
-    ir->rd = ir->rs1;
-
-    /* dispatch from funct4[0] field */
-    switch ((insn & 0x1000) >> 12) {
-    case 0:
-        /* dispatch from rs2 field */
-        switch (ir->rs2) {
-        case 0: /* C.JR */
-            /* Code point: rd = x0 is reserved */
-            if (!ir->rs1)
-                return false;
-            ir->opcode = rv_insn_cjr;
-            break;
-        default: /* C.MV */
-            /* Code point: rd = x0 is HINTS */
-            ir->opcode = ir->rd ? rv_insn_cmv : rv_insn_cnop;
-            break;
-        }
-        break;
-    case 1:
-        if (!ir->rs1 && !ir->rs2) /* C.EBREAK */
-            ir->opcode = rv_insn_ebreak;
-        else if (ir->rs1 && ir->rs2) { /* C.ADD */
-            /* Code point: rd = x0 is HINTS */
-            ir->opcode = ir->rd ? rv_insn_cadd : rv_insn_cnop;
-        } else if (ir->rs1 && !ir->rs2) /* C.JALR */
-            ir->opcode = rv_insn_cjalr;
-        else { /* rs2 != x0 AND rs1 = x0 */
-            /* Hint */
-            ir->opcode = rv_insn_cnop;
-        }
-        break;
-    default:
-        __UNREACHABLE;
-        break;
-    }
-    return true;
+    ir->shamt = c_decode_cbtype_shamt(insn);
+    ir->rs1 = c_decode_rs1c(insn) | 0x08;
 }
 
-/* C.BEQZ: CB-format
- *  15    13 12     10 9    7 6       2 1  0
- * | funct3 |   imm   | rs1' |   imm   | op |
- */
-static inline bool op_cbeqz(rv_insn_t *ir, const uint32_t insn)
+/* decode CB-format, used by C.ANDI */
+static inline void decode_cbimm(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst   funct3 imm        rs1' imm            op
-     * ------+------+----------+----+--------------+--
-     * C.BEQZ 110    imm[8|4:3] rs1' imm[7:6|2:1|5] 01
-     */
-    ir->imm = sign_extend_h(c_decode_cbtype_imm(insn));
     ir->rs1 = c_decode_rs1c(insn) | 0x08;
-    ir->opcode = rv_insn_cbeqz;
-    return true;
+    ir->imm = c_decode_caddi_imm(insn);
 }
 
-/* C.BNEZ: CB-format
- *  15    13 12     10 9    7 6       2 1  0
- * | funct3 |   imm   | rs1' |   imm   | op |
+/* decode CA-format
+ *  15                        10 9        7 6      5 4    2 1  0
+ * |           funct6           | rd'/rs1' | funct2 | rs2' | op |
  */
-static inline bool op_cbnez(rv_insn_t *ir, const uint32_t insn)
+static inline void decode_ca(rv_insn_t *ir, const uint32_t insn)
 {
-    /* inst   funct3 imm        rs1' imm            op
-     * ------+------+----------+----+--------------+--
-     * C.BNEZ 111    imm[8|4:3] rs1' imm[7:6|2:1|5] 01
-     */
-    ir->imm = sign_extend_h(c_decode_cbtype_imm(insn));
     ir->rs1 = c_decode_rs1c(insn) | 0x08;
-    ir->opcode = rv_insn_cbnez;
-    return true;
+    ir->rs2 = c_decode_rs2c(insn) | 0x08;
+    ir->rd = ir->rs1;
 }
 
-#else /* !RV32_HAS(EXT_C) */
-#define op_caddi4spn OP_UNIMP
-#define op_caddi OP_UNIMP
-#define op_cslli OP_UNIMP
-#define op_cjal OP_UNIMP
-#define op_clw OP_UNIMP
-#define op_cli OP_UNIMP
-#define op_clwsp OP_UNIMP
-#define op_clui OP_UNIMP
-#define op_cmisc_alu OP_UNIMP
-#define op_ccr OP_UNIMP
-#define op_cj OP_UNIMP
-#define op_csw OP_UNIMP
-#define op_cbeqz OP_UNIMP
-#define op_cswsp OP_UNIMP
-#define op_cbnez OP_UNIMP
+/* decode CR-format
+ *  15    12 11    7 6    2 1  0
+ * | funct4 |  rs1  |  rs2 | op |
+ */
+static inline void decode_cr(rv_insn_t *ir, const uint32_t insn)
+{
+    ir->rs1 = c_decode_rs1(insn);
+    ir->rs2 = c_decode_rs2(insn);
+    ir->rd = ir->rs1;
+}
 #endif /* RV32_HAS(EXT_C) */
 
-#if RV32_HAS(EXT_C) && RV32_HAS(EXT_F)
-/* C.FLWSP: CI-format
- *  15    13  12   11   7 6   2 1  0
- * | funct3 | imm |  rd  | imm | op |
+typedef struct decode_index decode_index_t;
+
+/* decode the instruction from the entry of the decoder tables it falls into,
+ * return false if it is illegal
+ */
+typedef bool (*decode_t)(rv_insn_t *ir,
+                         uint32_t insn,
+                         const decode_index_t *idx);
+
+/* An entry of the decoder tables. Most buckets hold a single encoding, or one
+ * whose rd = x0 variant is another instruction, e.g., a HINT, and are decoded
+ * directly from their entry by decode_<format>_insn(). The others are split
+ * again by another field of the instruction, whose value selects one of the
+ * sub-buckets following the entry at the given offset, or their encodings are
+ * scanned from the given offset.
+ */
+struct decode_index {
+    decode_t decode;
+    uint16_t offset;
+    uint8_t opcode[2]; /**< the opcode when rd is not x0, and when it is */
+    /* the register fields name floating-point registers, see RV32E */
+    bool fpreg;
+    uint8_t shift, mask; /**< the field splitting the bucket */
+};
+
+/* An encoding of an instruction, generated from src/rv32_insn.txt. An
+ * instruction matches if (insn & mask) == match, then it is decoded from the
+ * entry.
  */
-static inline bool op_cflwsp(rv_insn_t *ir, const uint32_t insn)
+typedef struct {
+    uint32_t mask, match;
+    decode_index_t entry;
+} decode_pattern_t;
+
+static bool decode_illegal(rv_insn_t *ir UNUSED,
+                           uint32_t insn UNUSED,
+                           const decode_index_t *idx UNUSED)
 {
-    /* inst    funct3 imm     rd    imm           op
-     * -------+------+-------+-----+-------------+--
-     * C.FLWSP 001    uimm[5] rd    uimm[4:2|7:6] 10
-     */
-    uint16_t tmp = 0;
-    tmp |= (insn & 0x70) >> 2;
-    tmp |= (insn & 0x0c) << 4;
-    tmp |= (insn & 0x1000) >> 7;
-    ir->imm = tmp;
-    ir->rd = c_decode_rd(insn);
-    ir->opcode = rv_insn_cflwsp;
-    return true;
+    return false;
 }
 
-/* C.FSWSP: CSS-Format
- *  15    13 12    7 6   2 1  0
- * | funct3 |  imm  | rs2 | op |
- */
-static inline bool op_cfswsp(rv_insn_t *ir, const uint32_t insn)
+/* look the sub-bucket up by the field splitting the bucket */
+static bool decode_index(rv_insn_t *ir,
+                         uint32_t insn,
+                         const decode_index_t *idx)
 {
-    /* inst    funct3 imm           rs2 op
-     * -------+------+-------------+---+--
-     * C.FSWSP 111    uimm[5:2|7:6] rs2 10
-     */
-    ir->imm = (insn & 0x1e00) >> 7 | (insn & 0x180) >> 1;
-    ir->rs2 = c_decode_rs2(insn);
-    ir->opcode = rv_insn_cfswsp;
-    return true;
+    idx += idx->offset + ((insn >> idx->shift) & idx->mask);
+    return idx->decode(ir, insn, idx);
 }
 
-/* C.FLW: CL-format
- *  15    13 12   10 9    7 6   5 4   2 1  0
- * | funct3 |  imm  | rs1' | imm | rd' | op |
+static bool rv_decode_scan(rv_insn_t *ir,
+                           uint32_t insn,
+                           const decode_index_t *idx);
+#if RV32_HAS(EXT_C)
+static bool rvc_decode_scan(rv_insn_t *ir,
+                            uint32_t insn,
+                            const decode_index_t *idx);
+#endif
+
+#include "rv32_decode_table.h"
+
+/* the first matching encoding wins, and the list is terminated by an illegal
+ * one which matches any instruction.
  */
-static inline bool op_cflw(rv_insn_t *ir, const uint32_t insn)
+static bool decode_scan(rv_insn_t *ir,
+                        uint32_t insn,
+                        const decode_pattern_t *p)
 {
-    /* inst  funct3 imm       rs1' imm       rd' op
-     * -----+------+---------+----+---------+---+--
-     * C.FLW 010    uimm[5:3] rs1' uimm[7:6] rd' 00
-     */
-    uint16_t tmp = 0;
-    tmp |= (insn & 0b0000000001000000) >> 4;
-    tmp |= (insn & FC_IMM_12_10) >> 7;
-    tmp |= (insn & 0b0000000000100000) << 1;
-    ir->imm = tmp;
-    ir->rd = c_decode_rdc(insn) | 0x08;
-    ir->rs1 = c_decode_rs1c(insn) | 0x08;
-    ir->opcode = rv_insn_cflw;
-    return true;
+    while ((insn & p->mask) != p->match)
+        p++;
+    return p->entry.decode(ir, insn, &p->entry);
 }
 
-/* C.FSW: CS-format
- *  15    13 12   10 9    7 6   5 4    2 1  0
- * | funct3 |  imm  | rs1' | imm | rs2' | op |
- */
-static inline bool op_cfsw(rv_insn_t *ir, const uint32_t insn)
+static bool rv_decode_scan(rv_insn_t *ir,
+                           uint32_t insn,
+                           const decode_index_t *idx)
 {
-    /* inst  funct3 imm       rs1' imm       rs2' op
-     * -----+------+---------+----+---------+----+--
-     * C.FSW 110    uimm[5:3] rs1' uimm[2|6] rs2' 00
-     */
-    uint32_t tmp = 0;
-    /*               ....xxxx....xxxx     */
-    tmp |= (insn & 0b0000000001000000) >> 4;
-    tmp |= (insn & FC_IMM_12_10) >> 7;
-    tmp |= (insn & 0b0000000000100000) << 1;
-    ir->imm = tmp;
-    ir->rs1 = c_decode_rs1c(insn) | 0x08;
-    ir->rs2 = c_decode_rs2c(insn) | 0x08;
-    ir->opcode = rv_insn_cfsw;
-    return true;
+    return decode_scan(ir, insn, &rv_decode_patterns[idx->offset]);
 }
 
-#else /* !(RV32_HAS(EXT_C) && RV32_HAS(EXT_F)) */
-#define op_cfsw OP_UNIMP
-#define op_cflw OP_UNIMP
-#define op_cfswsp OP_UNIMP
-#define op_cflwsp OP_UNIMP
-#endif /* RV32_HAS(EXT_C) && RV32_HAS(EXT_F) */
+#if RV32_HAS(EXT_C)
+static bool rvc_decode_scan(rv_insn_t *ir,
+                            uint32_t insn,
+                            const decode_index_t *idx)
+{
+    return decode_scan(ir, insn, &rvc_decode_patterns[idx->offset]);
+}
+#endif
 
-/* handler for all unimplemented opcodes */
-static inline bool op_unimp(rv_insn_t *ir UNUSED, uint32_t insn UNUSED)
+static inline bool decode_insn(rv_insn_t *ir,
+                               uint32_t insn,
+                               const decode_index_t *idx)
 {
-    return false;
+    /* rd is at the same place in 32-bit and compressed instructions */
+    ir->opcode = idx->opcode[!decode_rd(insn)];
+
+#if RV32_HAS(RV32E)
+    /* RV32E forbids x16-x31 for integer registers, but with the F extension,
+     * floating-point registers are not limited to 16. */
+    if (!idx->fpreg && unlikely(ir->rd > 15 || ir->rs1 > 15 || ir->rs2 > 15))
+        return false;
+#endif
+
+    return true;
 }
 
-/* RV32 decode handler type */
-typedef bool (*decode_t)(rv_insn_t *ir, uint32_t insn);
+#define _(format)                                                    \
+    static bool decode_##format##_insn(rv_insn_t *ir, uint32_t insn, \
+                                       const decode_index_t *idx)    \
+    {                                                                \
+        decode_##format(ir, insn);                                   \
+        return decode_insn(ir, insn, idx);                           \
+    }
+DECODE_FORMAT_LIST
+#undef _
 
 /* decode RISC-V instruction */
 bool rv_decode(rv_insn_t *ir, uint32_t insn)
 {
-    bool ret;
     assert(ir);
-    decode_t op;
-
-#define OP_UNIMP op_unimp
-#define OP(insn) op_##insn
-
-    /* RV32 base opcode map */
-    /* clang-format off */
-    static const decode_t rv_jump_table[] = {
-    //  000         001           010        011           100         101        110        111
-        OP(load),   OP(load_fp),  OP(unimp), OP(misc_mem), OP(op_imm), OP(auipc), OP(unimp), OP(unimp), // 00
-        OP(store),  OP(store_fp), OP(unimp), OP(amo),      OP(op),     OP(lui),   OP(unimp), OP(unimp), // 01
-        OP(madd),   OP(msub),     OP(nmsub), OP(nmadd),    OP(op_fp),  OP(unimp), OP(unimp), OP(unimp), // 10
-        OP(branch), OP(jalr),     OP(unimp), OP(jal),      OP(system), OP(unimp), OP(unimp), OP(unimp), // 11
-    };
-
-#if RV32_HAS(EXT_C)
-    /* RV32C opcode map */
-    static const decode_t rvc_jump_table[] = {
-    //  00             01             10          11
-        OP(caddi4spn), OP(caddi),     OP(cslli),  OP(unimp),  // 000
-        OP(unimp),      OP(cjal),      OP(unimp), OP(unimp),  // 001
-        OP(clw),       OP(cli),       OP(clwsp),  OP(unimp),  // 010
-        OP(cflw),      OP(clui),      OP(cflwsp), OP(unimp),  // 011
-        OP(unimp),     OP(cmisc_alu), OP(ccr),    OP(unimp),  // 100
-        OP(unimp),      OP(cj),        OP(unimp), OP(unimp),  // 101
-        OP(csw),       OP(cbeqz),     OP(cswsp),  OP(unimp),  // 110
-        OP(cfsw),      OP(cbnez),     OP(cfswsp), OP(unimp),  // 111
-    };
-#endif
-    /* clang-format on */
+    const decode_index_t *idx;
 
     /* Compressed Extension Instruction */
 #if RV32_HAS(EXT_C)
@@ -2023,37 +712,117 @@ bool rv_decode(rv_insn_t *ir, uint32_t insn)
      */
     if (is_compressed(insn)) {
         insn &= 0x0000FFFF;
-        const uint16_t c_index = (insn & FC_FUNC3) >> 11 | (insn & FC_OPCODE);
+        idx = &rvc_decode_table[(insn & FC_FUNC3) >> 11 | (insn & FC_OPCODE)];
+    } else
+#endif
+    {
+        idx = &rv_decode_table[(insn & INSN_6_2) << 1 |
+                               (insn & FR_FUNCT3) >> 12];
+    }
 
-        /* decode instruction (compressed instructions) */
-        op = rvc_jump_table[c_index];
-        assert(op);
-        ret = op(ir, insn);
+    return idx->decode(ir, insn, idx);
+}
 
-        goto end;
-    }
+#if RV32_HAS(DECODE_CACHE)
+/* the fields of rv_insn_t filled by rv_decode() */
+typedef struct {
+    uint32_t insn; /**< the instruction bits, 0 if the entry is empty */
+    int32_t imm;
+    uint8_t rd, rs1, rs2, opcode;
+#if RV32_HAS(EXT_C)
+    uint8_t shamt;
+#endif
+#if RV32_HAS(EXT_F)
+    uint8_t rm;
 #endif
+} decode_entry_t;
 
-    /* standard uncompressed instruction */
-    const uint32_t index = (insn & INSN_6_2) >> 2;
+/* instructions are aligned on 2 bytes with RV32C, 4 bytes otherwise */
+#define DECODE_ALIGN_SHIFT (RV32_HAS(EXT_C) ? 1 : 2)
 
-    /* decode instruction */
-    op = rv_jump_table[index];
-    assert(op);
-    ret = op(ir, insn);
+typedef struct {
+    decode_entry_t entry[RV_PG_SIZE >> DECODE_ALIGN_SHIFT];
+} decode_page_t;
 
-end:
+/* The pages are direct-mapped by their physical page number and allocated on
+ * first use. An entry is only reused if the fetched instruction bits match the
+ * ones it was decoded from, so that code modified by any means, including
+ * stores from the JIT-generated code and device DMA, is decoded again. As the
+ * decoded fields only depend on these bits, this also validates the entries
+ * lazily when another physical page takes over the slot, which thus is not
+ * cleared.
+ */
+struct decode_cache {
+    decode_page_t *page[N_DECODE_CACHE_PAGES];
+};
 
-#if RV32_HAS(RV32E)
-    /* RV32E forbids x16-x31 for integer registers, but with the F extension,
-     * floating-point registers are not limited to 16. */
-    if ((op != op_store_fp && op != op_load_fp && op != op_op_fp) &&
-        unlikely(ir->rd > 15 || ir->rs1 > 15 || ir->rs2 > 15))
-        ret = false;
-#endif
+decode_cache_t *decode_cache_new(void)
+{
+    decode_cache_t *dc = calloc(1, sizeof(decode_cache_t));
+    assert(dc);
+    return dc;
+}
+
+void decode_cache_free(decode_cache_t *dc)
+{
+    if (!dc)
+        return;
+    for (int i = 0; i < N_DECODE_CACHE_PAGES; i++)
+        free(dc->page[i]);
+    free(dc);
+}
+
+bool rv_decode_cached(decode_cache_t *dc,
+                      rv_insn_t *ir,
+                      uint32_t insn,
+                      uint32_t paddr)
+{
+    const uint32_t pfn = paddr >> RV_PG_SHIFT;
+    decode_page_t **slot = &dc->page[pfn & (N_DECODE_CACHE_PAGES - 1)];
+    decode_page_t *page = *slot;
+
+    if (unlikely(!page)) {
+        page = calloc(1, sizeof(decode_page_t));
+        assert(page);
+        *slot = page;
+    }
+
+    decode_entry_t *entry =
+        &page->entry[(paddr & (RV_PG_SIZE - 1)) >> DECODE_ALIGN_SHIFT];
+    /* the upper half of a compressed instruction belongs to the next one */
+    const uint32_t bits = is_compressed(insn) ? insn & 0xFFFF : insn;
 
-    return ret;
+    if (entry->insn != bits || unlikely(!bits)) {
+        rv_insn_t decoded = {0};
+        if (!rv_decode(&decoded, insn))
+            return false;
+        *entry = (decode_entry_t){
+            .insn = bits,
+            .imm = decoded.imm,
+            .rd = decoded.rd,
+            .rs1 = decoded.rs1,
+            .rs2 = decoded.rs2,
+            .opcode = decoded.opcode,
+#if RV32_HAS(EXT_C)
+            .shamt = decoded.shamt,
+#endif
+#if RV32_HAS(EXT_F)
+            .rm = decoded.rm,
+#endif
+        };
+    }
 
-#undef OP_UNIMP
-#undef OP
+    ir->imm = entry->imm;
+    ir->rd = entry->rd;
+    ir->rs1 = entry->rs1;
+    ir->rs2 = entry->rs2;
+    ir->opcode = entry->opcode;
+#if RV32_HAS(EXT_C)
+    ir->shamt = entry->shamt;
+#endif
+#if RV32_HAS(EXT_F)
+    ir->rm = entry->rm;
+#endif
+    return true;
 }
+#endif
@@ -28,211 +28,10 @@ enum op_field {
 #define ENC_GEN(X, A) ENCN(X, A)
 #define ENC(...) ENC_GEN(ENC, COUNT_VARARGS(__VA_ARGS__))(__VA_ARGS__)
 
-/* RISC-V instruction list in format _(instruction-name, can-branch, insn_len,
- *                                     translatable, reg-mask)
+/* RV_INSN_LIST is generated from the instruction description, see
+ * src/rv32_insn.txt and tools/gen-decoder.py.
  */
-/* clang-format off */
-#define RV_INSN_LIST                                   \
-    _(nop, 0, 4, 1, ENC(rs1, rd))                      \
-    /* RV32I Base Instruction Set */                   \
-    _(lui, 0, 4, 1, ENC(rd))                           \
-    _(auipc, 0, 4, 1, ENC(rd))                         \
-    _(jal, 1, 4, 1, ENC(rd))                           \
-    _(jalr, 1, 4, 1, ENC(rs1, rd))                     \
-    _(beq, 1, 4, 1, ENC(rs1, rs2))                     \
-    _(bne, 1, 4, 1, ENC(rs1, rs2))                     \
-    _(blt, 1, 4, 1, ENC(rs1, rs2))                     \
-    _(bge, 1, 4, 1, ENC(rs1, rs2))                     \
-    _(bltu, 1, 4, 1, ENC(rs1, rs2))                    \
-    _(bgeu, 1, 4, 1, ENC(rs1, rs2))                    \
-    _(lb, 0, 4, 1, ENC(rs1, rd))                       \
-    _(lh, 0, 4, 1, ENC(rs1, rd))                       \
-    _(lw, 0, 4, 1, ENC(rs1, rd))                       \
-    _(lbu, 0, 4, 1, ENC(rs1, rd))                      \
-    _(lhu, 0, 4, 1, ENC(rs1, rd))                      \
-    _(sb, 0, 4, 1, ENC(rs1, rs2))                      \
-    _(sh, 0, 4, 1, ENC(rs1, rs2))                      \
-    _(sw, 0, 4, 1, ENC(rs1, rs2))                      \
-    _(addi, 0, 4, 1, ENC(rs1, rd))                     \
-    _(slti, 0, 4, 1, ENC(rs1, rd))                     \
-    _(sltiu, 0, 4, 1, ENC(rs1, rd))                    \
-    _(xori, 0, 4, 1, ENC(rs1, rd))                     \
-    _(ori, 0, 4, 1, ENC(rs1, rd))                      \
-    _(andi, 0, 4, 1, ENC(rs1, rd))                     \
-    _(slli, 0, 4, 1, ENC(rs1, rd))                     \
-    _(srli, 0, 4, 1, ENC(rs1, rd))                     \
-    _(srai, 0, 4, 1, ENC(rs1, rd))                     \
-    _(add, 0, 4, 1, ENC(rs1, rs2, rd))                 \
-    _(sub, 0, 4, 1, ENC(rs1, rs2, rd))                 \
-    _(sll, 0, 4, 1, ENC(rs1, rs2, rd))                 \
-    _(slt, 0, 4, 1, ENC(rs1, rs2, rd))                 \
-    _(sltu, 0, 4, 1, ENC(rs1, rs2, rd))                \
-    _(xor, 0, 4, 1, ENC(rs1, rs2, rd))                 \
-    _(srl, 0, 4, 1, ENC(rs1, rs2, rd))                 \
-    _(sra, 0, 4, 1, ENC(rs1, rs2, rd))                 \
-    _(or, 0, 4, 1, ENC(rs1, rs2, rd))                  \
-    _(and, 0, 4, 1, ENC(rs1, rs2, rd))                 \
-    _(fence, 1, 4, 0, ENC(rs1, rd))                    \
-    _(ecall, 1, 4, 1, ENC(rs1, rd))                    \
-    _(ebreak, 1, 4, 1, ENC(rs1, rd))                   \
-    /* RISC-V Privileged Instruction */                \
-    _(wfi, 0, 4, 0, ENC(rs1, rd))                      \
-    _(uret, 0, 4, 0, ENC(rs1, rd))                     \
-    IIF(RV32_HAS(SYSTEM))(                             \
-        _(sret, 1, 4, 0, ENC(rs1, rd))                 \
-    )                                                  \
-    _(hret, 0, 4, 0, ENC(rs1, rd))                     \
-    _(mret, 1, 4, 0, ENC(rs1, rd))                     \
-    _(sfencevma, 1, 4, 0, ENC(rs1, rs2, rd))           \
-    /* RV32 Zifencei Standard Extension */             \
-    IIF(RV32_HAS(Zifencei))(                           \
-        _(fencei, 1, 4, 0, ENC(rs1, rd))               \
-    )                                                  \
-    /* RV32 Zicsr Standard Extension */                \
-    IIF(RV32_HAS(Zicsr))(                              \
-        _(csrrw, 1, 4, 0, ENC(rs1, rd))                \
-        _(csrrs, 0, 4, 0, ENC(rs1, rd))                \
-        _(csrrc, 0, 4, 0, ENC(rs1, rd))                \
-        _(csrrwi, 0, 4, 0, ENC(rs1, rd))               \
-        _(csrrsi, 0, 4, 0, ENC(rs1, rd))               \
-        _(csrrci, 0, 4, 0, ENC(rs1, rd))               \
-    )                                                  \
-    /* RV32 Zba Standard Extension */                  \
-    IIF(RV32_HAS(Zba))(                                \
-        _(sh1add, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(sh2add, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(sh3add, 0, 4, 0, ENC(rs1, rs2, rd))          \
-    )                                                  \
-    /* RV32 Zbb Standard Extension */                  \
-    IIF(RV32_HAS(Zbb))(                                \
-        _(andn, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(orn, 0, 4, 0, ENC(rs1, rs2, rd))             \
-        _(xnor, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(clz, 0, 4, 0, ENC(rs1, rd))                  \
-        _(ctz, 0, 4, 0, ENC(rs1, rd))                  \
-        _(cpop, 0, 4, 0, ENC(rs1, rd))                 \
-        _(max, 0, 4, 0, ENC(rs1, rs2, rd))             \
-        _(maxu, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(min, 0, 4, 0, ENC(rs1, rs2, rd))             \
-        _(minu, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(sextb, 0, 4, 0, ENC(rs1, rd))                \
-        _(sexth, 0, 4, 0, ENC(rs1, rd))                \
-        _(zexth, 0, 4, 0, ENC(rs1, rd))                \
-        _(rol, 0, 4, 0, ENC(rs1, rs2, rd))             \
-        _(ror, 0, 4, 0, ENC(rs1, rs2, rd))             \
-        _(rori, 0, 4, 0, ENC(rs1, rd))                 \
-        _(orcb, 0, 4, 0, ENC(rs1, rd))                 \
-        _(rev8, 0, 4, 0, ENC(rs1, rd))                 \
-    )                                                  \
-     /* RV32 Zbc Standard Extension */                 \
-    IIF(RV32_HAS(Zbc))(                                \
-        _(clmul, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(clmulh, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(clmulr, 0, 4, 0, ENC(rs1, rs2, rd))          \
-    )                                                  \
-    /* RV32 Zbs Standard Extension */                  \
-    IIF(RV32_HAS(Zbs))(                                \
-        _(bclr, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(bclri, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(bext, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(bexti, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(binv, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(binvi, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(bset, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(bseti, 0, 4, 0, ENC(rs1, rs2, rd))           \
-    )                                                  \
-    /* RV32M Standard Extension */                     \
-    IIF(RV32_HAS(EXT_M))(                              \
-        _(mul, 0, 4, 1, ENC(rs1, rs2, rd))             \
-        _(mulh, 0, 4, 1, ENC(rs1, rs2, rd))            \
-        _(mulhsu, 0, 4, 1, ENC(rs1, rs2, rd))          \
-        _(mulhu, 0, 4, 1, ENC(rs1, rs2, rd))           \
-        _(div, 0, 4, 1, ENC(rs1, rs2, rd))             \
-        _(divu, 0, 4, 1, ENC(rs1, rs2, rd))            \
-        _(rem, 0, 4, 1, ENC(rs1, rs2, rd))             \
-        _(remu, 0, 4, 1, ENC(rs1, rs2, rd))            \
-    )                                                  \
-    /* RV32A Standard Extension */                     \
-    IIF(RV32_HAS(EXT_A))(                              \
-        _(lrw, 0, 4, 0, ENC(rs1, rs2, rd))             \
-        _(scw, 0, 4, 0, ENC(rs1, rs2, rd))             \
-        _(amoswapw, 0, 4, 0, ENC(rs1, rs2, rd))        \
-        _(amoaddw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amoxorw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amoandw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amoorw, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(amominw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amomaxw, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(amominuw, 0, 4, 0, ENC(rs1, rs2, rd))        \
-        _(amomaxuw, 0, 4, 0, ENC(rs1, rs2, rd))        \
-    )                                                  \
-    /* RV32F Standard Extension */                     \
-    IIF(RV32_HAS(EXT_F))(                              \
-        _(flw, 0, 4, 0, ENC(rs1, rd))                  \
-        _(fsw, 0, 4, 0, ENC(rs1, rs2))                 \
-        _(fmadds, 0, 4, 0, ENC(rs1, rs2, rs3, rd))     \
-        _(fmsubs, 0, 4, 0, ENC(rs1, rs2, rs3, rd))     \
-        _(fnmsubs, 0, 4, 0, ENC(rs1, rs2, rs3, rd))    \
-        _(fnmadds, 0, 4, 0, ENC(rs1, rs2, rs3, rd))    \
-        _(fadds, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fsubs, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fmuls, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fdivs, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fsqrts, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(fsgnjs, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(fsgnjns, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fsgnjxs, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fmins, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fmaxs, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(fcvtws, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(fcvtwus, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fmvxw, 0, 4, 0, ENC(rs1, rs2, rd))           \
-        _(feqs, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(flts, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(fles, 0, 4, 0, ENC(rs1, rs2, rd))            \
-        _(fclasss, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fcvtsw, 0, 4, 0, ENC(rs1, rs2, rd))          \
-        _(fcvtswu, 0, 4, 0, ENC(rs1, rs2, rd))         \
-        _(fmvwx, 0, 4, 0, ENC(rs1, rs2, rd))           \
-    )                                                  \
-    /* RV32C Standard Extension */                     \
-    IIF(RV32_HAS(EXT_C))(                              \
-        _(caddi4spn, 0, 2, 1, ENC(rd))                 \
-        _(clw, 0, 2, 1, ENC(rs1, rd))                  \
-        _(csw, 0, 2, 1, ENC(rs1, rs2))                 \
-        _(cnop, 0, 2, 1, ENC())                        \
-        _(caddi, 0, 2, 1, ENC(rd))                     \
-        _(cjal, 1, 2, 1, ENC())                        \
-        _(cli, 0, 2, 1, ENC(rd))                       \
-        _(caddi16sp, 0, 2, 1, ENC())                   \
-        _(clui, 0, 2, 1, ENC(rd))                      \
-        _(csrli, 0, 2, 1, ENC(rs1))                    \
-        _(csrai, 0, 2, 1, ENC(rs1))                    \
-        _(candi, 0, 2, 1, ENC(rs1))                    \
-        _(csub, 0, 2, 1, ENC(rs1, rs2, rd))            \
-        _(cxor, 0, 2, 1, ENC(rs1, rs2, rd))            \
-        _(cor, 0, 2, 1, ENC(rs1, rs2, rd))             \
-        _(cand, 0, 2, 1, ENC(rs1, rs2, rd))            \
-        _(cj, 1, 2, 1, ENC())                          \
-        _(cbeqz, 1, 2, 1, ENC(rs1))                    \
-        _(cbnez, 1, 2, 1, ENC(rs1))                    \
-        _(cslli, 0, 2, 1, ENC(rd))                     \
-        _(clwsp, 0, 2, 1, ENC(rd))                     \
-        _(cjr, 1, 2, 1, ENC(rs1, rs2, rd))             \
-        _(cmv, 0, 2, 1, ENC(rs1, rs2, rd))             \
-        _(cebreak, 1, 2, 1,ENC(rs1, rs2, rd))          \
-        _(cjalr, 1, 2, 1, ENC(rs1, rs2, rd))           \
-        _(cadd, 0, 2, 1, ENC(rs1, rs2, rd))            \
-        _(cswsp, 0, 2, 1, ENC(rs2))                    \
-        /* RV32FC Instruction */                       \
-        IIF(RV32_HAS(EXT_F))(                          \
-            _(cflwsp, 0, 2, 1, ENC(rd))                \
-            _(cfswsp, 0, 2, 1, ENC(rs2))               \
-            _(cflw, 0, 2, 1, ENC(rs1, rd))             \
-            _(cfsw, 0, 2, 1, ENC(rs1, rs2))            \
-        )                                              \
-    )
-/* clang-format on */
+#include "rv32_insn_list.h"
 
 /* Macro operation fusion */
 
@@ -244,7 +43,34 @@ enum op_field {
     _(fuse2)           \
     _(fuse3)           \
     _(fuse4)           \
-    _(fuse5)
+    _(fuse5)           \
+    _(fuse6)           \
+    _(fuse7)           \
+    _(fuse8)           \
+    _(fuse9)
+
+/* macro operation fusion patterns, in the order they are tried by
+ * match_pattern()
+ */
+#define MOP_PATTERN_LIST \
+    _(lui_add)           \
+    _(lui_lw)            \
+    _(lui_jalr)          \
+    _(lui_run)           \
+    _(sw_run)            \
+    _(lw_run)            \
+    _(slli_add)          \
+    _(shift_run)         \
+    _(slt_branch)        \
+    _(lb_zext)           \
+    _(lh_zext)
+
+enum {
+#define _(pattern) mop_##pattern,
+    MOP_PATTERN_LIST
+#undef _
+    N_MOP_PATTERNS
+};
 
 /* clang-format off */
 /* IR (intermediate representation) is exclusively represented by RISC-V
@@ -338,6 +164,25 @@ typedef struct {
 #endif
 } branch_history_table_t;
 
+/* The IR of a basic block is stored as one contiguous array, split by access
+ * frequency. The hot records (rv_insn_t) are touched on every dispatch, thus
+ * they only carry the operands, the handler and the guest PC, and are laid
+ * out in program order so that the interpreter walks sequential cache lines.
+ * The cold records (rv_insn_cold_t) hold the data used by the block exit and
+ * by fused operations, thus only the final instruction and the fused ones
+ * have one. They follow the hot records, starting with the one of the final
+ * instruction, and are referenced from a table, stored in reverse order
+ * immediately before the first hot record:
+ *
+ *   | ref[n-1] | ... | ref[0] | hot[0] | ... | hot[n-1] | cold | ... | cold |
+ *
+ * so the cold record of any instruction is located from its position alone,
+ * see rv_insn_cold(), and the one of the final instruction, which the block
+ * exit reads, from its address, see rv_insn_exit(). The other instructions
+ * have a NULL reference.
+ */
+#define RV_INSN_IDX_BITS 15
+
 typedef struct rv_insn {
     union {
         int32_t imm;
@@ -364,9 +209,9 @@ typedef struct rv_insn {
     uint8_t rm;
 #endif
 
-    /* fuse operation */
-    int32_t imm2;
-    opcode_fuse_t *fuse;
+    /* position within the block, and whether this is the final instruction */
+    uint16_t idx : RV_INSN_IDX_BITS;
+    uint16_t tail : 1;
 
     uint32_t pc;
 
@@ -376,15 +221,19 @@ typedef struct rv_insn {
      * optimization enables the self-recursive function to reuse the same
      * function stack frame.
      *
-     * The @next member indicates the next IR or is NULL if it is the final
-     * instruction in a basic block. The @impl member facilitates the direct
-     * invocation of the next instruction emulation without the need to compute
-     * the jump address. By utilizing these two members, all instruction
-     * emulations can be rewritten into a self-recursive version, enabling the
-     * compiler to leverage TCO.
+     * The next instruction of a block is the adjacent IR, unless @tail is set.
+     * The @impl member facilitates the direct invocation of the next
+     * instruction emulation without the need to compute the jump address. By
+     * utilizing these members, all instruction emulations can be rewritten
+     * into a self-recursive version, enabling the compiler to leverage TCO.
      */
-    struct rv_insn *next;
     bool (*impl)(riscv_t *, const struct rv_insn *, uint64_t, uint32_t);
+} rv_insn_t;
+
+typedef struct {
+    /* fuse operation */
+    int32_t imm2;
+    opcode_fuse_t *fuse;
 
     /* Two pointers, 'branch_taken' and 'branch_untaken', are employed to
      * avoid the overhead associated with aggressive memory copying. Instead
@@ -395,7 +244,73 @@ typedef struct rv_insn {
      */
     struct rv_insn *branch_taken, *branch_untaken;
     branch_history_table_t *branch_table;
-} rv_insn_t;
+#if !RV32_HAS(JIT)
+    /* whether the block of the final instruction was run since the last
+     * eviction from the block map, see block_map_evict()
+     */
+    bool referenced;
+#endif
+} rv_insn_cold_t;
+
+/* a standalone instruction, laid out as a block of a single IR, whose @ref
+ * must be set to @cold
+ */
+typedef struct {
+    rv_insn_cold_t *ref;
+    rv_insn_t ir;
+    rv_insn_cold_t cold;
+} rv_insn_single_t;
+
+/* locate the cold record of an instruction, see rv_insn_t for the layout */
+static inline rv_insn_cold_t *rv_insn_cold(const rv_insn_t *ir)
+{
+    rv_insn_cold_t **ref = (rv_insn_cold_t **) (uintptr_t) (ir - ir->idx);
+    return ref[-1 - (int) ir->idx];
+}
+
+/* locate the cold record of the final instruction of a translated block */
+static inline rv_insn_cold_t *rv_insn_exit(const rv_insn_t *ir)
+{
+    return (rv_insn_cold_t *) (uintptr_t) (ir + 1);
+}
+
+/* Rebuild the i-th instruction covered by the fused operation @ir. Only 32-bit
+ * instructions are fused, hence the i-th one is located at ir->pc + 4 * i.
+ */
+static inline void rv_insn_unfuse(const rv_insn_t *ir, int i, rv_insn_t *insn)
+{
+    const opcode_fuse_t *fuse = rv_insn_cold(ir)->fuse + i;
+    *insn = (rv_insn_t){
+        .imm = fuse->imm,
+        .rd = fuse->rd,
+        .rs1 = fuse->rs1,
+        .rs2 = fuse->rs2,
+        .opcode = fuse->opcode,
+        .pc = ir->pc + 4 * i,
+    };
+}
 
 /* decode the RISC-V instruction */
 bool rv_decode(rv_insn_t *ir, const uint32_t insn);
+
+#if RV32_HAS(DECODE_CACHE)
+/* number of physical pages held by the decode cache, must be a power of two */
+#ifndef N_DECODE_CACHE_PAGES
+#define N_DECODE_CACHE_PAGES 256
+#endif
+
+typedef struct decode_cache decode_cache_t;
+
+/* create and destroy the decode cache */
+decode_cache_t *decode_cache_new(void);
+void decode_cache_free(decode_cache_t *dc);
+
+/* Decode the instruction @insn fetched from the physical address @paddr. The
+ * decoded fields are kept per physical page and reused as long as the same
+ * instruction bits are fetched from there again.
+ */
+bool rv_decode_cached(decode_cache_t *dc,
+                      rv_insn_t *ir,
+                      uint32_t insn,
+                      uint32_t paddr);
+#endif
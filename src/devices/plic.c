@@ -18,9 +18,11 @@ void plic_update_interrupts(plic_t *plic)
     plic->ip |= plic->active & ~plic->masked;
     plic->masked |= plic->active;
     /* Send interrupt to target */
-    if (plic->ip & plic->ie)
+    if (plic->ip & plic->ie) {
+        if (!(rv->csr_sip & SIP_SEIP))
+            rv_raise_event(rv);
         rv->csr_sip |= SIP_SEIP;
-    else
+    } else
         rv->csr_sip &= ~SIP_SEIP;
 }
 
@@ -6,6 +6,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <poll.h>
+#if !defined(__EMSCRIPTEN__)
+#include <pthread.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +23,180 @@
 
 #define U8250_INTR_THRE 1
 
+/* input read by the reader thread at once, and waiting for the guest */
+#define U8250_IN_BUF_SIZE 256
+
+#if !defined(__EMSCRIPTEN__)
+struct u8250_reader {
+    u8250_state_t *uart;
+    pthread_t thread;
+    int in_fd;
+    int wake_fd[2]; /* written to stop the thread */
+    /* ring of the input, filled by the thread and drained by the guest */
+    uint32_t head, tail;
+    uint8_t buf[U8250_IN_BUF_SIZE];
+    /* the thread waits for room in the ring, and the guest may wait for the
+     * input, see u8250_reader_wait()
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t room, input;
+    bool stop;
+    bool done; /* the thread has exited, at the end of the input notably */
+    uint64_t n_syscalls;
+};
+
+static uint32_t u8250_reader_len(struct u8250_reader *reader)
+{
+    return __atomic_load_n(&reader->tail, __ATOMIC_ACQUIRE) - reader->head;
+}
+
+/* wake the guest waiting for the input */
+static void u8250_reader_signal(struct u8250_reader *reader, bool done)
+{
+    pthread_mutex_lock(&reader->lock);
+    reader->done |= done;
+    pthread_cond_signal(&reader->input);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+static void *u8250_reader_main(void *arg)
+{
+    struct u8250_reader *reader = arg;
+    for (;;) {
+        pthread_mutex_lock(&reader->lock);
+        while (!reader->stop &&
+               reader->tail - __atomic_load_n(&reader->head,
+                                              __ATOMIC_ACQUIRE) ==
+                   U8250_IN_BUF_SIZE)
+            pthread_cond_wait(&reader->room, &reader->lock);
+        const bool stop = reader->stop;
+        pthread_mutex_unlock(&reader->lock);
+        if (stop)
+            break;
+
+        /* sleep until the input comes, or the thread is stopped */
+        struct pollfd pfd[2] = {
+            {reader->in_fd, POLLIN, 0},
+            {reader->wake_fd[0], POLLIN, 0},
+        };
+        const int ret = poll(pfd, 2, -1);
+        __atomic_add_fetch(&reader->n_syscalls, 1, __ATOMIC_RELAXED);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0 || pfd[1].revents)
+            break;
+
+        /* fill the free part of the ring up to its end */
+        const uint32_t head = __atomic_load_n(&reader->head, __ATOMIC_ACQUIRE);
+        const uint32_t idx = reader->tail % U8250_IN_BUF_SIZE;
+        uint32_t room = U8250_IN_BUF_SIZE - (reader->tail - head);
+        if (room > U8250_IN_BUF_SIZE - idx)
+            room = U8250_IN_BUF_SIZE - idx;
+        const ssize_t n = read(reader->in_fd, reader->buf + idx, room);
+        __atomic_add_fetch(&reader->n_syscalls, 1, __ATOMIC_RELAXED);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n <= 0) { /* the end of the input */
+            if (n < 0)
+                rv_log_error("Failed to read UART input: %s",
+                             strerror(errno));
+            break;
+        }
+        __atomic_store_n(&reader->tail, reader->tail + n, __ATOMIC_RELEASE);
+        u8250_reader_signal(reader, false);
+        if (reader->uart->wake)
+            reader->uart->wake(reader->uart->wake_arg);
+    }
+    u8250_reader_signal(reader, true);
+    return NULL;
+}
+
+/* Wait for the next byte of the input, and return false if the input has
+ * ended instead
+ */
+static bool u8250_reader_wait(struct u8250_reader *reader)
+{
+    pthread_mutex_lock(&reader->lock);
+    while (!u8250_reader_len(reader) && !reader->done)
+        pthread_cond_wait(&reader->input, &reader->lock);
+    pthread_mutex_unlock(&reader->lock);
+    return u8250_reader_len(reader);
+}
+
+/* Take the next byte of the input, which is known to be there */
+static uint8_t u8250_reader_pop(struct u8250_reader *reader)
+{
+    const bool full = u8250_reader_len(reader) == U8250_IN_BUF_SIZE;
+    const uint8_t value = reader->buf[reader->head % U8250_IN_BUF_SIZE];
+    __atomic_store_n(&reader->head, reader->head + 1, __ATOMIC_RELEASE);
+    if (full) {
+        pthread_mutex_lock(&reader->lock);
+        pthread_cond_signal(&reader->room);
+        pthread_mutex_unlock(&reader->lock);
+    }
+    return value;
+}
+
+void u8250_start_reader(u8250_state_t *uart)
+{
+    if (uart->unbuffered)
+        return;
+
+    struct u8250_reader *reader = calloc(1, sizeof(struct u8250_reader));
+    assert(reader);
+    reader->uart = uart;
+    reader->in_fd = uart->in_fd;
+    if (pipe(reader->wake_fd)) {
+        rv_log_error("Failed to create the UART reader: %s", strerror(errno));
+        free(reader);
+        return;
+    }
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->room, NULL);
+    pthread_cond_init(&reader->input, NULL);
+    if (pthread_create(&reader->thread, NULL, u8250_reader_main, reader)) {
+        rv_log_error("Failed to create the UART reader");
+        close(reader->wake_fd[0]);
+        close(reader->wake_fd[1]);
+        free(reader);
+        return;
+    }
+    uart->reader = reader;
+}
+
+static void u8250_stop_reader(struct u8250_reader *reader)
+{
+    pthread_mutex_lock(&reader->lock);
+    reader->stop = true;
+    pthread_cond_signal(&reader->room);
+    pthread_mutex_unlock(&reader->lock);
+    const uint8_t wake = 0;
+    if (write(reader->wake_fd[1], &wake, 1) < 1)
+        rv_log_error("Failed to stop the UART reader: %s", strerror(errno));
+    pthread_join(reader->thread, NULL);
+    close(reader->wake_fd[0]);
+    close(reader->wake_fd[1]);
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->room);
+    pthread_cond_destroy(&reader->input);
+    free(reader);
+}
+
+uint64_t u8250_reader_syscalls(const u8250_state_t *uart)
+{
+    return uart->reader ? __atomic_load_n(&uart->reader->n_syscalls,
+                                          __ATOMIC_RELAXED)
+                        : 0;
+}
+#else
+void u8250_start_reader(u8250_state_t *uart UNUSED) {}
+
+uint64_t u8250_reader_syscalls(const u8250_state_t *uart UNUSED)
+{
+    return 0;
+}
+#endif
+
 void u8250_update_interrupts(u8250_state_t *uart)
 {
     /* Some interrupts are level-generated. */
@@ -68,17 +245,52 @@ void u8250_check_ready(u8250_state_t *uart)
     if (input_buf_size)
         uart->in_ready = true;
 #else
+    if (uart->reader) {
+        uart->in_ready = u8250_reader_len(uart->reader);
+        return;
+    }
+
     struct pollfd pfd = {uart->in_fd, POLLIN, 0};
     poll(&pfd, 1, 0);
+    uart->n_syscalls++;
     if (pfd.revents & POLLIN)
         uart->in_ready = true;
 #endif
 }
 
+void u8250_flush(u8250_state_t *uart)
+{
+    const uint8_t *p = uart->out_buf;
+    uint32_t left = uart->out_len;
+    while (left) {
+        const ssize_t n = write(uart->out_fd, p, left);
+        uart->n_syscalls++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            rv_log_error("Failed to write UART output: %s", strerror(errno));
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+    uart->out_len = 0;
+}
+
+void u8250_flush_idle(u8250_state_t *uart)
+{
+    if (!uart->out_busy)
+        u8250_flush(uart);
+    uart->out_busy = false;
+}
+
 static void u8250_handle_out(u8250_state_t *uart, uint8_t value)
 {
-    if (write(uart->out_fd, &value, 1) < 1)
-        rv_log_error("Failed to write UART output: %s", strerror(errno));
+    uart->out_busy = true;
+    uart->out_buf[uart->out_len++] = value;
+    if (uart->unbuffered || value == '\n' ||
+        uart->out_len == sizeof(uart->out_buf))
+        u8250_flush(uart);
 }
 
 static uint8_t u8250_handle_in(u8250_state_t *uart)
@@ -94,14 +306,33 @@ static uint8_t u8250_handle_in(u8250_state_t *uart)
     if (--input_buf_size == 0)
         input_buf_start = 0;
 #else
-    if (read(uart->in_fd, &value, 1) < 0)
-        rv_log_error("Failed to read UART input: %s", strerror(errno));
+    if (uart->reader) {
+        value = u8250_reader_pop(uart->reader);
+    } else {
+        if (read(uart->in_fd, &value, 1) < 0)
+            rv_log_error("Failed to read UART input: %s", strerror(errno));
+        uart->n_syscalls++;
+    }
 #endif
     uart->in_ready = false;
 
     if (value == 1) { /* start of heading (Ctrl-a) */
+#if !defined(__EMSCRIPTEN__)
+        /* the next key is left to the guest unless it quits */
+        if (uart->reader) {
+            if (u8250_reader_wait(uart->reader) &&
+                uart->reader->buf[uart->reader->head % U8250_IN_BUF_SIZE] ==
+                    120) { /* keyboard x */
+                u8250_flush(uart);
+                rv_log_info("RISC-V emulator is destroyed");
+                exit(EXIT_SUCCESS);
+            }
+            return value;
+        }
+#endif
         u8250_check_ready(uart);
         if (getchar() == 120) { /* keyboard x */
+            u8250_flush(uart);
             rv_log_info("RISC-V emulator is destroyed");
             exit(EXIT_SUCCESS);
         }
@@ -195,5 +426,10 @@ u8250_state_t *u8250_new()
 
 void u8250_delete(u8250_state_t *uart)
 {
+#if !defined(__EMSCRIPTEN__)
+    if (uart->reader)
+        u8250_stop_reader(uart->reader);
+#endif
+    u8250_flush(uart);
     free(uart);
 }
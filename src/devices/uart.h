@@ -11,6 +11,11 @@
 #define IRQ_UART_SHIFT 1
 #define IRQ_UART_BIT (1 << IRQ_UART_SHIFT)
 
+/* output written out at once, on a newline, when full, or by u8250_flush() */
+#ifndef U8250_OUT_BUF_SIZE
+#define U8250_OUT_BUF_SIZE 4096
+#endif
+
 enum UART_REG {
     U8250_THR_RBR_DLL = 0,
     U8250_IER_DLH,
@@ -30,6 +35,19 @@ typedef struct {
     uint8_t mcr;       /* other output signals, loopback mode (ignored) */
     int in_fd, out_fd; /* I/O handling */
     bool in_ready;
+    /* output not written out yet */
+    uint32_t out_len;
+    uint8_t out_buf[U8250_OUT_BUF_SIZE];
+    bool out_busy; /* output came since the last u8250_flush_idle() */
+    /* write every byte and poll the input with system calls instead, as a
+     * baseline for the measurement of the system calls
+     */
+    bool unbuffered;
+    uint64_t n_syscalls; /* host system calls but the ones of the reader */
+    struct u8250_reader *reader; /* thread reading the input, or NULL */
+    /* called by the reader once input comes, see IRQ_UART_BIT */
+    void (*wake)(void *arg);
+    void *wake_arg;
 } u8250_state_t;
 
 /* update UART status */
@@ -38,6 +56,22 @@ void u8250_update_interrupts(u8250_state_t *uart);
 /* poll UART status */
 void u8250_check_ready(u8250_state_t *uart);
 
+/* Read the input by a thread, so that u8250_check_ready() takes no system
+ * call. Not called when the input belongs to another device.
+ */
+void u8250_start_reader(u8250_state_t *uart);
+
+/* write out the output buffered so far */
+void u8250_flush(u8250_state_t *uart);
+
+/* write out the output buffered so far if no more came since the last call,
+ * so that a line is not split while the guest is writing it
+ */
+void u8250_flush_idle(u8250_state_t *uart);
+
+/* number of host system calls taken by the reader thread */
+uint64_t u8250_reader_syscalls(const u8250_state_t *uart);
+
 /* read a word from UART */
 uint32_t u8250_read(u8250_state_t *uart, uint32_t addr);
 
@@ -0,0 +1,394 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * A copy-on-write overlay keeps the sectors written by a guest in a sparse
+ * delta file, while the others are read from a base image shared by several
+ * guests, through the page cache of the host. Cloning a disk then amounts to
+ * creating an empty overlay.
+ *
+ * The overlay is divided into clusters of 64 sectors. The disk is indexed by
+ * a two-level table, similar to qcow2: the L1 table, following the header,
+ * holds the offsets of the L2 tables, each of one cluster, and an L2 entry
+ * holds the offset of a cluster of data along with the bitmap of its sectors
+ * written so far. Hence, a write never copies data from the base image, and
+ * a read takes the sectors in the bitmap from the overlay and the other ones
+ * from the base image. The clusters and L2 tables are allocated at the end of
+ * the file, and the tables are loaded lazily and kept in memory.
+ *
+ * All fields are stored in the byte order of the host.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vblk-overlay.h"
+
+#define OVERLAY_MAGIC 0x564f5652 /* "RVOV" */
+#define OVERLAY_VERSION 1
+
+#define SECTOR_SHIFT 9
+#define SECTOR_SIZE (1 << SECTOR_SHIFT)
+
+/* a cluster holds 64 sectors, i.e., the bits of an L2 entry */
+#define CLUSTER_BITS 15
+#define CLUSTER_SIZE (1 << CLUSTER_BITS)
+#define L2_BITS (CLUSTER_BITS - 4) /* 16-byte L2 entries */
+#define L2_SIZE (1 << L2_BITS)
+
+PACKED(struct overlay_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; /* size of the base image in bytes */
+    uint32_t cluster_bits;
+    uint32_t l1_size; /* number of L1 entries */
+    uint64_t l1_offset;
+});
+
+typedef struct {
+    uint64_t offset; /* of the cluster in the overlay, 0 if not allocated */
+    uint64_t bitmap; /* sectors of the cluster written to the overlay */
+} l2_entry_t;
+
+struct vblk_overlay {
+    int fd, base_fd;
+    uint64_t size;
+    uint32_t l1_size;
+    uint64_t l1_offset;
+    uint64_t *l1;
+    l2_entry_t **l2; /* loaded L2 tables, indexed as the L1 table */
+    uint64_t end;    /* where the next cluster is allocated */
+};
+
+static int pread_full(int fd, void *buf, size_t len, uint64_t offset)
+{
+    uint8_t *p = buf;
+    while (len) {
+        const ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0) { /* beyond the end of the file */
+            memset(p, 0, len);
+            break;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int pwrite_full(int fd, const void *buf, size_t len, uint64_t offset)
+{
+    const uint8_t *p = buf;
+    while (len) {
+        const ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/* allocate a cluster at the end of the overlay, reading as zeros */
+static uint64_t overlay_alloc(vblk_overlay_t *ov)
+{
+    const uint64_t offset = ov->end;
+    if (ftruncate(ov->fd, offset + CLUSTER_SIZE) == -1)
+        return 0;
+    ov->end += CLUSTER_SIZE;
+    return offset;
+}
+
+/* the L2 entry of @cluster, or NULL if there is none and @alloc is false */
+static l2_entry_t *overlay_lookup(vblk_overlay_t *ov,
+                                  uint64_t cluster,
+                                  bool alloc)
+{
+    const uint64_t l1_idx = cluster >> L2_BITS;
+    if (l1_idx >= ov->l1_size)
+        return NULL;
+
+    if (!ov->l2[l1_idx]) {
+        if (!ov->l1[l1_idx] && !alloc)
+            return NULL;
+        l2_entry_t *l2 = malloc(CLUSTER_SIZE);
+        if (!l2)
+            return NULL;
+
+        if (ov->l1[l1_idx]) {
+            if (pread_full(ov->fd, l2, CLUSTER_SIZE, ov->l1[l1_idx])) {
+                free(l2);
+                return NULL;
+            }
+        } else {
+            const uint64_t offset = overlay_alloc(ov);
+            if (!offset ||
+                pwrite_full(ov->fd, &offset, sizeof(offset),
+                            ov->l1_offset + l1_idx * sizeof(offset))) {
+                free(l2);
+                return NULL;
+            }
+            memset(l2, 0, CLUSTER_SIZE);
+            ov->l1[l1_idx] = offset;
+        }
+        ov->l2[l1_idx] = l2;
+    }
+    return &ov->l2[l1_idx][cluster & (L2_SIZE - 1)];
+}
+
+/* write @entry of @cluster back to its L2 table */
+static int overlay_store(vblk_overlay_t *ov,
+                         uint64_t cluster,
+                         const l2_entry_t *entry)
+{
+    const uint64_t l2_offset = ov->l1[cluster >> L2_BITS];
+    return pwrite_full(ov->fd, entry, sizeof(*entry),
+                       l2_offset + (cluster & (L2_SIZE - 1)) * sizeof(*entry));
+}
+
+static uint64_t sector_mask(uint32_t first, uint32_t last)
+{
+    const uint64_t below_last = last == 63 ? ~0ULL : (1ULL << (last + 1)) - 1;
+    return below_last & ~((1ULL << first) - 1);
+}
+
+int vblk_overlay_read(vblk_overlay_t *ov,
+                      void *buf,
+                      uint32_t len,
+                      uint64_t offset)
+{
+    uint8_t *p = buf;
+    while (len) {
+        const uint64_t cluster = offset >> CLUSTER_BITS;
+        const uint32_t in_cluster = offset & (CLUSTER_SIZE - 1);
+        const l2_entry_t *entry = overlay_lookup(ov, cluster, false);
+        const uint64_t bitmap = entry ? entry->bitmap : 0;
+
+        /* the runs of sectors either in the overlay or in the base image */
+        uint32_t chunk = CLUSTER_SIZE - in_cluster;
+        if (chunk > len)
+            chunk = len;
+        for (uint32_t pos = in_cluster; pos < in_cluster + chunk;) {
+            const uint32_t sector = pos >> SECTOR_SHIFT;
+            const bool written = (bitmap >> sector) & 1;
+            uint32_t end = (sector + 1) << SECTOR_SHIFT;
+            while (end < CLUSTER_SIZE &&
+                   ((bitmap >> (end >> SECTOR_SHIFT)) & 1) == written)
+                end += SECTOR_SIZE;
+            if (end > in_cluster + chunk)
+                end = in_cluster + chunk;
+
+            const int ret =
+                written ? pread_full(ov->fd, p, end - pos, entry->offset + pos)
+                        : pread_full(ov->base_fd, p, end - pos,
+                                     (cluster << CLUSTER_BITS) + pos);
+            if (ret)
+                return -1;
+            p += end - pos;
+            pos = end;
+        }
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* copy the sector of @pos in @cluster from the base image, unless written */
+static int overlay_fill(vblk_overlay_t *ov,
+                        uint64_t cluster,
+                        l2_entry_t *entry,
+                        uint32_t pos)
+{
+    const uint32_t sector = pos >> SECTOR_SHIFT;
+    if ((entry->bitmap >> sector) & 1)
+        return 0;
+
+    uint8_t data[SECTOR_SIZE];
+    const uint32_t start = sector << SECTOR_SHIFT;
+    if (pread_full(ov->base_fd, data, SECTOR_SIZE,
+                   (cluster << CLUSTER_BITS) + start) ||
+        pwrite_full(ov->fd, data, SECTOR_SIZE, entry->offset + start))
+        return -1;
+    entry->bitmap |= 1ULL << sector;
+    return 0;
+}
+
+int vblk_overlay_write(vblk_overlay_t *ov,
+                       const void *buf,
+                       uint32_t len,
+                       uint64_t offset)
+{
+    const uint8_t *p = buf;
+    while (len) {
+        const uint64_t cluster = offset >> CLUSTER_BITS;
+        const uint32_t in_cluster = offset & (CLUSTER_SIZE - 1);
+        l2_entry_t *entry = overlay_lookup(ov, cluster, true);
+        if (!entry)
+            return -1;
+
+        if (!entry->offset) {
+            entry->offset = overlay_alloc(ov);
+            if (!entry->offset)
+                return -1;
+        }
+
+        uint32_t chunk = CLUSTER_SIZE - in_cluster;
+        if (chunk > len)
+            chunk = len;
+
+        /* the sectors partly written keep the rest of their data */
+        const uint32_t end = in_cluster + chunk;
+        if (((in_cluster & (SECTOR_SIZE - 1)) &&
+             overlay_fill(ov, cluster, entry, in_cluster)) ||
+            ((end & (SECTOR_SIZE - 1)) &&
+             overlay_fill(ov, cluster, entry, end)))
+            return -1;
+
+        /* the data reaches the overlay before the sectors are marked */
+        if (pwrite_full(ov->fd, p, chunk, entry->offset + in_cluster))
+            return -1;
+        entry->bitmap |= sector_mask(in_cluster >> SECTOR_SHIFT,
+                                     (end - 1) >> SECTOR_SHIFT);
+        if (overlay_store(ov, cluster, entry))
+            return -1;
+
+        p += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int vblk_overlay_discard(vblk_overlay_t *ov, uint64_t len, uint64_t offset)
+{
+    while (len) {
+        const uint64_t cluster = offset >> CLUSTER_BITS;
+        const uint32_t in_cluster = offset & (CLUSTER_SIZE - 1);
+        uint32_t chunk = CLUSTER_SIZE - in_cluster;
+        if (chunk > len)
+            chunk = len;
+
+        /* the sectors partly discarded keep their data */
+        const uint32_t first = (in_cluster + SECTOR_SIZE - 1) >> SECTOR_SHIFT;
+        const uint32_t end = (in_cluster + chunk) >> SECTOR_SHIFT;
+        l2_entry_t *entry = overlay_lookup(ov, cluster, false);
+        if (entry && first < end &&
+            (entry->bitmap & sector_mask(first, end - 1))) {
+            entry->bitmap &= ~sector_mask(first, end - 1);
+            if (overlay_store(ov, cluster, entry))
+                return -1;
+        }
+
+        offset += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int vblk_overlay_sync(vblk_overlay_t *ov)
+{
+    return fsync(ov->fd);
+}
+
+/* create the header and the empty L1 table of a new overlay */
+static int overlay_create(vblk_overlay_t *ov)
+{
+    const struct overlay_header header = {
+        .magic = OVERLAY_MAGIC,
+        .version = OVERLAY_VERSION,
+        .size = ov->size,
+        .cluster_bits = CLUSTER_BITS,
+        .l1_size = ov->l1_size,
+        .l1_offset = CLUSTER_SIZE,
+    };
+    const uint64_t l1_bytes = (uint64_t) ov->l1_size * sizeof(uint64_t);
+    ov->l1_offset = CLUSTER_SIZE;
+    ov->end = CLUSTER_SIZE + (l1_bytes + CLUSTER_SIZE - 1) /
+                                 CLUSTER_SIZE * CLUSTER_SIZE;
+    if (ftruncate(ov->fd, ov->end) == -1 ||
+        pwrite_full(ov->fd, &header, sizeof(header), 0))
+        return -1;
+    return 0;
+}
+
+/* load the header and the L1 table of an existing overlay */
+static int overlay_load(vblk_overlay_t *ov, uint64_t file_size)
+{
+    struct overlay_header header;
+    if (pread_full(ov->fd, &header, sizeof(header), 0))
+        return -1;
+    if (header.magic != OVERLAY_MAGIC || header.version != OVERLAY_VERSION ||
+        header.cluster_bits != CLUSTER_BITS) {
+        rv_log_error("Not an overlay of this format");
+        errno = EINVAL;
+        return -1;
+    }
+    if (header.size != ov->size || header.l1_size != ov->l1_size) {
+        rv_log_error("Overlay of a base image of %" PRIu64 " bytes",
+                     header.size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    ov->l1_offset = header.l1_offset;
+    ov->end = (file_size + CLUSTER_SIZE - 1) / CLUSTER_SIZE * CLUSTER_SIZE;
+    return pread_full(ov->fd, ov->l1, ov->l1_size * sizeof(uint64_t),
+                      ov->l1_offset);
+}
+
+vblk_overlay_t *vblk_overlay_open(const char *path, int base_fd, uint64_t size)
+{
+    vblk_overlay_t *ov = calloc(1, sizeof(vblk_overlay_t));
+    if (!ov)
+        return NULL;
+    ov->fd = open(path, O_RDWR | O_CREAT, 0644);
+    ov->base_fd = base_fd;
+    ov->size = size;
+    ov->l1_size = (size + ((uint64_t) CLUSTER_SIZE << L2_BITS) - 1) >>
+                  (CLUSTER_BITS + L2_BITS);
+    ov->l1 = calloc(ov->l1_size ? ov->l1_size : 1, sizeof(uint64_t));
+    ov->l2 = calloc(ov->l1_size ? ov->l1_size : 1, sizeof(l2_entry_t *));
+    if (!ov->l1 || !ov->l2 || ov->fd < 0)
+        goto fail;
+
+    struct stat st;
+    if (fstat(ov->fd, &st) == -1)
+        goto fail;
+    if (st.st_size ? overlay_load(ov, st.st_size) : overlay_create(ov))
+        goto fail;
+    return ov;
+
+fail:
+    rv_log_error("Could not open overlay %s: %s", path, strerror(errno));
+    if (ov->fd >= 0)
+        close(ov->fd);
+    free(ov->l2);
+    free(ov->l1);
+    free(ov);
+    return NULL;
+}
+
+void vblk_overlay_close(vblk_overlay_t *ov)
+{
+    for (uint32_t i = 0; i < ov->l1_size; i++)
+        free(ov->l2[i]);
+    free(ov->l2);
+    free(ov->l1);
+    close(ov->fd);
+    free(ov);
+}
@@ -0,0 +1,38 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Copy-on-write overlay of a disk image, see vblk-overlay.c */
+typedef struct vblk_overlay vblk_overlay_t;
+
+/* Open the overlay @path of the base image @base_fd of @size bytes, which is
+ * created empty if it does not exist. Return NULL on failure.
+ */
+vblk_overlay_t *vblk_overlay_open(const char *path, int base_fd, uint64_t size);
+
+/* Read @len bytes at @offset of the disk, and return 0 or -1 on failure */
+int vblk_overlay_read(vblk_overlay_t *ov,
+                      void *buf,
+                      uint32_t len,
+                      uint64_t offset);
+
+/* Write @len bytes at @offset of the disk, and return 0 or -1 on failure */
+int vblk_overlay_write(vblk_overlay_t *ov,
+                       const void *buf,
+                       uint32_t len,
+                       uint64_t offset);
+
+/* Drop the sectors within @len bytes at @offset of the disk from the overlay,
+ * which then reads them from the base image again. Return 0 or -1 on failure.
+ */
+int vblk_overlay_discard(vblk_overlay_t *ov, uint64_t len, uint64_t offset);
+
+/* Write the overlay back to the storage, and return 0 or -1 on failure */
+int vblk_overlay_sync(vblk_overlay_t *ov);
+
+void vblk_overlay_close(vblk_overlay_t *ov);
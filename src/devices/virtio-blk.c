@@ -8,14 +8,26 @@
 #include <fcntl.h>
 #include <libgen.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+/* The asynchronous backend runs the requests on an I/O worker thread, which
+ * is not available for wasm.
+ */
+#if !defined(__EMSCRIPTEN__)
+#define VBLK_HAVE_ASYNC 1
+#include <pthread.h>
+#else
+#define VBLK_HAVE_ASYNC 0
+#endif
+
 /*
  * The /dev/ block devices cannot be embedded to the part of the wasm.
  * Thus, accessing /dev/ block devices is not supported for wasm.
@@ -28,6 +40,8 @@
 #endif
 #endif /* !defined(__EMSCRIPTEN__) */
 
+#include "vblk-overlay.h"
+#include "virtio-queue.h"
 #include "virtio.h"
 
 #define DISK_BLK_SIZE 512
@@ -35,11 +49,26 @@
 /* TODO: Enable mutiple virtio-blk devices. */
 #define VBLK_DEV_CNT_MAX 1
 
-#define VBLK_FEATURES_0 0
+#define VBLK_FEATURES_0                                             \
+    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_MQ | \
+     VIRTIO_BLK_F_DISCARD | VIRTIO_BLK_F_WRITE_ZEROES |            \
+     VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_RING_F_EVENT_IDX)
 #define VBLK_FEATURES_1 1 /* VIRTIO_F_VERSION_1 */
 #define VBLK_QUEUE_NUM_MAX 1024
 #define VBLK_QUEUE (vblk->queues[vblk->queue_sel])
 
+/* Limits of a request: the data buffers, and the ranges of sectors of a
+ * DISCARD or WRITE_ZEROES request along with their size.
+ */
+#define VBLK_SEG_MAX 128
+#define VBLK_IOV_MAX (VBLK_SEG_MAX + 1) /* the status may share the last one */
+#define VBLK_RANGE_MAX 32
+#define VBLK_RANGE_SECTORS_MAX (1 << 22)
+
+/* returned by a GET_ID request, at most 20 bytes */
+#define VBLK_ID "rv32emu"
+#define VBLK_ID_LEN 20
+
 #define VBLK_PRIV(x) ((struct virtio_blk_config *) x->priv)
 
 PACKED(struct virtio_blk_config {
@@ -63,7 +92,8 @@ PACKED(struct virtio_blk_config {
     } topology;
 
     uint8_t writeback;
-    uint8_t unused0[3];
+    uint8_t unused0;
+    uint16_t num_queues;
     uint32_t max_discard_sectors;
     uint32_t max_discard_seg;
     uint32_t discard_sector_alignment;
@@ -81,9 +111,471 @@ PACKED(struct vblk_req_header {
     uint8_t status;
 });
 
+/* The data of a DISCARD or WRITE_ZEROES request is an array of ranges */
+PACKED(struct vblk_req_range {
+    uint64_t sector;
+    uint32_t num_sectors;
+    uint32_t flags;
+});
+
 static struct virtio_blk_config vblk_configs[VBLK_DEV_CNT_MAX];
 static int vblk_dev_cnt = 0;
 
+/* A request gathered from a descriptor chain */
+typedef struct {
+    uint16_t queue_idx;
+    uint16_t desc_idx; /* head of the descriptor chain */
+    uint32_t type;
+    uint64_t sector;
+    struct iovec *iov; /* the data buffers, in the memory of the host */
+    uint32_t n_iov;
+    uint32_t len; /* of the data written to the guest */
+    uint8_t *status;
+} vblk_req_t;
+
+#if VBLK_HAVE_ASYNC
+#define VBLK_REQ_MAX (VBLK_QUEUE_NUM_MAX * VBLK_QUEUE_CNT)
+
+/*
+ * The asynchronous backend accesses the disk file with preadv() and pwritev()
+ * rather than mapping it whole, on a worker thread so that the guest keeps
+ * running while the host performs the I/O. The vCPU submits the requests when
+ * the driver notifies a queue, and later collects the completed ones in
+ * virtio_blk_poll() to fill the used rings and raise the interrupt. Each
+ * descriptor chain is in flight at most once, hence its request is held in
+ * the slot indexed by the queue and the head of the chain, and both FIFOs
+ * hold the indices of the slots. A chain made available again before it is
+ * used would overwrite the request under the worker, thus the vCPU keeps
+ * track of the slots in flight, and fails the device on such a reuse.
+ */
+struct vblk_io {
+    virtio_blk_state_t *vblk;
+    int fd;
+    vblk_overlay_t *overlay; /* of the disk file, or NULL */
+    bool readonly;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t submitted; /* signals the worker */
+    pthread_cond_t idle;      /* signals the vCPU, see vblk_io_drain() */
+    bool quit;
+    bool completed; /* read by the vCPU without the lock */
+    uint32_t n_pending; /* submitted but not completed yet */
+    uint32_t sq_head, sq_tail, cq_head, cq_tail;
+    uint16_t sq[VBLK_REQ_MAX], cq[VBLK_REQ_MAX];
+    vblk_req_t reqs[VBLK_REQ_MAX];
+    struct iovec *iovs[VBLK_REQ_MAX]; /* of the slots, allocated on demand */
+    uint64_t inflight[VBLK_REQ_MAX / 64]; /* slots in flight, by the vCPU */
+};
+
+/* the slot holding the request of the chain headed by @desc_idx */
+static inline uint16_t vblk_io_slot(uint16_t queue_idx, uint16_t desc_idx)
+{
+    return queue_idx * VBLK_QUEUE_NUM_MAX + desc_idx;
+}
+
+static inline bool vblk_io_inflight(const struct vblk_io *io, uint16_t slot)
+{
+    return io->inflight[slot / 64] & (1ULL << (slot % 64));
+}
+
+/* transfer the buffers of @iov at @offset of the raw disk file, of
+ * @disk_size bytes
+ */
+static int vblk_io_rwv(int fd,
+                       bool write,
+                       struct iovec *iov,
+                       uint32_t n_iov,
+                       uint64_t offset,
+                       uint64_t disk_size)
+{
+    /* the part of the last sector beyond the end of the file is dropped,
+     * rather than growing the file
+     */
+    if (write) {
+        uint64_t room = offset < disk_size ? disk_size - offset : 0;
+        uint32_t i = 0;
+        for (; i < n_iov && room; i++) {
+            if (iov[i].iov_len > room)
+                iov[i].iov_len = room;
+            room -= iov[i].iov_len;
+        }
+        n_iov = i;
+    }
+
+    while (n_iov) {
+        ssize_t n = write ? pwritev(fd, iov, n_iov, offset)
+                          : preadv(fd, iov, n_iov, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0) {
+            /* the last sector is partly beyond the end of the file */
+            if (write)
+                return -1;
+            for (; n_iov; iov++, n_iov--)
+                memset(iov->iov_base, 0, iov->iov_len);
+            break;
+        }
+
+        /* skip the buffers transferred, the last one possibly in part */
+        offset += n;
+        for (; n_iov && (size_t) n >= iov->iov_len; iov++, n_iov--)
+            n -= iov->iov_len;
+        if (n_iov) {
+            iov->iov_base = (uint8_t *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+#endif /* VBLK_HAVE_ASYNC */
+
+/*
+ * The disk is accessed either in memory, mapped or read whole at start, or by
+ * the I/O worker of the asynchronous backend, through the file descriptor or
+ * the overlay. The functions below return 0, or -1 on failure.
+ */
+static uint8_t vblk_zeros[1 << 16];
+
+static int vblk_disk_rw(virtio_blk_state_t *vblk,
+                        bool write,
+                        struct iovec *iov,
+                        uint32_t n_iov,
+                        uint64_t offset)
+{
+#if VBLK_HAVE_ASYNC
+    struct vblk_io *io = vblk->io;
+    if (io && !io->overlay)
+        return vblk_io_rwv(io->fd, write, iov, n_iov, offset,
+                           VBLK_PRIV(vblk)->disk_size);
+#endif
+
+    const uint64_t disk_size = VBLK_PRIV(vblk)->disk_size;
+    for (uint32_t i = 0; i < n_iov; i++) {
+        const uint32_t len = iov[i].iov_len;
+#if VBLK_HAVE_ASYNC
+        if (io) {
+            const int ret =
+                write ? vblk_overlay_write(io->overlay, iov[i].iov_base, len,
+                                           offset)
+                      : vblk_overlay_read(io->overlay, iov[i].iov_base, len,
+                                          offset);
+            if (ret)
+                return -1;
+            offset += len;
+            continue;
+        }
+#endif
+        /* the last sector is partly beyond the end of the disk */
+        uint32_t n = offset < disk_size ? disk_size - offset : 0;
+        if (n > len)
+            n = len;
+        uint8_t *disk = (uint8_t *) vblk->disk + offset;
+        if (write) {
+            memcpy(disk, iov[i].iov_base, n);
+        } else {
+            memcpy(iov[i].iov_base, disk, n);
+            memset((uint8_t *) iov[i].iov_base + n, 0, len - n);
+        }
+        offset += len;
+    }
+    return 0;
+}
+
+/* zero, or merely drop if @discard is set, @len bytes at @offset */
+static int vblk_disk_zero(virtio_blk_state_t *vblk,
+                          bool discard,
+                          uint64_t len,
+                          uint64_t offset)
+{
+#if VBLK_HAVE_ASYNC
+    struct vblk_io *io = vblk->io;
+    if (io && io->overlay && discard)
+        return vblk_overlay_discard(io->overlay, len, offset);
+#endif
+    /* discarding is a hint, which the raw disk ignores */
+    if (discard)
+        return 0;
+
+#if VBLK_HAVE_ASYNC
+    while (io && len) {
+        const uint32_t n = len < sizeof(vblk_zeros) ? len : sizeof(vblk_zeros);
+        struct iovec iov = {.iov_base = vblk_zeros, .iov_len = n};
+        if (vblk_disk_rw(vblk, true, &iov, 1, offset))
+            return -1;
+        offset += n;
+        len -= n;
+    }
+    if (io)
+        return 0;
+#endif
+
+    const uint64_t disk_size = VBLK_PRIV(vblk)->disk_size;
+    if (offset < disk_size)
+        memset((uint8_t *) vblk->disk + offset, 0,
+               len < disk_size - offset ? len : disk_size - offset);
+    return 0;
+}
+
+/* write the disk back to the storage of the host */
+static int vblk_disk_flush(virtio_blk_state_t *vblk)
+{
+#if VBLK_HAVE_ASYNC
+    struct vblk_io *io = vblk->io;
+    if (io && io->overlay)
+        return vblk_overlay_sync(io->overlay);
+    if (io)
+        return fsync(io->fd);
+#endif
+#if HAVE_MMAP
+    /* with mmap_fallback, the disk is only written back on exit */
+    if (vblk->disk_fd == -1 && vblk->disk)
+        return msync(vblk->disk, VBLK_PRIV(vblk)->disk_size, MS_SYNC);
+#endif
+    return 0;
+}
+
+/* the sum of up to VBLK_IOV_MAX lengths, which does not fit in 32 bits */
+static uint64_t vblk_iov_size(const vblk_req_t *req)
+{
+    uint64_t size = 0;
+    for (uint32_t i = 0; i < req->n_iov; i++)
+        size += req->iov[i].iov_len;
+    return size;
+}
+
+/* copy up to @len bytes of the data buffers to or from @buf */
+static uint32_t vblk_iov_copy(const vblk_req_t *req,
+                              bool to_iov,
+                              void *buf,
+                              uint32_t len)
+{
+    uint8_t *p = buf;
+    for (uint32_t i = 0; i < req->n_iov && len; i++) {
+        const uint32_t n =
+            req->iov[i].iov_len < len ? req->iov[i].iov_len : len;
+        to_iov ? memcpy(req->iov[i].iov_base, p, n)
+               : memcpy(p, req->iov[i].iov_base, n);
+        p += n;
+        len -= n;
+    }
+    return p - (uint8_t *) buf;
+}
+
+/* DISCARD and WRITE_ZEROES */
+static uint8_t vblk_exec_ranges(virtio_blk_state_t *vblk, const vblk_req_t *req)
+{
+    struct vblk_req_range ranges[VBLK_RANGE_MAX];
+    const uint64_t size = vblk_iov_size(req);
+    if (!size || size % sizeof(ranges[0]) || size > sizeof(ranges))
+        return VIRTIO_BLK_S_IOERR;
+    vblk_iov_copy(req, false, ranges, size);
+
+    const uint64_t capacity = VBLK_PRIV(vblk)->capacity;
+    for (uint32_t i = 0; i < size / sizeof(ranges[0]); i++) {
+        const uint64_t sector = ranges[i].sector;
+        const uint32_t n = ranges[i].num_sectors;
+        if (n > VBLK_RANGE_SECTORS_MAX || sector > capacity ||
+            n > capacity - sector)
+            return VIRTIO_BLK_S_IOERR;
+        if (vblk_disk_zero(vblk, req->type == VIRTIO_BLK_T_DISCARD,
+                           (uint64_t) n * DISK_BLK_SIZE,
+                           sector * DISK_BLK_SIZE)) {
+            rv_log_error("Zeroing block device failed: %s", strerror(errno));
+            return VIRTIO_BLK_S_IOERR;
+        }
+    }
+    return VIRTIO_BLK_S_OK;
+}
+
+/* Run @req on the disk, on the vCPU or on the I/O worker, and return its
+ * status. The length of the data written to the guest is left in @req.
+ */
+static uint8_t vblk_exec(virtio_blk_state_t *vblk, vblk_req_t *req)
+{
+    const bool readonly = vblk->device_features & VIRTIO_BLK_F_RO;
+    req->len = 0;
+
+    switch (req->type) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT: {
+        const bool write = req->type == VIRTIO_BLK_T_OUT;
+        const uint64_t capacity = VBLK_PRIV(vblk)->capacity;
+        const uint64_t size = vblk_iov_size(req);
+
+        /* Check the sectors are within the disk, before any I/O. The length
+         * of the data read, and of the status, is reported in 32 bits.
+         */
+        if (req->sector > capacity ||
+            size > (capacity - req->sector) * DISK_BLK_SIZE ||
+            size >= UINT32_MAX)
+            return VIRTIO_BLK_S_IOERR;
+        if (write && readonly) {
+            rv_log_error("Fail to write on a read only block device");
+            return VIRTIO_BLK_S_IOERR;
+        }
+        if (vblk_disk_rw(vblk, write, req->iov, req->n_iov,
+                         req->sector * DISK_BLK_SIZE)) {
+            rv_log_error("I/O on block device failed: %s", strerror(errno));
+            return VIRTIO_BLK_S_IOERR;
+        }
+        if (!write)
+            req->len = size;
+        return VIRTIO_BLK_S_OK;
+    }
+    case VIRTIO_BLK_T_FLUSH:
+        if (vblk_disk_flush(vblk)) {
+            rv_log_error("fsync block device failed: %s", strerror(errno));
+            return VIRTIO_BLK_S_IOERR;
+        }
+        return VIRTIO_BLK_S_OK;
+    case VIRTIO_BLK_T_DISCARD:
+    case VIRTIO_BLK_T_WRITE_ZEROES:
+        if (readonly)
+            return VIRTIO_BLK_S_IOERR;
+        return vblk_exec_ranges(vblk, req);
+    case VIRTIO_BLK_T_GET_ID: {
+        char id[VBLK_ID_LEN] = VBLK_ID;
+        req->len = vblk_iov_copy(req, true, id, sizeof(id));
+        return VIRTIO_BLK_S_OK;
+    }
+    default:
+        rv_log_error("Unsupported virtio-blk operation");
+        return VIRTIO_BLK_S_UNSUPP;
+    }
+}
+
+#if VBLK_HAVE_ASYNC
+static void *vblk_io_worker(void *arg)
+{
+    struct vblk_io *io = arg;
+
+    pthread_mutex_lock(&io->lock);
+    while (!io->quit) {
+        if (io->sq_head == io->sq_tail) {
+            pthread_cond_wait(&io->submitted, &io->lock);
+            continue;
+        }
+        const uint16_t slot = io->sq[io->sq_head++ % VBLK_REQ_MAX];
+        pthread_mutex_unlock(&io->lock);
+
+        vblk_req_t *req = &io->reqs[slot];
+        *req->status = vblk_exec(io->vblk, req);
+
+        pthread_mutex_lock(&io->lock);
+        io->cq[io->cq_tail++ % VBLK_REQ_MAX] = slot;
+        __atomic_store_n(&io->completed, true, __ATOMIC_RELEASE);
+        if (--io->n_pending == 0)
+            pthread_cond_signal(&io->idle);
+        if (io->vblk->wake)
+            io->vblk->wake(io->vblk->wake_arg);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+static struct vblk_io *vblk_io_new(virtio_blk_state_t *vblk,
+                                   int fd,
+                                   vblk_overlay_t *overlay,
+                                   bool readonly)
+{
+    struct vblk_io *io = calloc(1, sizeof(struct vblk_io));
+    if (!io)
+        return NULL;
+    io->vblk = vblk;
+    io->fd = fd;
+    io->overlay = overlay;
+    io->readonly = readonly;
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->submitted, NULL);
+    pthread_cond_init(&io->idle, NULL);
+    if (pthread_create(&io->worker, NULL, vblk_io_worker, io)) {
+        pthread_cond_destroy(&io->idle);
+        pthread_cond_destroy(&io->submitted);
+        pthread_mutex_destroy(&io->lock);
+        free(io);
+        return NULL;
+    }
+    return io;
+}
+
+/* wait for the requests in flight, and drop their completions */
+static void vblk_io_drain(struct vblk_io *io)
+{
+    pthread_mutex_lock(&io->lock);
+    while (io->n_pending)
+        pthread_cond_wait(&io->idle, &io->lock);
+    io->cq_head = io->cq_tail;
+    __atomic_store_n(&io->completed, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&io->lock);
+    memset(io->inflight, 0, sizeof(io->inflight));
+}
+
+/* wait for the requests in flight, keeping their completions */
+static void vblk_io_wait(struct vblk_io *io)
+{
+    pthread_mutex_lock(&io->lock);
+    while (io->n_pending)
+        pthread_cond_wait(&io->idle, &io->lock);
+    pthread_mutex_unlock(&io->lock);
+}
+
+/* complete the requests in flight, write the disk back and close it */
+static void vblk_io_delete(struct vblk_io *io)
+{
+    vblk_io_drain(io);
+    pthread_mutex_lock(&io->lock);
+    io->quit = true;
+    pthread_cond_signal(&io->submitted);
+    pthread_mutex_unlock(&io->lock);
+    pthread_join(io->worker, NULL);
+
+    if (io->overlay) {
+        if (!io->readonly && vblk_overlay_sync(io->overlay) == -1)
+            rv_log_error("fsync overlay failed: %s", strerror(errno));
+        vblk_overlay_close(io->overlay);
+    } else if (!io->readonly && fsync(io->fd) == -1) {
+        rv_log_error("fsync block device failed: %s", strerror(errno));
+    }
+    close(io->fd);
+    for (uint32_t i = 0; i < VBLK_REQ_MAX; i++)
+        free(io->iovs[i]);
+    pthread_cond_destroy(&io->idle);
+    pthread_cond_destroy(&io->submitted);
+    pthread_mutex_destroy(&io->lock);
+    free(io);
+}
+
+/* hand @req over to the I/O worker, and return 0 or -1 on failure */
+static int vblk_io_submit(virtio_blk_state_t *vblk, const vblk_req_t *req)
+{
+    struct vblk_io *io = vblk->io;
+    const uint16_t slot = vblk_io_slot(req->queue_idx, req->desc_idx);
+    assert(!vblk_io_inflight(io, slot));
+
+    /* the buffers are copied, as @req only lives until the notification is
+     * handled
+     */
+    if (!io->iovs[slot]) {
+        io->iovs[slot] = malloc(sizeof(struct iovec) * VBLK_IOV_MAX);
+        if (!io->iovs[slot])
+            return -1;
+    }
+    memcpy(io->iovs[slot], req->iov, sizeof(struct iovec) * req->n_iov);
+    io->reqs[slot] = *req;
+    io->reqs[slot].iov = io->iovs[slot];
+
+    io->inflight[slot / 64] |= 1ULL << (slot % 64);
+    pthread_mutex_lock(&io->lock);
+    io->sq[io->sq_tail++ % VBLK_REQ_MAX] = slot;
+    io->n_pending++;
+    pthread_cond_signal(&io->submitted);
+    pthread_mutex_unlock(&io->lock);
+    return 0;
+}
+#endif /* VBLK_HAVE_ASYNC */
+
 static void virtio_blk_set_fail(virtio_blk_state_t *vblk)
 {
     vblk->status |= VIRTIO_STATUS_DEVICE_NEEDS_RESET;
@@ -109,128 +601,118 @@ static void virtio_blk_update_status(virtio_blk_state_t *vblk, uint32_t status)
         return;
 
     /* Reset */
+#if VBLK_HAVE_ASYNC
+    if (vblk->io)
+        vblk_io_drain(vblk->io);
+#endif
     uint32_t device_features = vblk->device_features;
     uint32_t *ram = vblk->ram;
     uint32_t *disk = vblk->disk;
     uint64_t disk_size = vblk->disk_size;
     int disk_fd = vblk->disk_fd;
+    void (*wake)(void *arg) = vblk->wake;
+    void *wake_arg = vblk->wake_arg;
+    struct vblk_io *io = vblk->io;
     void *priv = vblk->priv;
-    uint32_t capacity = VBLK_PRIV(vblk)->capacity;
+    uint64_t capacity = VBLK_PRIV(vblk)->capacity;
     memset(vblk, 0, sizeof(*vblk));
     vblk->device_features = device_features;
     vblk->ram = ram;
     vblk->disk = disk;
     vblk->disk_size = disk_size;
     vblk->disk_fd = disk_fd;
+    vblk->wake = wake;
+    vblk->wake_arg = wake_arg;
+    vblk->io = io;
     vblk->priv = priv;
     VBLK_PRIV(vblk)->capacity = capacity;
 }
 
-static void virtio_blk_write_handler(virtio_blk_state_t *vblk,
-                                     uint64_t sector,
-                                     uint64_t desc_addr,
-                                     uint32_t len)
+/* Gather the descriptor chain headed by @desc_idx into @req, and return 0,
+ * or -1 if the chain is malformed. A request consists of:
+ *   le32 type, le32 reserved and le64 sector, in the first descriptor
+ *   u8 data[], in any number of descriptors
+ *   u8 status, the last byte of the last descriptor
+ */
+static int virtio_blk_gather(virtio_blk_state_t *vblk,
+                             const virtio_blk_queue_t *queue,
+                             uint16_t desc_idx,
+                             vblk_req_t *req)
 {
-    void *dest = (void *) ((uintptr_t) vblk->disk + sector * DISK_BLK_SIZE);
-    const void *src = (void *) ((uintptr_t) vblk->ram + desc_addr);
-    memcpy(dest, src, len);
-}
+    /* the header takes the first buffer, followed by the data */
+    struct iovec iov[VBLK_IOV_MAX + 1];
+    const virtq_t vq = VIRTQ(vblk->ram, queue);
+    int n_write;
+    const int n = virtq_gather(&vq, desc_idx, iov, ARRAY_SIZE(iov), &n_write);
+    if (n < 2 || n_write == n || !n_write ||
+        iov[0].iov_len < offsetof(struct vblk_req_header, status))
+        return -1;
+    const struct vblk_req_header *header = iov[0].iov_base;
+    req->n_iov = n - 1;
+    memcpy(req->iov, &iov[1], sizeof(struct iovec) * req->n_iov);
 
-static void virtio_blk_read_handler(virtio_blk_state_t *vblk,
-                                    uint64_t sector,
-                                    uint64_t desc_addr,
-                                    uint32_t len)
-{
-    void *dest = (void *) ((uintptr_t) vblk->ram + desc_addr);
-    const void *src =
-        (void *) ((uintptr_t) vblk->disk + sector * DISK_BLK_SIZE);
-    memcpy(dest, src, len);
+    /* The status is written by the device */
+    struct iovec *last = &req->iov[req->n_iov - 1];
+    if (!last->iov_len)
+        return -1;
+    req->status = (uint8_t *) last->iov_base + --last->iov_len;
+    if (!last->iov_len)
+        req->n_iov--;
+
+    req->type = header->type;
+    req->sector = header->sector;
+    return 0;
 }
 
+/* Return 0 if the request is completed, 1 if it is in flight on the I/O
+ * worker, or -1 on failure.
+ */
 static int virtio_blk_desc_handler(virtio_blk_state_t *vblk,
                                    const virtio_blk_queue_t *queue,
                                    uint16_t desc_idx,
                                    uint32_t *plen)
 {
-    /* A full virtio_blk_req is represented by 3 descriptors, where
-     * the first descriptor contains:
-     *   le32 type
-     *   le32 reserved
-     *   le64 sector
-     * the second descriptor contains:
-     *   u8 data[][512]
-     * the third descriptor contains:
-     *   u8 status
-     */
-    struct virtq_desc vq_desc[3];
-
-    /* Collect the descriptors */
-    for (int i = 0; i < 3; i++) {
-        /* The size of the `struct virtq_desc` is 4 words */
-        const struct virtq_desc *desc =
-            (struct virtq_desc *) &vblk->ram[queue->queue_desc + desc_idx * 4];
-
-        /* Retrieve the fields of current descriptor */
-        vq_desc[i].addr = desc->addr;
-        vq_desc[i].len = desc->len;
-        vq_desc[i].flags = desc->flags;
-        desc_idx = desc->next;
-    }
+    struct iovec iov[VBLK_IOV_MAX];
+    vblk_req_t req = {
+        .queue_idx = queue - vblk->queues,
+        .desc_idx = desc_idx,
+        .iov = iov,
+    };
 
-    /* The next flag for the first and second descriptors should be set,
-     * whereas for the third descriptor is should not be set
-     */
-    if (!(vq_desc[0].flags & VIRTIO_DESC_F_NEXT) ||
-        !(vq_desc[1].flags & VIRTIO_DESC_F_NEXT) ||
-        (vq_desc[2].flags & VIRTIO_DESC_F_NEXT)) {
-        /* since the descriptor list is abnormal, we don't write the status
-         * back here */
-        virtio_blk_set_fail(vblk);
+#if VBLK_HAVE_ASYNC
+    /* the driver made the chain available again before it was used */
+    if (vblk->io && desc_idx < VBLK_QUEUE_NUM_MAX &&
+        vblk_io_inflight(vblk->io, vblk_io_slot(req.queue_idx, desc_idx))) {
+        rv_log_error("virtio-blk request reused while in flight");
         return -1;
     }
+#endif
 
-    /* Process the header */
-    const struct vblk_req_header *header =
-        (struct vblk_req_header *) ((uintptr_t) vblk->ram + vq_desc[0].addr);
-    uint32_t type = header->type;
-    uint64_t sector = header->sector;
-    uint8_t *status = (uint8_t *) ((uintptr_t) vblk->ram + vq_desc[2].addr);
-
-    /* Check sector index is valid */
-    if (sector > (VBLK_PRIV(vblk)->capacity - 1)) {
-        *status = VIRTIO_BLK_S_IOERR;
+    /* since the descriptor list is abnormal, we don't write the status back
+     * here
+     */
+    if (virtio_blk_gather(vblk, queue, desc_idx, &req))
         return -1;
-    }
 
-    /* Process the data */
-    switch (type) {
-    case VIRTIO_BLK_T_IN:
-        virtio_blk_read_handler(vblk, sector, vq_desc[1].addr, vq_desc[1].len);
-        break;
-    case VIRTIO_BLK_T_OUT:
-        if (vblk->device_features & VIRTIO_BLK_F_RO) { /* readonly */
-            rv_log_error("Fail to write on a read only block device");
-            *status = VIRTIO_BLK_S_IOERR;
-            return -1;
-        }
-        virtio_blk_write_handler(vblk, sector, vq_desc[1].addr, vq_desc[1].len);
-        break;
-    default:
-        rv_log_error("Unsupported virtio-blk operation");
-        *status = VIRTIO_BLK_S_UNSUPP;
-        return -1;
+#if VBLK_HAVE_ASYNC
+    if (vblk->io) {
+        if (!vblk_io_submit(vblk, &req))
+            return 1;
+        rv_log_error("Fail to submit a virtio-blk request");
+        *req.status = VIRTIO_BLK_S_IOERR;
+        *plen = 1;
+        return 0;
     }
+#endif
 
-    /* Return the device status */
-    *status = VIRTIO_BLK_S_OK;
-    *plen = vq_desc[1].len;
-
+    /* Return the device status, written last */
+    *req.status = vblk_exec(vblk, &req);
+    *plen = req.len + 1;
     return 0;
 }
 
 static void virtio_queue_notify_handler(virtio_blk_state_t *vblk, int index)
 {
-    uint32_t *ram = vblk->ram;
     virtio_blk_queue_t *queue = &vblk->queues[index];
     if (vblk->status & VIRTIO_STATUS_DEVICE_NEEDS_RESET)
         return;
@@ -238,61 +720,113 @@ static void virtio_queue_notify_handler(virtio_blk_state_t *vblk, int index)
     if (!((vblk->status & VIRTIO_STATUS_DRIVER_OK) && queue->ready))
         return virtio_blk_set_fail(vblk);
 
-    /* Check for new buffers */
-    uint16_t new_avail = ram[queue->queue_avail] >> 16;
-    if (new_avail - queue->last_avail > (uint16_t) queue->queue_num) {
-        rv_log_error("Size check fail");
-        return virtio_blk_set_fail(vblk);
-    }
-
-    if (queue->last_avail == new_avail)
-        return;
-
-    /* Process them */
-    uint16_t new_used =
-        ram[queue->queue_used] >> 16; /* virtq_used.idx (le16) */
-    while (queue->last_avail != new_avail) {
-        /* Obtain the index in the ring buffer */
-        uint16_t queue_idx = queue->last_avail % queue->queue_num;
-
-        /* Since each buffer index occupies 2 bytes but the memory is aligned
-         * with 4 bytes, and the first element of the available queue is stored
-         * at ram[queue->queue_avail + 1], to acquire the buffer index, it
-         * requires the following array index calculation and bit shifting.
-         * Check also the `struct virtq_avail` on the spec.
-         */
-        uint16_t buffer_idx = ram[queue->queue_avail + 1 + queue_idx / 2] >>
-                              (16 * (queue_idx % 2));
-
+    /* Process the new buffers */
+    const virtq_t vq = VIRTQ(vblk->ram, queue);
+    const bool event_idx = vblk->driver_features & VIRTIO_RING_F_EVENT_IDX;
+    const uint16_t old_used = virtq_used_idx(&vq);
+    int buffer_idx;
+    while ((buffer_idx = virtq_pop_avail(&vq, &queue->last_avail)) >= 0) {
         /* Consume request from the available queue and process the data in the
          * descriptor list.
          */
         uint32_t len = 0;
         int result = virtio_blk_desc_handler(vblk, queue, buffer_idx, &len);
-        if (result != 0)
+        if (result < 0)
             return virtio_blk_set_fail(vblk);
 
-        /* Write used element information (`struct virtq_used_elem`) to the used
-         * queue */
-        uint32_t vq_used_addr =
-            queue->queue_used + 1 + (new_used % queue->queue_num) * 2;
-        ram[vq_used_addr] = buffer_idx; /* virtq_used_elem.id  (le32) */
-        ram[vq_used_addr + 1] = len;    /* virtq_used_elem.len (le32) */
-        queue->last_avail++;
-        new_used++;
+        /* the used element is written on completion, see virtio_blk_poll() */
+        if (result > 0) {
+            queue->n_inflight++;
+            continue;
+        }
+
+        virtq_push_used(&vq, buffer_idx, len);
     }
+    if (buffer_idx < -1)
+        return virtio_blk_set_fail(vblk);
 
-    /* Check le32 len field of `struct virtq_used_elem` on the spec  */
-    vblk->ram[queue->queue_used] &= MASK(16); /* Reset low 16 bits to zero */
-    vblk->ram[queue->queue_used] |= ((uint32_t) new_used) << 16; /* len */
+    /* Ask for a notification of the next buffer, unless requests are in
+     * flight: the buffers added meanwhile are then taken on their completion.
+     */
+    if (event_idx)
+        virtq_set_avail_event(&vq,
+                              queue->last_avail - (queue->n_inflight ? 1 : 0));
 
-    /* Send interrupt, unless VIRTQ_AVAIL_F_NO_INTERRUPT is set */
-    if (!(ram[queue->queue_avail] & 1))
+    if (virtq_need_interrupt(&vq, event_idx, old_used))
         vblk->interrupt_status |= VIRTIO_INT_USED_RING;
 }
 
+#if VBLK_HAVE_ASYNC
+bool virtio_blk_poll(virtio_blk_state_t *vblk)
+{
+    struct vblk_io *io = vblk->io;
+    if (!io || !__atomic_load_n(&io->completed, __ATOMIC_ACQUIRE))
+        return false;
+
+    uint16_t old_used[VBLK_QUEUE_CNT];
+    for (uint32_t i = 0; i < ARRAY_SIZE(vblk->queues); i++)
+        old_used[i] = vblk->ram[vblk->queues[i].queue_used] >> 16;
+
+    pthread_mutex_lock(&io->lock);
+    __atomic_store_n(&io->completed, false, __ATOMIC_RELAXED);
+    uint32_t used_queues = 0;
+    while (io->cq_head != io->cq_tail) {
+        const uint16_t slot = io->cq[io->cq_head++ % VBLK_REQ_MAX];
+        const vblk_req_t *req = &io->reqs[slot];
+        io->inflight[slot / 64] &= ~(1ULL << (slot % 64));
+        virtio_blk_queue_t *queue = &vblk->queues[req->queue_idx];
+        const virtq_t vq = VIRTQ(vblk->ram, queue);
+        virtq_push_used(&vq, req->desc_idx, req->len + 1);
+        queue->n_inflight--;
+        used_queues |= 1 << req->queue_idx;
+    }
+    pthread_mutex_unlock(&io->lock);
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(vblk->queues); i++) {
+        if (!(used_queues & (1 << i)))
+            continue;
+        /* take the buffers added without notification, see above */
+        if ((vblk->driver_features & VIRTIO_RING_F_EVENT_IDX) &&
+            vblk->queues[i].ready)
+            virtio_queue_notify_handler(vblk, i);
+        const virtq_t vq = VIRTQ(vblk->ram, &vblk->queues[i]);
+        if (virtq_need_interrupt(
+                &vq, vblk->driver_features & VIRTIO_RING_F_EVENT_IDX,
+                old_used[i]))
+            vblk->interrupt_status |= VIRTIO_INT_USED_RING;
+    }
+    return used_queues;
+}
+
+bool virtio_blk_quiesce(virtio_blk_state_t *vblk)
+{
+    if (!vblk->io)
+        return false;
+
+    /* the completions may hand the worker the buffers added meanwhile */
+    bool used = false;
+    for (;;) {
+        vblk_io_wait(vblk->io);
+        if (!virtio_blk_poll(vblk))
+            return used;
+        used = true;
+    }
+}
+#else
+bool virtio_blk_poll(virtio_blk_state_t *vblk UNUSED)
+{
+    return false;
+}
+
+bool virtio_blk_quiesce(virtio_blk_state_t *vblk UNUSED)
+{
+    return false;
+}
+#endif
+
 uint32_t virtio_blk_read(virtio_blk_state_t *vblk, uint32_t addr)
 {
+    const uint32_t shift = 8 * (addr & 0b11);
     addr = addr >> 2;
 #define _(reg) VIRTIO_##reg
     switch (addr) {
@@ -319,8 +853,10 @@ uint32_t virtio_blk_read(virtio_blk_state_t *vblk, uint32_t addr)
     case _(ConfigGeneration):
         return VIRTIO_CONFIG_GENERATE;
     default:
-        /* Read configuration from the corresponding register */
-        return ((uint32_t *) VBLK_PRIV(vblk))[addr - _(Config)];
+        /* Read configuration from the corresponding register, whose fields
+         * narrower than a word are read by the smaller loads.
+         */
+        return ((uint32_t *) VBLK_PRIV(vblk))[addr - _(Config)] >> shift;
     }
 #undef _
 }
@@ -399,7 +935,9 @@ void virtio_blk_write(virtio_blk_state_t *vblk, uint32_t addr, uint32_t value)
 
 uint32_t *virtio_blk_init(virtio_blk_state_t *vblk,
                           char *disk_file,
-                          bool readonly)
+                          const char *overlay_file,
+                          bool readonly,
+                          bool async)
 {
     if (vblk_dev_cnt >= VBLK_DEV_CNT_MAX) {
         rv_log_error(
@@ -424,8 +962,9 @@ uint32_t *virtio_blk_init(virtio_blk_state_t *vblk,
         return NULL;
     }
 
-    /* Open disk file */
-    int disk_fd = open(disk_file, readonly ? O_RDONLY : O_RDWR);
+    /* Open disk file, which is left unmodified below an overlay */
+    int disk_fd =
+        open(disk_file, readonly || overlay_file ? O_RDONLY : O_RDWR);
     if (disk_fd < 0) {
         rv_log_error("Could not open %s: %s", disk_file, strerror(errno));
         goto fail;
@@ -475,8 +1014,29 @@ uint32_t *virtio_blk_init(virtio_blk_state_t *vblk,
     }
     VBLK_PRIV(vblk)->disk_size = disk_size;
 
-    /* Set up the disk memory */
-    uint32_t *disk_mem;
+    /* Set up the disk memory, unless the disk is accessed by the I/O worker */
+    uint32_t *disk_mem = NULL;
+    if (async || overlay_file) {
+#if VBLK_HAVE_ASYNC
+        /* the overlay is only accessed by the I/O worker */
+        vblk_overlay_t *overlay = NULL;
+        if (overlay_file) {
+            overlay = vblk_overlay_open(overlay_file, disk_fd, disk_size);
+            if (!overlay)
+                goto disk_size_fail;
+        }
+        vblk->io = vblk_io_new(vblk, disk_fd, overlay, readonly);
+        if (!vblk->io)
+            goto disk_mem_err;
+        goto disk_ok;
+#else
+        if (overlay_file) {
+            rv_log_error("Overlay is not supported");
+            goto disk_size_fail;
+        }
+        rv_log_warn("Asynchronous block device is not supported");
+#endif
+    }
 #if HAVE_MMAP
     disk_mem = mmap(NULL, VBLK_PRIV(vblk)->disk_size,
                     readonly ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED,
@@ -515,9 +1075,19 @@ disk_mem_ok:
     assert(!(((uintptr_t) disk_mem) & 0b11));
 
     vblk->disk = disk_mem;
+
+disk_ok:
     VBLK_PRIV(vblk)->capacity =
         (VBLK_PRIV(vblk)->disk_size - 1) / DISK_BLK_SIZE + 1;
 
+    VBLK_PRIV(vblk)->seg_max = VBLK_SEG_MAX;
+    VBLK_PRIV(vblk)->num_queues = VBLK_QUEUE_CNT;
+    VBLK_PRIV(vblk)->max_discard_sectors = VBLK_RANGE_SECTORS_MAX;
+    VBLK_PRIV(vblk)->max_discard_seg = VBLK_RANGE_MAX;
+    VBLK_PRIV(vblk)->discard_sector_alignment = 1;
+    VBLK_PRIV(vblk)->max_write_zeroes_sectors = VBLK_RANGE_SECTORS_MAX;
+    VBLK_PRIV(vblk)->max_write_zeroes_seg = VBLK_RANGE_MAX;
+
     if (readonly)
         vblk->device_features = VIRTIO_BLK_F_RO;
 
@@ -542,11 +1112,15 @@ virtio_blk_state_t *vblk_new()
 
 void vblk_delete(virtio_blk_state_t *vblk)
 {
+#if VBLK_HAVE_ASYNC
+    if (vblk->io)
+        vblk_io_delete(vblk->io);
+#endif
     /* mmap_fallback is used */
     if (vblk->disk_fd != -1)
         free(vblk->disk);
 #if HAVE_MMAP
-    else
+    else if (vblk->disk)
         munmap(vblk->disk, VBLK_PRIV(vblk)->disk_size);
 #endif
     free(vblk);
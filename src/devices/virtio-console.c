@@ -0,0 +1,479 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "virtio-queue.h"
+#include "virtio.h"
+
+/* Unlike the 8250 UART, which takes a system call per byte, the console
+ * moves the bytes by whole buffers: the output of the driver is gathered in
+ * a host buffer, written out once per poll or whenever it is full, and the
+ * input is read by chunks straight into the buffers of the driver.
+ */
+
+#define VCON_FEATURES_0 (VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_RING_F_EVENT_IDX)
+#define VCON_FEATURES_1 1 /* VIRTIO_F_VERSION_1 */
+#define VCON_QUEUE_NUM_MAX 64
+#define VCON_QUEUE (vcon->queues[vcon->queue_sel])
+#define VCON_RX_QUEUE 0
+#define VCON_TX_QUEUE 1
+
+/* host buffer of the output, written out when full */
+#ifndef VCON_OUT_BUF_SIZE
+#define VCON_OUT_BUF_SIZE 4096
+#endif
+
+/* input read from the host at once */
+#define VCON_IN_BUF_SIZE 256
+
+/* buffers of a descriptor chain */
+#define VCON_IOV_MAX 64
+
+#define VCON_PRIV(x) ((vcon_priv_t *) x->priv)
+
+PACKED(struct virtio_console_config {
+    uint16_t cols;
+    uint16_t rows;
+    uint32_t max_nr_ports;
+    uint32_t emerg_wr;
+});
+
+typedef struct {
+    struct virtio_console_config config;
+    /* output of the driver, not written out yet */
+    uint32_t out_len;
+    uint8_t out_buf[VCON_OUT_BUF_SIZE];
+    /* input of the host, waiting for a receive buffer */
+    uint32_t in_start, in_len;
+    uint8_t in_buf[VCON_IN_BUF_SIZE];
+    /* the last input byte was Ctrl-a */
+    bool in_escape;
+    bool in_eof; /* the host has no more input */
+} vcon_priv_t;
+
+static void virtio_console_set_fail(virtio_console_state_t *vcon)
+{
+    vcon->status |= VIRTIO_STATUS_DEVICE_NEEDS_RESET;
+    if (vcon->status & VIRTIO_STATUS_DRIVER_OK)
+        vcon->interrupt_status |= VIRTIO_INT_CONF_CHANGE;
+}
+
+static inline uint32_t vcon_preprocess(virtio_console_state_t *vcon,
+                                       uint32_t addr)
+{
+    if ((addr >= MEM_SIZE) || (addr & 0b11)) {
+        virtio_console_set_fail(vcon);
+        return 0;
+    }
+
+    return addr >> 2;
+}
+
+static void virtio_console_update_status(virtio_console_state_t *vcon,
+                                         uint32_t status)
+{
+    vcon->status |= status;
+    if (status)
+        return;
+
+    /* Reset, the output already given by the driver is kept */
+    uint32_t *ram = vcon->ram;
+    int in_fd = vcon->in_fd, out_fd = vcon->out_fd;
+    uint32_t device_features = vcon->device_features;
+    void *priv = vcon->priv;
+    memset(vcon, 0, sizeof(*vcon));
+    vcon->ram = ram;
+    vcon->in_fd = in_fd;
+    vcon->out_fd = out_fd;
+    vcon->device_features = device_features;
+    vcon->priv = priv;
+}
+
+/* Gather the descriptor chain headed by @desc_idx into @iov, see
+ * virtq_gather(), and return the number of buffers, or -1 if the chain is
+ * malformed or its buffers are not all @write ones.
+ */
+static int vcon_gather(virtio_console_state_t *vcon,
+                       const virtio_console_queue_t *queue,
+                       uint16_t desc_idx,
+                       struct iovec *iov,
+                       bool write)
+{
+    const virtq_t vq = VIRTQ(vcon->ram, queue);
+    int n_write;
+    const int n = virtq_gather(&vq, desc_idx, iov, VCON_IOV_MAX, &n_write);
+    if (n < 0 || n_write != (write ? n : 0))
+        return -1;
+    return n;
+}
+
+/* Whether @queue holds a buffer not taken yet */
+static bool vcon_has_avail(const virtio_console_state_t *vcon,
+                           const virtio_console_queue_t *queue)
+{
+    const virtq_t vq = VIRTQ(vcon->ram, queue);
+    return virtq_has_avail(&vq, queue->last_avail);
+}
+
+/* Take the next buffer of @queue, and return its index, or -1 if none */
+static int vcon_pop_avail(virtio_console_state_t *vcon,
+                          virtio_console_queue_t *queue)
+{
+    const virtq_t vq = VIRTQ(vcon->ram, queue);
+    const int desc_idx = virtq_pop_avail(&vq, &queue->last_avail);
+    if (desc_idx < -1) {
+        virtio_console_set_fail(vcon);
+        return -1;
+    }
+    return desc_idx;
+}
+
+static void vcon_push_used(virtio_console_state_t *vcon,
+                           const virtio_console_queue_t *queue,
+                           uint16_t desc_idx,
+                           uint32_t len)
+{
+    const virtq_t vq = VIRTQ(vcon->ram, queue);
+    virtq_push_used(&vq, desc_idx, len);
+}
+
+/* Ask for a notification of the next buffer, see VIRTIO_F_EVENT_IDX */
+static void vcon_update_avail_event(virtio_console_state_t *vcon,
+                                    const virtio_console_queue_t *queue)
+{
+    if (!(vcon->driver_features & VIRTIO_RING_F_EVENT_IDX))
+        return;
+    const virtq_t vq = VIRTQ(vcon->ram, queue);
+    virtq_set_avail_event(&vq, queue->last_avail);
+}
+
+/* Whether to interrupt the driver once the used index moved from @old_used */
+static bool vcon_need_interrupt(virtio_console_state_t *vcon,
+                                const virtio_console_queue_t *queue,
+                                uint16_t old_used)
+{
+    const virtq_t vq = VIRTQ(vcon->ram, queue);
+    return virtq_need_interrupt(
+        &vq, vcon->driver_features & VIRTIO_RING_F_EVENT_IDX, old_used);
+}
+
+void virtio_console_flush(virtio_console_state_t *vcon)
+{
+    vcon_priv_t *priv = VCON_PRIV(vcon);
+    const uint8_t *p = priv->out_buf;
+    uint32_t left = priv->out_len;
+    while (left) {
+        const ssize_t n = write(vcon->out_fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            rv_log_error("Failed to write console output: %s",
+                         strerror(errno));
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+    priv->out_len = 0;
+}
+
+/* Take the output of the transmit @queue into the host buffer. The buffers
+ * are returned at once, since the driver waits for them.
+ */
+static void vcon_tx(virtio_console_state_t *vcon,
+                    virtio_console_queue_t *queue)
+{
+    vcon_priv_t *priv = VCON_PRIV(vcon);
+    struct iovec iov[VCON_IOV_MAX];
+    int desc_idx;
+    while ((desc_idx = vcon_pop_avail(vcon, queue)) >= 0) {
+        const int n = vcon_gather(vcon, queue, desc_idx, iov, false);
+        if (n < 0)
+            return virtio_console_set_fail(vcon);
+
+        for (int i = 0; i < n; i++) {
+            const uint8_t *src = iov[i].iov_base;
+            size_t left = iov[i].iov_len;
+            while (left) {
+                if (priv->out_len == sizeof(priv->out_buf))
+                    virtio_console_flush(vcon);
+                uint32_t chunk = sizeof(priv->out_buf) - priv->out_len;
+                if (chunk > left)
+                    chunk = left;
+                memcpy(priv->out_buf + priv->out_len, src, chunk);
+                priv->out_len += chunk;
+                src += chunk;
+                left -= chunk;
+            }
+        }
+        vcon_push_used(vcon, queue, desc_idx, 0);
+    }
+}
+
+/* Read the input of the host if any, and return false if there is none */
+static bool vcon_read_input(virtio_console_state_t *vcon)
+{
+    vcon_priv_t *priv = VCON_PRIV(vcon);
+    struct pollfd pfd = {vcon->in_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+        return false;
+
+    const ssize_t n = read(vcon->in_fd, priv->in_buf, sizeof(priv->in_buf));
+    if (n <= 0) {
+        if (n < 0)
+            rv_log_error("Failed to read console input: %s",
+                         strerror(errno));
+        else
+            priv->in_eof = true;
+        return false;
+    }
+    priv->in_start = 0;
+    priv->in_len = n;
+
+    /* Ctrl-a x quits, as it does with the UART */
+    for (ssize_t i = 0; i < n; i++) {
+        if (priv->in_escape && priv->in_buf[i] == 'x') {
+            virtio_console_flush(vcon);
+            rv_log_info("RISC-V emulator is destroyed");
+            exit(EXIT_SUCCESS);
+        }
+        priv->in_escape = priv->in_buf[i] == 1;
+
+#if RV32_HAS(SDL) && RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+        /* Trap Ctrl-c to destroy the SDL window, see u8250_handle_in() */
+        extern void sdl_video_audio_cleanup();
+        if (priv->in_buf[i] == 3)
+            sdl_video_audio_cleanup();
+#endif
+    }
+    return true;
+}
+
+/* Pass the input of the host to the buffers of the receive queue */
+static void vcon_rx(virtio_console_state_t *vcon)
+{
+    vcon_priv_t *priv = VCON_PRIV(vcon);
+    virtio_console_queue_t *queue = &vcon->queues[VCON_RX_QUEUE];
+    if (!(vcon->status & VIRTIO_STATUS_DRIVER_OK) ||
+        (vcon->status & VIRTIO_STATUS_DEVICE_NEEDS_RESET) || !queue->ready)
+        return;
+
+    /* the host is not polled until the driver has room for its input */
+    const uint16_t old_used = vcon->ram[queue->queue_used] >> 16;
+    struct iovec iov[VCON_IOV_MAX];
+    while (vcon_has_avail(vcon, queue) &&
+           (priv->in_len || (!priv->in_eof && vcon_read_input(vcon)))) {
+        const int desc_idx = vcon_pop_avail(vcon, queue);
+        const int n = vcon_gather(vcon, queue, desc_idx, iov, true);
+        if (n < 0)
+            return virtio_console_set_fail(vcon);
+
+        uint32_t len = 0;
+        for (int i = 0; i < n && priv->in_len; i++) {
+            const uint32_t chunk =
+                iov[i].iov_len < priv->in_len ? iov[i].iov_len : priv->in_len;
+            memcpy(iov[i].iov_base, priv->in_buf + priv->in_start, chunk);
+            priv->in_start += chunk;
+            priv->in_len -= chunk;
+            len += chunk;
+        }
+        vcon_push_used(vcon, queue, desc_idx, len);
+    }
+
+    vcon_update_avail_event(vcon, queue);
+    if (vcon_need_interrupt(vcon, queue, old_used))
+        vcon->interrupt_status |= VIRTIO_INT_USED_RING;
+}
+
+static void virtio_console_queue_notify_handler(virtio_console_state_t *vcon,
+                                                int index)
+{
+    virtio_console_queue_t *queue = &vcon->queues[index];
+    if (vcon->status & VIRTIO_STATUS_DEVICE_NEEDS_RESET)
+        return;
+
+    if (!((vcon->status & VIRTIO_STATUS_DRIVER_OK) && queue->ready))
+        return virtio_console_set_fail(vcon);
+
+    /* the input waits for the next poll */
+    if (index == VCON_RX_QUEUE)
+        return;
+
+    const uint16_t old_used = vcon->ram[queue->queue_used] >> 16;
+    vcon_tx(vcon, queue);
+    vcon_update_avail_event(vcon, queue);
+    if (vcon_need_interrupt(vcon, queue, old_used))
+        vcon->interrupt_status |= VIRTIO_INT_USED_RING;
+}
+
+int virtio_console_wait_fd(virtio_console_state_t *vcon)
+{
+    const vcon_priv_t *priv = VCON_PRIV(vcon);
+    return priv->in_len || priv->in_eof ? -1 : vcon->in_fd;
+}
+
+bool virtio_console_poll(virtio_console_state_t *vcon)
+{
+    const uint32_t interrupt_status = vcon->interrupt_status;
+    if (VCON_PRIV(vcon)->out_len)
+        virtio_console_flush(vcon);
+    vcon_rx(vcon);
+    return vcon->interrupt_status != interrupt_status;
+}
+
+uint32_t virtio_console_read(virtio_console_state_t *vcon, uint32_t addr)
+{
+    const uint32_t shift = 8 * (addr & 0b11);
+    addr = addr >> 2;
+#define _(reg) VIRTIO_##reg
+    switch (addr) {
+    case _(MagicValue):
+        return VIRTIO_MAGIC_NUMBER;
+    case _(Version):
+        return VIRTIO_VERSION;
+    case _(DeviceID):
+        return VIRTIO_CONSOLE_DEV_ID;
+    case _(VendorID):
+        return VIRTIO_VENDOR_ID;
+    case _(DeviceFeatures):
+        return vcon->device_features_sel == 0
+                   ? VCON_FEATURES_0 | vcon->device_features
+                   : (vcon->device_features_sel == 1 ? VCON_FEATURES_1 : 0);
+    case _(QueueNumMax):
+        return VCON_QUEUE_NUM_MAX;
+    case _(QueueReady):
+        return (uint32_t) VCON_QUEUE.ready;
+    case _(InterruptStatus):
+        return vcon->interrupt_status;
+    case _(Status):
+        return vcon->status;
+    case _(ConfigGeneration):
+        return VIRTIO_CONFIG_GENERATE;
+    default:
+        /* Read configuration from the corresponding register, whose fields
+         * narrower than a word are read by the smaller loads.
+         */
+        if (addr < _(Config) ||
+            addr - _(Config) >= sizeof(struct virtio_console_config) / 4)
+            return 0;
+        return ((uint32_t *) &VCON_PRIV(vcon)->config)[addr - _(Config)] >>
+               shift;
+    }
+#undef _
+}
+
+void virtio_console_write(virtio_console_state_t *vcon,
+                          uint32_t addr,
+                          uint32_t value)
+{
+    addr = addr >> 2;
+#define _(reg) VIRTIO_##reg
+    switch (addr) {
+    case _(DeviceFeaturesSel):
+        vcon->device_features_sel = value;
+        break;
+    case _(DriverFeatures):
+        vcon->driver_features_sel == 0 ? (vcon->driver_features = value) : 0;
+        break;
+    case _(DriverFeaturesSel):
+        vcon->driver_features_sel = value;
+        break;
+    case _(QueueSel):
+        if (value < ARRAY_SIZE(vcon->queues))
+            vcon->queue_sel = value;
+        else
+            virtio_console_set_fail(vcon);
+        break;
+    case _(QueueNum):
+        if (value > 0 && value <= VCON_QUEUE_NUM_MAX)
+            VCON_QUEUE.queue_num = value;
+        else
+            virtio_console_set_fail(vcon);
+        break;
+    case _(QueueReady):
+        VCON_QUEUE.ready = value & 1;
+        if (value & 1)
+            VCON_QUEUE.last_avail = vcon->ram[VCON_QUEUE.queue_avail] >> 16;
+        break;
+    case _(QueueDescLow):
+        VCON_QUEUE.queue_desc = vcon_preprocess(vcon, value);
+        break;
+    case _(QueueDescHigh):
+        if (value)
+            virtio_console_set_fail(vcon);
+        break;
+    case _(QueueDriverLow):
+        VCON_QUEUE.queue_avail = vcon_preprocess(vcon, value);
+        break;
+    case _(QueueDriverHigh):
+        if (value)
+            virtio_console_set_fail(vcon);
+        break;
+    case _(QueueDeviceLow):
+        VCON_QUEUE.queue_used = vcon_preprocess(vcon, value);
+        break;
+    case _(QueueDeviceHigh):
+        if (value)
+            virtio_console_set_fail(vcon);
+        break;
+    case _(QueueNotify):
+        if (value < ARRAY_SIZE(vcon->queues))
+            virtio_console_queue_notify_handler(vcon, value);
+        else
+            virtio_console_set_fail(vcon);
+        break;
+    case _(InterruptACK):
+        vcon->interrupt_status &= ~value;
+        break;
+    case _(Status):
+        virtio_console_update_status(vcon, value);
+        break;
+    default:
+        /* The configuration is read-only, emerg_wr is not offered */
+        break;
+    }
+#undef _
+}
+
+void virtio_console_init(virtio_console_state_t *vcon)
+{
+    vcon->priv = calloc(1, sizeof(vcon_priv_t));
+    assert(vcon->priv);
+
+    /* the size of the terminal, if the output is one */
+    struct virtio_console_config *config = &VCON_PRIV(vcon)->config;
+    struct winsize ws;
+    if (!ioctl(vcon->out_fd, TIOCGWINSZ, &ws) && ws.ws_col && ws.ws_row) {
+        config->cols = ws.ws_col;
+        config->rows = ws.ws_row;
+        vcon->device_features |= VIRTIO_CONSOLE_F_SIZE;
+    }
+    config->max_nr_ports = 1;
+}
+
+virtio_console_state_t *vcon_new()
+{
+    virtio_console_state_t *vcon = calloc(1, sizeof(virtio_console_state_t));
+    assert(vcon);
+    return vcon;
+}
+
+void vcon_delete(virtio_console_state_t *vcon)
+{
+    if (vcon->priv)
+        virtio_console_flush(vcon);
+    free(vcon->priv);
+    free(vcon);
+}
@@ -0,0 +1,549 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "virtio-queue.h"
+#include "virtio.h"
+#include "vnet-backend.h"
+
+#define VNET_FEATURES_0                                                 \
+    (VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | VIRTIO_NET_F_CTRL_VQ |   \
+     VIRTIO_NET_F_MQ | VIRTIO_RING_F_INDIRECT_DESC |                   \
+     VIRTIO_RING_F_EVENT_IDX)
+#define VNET_FEATURES_1 1 /* VIRTIO_F_VERSION_1 */
+#define VNET_QUEUE_NUM_MAX 256
+#define VNET_QUEUE (vnet->queues[vnet->queue_sel])
+#define VNET_CTRL_QUEUE (VNET_QUEUE_PAIRS * 2)
+
+/* Ethernet frame with a VLAN tag but no FCS, as no offload is offered */
+#define VNET_FRAME_MAX 1518
+
+/* frames passed to the driver per poll, which raises a single interrupt */
+#define VNET_RX_BUDGET 64
+
+/* buffers of a descriptor chain */
+#define VNET_IOV_MAX 64
+
+#define VNET_PRIV(x) ((vnet_priv_t *) x->priv)
+
+PACKED(struct virtio_net_config {
+    uint8_t mac[6];
+    uint16_t status;
+    uint16_t max_virtqueue_pairs;
+    uint16_t mtu;
+});
+
+/* precedes every frame in the buffers, see VIRTIO_F_VERSION_1 */
+PACKED(struct virtio_net_hdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    uint16_t num_buffers;
+});
+
+typedef struct {
+    struct virtio_net_config config;
+    /* frame taken from the backend, waiting for a receive buffer */
+    uint32_t rx_len;
+    uint8_t rx_frame[VNET_FRAME_MAX];
+} vnet_priv_t;
+
+static void virtio_net_set_fail(virtio_net_state_t *vnet)
+{
+    vnet->status |= VIRTIO_STATUS_DEVICE_NEEDS_RESET;
+    if (vnet->status & VIRTIO_STATUS_DRIVER_OK)
+        vnet->interrupt_status |= VIRTIO_INT_CONF_CHANGE;
+}
+
+static inline uint32_t vnet_preprocess(virtio_net_state_t *vnet,
+                                       uint32_t addr)
+{
+    if ((addr >= MEM_SIZE) || (addr & 0b11)) {
+        virtio_net_set_fail(vnet);
+        return 0;
+    }
+
+    return addr >> 2;
+}
+
+static void virtio_net_update_status(virtio_net_state_t *vnet,
+                                     uint32_t status)
+{
+    vnet->status |= status;
+    if (status)
+        return;
+
+    /* Reset */
+    uint32_t *ram = vnet->ram;
+    struct vnet_backend *backend = vnet->backend;
+    struct vnet_pcap *pcap = vnet->pcap;
+    void *priv = vnet->priv;
+    memset(vnet, 0, sizeof(*vnet));
+    vnet->ram = ram;
+    vnet->backend = backend;
+    vnet->pcap = pcap;
+    vnet->priv = priv;
+    vnet->n_pairs = 1;
+}
+
+/* Gather the descriptor chain headed by @desc_idx, see virtq_gather() */
+static int vnet_gather(virtio_net_state_t *vnet,
+                       const virtio_net_queue_t *queue,
+                       uint16_t desc_idx,
+                       struct iovec *iov,
+                       int *n_write)
+{
+    const virtq_t vq = VIRTQ(vnet->ram, queue);
+    return virtq_gather(&vq, desc_idx, iov, VNET_IOV_MAX, n_write);
+}
+
+/* Take the next buffer of @queue, and return its index, or -1 if none */
+static int vnet_pop_avail(virtio_net_state_t *vnet, virtio_net_queue_t *queue)
+{
+    const virtq_t vq = VIRTQ(vnet->ram, queue);
+    const int desc_idx = virtq_pop_avail(&vq, &queue->last_avail);
+    if (desc_idx < -1) {
+        virtio_net_set_fail(vnet);
+        return -1;
+    }
+    return desc_idx;
+}
+
+static void vnet_push_used(virtio_net_state_t *vnet,
+                           const virtio_net_queue_t *queue,
+                           uint16_t desc_idx,
+                           uint32_t len)
+{
+    const virtq_t vq = VIRTQ(vnet->ram, queue);
+    virtq_push_used(&vq, desc_idx, len);
+}
+
+/* Ask for a notification of the next buffer, see VIRTIO_F_EVENT_IDX */
+static void vnet_update_avail_event(virtio_net_state_t *vnet,
+                                    const virtio_net_queue_t *queue)
+{
+    if (!(vnet->driver_features & VIRTIO_RING_F_EVENT_IDX))
+        return;
+    const virtq_t vq = VIRTQ(vnet->ram, queue);
+    virtq_set_avail_event(&vq, queue->last_avail);
+}
+
+/* Whether to interrupt the driver once the used index moved from @old_used */
+static bool vnet_need_interrupt(virtio_net_state_t *vnet,
+                                const virtio_net_queue_t *queue,
+                                uint16_t old_used)
+{
+    const virtq_t vq = VIRTQ(vnet->ram, queue);
+    return virtq_need_interrupt(
+        &vq, vnet->driver_features & VIRTIO_RING_F_EVENT_IDX, old_used);
+}
+
+/* copy up to @len bytes of the buffers @iov to @buf, and return the count */
+static uint32_t vnet_iov_read(const struct iovec *iov,
+                              int n,
+                              void *buf,
+                              uint32_t len)
+{
+    uint8_t *p = buf;
+    for (int i = 0; i < n && len; i++) {
+        const uint32_t chunk = iov[i].iov_len < len ? iov[i].iov_len : len;
+        memcpy(p, iov[i].iov_base, chunk);
+        p += chunk;
+        len -= chunk;
+    }
+    return p - (uint8_t *) buf;
+}
+
+/* Send the frames of the transmit @queue */
+static void vnet_tx(virtio_net_state_t *vnet, virtio_net_queue_t *queue)
+{
+    struct iovec iov[VNET_IOV_MAX];
+    uint8_t frame[sizeof(struct virtio_net_hdr) + VNET_FRAME_MAX];
+    int desc_idx;
+    while ((desc_idx = vnet_pop_avail(vnet, queue)) >= 0) {
+        int n_write;
+        const int n = vnet_gather(vnet, queue, desc_idx, iov, &n_write);
+        if (n < 0 || n_write)
+            return virtio_net_set_fail(vnet);
+
+        uint32_t size = 0;
+        for (int i = 0; i < n; i++)
+            size += iov[i].iov_len;
+
+        /* the header tells no offload, hence is skipped */
+        if (size > sizeof(struct virtio_net_hdr) && size <= sizeof(frame)) {
+            vnet_iov_read(iov, n, frame, size);
+            const uint8_t *payload = frame + sizeof(struct virtio_net_hdr);
+            const uint32_t len = size - sizeof(struct virtio_net_hdr);
+            if (vnet->pcap)
+                vnet_pcap_write(vnet->pcap, payload, len);
+            vnet_backend_send(vnet->backend, payload, len);
+        }
+        vnet_push_used(vnet, queue, desc_idx, 0);
+    }
+}
+
+/* Write the frame pending in @vnet to a buffer of the receive @queue, and
+ * return false if there is none.
+ */
+static bool vnet_rx_frame(virtio_net_state_t *vnet, virtio_net_queue_t *queue)
+{
+    vnet_priv_t *priv = VNET_PRIV(vnet);
+    struct iovec iov[VNET_IOV_MAX];
+    const int desc_idx = vnet_pop_avail(vnet, queue);
+    if (desc_idx < 0)
+        return false;
+
+    int n_write;
+    const int n = vnet_gather(vnet, queue, desc_idx, iov, &n_write);
+    if (n < 0 || n_write != n) {
+        virtio_net_set_fail(vnet);
+        return false;
+    }
+
+    /* The frame is dropped if it does not fit */
+    const struct virtio_net_hdr hdr = {.num_buffers = 1};
+    const uint8_t *src[2] = {(const uint8_t *) &hdr, priv->rx_frame};
+    uint32_t left[2] = {sizeof(hdr), priv->rx_len};
+    uint32_t size = 0;
+    for (int i = 0; i < n; i++)
+        size += iov[i].iov_len;
+    if (size < sizeof(hdr) + priv->rx_len) {
+        vnet_push_used(vnet, queue, desc_idx, 0);
+        return true;
+    }
+
+    /* scatter the header, then the frame */
+    int part = 0;
+    for (int i = 0; i < n && part < 2; i++) {
+        uint8_t *dst = iov[i].iov_base;
+        uint32_t room = iov[i].iov_len;
+        while (room && part < 2) {
+            const uint32_t chunk = room < left[part] ? room : left[part];
+            memcpy(dst, src[part], chunk);
+            dst += chunk;
+            room -= chunk;
+            src[part] += chunk;
+            if (!(left[part] -= chunk))
+                part++;
+        }
+    }
+    vnet_push_used(vnet, queue, desc_idx, sizeof(hdr) + priv->rx_len);
+    return true;
+}
+
+/* The receive queue of the flow of @frame, so that its frames stay in order */
+static uint32_t vnet_rx_pair(const virtio_net_state_t *vnet,
+                             const uint8_t *frame,
+                             uint32_t len)
+{
+    if (vnet->n_pairs <= 1)
+        return 0;
+
+    /* the Ethernet addresses and type, and for IPv4 the addresses and the
+     * ports of TCP or UDP
+     */
+    uint32_t end = len < 14 ? len : 14;
+    if (len >= 38 && frame[12] == 0x08 && frame[13] == 0x00 &&
+        (frame[23] == 6 || frame[23] == 17))
+        end = 14 + (frame[14] & 0xf) * 4 + 4;
+    if (end > len)
+        end = len;
+
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    for (uint32_t i = 0; i < end; i++) {
+        if (i >= 14 && i < 26) /* the rest of the IPv4 header but addresses */
+            continue;
+        if (i >= 34 && i < end - 4)
+            continue;
+        hash = (hash ^ frame[i]) * 16777619u;
+    }
+    return hash % vnet->n_pairs;
+}
+
+/* Pass the frames of the backend to the driver */
+static void vnet_rx(virtio_net_state_t *vnet)
+{
+    vnet_priv_t *priv = VNET_PRIV(vnet);
+    if (!(vnet->status & VIRTIO_STATUS_DRIVER_OK) ||
+        (vnet->status & VIRTIO_STATUS_DEVICE_NEEDS_RESET))
+        return;
+
+    uint16_t old_used[VNET_QUEUE_PAIRS];
+    for (uint32_t i = 0; i < VNET_QUEUE_PAIRS; i++)
+        old_used[i] = vnet->ram[vnet->queues[2 * i].queue_used] >> 16;
+
+    for (int budget = VNET_RX_BUDGET; budget; budget--) {
+        if (!priv->rx_len) {
+            priv->rx_len = vnet_backend_recv(vnet->backend, priv->rx_frame,
+                                             sizeof(priv->rx_frame));
+            if (!priv->rx_len)
+                break;
+            if (vnet->pcap)
+                vnet_pcap_write(vnet->pcap, priv->rx_frame, priv->rx_len);
+        }
+
+        const uint32_t pair =
+            vnet_rx_pair(vnet, priv->rx_frame, priv->rx_len);
+        virtio_net_queue_t *queue = &vnet->queues[2 * pair];
+        if (!queue->ready || !vnet_rx_frame(vnet, queue))
+            break;
+        priv->rx_len = 0;
+    }
+
+    for (uint32_t i = 0; i < VNET_QUEUE_PAIRS; i++) {
+        const virtio_net_queue_t *queue = &vnet->queues[2 * i];
+        if (!queue->ready)
+            continue;
+        vnet_update_avail_event(vnet, queue);
+        if (vnet_need_interrupt(vnet, queue, old_used[i]))
+            vnet->interrupt_status |= VIRTIO_INT_USED_RING;
+    }
+}
+
+/* Run the commands of the control queue: only the number of queue pairs is
+ * set, and the others fail.
+ */
+static void vnet_ctrl(virtio_net_state_t *vnet, virtio_net_queue_t *queue)
+{
+    struct iovec iov[VNET_IOV_MAX];
+    int desc_idx;
+    while ((desc_idx = vnet_pop_avail(vnet, queue)) >= 0) {
+        int n_write;
+        const int n = vnet_gather(vnet, queue, desc_idx, iov, &n_write);
+        if (n < 0 || !n_write || !iov[n - 1].iov_len)
+            return virtio_net_set_fail(vnet);
+
+        /* u8 class, u8 command, the data, then u8 ack */
+        uint8_t cmd[4] = {0};
+        const uint32_t len = vnet_iov_read(iov, n - n_write, cmd, sizeof(cmd));
+        uint8_t ack = VIRTIO_NET_ERR;
+        if (len >= 4 && cmd[0] == VIRTIO_NET_CTRL_MQ &&
+            cmd[1] == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+            const uint16_t pairs = cmd[2] | cmd[3] << 8;
+            if (pairs >= 1 && pairs <= VNET_QUEUE_PAIRS) {
+                vnet->n_pairs = pairs;
+                ack = VIRTIO_NET_OK;
+            }
+        }
+        *(uint8_t *) iov[n - 1].iov_base = ack;
+        vnet_push_used(vnet, queue, desc_idx, 1);
+    }
+}
+
+static void virtio_net_queue_notify_handler(virtio_net_state_t *vnet,
+                                            int index)
+{
+    virtio_net_queue_t *queue = &vnet->queues[index];
+    if (vnet->status & VIRTIO_STATUS_DEVICE_NEEDS_RESET)
+        return;
+
+    if (!((vnet->status & VIRTIO_STATUS_DRIVER_OK) && queue->ready))
+        return virtio_net_set_fail(vnet);
+
+    /* new receive buffers take the pending frames */
+    if (index % 2 == 0 && index != VNET_CTRL_QUEUE)
+        return vnet_rx(vnet);
+
+    const uint16_t old_used = vnet->ram[queue->queue_used] >> 16;
+    if (index == VNET_CTRL_QUEUE)
+        vnet_ctrl(vnet, queue);
+    else
+        vnet_tx(vnet, queue);
+
+    vnet_update_avail_event(vnet, queue);
+    if (vnet_need_interrupt(vnet, queue, old_used))
+        vnet->interrupt_status |= VIRTIO_INT_USED_RING;
+}
+
+int virtio_net_wait_fd(virtio_net_state_t *vnet)
+{
+    /* a frame waiting for a receive buffer holds the next ones back */
+    if (VNET_PRIV(vnet)->rx_len)
+        return -1;
+    return vnet_backend_fd(vnet->backend);
+}
+
+bool virtio_net_poll(virtio_net_state_t *vnet)
+{
+    const uint32_t interrupt_status = vnet->interrupt_status;
+    vnet_rx(vnet);
+    return vnet->interrupt_status != interrupt_status;
+}
+
+uint32_t virtio_net_read(virtio_net_state_t *vnet, uint32_t addr)
+{
+    const uint32_t shift = 8 * (addr & 0b11);
+    addr = addr >> 2;
+#define _(reg) VIRTIO_##reg
+    switch (addr) {
+    case _(MagicValue):
+        return VIRTIO_MAGIC_NUMBER;
+    case _(Version):
+        return VIRTIO_VERSION;
+    case _(DeviceID):
+        return VIRTIO_NET_DEV_ID;
+    case _(VendorID):
+        return VIRTIO_VENDOR_ID;
+    case _(DeviceFeatures):
+        return vnet->device_features_sel == 0
+                   ? VNET_FEATURES_0 | vnet->device_features
+                   : (vnet->device_features_sel == 1 ? VNET_FEATURES_1 : 0);
+    case _(QueueNumMax):
+        return VNET_QUEUE_NUM_MAX;
+    case _(QueueReady):
+        return (uint32_t) VNET_QUEUE.ready;
+    case _(InterruptStatus):
+        return vnet->interrupt_status;
+    case _(Status):
+        return vnet->status;
+    case _(ConfigGeneration):
+        return VIRTIO_CONFIG_GENERATE;
+    default:
+        /* Read configuration from the corresponding register, whose fields
+         * narrower than a word are read by the smaller loads.
+         */
+        if (addr < _(Config) ||
+            addr - _(Config) >= sizeof(struct virtio_net_config) / 4)
+            return 0;
+        return ((uint32_t *) &VNET_PRIV(vnet)->config)[addr - _(Config)] >>
+               shift;
+    }
+#undef _
+}
+
+void virtio_net_write(virtio_net_state_t *vnet, uint32_t addr, uint32_t value)
+{
+    addr = addr >> 2;
+#define _(reg) VIRTIO_##reg
+    switch (addr) {
+    case _(DeviceFeaturesSel):
+        vnet->device_features_sel = value;
+        break;
+    case _(DriverFeatures):
+        vnet->driver_features_sel == 0 ? (vnet->driver_features = value) : 0;
+        break;
+    case _(DriverFeaturesSel):
+        vnet->driver_features_sel = value;
+        break;
+    case _(QueueSel):
+        if (value < ARRAY_SIZE(vnet->queues))
+            vnet->queue_sel = value;
+        else
+            virtio_net_set_fail(vnet);
+        break;
+    case _(QueueNum):
+        if (value > 0 && value <= VNET_QUEUE_NUM_MAX)
+            VNET_QUEUE.queue_num = value;
+        else
+            virtio_net_set_fail(vnet);
+        break;
+    case _(QueueReady):
+        VNET_QUEUE.ready = value & 1;
+        if (value & 1)
+            VNET_QUEUE.last_avail = vnet->ram[VNET_QUEUE.queue_avail] >> 16;
+        break;
+    case _(QueueDescLow):
+        VNET_QUEUE.queue_desc = vnet_preprocess(vnet, value);
+        break;
+    case _(QueueDescHigh):
+        if (value)
+            virtio_net_set_fail(vnet);
+        break;
+    case _(QueueDriverLow):
+        VNET_QUEUE.queue_avail = vnet_preprocess(vnet, value);
+        break;
+    case _(QueueDriverHigh):
+        if (value)
+            virtio_net_set_fail(vnet);
+        break;
+    case _(QueueDeviceLow):
+        VNET_QUEUE.queue_used = vnet_preprocess(vnet, value);
+        break;
+    case _(QueueDeviceHigh):
+        if (value)
+            virtio_net_set_fail(vnet);
+        break;
+    case _(QueueNotify):
+        if (value < ARRAY_SIZE(vnet->queues))
+            virtio_net_queue_notify_handler(vnet, value);
+        else
+            virtio_net_set_fail(vnet);
+        break;
+    case _(InterruptACK):
+        vnet->interrupt_status &= ~value;
+        break;
+    case _(Status):
+        virtio_net_update_status(vnet, value);
+        break;
+    default:
+        /* The configuration is read-only */
+        break;
+    }
+#undef _
+}
+
+void virtio_net_init(virtio_net_state_t *vnet, char *netdev)
+{
+    vnet->priv = calloc(1, sizeof(vnet_priv_t));
+    assert(vnet->priv);
+    vnet->n_pairs = 1;
+
+    /* the backend, then the options */
+    char *pcap_file = NULL;
+    char *opt = strtok(netdev, ",");
+    char *backend = opt;
+    while ((opt = strtok(NULL, ","))) {
+        if (!strncmp(opt, "pcap=", 5)) {
+            pcap_file = opt + 5; /* strlen("pcap=") */
+        } else {
+            rv_log_error("Unknown vnet option: %s", opt);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    vnet->backend = backend ? vnet_backend_open(backend) : NULL;
+    if (!vnet->backend)
+        exit(EXIT_FAILURE);
+    if (pcap_file) {
+        vnet->pcap = vnet_pcap_open(pcap_file);
+        if (!vnet->pcap)
+            exit(EXIT_FAILURE);
+    }
+
+    /* a locally administered address, told apart by the end of the link */
+    struct virtio_net_config *config = &VNET_PRIV(vnet)->config;
+    static const uint8_t mac[6] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
+    memcpy(config->mac, mac, sizeof(mac));
+    config->mac[5] += vnet_backend_index(vnet->backend);
+    config->status = VIRTIO_NET_S_LINK_UP;
+    config->max_virtqueue_pairs = VNET_QUEUE_PAIRS;
+}
+
+virtio_net_state_t *vnet_new()
+{
+    virtio_net_state_t *vnet = calloc(1, sizeof(virtio_net_state_t));
+    assert(vnet);
+    return vnet;
+}
+
+void vnet_delete(virtio_net_state_t *vnet)
+{
+    if (vnet->pcap)
+        vnet_pcap_close(vnet->pcap);
+    if (vnet->backend)
+        vnet_backend_close(vnet->backend);
+    free(vnet->priv);
+    free(vnet);
+}
@@ -0,0 +1,137 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * The split virtqueues of the virtio devices. Every index and address below
+ * is given by the driver, hence is checked before the memory of the guest is
+ * accessed.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "virtio-queue.h"
+#include "virtio.h"
+
+int virtq_gather(const virtq_t *vq,
+                 uint16_t desc_idx,
+                 struct iovec *iov,
+                 int iov_max,
+                 int *n_write)
+{
+    /* The size of the `struct virtq_desc` is 4 words */
+    const struct virtq_desc *table = (struct virtq_desc *) &vq->ram[vq->desc];
+    uint32_t table_num = vq->num;
+    if (desc_idx >= table_num)
+        return -1;
+
+    /* An indirect table in place of the head holds the whole chain */
+    const struct virtq_desc *desc = &table[desc_idx];
+    if (desc->flags & VIRTIO_DESC_F_INDIRECT) {
+        if ((desc->flags & VIRTIO_DESC_F_NEXT) || !desc->len ||
+            desc->len % sizeof(struct virtq_desc) || (desc->addr & 15) ||
+            desc->addr > MEM_SIZE || desc->len > MEM_SIZE - desc->addr)
+            return -1;
+        table = (struct virtq_desc *) ((uintptr_t) vq->ram + desc->addr);
+        table_num = desc->len / sizeof(struct virtq_desc);
+        desc_idx = 0;
+    }
+
+    /* A chain is at most as long as its table, which catches the loops */
+    int n = 0;
+    *n_write = 0;
+    for (uint32_t i = 0;; i++) {
+        if (i == table_num || desc_idx >= table_num || n == iov_max)
+            return -1;
+        desc = &table[desc_idx];
+        if ((desc->flags & VIRTIO_DESC_F_INDIRECT) || desc->addr > MEM_SIZE ||
+            desc->len > MEM_SIZE - desc->addr)
+            return -1;
+
+        /* the buffers written follow the ones read */
+        if (desc->flags & VIRTIO_DESC_F_WRITE)
+            (*n_write)++;
+        else if (*n_write)
+            return -1;
+        iov[n++] = (struct iovec){
+            .iov_base = (void *) ((uintptr_t) vq->ram + desc->addr),
+            .iov_len = desc->len,
+        };
+
+        if (!(desc->flags & VIRTIO_DESC_F_NEXT))
+            break;
+        desc_idx = desc->next;
+    }
+    return n;
+}
+
+bool virtq_has_avail(const virtq_t *vq, uint16_t last_avail)
+{
+    return last_avail != (uint16_t) (vq->ram[vq->avail] >> 16);
+}
+
+int virtq_pop_avail(const virtq_t *vq, uint16_t *last_avail)
+{
+    const uint16_t new_avail = vq->ram[vq->avail] >> 16;
+    if (*last_avail == new_avail)
+        return -1;
+    if ((uint16_t) (new_avail - *last_avail) > (uint16_t) vq->num) {
+        rv_log_error("Size check fail");
+        return -2;
+    }
+
+    /* Since each buffer index occupies 2 bytes but the memory is aligned
+     * with 4 bytes, and the first element of the available queue is stored
+     * at ram[vq->avail + 1], to acquire the buffer index, it requires the
+     * following array index calculation and bit shifting. Check also the
+     * `struct virtq_avail` on the spec.
+     */
+    const uint16_t queue_idx = (*last_avail)++ % vq->num;
+    return (uint16_t) (vq->ram[vq->avail + 1 + queue_idx / 2] >>
+                       (16 * (queue_idx % 2)));
+}
+
+void virtq_push_used(const virtq_t *vq, uint16_t desc_idx, uint32_t len)
+{
+    uint32_t *ram = vq->ram;
+    uint16_t new_used = virtq_used_idx(vq); /* virtq_used.idx (le16) */
+    const uint32_t vq_used_addr = vq->used + 1 + (new_used % vq->num) * 2;
+    ram[vq_used_addr] = desc_idx; /* virtq_used_elem.id  (le32) */
+    ram[vq_used_addr + 1] = len;  /* virtq_used_elem.len (le32) */
+    new_used++;
+
+    /* Check le32 len field of `struct virtq_used_elem` on the spec  */
+    ram[vq->used] &= MASK(16); /* Reset low 16 bits to zero */
+    ram[vq->used] |= ((uint32_t) new_used) << 16; /* len */
+}
+
+/*
+ * With VIRTIO_F_EVENT_IDX, the driver asks for an interrupt once the used
+ * index passes the used_event field, which follows the ring of the available
+ * queue, and the device asks for a notification once the available index
+ * passes the avail_event field, which follows the ring of the used queue.
+ */
+void virtq_set_avail_event(const virtq_t *vq, uint16_t avail_idx)
+{
+    *(uint16_t *) ((uintptr_t) vq->ram + vq->used * 4 + 4 + vq->num * 8) =
+        avail_idx;
+}
+
+bool virtq_need_interrupt(const virtq_t *vq, bool event_idx, uint16_t old_used)
+{
+    const uint16_t new_used = virtq_used_idx(vq);
+    if (new_used == old_used)
+        return false;
+
+    /* Send interrupt, unless VIRTQ_AVAIL_F_NO_INTERRUPT is set */
+    if (!event_idx)
+        return !(vq->ram[vq->avail] & 1);
+
+    const uint16_t used_event =
+        *(uint16_t *) ((uintptr_t) vq->ram + vq->avail * 4 + 4 + vq->num * 2);
+    return (uint16_t) (new_used - used_event - 1) <
+           (uint16_t) (new_used - old_used);
+}
@@ -0,0 +1,68 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* A split virtqueue in the memory @ram of the guest, shared by the virtio
+ * devices. The addresses of the descriptor table, the available ring and the
+ * used ring are word indices into @ram, as kept by the devices.
+ */
+typedef struct {
+    uint32_t *ram;
+    uint32_t num;
+    uint32_t desc;
+    uint32_t avail;
+    uint32_t used;
+} virtq_t;
+
+/* The virtqueue of @queue, any of the queue types of virtio.h */
+#define VIRTQ(ram_, queue)                                   \
+    ((virtq_t){.ram = (ram_),                                \
+               .num = (queue)->queue_num,                    \
+               .desc = (queue)->queue_desc,                  \
+               .avail = (queue)->queue_avail,                \
+               .used = (queue)->queue_used})
+
+/* Gather the descriptor chain headed by @desc_idx into @iov, of at most
+ * @iov_max buffers, following the indirect table if any. The buffers read by
+ * the device come first, and the @n_write last ones are written. Return the
+ * number of buffers, or -1 if the chain is malformed.
+ */
+int virtq_gather(const virtq_t *vq,
+                 uint16_t desc_idx,
+                 struct iovec *iov,
+                 int iov_max,
+                 int *n_write);
+
+/* Whether the driver made a buffer available after @last_avail */
+bool virtq_has_avail(const virtq_t *vq, uint16_t last_avail);
+
+/* Take the next buffer after @last_avail, which is advanced, and return its
+ * index, or -1 if none, or -2 if the available index is beyond the ring.
+ */
+int virtq_pop_avail(const virtq_t *vq, uint16_t *last_avail);
+
+/* Write a used element (`struct virtq_used_elem`) to the used ring */
+void virtq_push_used(const virtq_t *vq, uint16_t desc_idx, uint32_t len);
+
+/* Index of the next element of the used ring */
+static inline uint16_t virtq_used_idx(const virtq_t *vq)
+{
+    return vq->ram[vq->used] >> 16;
+}
+
+/* Ask for a notification once the driver makes the buffer @avail_idx
+ * available, see VIRTIO_F_EVENT_IDX.
+ */
+void virtq_set_avail_event(const virtq_t *vq, uint16_t avail_idx);
+
+/* Whether to interrupt the driver once the used index moved from @old_used,
+ * where @event_idx tells if VIRTIO_F_EVENT_IDX was negotiated.
+ */
+bool virtq_need_interrupt(const virtq_t *vq, bool event_idx, uint16_t old_used);
@@ -18,6 +18,10 @@
 
 #define VIRTIO_DESC_F_NEXT 1
 #define VIRTIO_DESC_F_WRITE 2
+#define VIRTIO_DESC_F_INDIRECT 4
+
+#define VIRTIO_RING_F_INDIRECT_DESC (1 << 28)
+#define VIRTIO_RING_F_EVENT_IDX (1 << 29)
 
 #define VIRTIO_BLK_DEV_ID 2
 #define VIRTIO_BLK_T_IN 0
@@ -33,8 +37,29 @@
 #define VIRTIO_BLK_S_IOERR 1
 #define VIRTIO_BLK_S_UNSUPP 2
 
-/* TODO: support more features */
+#define VIRTIO_BLK_F_SEG_MAX (1 << 2)
 #define VIRTIO_BLK_F_RO (1 << 5)
+#define VIRTIO_BLK_F_FLUSH (1 << 9)
+#define VIRTIO_BLK_F_MQ (1 << 12)
+#define VIRTIO_BLK_F_DISCARD (1 << 13)
+#define VIRTIO_BLK_F_WRITE_ZEROES (1 << 14)
+
+#define VIRTIO_NET_DEV_ID 1
+#define VIRTIO_NET_F_MAC (1 << 5)
+#define VIRTIO_NET_F_STATUS (1 << 16)
+#define VIRTIO_NET_F_CTRL_VQ (1 << 17)
+#define VIRTIO_NET_F_MQ (1 << 22)
+
+#define VIRTIO_NET_S_LINK_UP 1
+
+#define VIRTIO_NET_CTRL_MQ 4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET 0
+
+#define VIRTIO_NET_OK 0
+#define VIRTIO_NET_ERR 1
+
+#define VIRTIO_CONSOLE_DEV_ID 3
+#define VIRTIO_CONSOLE_F_SIZE (1 << 0)
 
 /* VirtIO MMIO registers */
 #define VIRTIO_REG_LIST                  \
@@ -79,12 +104,16 @@ struct virtq_desc {
 #define IRQ_VBLK_SHIFT 3
 #define IRQ_VBLK_BIT (1 << IRQ_VBLK_SHIFT)
 
+/* number of request queues of virtio-blk, see VIRTIO_BLK_F_MQ */
+#define VBLK_QUEUE_CNT 4
+
 typedef struct {
     uint32_t queue_num;
     uint32_t queue_desc;
     uint32_t queue_avail;
     uint32_t queue_used;
     uint16_t last_avail;
+    uint16_t n_inflight; /* requests on the I/O worker */
     bool ready;
 } virtio_blk_queue_t;
 
@@ -96,7 +125,7 @@ typedef struct {
     uint32_t driver_features_sel;
     /* queue config */
     uint32_t queue_sel;
-    virtio_blk_queue_t queues[2];
+    virtio_blk_queue_t queues[VBLK_QUEUE_CNT];
     /* status */
     uint32_t status;
     uint32_t interrupt_status;
@@ -105,6 +134,11 @@ typedef struct {
     uint32_t *disk;
     uint64_t disk_size;
     int disk_fd;
+    /* called by the I/O worker once a request completes, see IRQ_VBLK_BIT */
+    void (*wake)(void *arg);
+    void *wake_arg;
+    /* I/O worker of the asynchronous backend, or NULL */
+    struct vblk_io *io;
     /* implementation-specific */
     void *priv;
 } virtio_blk_state_t;
@@ -115,8 +149,140 @@ void virtio_blk_write(virtio_blk_state_t *vblk, uint32_t addr, uint32_t value);
 
 uint32_t *virtio_blk_init(virtio_blk_state_t *vblk,
                           char *disk_file,
-                          bool readonly);
+                          const char *overlay_file,
+                          bool readonly,
+                          bool async);
+
+/* Complete the requests finished by the I/O worker of the asynchronous
+ * backend, and return true if any.
+ */
+bool virtio_blk_poll(virtio_blk_state_t *vblk);
+
+/* Wait for the requests in flight on the I/O worker and complete them, so
+ * that none is left, and return true if any.
+ */
+bool virtio_blk_quiesce(virtio_blk_state_t *vblk);
 
 virtio_blk_state_t *vblk_new();
 
 void vblk_delete(virtio_blk_state_t *vblk);
+
+#define IRQ_VNET_SHIFT 2
+#define IRQ_VNET_BIT (1 << IRQ_VNET_SHIFT)
+
+/* number of pairs of receive and transmit queues of virtio-net, which are
+ * followed by the control queue, see VIRTIO_NET_F_MQ
+ */
+#define VNET_QUEUE_PAIRS 2
+
+typedef struct {
+    uint32_t queue_num;
+    uint32_t queue_desc;
+    uint32_t queue_avail;
+    uint32_t queue_used;
+    uint16_t last_avail;
+    bool ready;
+} virtio_net_queue_t;
+
+typedef struct {
+    /* feature negotiation */
+    uint32_t device_features;
+    uint32_t device_features_sel;
+    uint32_t driver_features;
+    uint32_t driver_features_sel;
+    /* queue config */
+    uint32_t queue_sel;
+    virtio_net_queue_t queues[VNET_QUEUE_PAIRS * 2 + 1];
+    uint16_t n_pairs; /* of queues in use, set by the driver */
+    /* status */
+    uint32_t status;
+    uint32_t interrupt_status;
+    /* supplied by environment */
+    uint32_t *ram;
+    struct vnet_backend *backend;
+    struct vnet_pcap *pcap; /* record of the frames, or NULL */
+    /* implementation-specific */
+    void *priv;
+} virtio_net_state_t;
+
+uint32_t virtio_net_read(virtio_net_state_t *vnet, uint32_t addr);
+
+void virtio_net_write(virtio_net_state_t *vnet, uint32_t addr, uint32_t value);
+
+/* Attach @vnet to the backend of @netdev, see vnet-backend.h, whose frames
+ * may be recorded to the pcap file of the option pcap=<file>
+ */
+void virtio_net_init(virtio_net_state_t *vnet, char *netdev);
+
+/* Pass the frames received by the backend to the driver, and return true if
+ * any.
+ */
+bool virtio_net_poll(virtio_net_state_t *vnet);
+
+/* File descriptor readable when a frame comes for the driver, or -1 if the
+ * device has to be polled instead
+ */
+int virtio_net_wait_fd(virtio_net_state_t *vnet);
+
+virtio_net_state_t *vnet_new();
+
+void vnet_delete(virtio_net_state_t *vnet);
+
+#define IRQ_VCON_SHIFT 4
+#define IRQ_VCON_BIT (1 << IRQ_VCON_SHIFT)
+
+/* the receive queue, then the transmit queue, of the single port */
+#define VCON_QUEUE_CNT 2
+
+typedef struct {
+    uint32_t queue_num;
+    uint32_t queue_desc;
+    uint32_t queue_avail;
+    uint32_t queue_used;
+    uint16_t last_avail;
+    bool ready;
+} virtio_console_queue_t;
+
+typedef struct {
+    /* feature negotiation */
+    uint32_t device_features;
+    uint32_t device_features_sel;
+    uint32_t driver_features;
+    uint32_t driver_features_sel;
+    /* queue config */
+    uint32_t queue_sel;
+    virtio_console_queue_t queues[VCON_QUEUE_CNT];
+    /* status */
+    uint32_t status;
+    uint32_t interrupt_status;
+    /* supplied by environment */
+    uint32_t *ram;
+    int in_fd, out_fd;
+    /* implementation-specific */
+    void *priv;
+} virtio_console_state_t;
+
+uint32_t virtio_console_read(virtio_console_state_t *vcon, uint32_t addr);
+
+void virtio_console_write(virtio_console_state_t *vcon,
+                          uint32_t addr,
+                          uint32_t value);
+
+void virtio_console_init(virtio_console_state_t *vcon);
+
+/* Write out the output buffered so far, pass the pending input to the
+ * driver, and return true if the interrupt status changed.
+ */
+bool virtio_console_poll(virtio_console_state_t *vcon);
+
+/* File descriptor readable when input comes for the driver, or -1 if none
+ * is awaited
+ */
+int virtio_console_wait_fd(virtio_console_state_t *vcon);
+
+/* Write out the output buffered so far */
+void virtio_console_flush(virtio_console_state_t *vcon);
+
+virtio_console_state_t *vcon_new();
+
+void vcon_delete(virtio_console_state_t *vcon);
@@ -0,0 +1,605 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * The backends of virtio-net carry Ethernet frames, without the FCS, between
+ * the guest and the outside without touching the network of the host:
+ * - shm: two emulators opening the same file are linked by a pair of rings
+ *   of frames in the shared mapping of the file, one per direction. Each end
+ *   holds a lock on one byte of the file, so that the lock of a crashed
+ *   emulator is released and its end may be taken again.
+ * - socket: the frames are streamed over a UNIX socket, each preceded by its
+ *   length as a big-endian 32-bit word, as the stream netdev of QEMU does.
+ *   The first emulator listens on the socket, and the next one connects.
+ * - replay: the frames of a pcap file are received in turn, as soon as the
+ *   guest has room for them, and the frames sent are dropped.
+ * Any of them may be recorded to a pcap file, see vnet_pcap_open().
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "vnet-backend.h"
+
+struct vnet_backend {
+    int (*send)(vnet_backend_t *be, const void *frame, uint32_t len);
+    uint32_t (*recv)(vnet_backend_t *be, void *buf, uint32_t size);
+    void (*close)(vnet_backend_t *be);
+    int (*fd)(const vnet_backend_t *be); /* or NULL if there is none */
+    int index;
+};
+
+/* shm */
+
+#define SHM_SLOTS 256
+#define SHM_FRAME_MAX 2044
+
+typedef struct {
+    uint32_t len;
+    uint8_t data[SHM_FRAME_MAX];
+} shm_slot_t;
+
+/* the indices run freely, and are each written by one end only */
+typedef struct {
+    uint32_t head; /* written by the sender */
+    uint8_t pad0[60];
+    uint32_t tail; /* written by the receiver */
+    uint8_t pad1[60];
+    shm_slot_t slots[SHM_SLOTS];
+} shm_ring_t;
+
+/* ring[i] carries the frames sent by end i */
+typedef struct {
+    shm_ring_t ring[2];
+} shm_link_t;
+
+typedef struct {
+    vnet_backend_t be;
+    int fd;
+    shm_link_t *link;
+} shm_backend_t;
+
+static int shm_send(vnet_backend_t *be, const void *frame, uint32_t len)
+{
+    shm_backend_t *shm = (shm_backend_t *) be;
+    shm_ring_t *ring = &shm->link->ring[be->index];
+    const uint32_t head = ring->head;
+    if (len > SHM_FRAME_MAX ||
+        head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= SHM_SLOTS)
+        return -1;
+
+    shm_slot_t *slot = &ring->slots[head % SHM_SLOTS];
+    slot->len = len;
+    memcpy(slot->data, frame, len);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static uint32_t shm_recv(vnet_backend_t *be, void *buf, uint32_t size)
+{
+    shm_backend_t *shm = (shm_backend_t *) be;
+    shm_ring_t *ring = &shm->link->ring[!be->index];
+    const uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = ring->tail;
+    /* The ring is written by the peer, which may be broken: the frames of a
+     * ring holding more than it can are dropped, and each length is read
+     * once, so that it cannot change between its check and the copy.
+     */
+    if (head - tail > SHM_SLOTS)
+        tail = head;
+    uint32_t len = 0;
+    while (!len && tail != head) {
+        const shm_slot_t *slot = &ring->slots[tail++ % SHM_SLOTS];
+        const uint32_t n = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+        if (n <= size && n <= SHM_FRAME_MAX) {
+            len = n;
+            memcpy(buf, slot->data, len);
+        }
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return len;
+}
+
+static void shm_close(vnet_backend_t *be)
+{
+    shm_backend_t *shm = (shm_backend_t *) be;
+    munmap(shm->link, sizeof(shm_link_t));
+    close(shm->fd); /* also releases the lock of the end */
+    free(shm);
+}
+
+/* lock the byte @index of @fd, which stands for one end of the link */
+static bool shm_lock(int fd, int index)
+{
+    struct flock lock = {
+        .l_type = F_WRLCK,
+        .l_whence = SEEK_SET,
+        .l_start = index,
+        .l_len = 1,
+    };
+    return fcntl(fd, F_SETLK, &lock) == 0;
+}
+
+static vnet_backend_t *shm_open_link(const char *path)
+{
+    shm_backend_t *shm = calloc(1, sizeof(shm_backend_t));
+    if (!shm)
+        return NULL;
+    shm->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (shm->fd < 0)
+        goto fail;
+
+    /* a new file is zeroed, which leaves both rings empty */
+    struct stat st;
+    if (fstat(shm->fd, &st) == -1 ||
+        (st.st_size != sizeof(shm_link_t) &&
+         ftruncate(shm->fd, sizeof(shm_link_t)) == -1))
+        goto fail;
+
+    if (shm_lock(shm->fd, 0)) {
+        shm->be.index = 0;
+    } else if (shm_lock(shm->fd, 1)) {
+        shm->be.index = 1;
+    } else {
+        rv_log_error("Both ends of %s are taken", path);
+        errno = EBUSY;
+        goto fail;
+    }
+
+    shm->link = mmap(NULL, sizeof(shm_link_t), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, shm->fd, 0);
+    if (shm->link == MAP_FAILED)
+        goto fail;
+
+    /* drop the frames sent to a former emulator at this end */
+    shm_ring_t *ring = &shm->link->ring[!shm->be.index];
+    const uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+
+    shm->be.send = shm_send;
+    shm->be.recv = shm_recv;
+    shm->be.close = shm_close;
+    return &shm->be;
+
+fail:
+    rv_log_error("Could not open %s: %s", path, strerror(errno));
+    if (shm->fd >= 0)
+        close(shm->fd);
+    free(shm);
+    return NULL;
+}
+
+/* socket */
+
+#define SOCKET_FRAME_MAX 65536
+
+typedef struct {
+    vnet_backend_t be;
+    int listen_fd; /* or -1 if connected to the listening emulator */
+    int fd;        /* of the connection, or -1 if none */
+    uint32_t rlen; /* bytes of the frame being received */
+    uint8_t rbuf[4 + SOCKET_FRAME_MAX];
+    uint32_t woff, wlen; /* the tail of the frame partly sent, in wbuf */
+    uint8_t wbuf[4 + SOCKET_FRAME_MAX];
+} socket_backend_t;
+
+static void socket_disconnect(socket_backend_t *sock)
+{
+    close(sock->fd);
+    sock->fd = -1;
+    sock->rlen = 0;
+    sock->wlen = 0;
+}
+
+/* Neither the sends nor the receives block, so that a peer which stops
+ * reading does not stall the guest: the frames it has no room for are
+ * dropped, as Ethernet may do.
+ */
+static void socket_setup(int fd)
+{
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+#if defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){1}, sizeof(int));
+#endif
+}
+
+/* take the connection of the peer if it came, and return whether there is */
+static bool socket_connected(socket_backend_t *sock)
+{
+    if (sock->fd < 0 && sock->listen_fd >= 0) {
+        sock->fd = accept(sock->listen_fd, NULL, NULL);
+        if (sock->fd >= 0)
+            socket_setup(sock->fd);
+    }
+    return sock->fd >= 0;
+}
+
+/* send what @msg holds as far as the socket has room, and return the bytes
+ * sent, or -1 if the connection is lost
+ */
+static ssize_t socket_write(socket_backend_t *sock, const struct msghdr *msg)
+{
+    for (;;) {
+#if defined(MSG_NOSIGNAL)
+        const ssize_t n = sendmsg(sock->fd, msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+        const ssize_t n = sendmsg(sock->fd, msg, MSG_DONTWAIT);
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n <= 0) {
+            socket_disconnect(sock);
+            return -1;
+        }
+        return n;
+    }
+}
+
+/* send the tail of the frame partly sent, and return whether it is gone */
+static bool socket_flush(socket_backend_t *sock)
+{
+    if (!sock->wlen)
+        return true;
+    struct iovec iov = {.iov_base = sock->wbuf + sock->woff,
+                        .iov_len = sock->wlen};
+    const struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    const ssize_t n = socket_write(sock, &msg);
+    if (n < 0)
+        return false;
+    sock->woff += n;
+    sock->wlen -= n;
+    return !sock->wlen;
+}
+
+static int socket_send(vnet_backend_t *be, const void *frame, uint32_t len)
+{
+    socket_backend_t *sock = (socket_backend_t *) be;
+    if (!socket_connected(sock) || len > SOCKET_FRAME_MAX ||
+        !socket_flush(sock))
+        return -1;
+
+    const uint32_t header = htonl(len);
+    struct iovec iov[2] = {
+        {.iov_base = (void *) &header, .iov_len = sizeof(header)},
+        {.iov_base = (void *) frame, .iov_len = len},
+    };
+    const struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+    const ssize_t n = socket_write(sock, &msg);
+    if (n <= 0)
+        return -1;
+
+    /* a frame is never cut short on the stream, the rest of it goes first
+     * on the next send or receive
+     */
+    const uint32_t total = sizeof(header) + len;
+    if ((size_t) n < total) {
+        memcpy(sock->wbuf, &header, sizeof(header));
+        memcpy(sock->wbuf + sizeof(header), frame, len);
+        sock->woff = n;
+        sock->wlen = total - n;
+    }
+    return 0;
+}
+
+static uint32_t socket_recv(vnet_backend_t *be, void *buf, uint32_t size)
+{
+    socket_backend_t *sock = (socket_backend_t *) be;
+    if (socket_connected(sock))
+        socket_flush(sock);
+    while (socket_connected(sock)) {
+        /* the length, then the frame */
+        uint32_t want = sizeof(uint32_t);
+        if (sock->rlen >= sizeof(uint32_t)) {
+            uint32_t header;
+            memcpy(&header, sock->rbuf, sizeof(header));
+            if (ntohl(header) > SOCKET_FRAME_MAX) {
+                rv_log_error("Frame of %u bytes on the socket", ntohl(header));
+                socket_disconnect(sock);
+                return 0;
+            }
+            want += ntohl(header);
+        }
+
+        if (sock->rlen < want) {
+            const ssize_t n = recv(sock->fd, sock->rbuf + sock->rlen,
+                                   want - sock->rlen, MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+            if (n <= 0) {
+                socket_disconnect(sock);
+                return 0;
+            }
+            sock->rlen += n;
+            continue;
+        }
+
+        /* a complete frame */
+        const uint32_t len = want - sizeof(uint32_t);
+        sock->rlen = 0;
+        if (len && len <= size) {
+            memcpy(buf, sock->rbuf + sizeof(uint32_t), len);
+            return len;
+        }
+    }
+    return 0;
+}
+
+static int socket_fd(const vnet_backend_t *be)
+{
+    const socket_backend_t *sock = (const socket_backend_t *) be;
+    return sock->fd >= 0 ? sock->fd : sock->listen_fd;
+}
+
+static void socket_close(vnet_backend_t *be)
+{
+    socket_backend_t *sock = (socket_backend_t *) be;
+    if (sock->fd >= 0)
+        close(sock->fd);
+    if (sock->listen_fd >= 0)
+        close(sock->listen_fd);
+    free(sock);
+}
+
+static vnet_backend_t *socket_open(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        rv_log_error("Socket path too long: %s", path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    socket_backend_t *sock = malloc(sizeof(socket_backend_t));
+    if (!sock)
+        return NULL;
+    sock->listen_fd = -1;
+    sock->rlen = 0;
+    sock->wlen = 0;
+    sock->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock->fd < 0)
+        goto fail;
+
+    /* connect to the emulator listening, or be the one */
+    if (connect(sock->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        if (errno != ENOENT && errno != ECONNREFUSED)
+            goto fail;
+        sock->listen_fd = sock->fd;
+        sock->fd = -1;
+        unlink(path); /* left by a former emulator */
+        if (bind(sock->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+            listen(sock->listen_fd, 1) ||
+            fcntl(sock->listen_fd, F_SETFL, O_NONBLOCK) == -1)
+            goto fail;
+        sock->be.index = 0;
+    } else {
+        socket_setup(sock->fd);
+        sock->be.index = 1;
+    }
+
+    sock->be.send = socket_send;
+    sock->be.recv = socket_recv;
+    sock->be.close = socket_close;
+    sock->be.fd = socket_fd;
+    return &sock->be;
+
+fail:
+    rv_log_error("Could not open socket %s: %s", path, strerror(errno));
+    if (sock->fd >= 0)
+        close(sock->fd);
+    if (sock->listen_fd >= 0)
+        close(sock->listen_fd);
+    free(sock);
+    return NULL;
+}
+
+/* replay */
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET 1
+
+PACKED(struct pcap_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+});
+
+PACKED(struct pcap_record {
+    uint32_t ts_sec;
+    uint32_t ts_frac; /* microseconds, or nanoseconds */
+    uint32_t incl_len;
+    uint32_t orig_len;
+});
+
+typedef struct {
+    vnet_backend_t be;
+    FILE *file;
+    bool swapped; /* written in the other byte order */
+} replay_backend_t;
+
+static uint32_t pcap_word(const replay_backend_t *replay, uint32_t word)
+{
+    return replay->swapped ? __builtin_bswap32(word) : word;
+}
+
+static int replay_send(vnet_backend_t *be UNUSED,
+                       const void *frame UNUSED,
+                       uint32_t len UNUSED)
+{
+    return 0;
+}
+
+static uint32_t replay_recv(vnet_backend_t *be, void *buf, uint32_t size)
+{
+    replay_backend_t *replay = (replay_backend_t *) be;
+    struct pcap_record record;
+    while (replay->file &&
+           fread(&record, sizeof(record), 1, replay->file) == 1) {
+        const uint32_t len = pcap_word(replay, record.incl_len);
+        if (len && len <= size) {
+            if (fread(buf, 1, len, replay->file) != len)
+                break;
+            return len;
+        }
+        if (fseek(replay->file, len, SEEK_CUR))
+            break;
+    }
+
+    /* the end of the capture */
+    if (replay->file) {
+        fclose(replay->file);
+        replay->file = NULL;
+    }
+    return 0;
+}
+
+static void replay_close(vnet_backend_t *be)
+{
+    replay_backend_t *replay = (replay_backend_t *) be;
+    if (replay->file)
+        fclose(replay->file);
+    free(replay);
+}
+
+static vnet_backend_t *replay_open(const char *path)
+{
+    replay_backend_t *replay = calloc(1, sizeof(replay_backend_t));
+    if (!replay)
+        return NULL;
+    replay->file = fopen(path, "rb");
+    if (!replay->file) {
+        rv_log_error("Could not open %s: %s", path, strerror(errno));
+        goto fail;
+    }
+
+    struct pcap_header header;
+    if (fread(&header, sizeof(header), 1, replay->file) != 1)
+        goto format_fail;
+    replay->swapped = header.magic == __builtin_bswap32(PCAP_MAGIC) ||
+                      header.magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+    const uint32_t magic = pcap_word(replay, header.magic);
+    if ((magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC) ||
+        pcap_word(replay, header.linktype) != PCAP_LINKTYPE_ETHERNET)
+        goto format_fail;
+
+    replay->be.send = replay_send;
+    replay->be.recv = replay_recv;
+    replay->be.close = replay_close;
+    return &replay->be;
+
+format_fail:
+    rv_log_error("%s is not a pcap capture of Ethernet frames", path);
+fail:
+    if (replay->file)
+        fclose(replay->file);
+    free(replay);
+    return NULL;
+}
+
+vnet_backend_t *vnet_backend_open(const char *spec)
+{
+    if (!strncmp(spec, "shm=", 4))
+        return shm_open_link(spec + 4);
+    if (!strncmp(spec, "socket=", 7))
+        return socket_open(spec + 7);
+    if (!strncmp(spec, "replay=", 7))
+        return replay_open(spec + 7);
+    rv_log_error("Unknown vnet backend: %s", spec);
+    return NULL;
+}
+
+int vnet_backend_send(vnet_backend_t *be, const void *frame, uint32_t len)
+{
+    return be->send(be, frame, len);
+}
+
+uint32_t vnet_backend_recv(vnet_backend_t *be, void *buf, uint32_t size)
+{
+    return be->recv(be, buf, size);
+}
+
+int vnet_backend_fd(const vnet_backend_t *be)
+{
+    return be->fd ? be->fd(be) : -1;
+}
+
+int vnet_backend_index(const vnet_backend_t *be)
+{
+    return be->index;
+}
+
+void vnet_backend_close(vnet_backend_t *be)
+{
+    be->close(be);
+}
+
+/* pcap recording */
+
+struct vnet_pcap {
+    FILE *file;
+};
+
+vnet_pcap_t *vnet_pcap_open(const char *path)
+{
+    vnet_pcap_t *pcap = malloc(sizeof(vnet_pcap_t));
+    if (!pcap)
+        return NULL;
+    pcap->file = fopen(path, "wb");
+    const struct pcap_header header = {
+        .magic = PCAP_MAGIC,
+        .version_major = 2,
+        .version_minor = 4,
+        .snaplen = SOCKET_FRAME_MAX,
+        .linktype = PCAP_LINKTYPE_ETHERNET,
+    };
+    if (!pcap->file || fwrite(&header, sizeof(header), 1, pcap->file) != 1) {
+        rv_log_error("Could not create %s: %s", path, strerror(errno));
+        if (pcap->file)
+            fclose(pcap->file);
+        free(pcap);
+        return NULL;
+    }
+    return pcap;
+}
+
+void vnet_pcap_write(vnet_pcap_t *pcap, const void *frame, uint32_t len)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    const struct pcap_record record = {
+        .ts_sec = tv.tv_sec,
+        .ts_frac = tv.tv_usec,
+        .incl_len = len,
+        .orig_len = len,
+    };
+    fwrite(&record, sizeof(record), 1, pcap->file);
+    fwrite(frame, 1, len, pcap->file);
+}
+
+void vnet_pcap_close(vnet_pcap_t *pcap)
+{
+    fclose(pcap->file);
+    free(pcap);
+}
@@ -0,0 +1,47 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Where the frames of virtio-net go to and come from, see vnet-backend.c */
+typedef struct vnet_backend vnet_backend_t;
+
+/* Open the backend described by @spec, one of:
+ *   shm=<file>     link with another emulator opening the same <file>
+ *   socket=<path>  stream of frames over the UNIX socket <path>
+ *   replay=<file>  frames of the pcap <file> received in turn
+ * Return NULL on failure.
+ */
+vnet_backend_t *vnet_backend_open(const char *spec);
+
+/* Send @frame of @len bytes, and return 0, or -1 if it is dropped */
+int vnet_backend_send(vnet_backend_t *be, const void *frame, uint32_t len);
+
+/* Receive a frame into @buf of @size bytes, and return its length, or 0 if
+ * none is pending. Frames larger than @size are dropped.
+ */
+uint32_t vnet_backend_recv(vnet_backend_t *be, void *buf, uint32_t size);
+
+/* File descriptor readable when a frame comes, or -1 if the backend has to
+ * be polled
+ */
+int vnet_backend_fd(const vnet_backend_t *be);
+
+/* Index of the emulator on the link, which tells the MAC addresses apart */
+int vnet_backend_index(const vnet_backend_t *be);
+
+void vnet_backend_close(vnet_backend_t *be);
+
+/* Record of the frames in a pcap file */
+typedef struct vnet_pcap vnet_pcap_t;
+
+/* Create the pcap file @path, and return NULL on failure */
+vnet_pcap_t *vnet_pcap_open(const char *path);
+
+void vnet_pcap_write(vnet_pcap_t *pcap, const void *frame, uint32_t len);
+
+void vnet_pcap_close(vnet_pcap_t *pcap);
@@ -19,6 +19,15 @@
 extern struct target_ops gdbstub_ops;
 #endif
 
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#if RV32_HAS(HOST_TIMER)
+#include <pthread.h>
+#endif
+
 #if defined(__EMSCRIPTEN__)
 #include "em_runtime.h"
 #endif
@@ -80,10 +89,50 @@ static void __trap_handler(riscv_t *rv);
         return false;                                                 \
     }
 
+#if RV32_HAS(SMC_DETECT)
+/* Leave the block after a store which modified translated code, since the
+ * instructions that follow may be stale. @len is the length of the store.
+ */
+#define RV_SMC_EXIT(len)                      \
+    if (unlikely(rv->smc_lo <= rv->smc_hi)) { \
+        rv->csr_cycle = cycle;                \
+        rv->PC = PC + (len);                  \
+        return true;                          \
+    }
+#else
+#define RV_SMC_EXIT(len)
+#endif
+
+#if RV32_HAS(HOST_TIMER)
+/* bring rv->timer to the host time elapsed since the hart was created, in
+ * ticks of TIMEBASE_FREQ. The hot path then has no timer to update, and
+ * this is called at the poll of the peripherals, at WFI and at reads of the
+ * time CSR instead.
+ */
+static uint64_t rv_host_ticks(const vm_attr_t *attr)
+{
+    const struct timespec *epoch = &attr->timer_epoch;
+    struct timespec now;
+    rv_clock_gettime(&now);
+    const uint64_t ns = (now.tv_sec - epoch->tv_sec) * 1000000000ULL +
+                        now.tv_nsec - epoch->tv_nsec;
+    return ns / 1000000000 * TIMEBASE_FREQ +
+           ns % 1000000000 * TIMEBASE_FREQ / 1000000000;
+}
+
+static void rv_sample_timer(riscv_t *rv)
+{
+    rv->timer = rv_host_ticks(PRIV(rv));
+}
+#endif
+
 /* FIXME: use more precise methods for updating time, e.g., RTC */
 #if RV32_HAS(Zicsr)
 static inline void update_time(riscv_t *rv)
 {
+#if RV32_HAS(HOST_TIMER)
+    rv_sample_timer(rv);
+#endif
     rv->csr_time[0] = rv->timer & 0xFFFFFFFF;
     rv->csr_time[1] = rv->timer >> 32;
 }
@@ -162,6 +211,17 @@ static uint32_t *csr_get_ptr(riscv_t *rv, uint32_t csr)
     }
 }
 
+#if RV32_HAS(SYSTEM)
+/* an interrupt may become pending and enabled after a write to @c */
+static inline void csr_raise_event(riscv_t *rv, const uint32_t *c)
+{
+    if (c == &rv->csr_sstatus || c == &rv->csr_sie || c == &rv->csr_sip)
+        rv_raise_event(rv);
+}
+#else
+#define csr_raise_event(rv, c)
+#endif
+
 /* CSRRW (Atomic Read/Write CSR) instruction atomically swaps values in the
  * CSRs and integer registers. CSRRW reads the old value of the CSR,
  * zero-extends the value to XLEN bits, and then writes it to register rd.
@@ -197,6 +257,11 @@ static uint32_t csr_csrrw(riscv_t *rv, uint32_t csr, uint32_t val)
         need_clear_block_map = true;
 #endif
 
+    /* the address translation depends on satp and sstatus.SUM/MXR */
+    if (c == &rv->csr_satp || c == &rv->csr_sstatus)
+        dtlb_flush(rv);
+    csr_raise_event(rv, c);
+
     return out;
 }
 
@@ -215,6 +280,10 @@ static uint32_t csr_csrrs(riscv_t *rv, uint32_t csr, uint32_t val)
 
     *c |= val;
 
+    if (c == &rv->csr_satp || c == &rv->csr_sstatus)
+        dtlb_flush(rv);
+    csr_raise_event(rv, c);
+
     return out;
 }
 
@@ -236,6 +305,10 @@ static uint32_t csr_csrrc(riscv_t *rv, uint32_t csr, uint32_t val)
 
     *c &= ~val;
 
+    if (c == &rv->csr_satp || c == &rv->csr_sstatus)
+        dtlb_flush(rv);
+    csr_raise_event(rv, c);
+
     return out;
 }
 #endif
@@ -265,8 +338,10 @@ void rv_debug(riscv_t *rv)
 #endif /* RV32_HAS(GDBSTUB) */
 
 #if !RV32_HAS(JIT)
-/* hash function for the block map */
-HASH_FUNC_IMPL(map_hash, BLOCK_MAP_CAPACITY_BITS, 1 << BLOCK_MAP_CAPACITY_BITS)
+/* hash function for the block map, whose slots are indexed by the upper bits
+ * of the hash, i.e., map_hash(addr) >> block_map_t::shift
+ */
+HASH_FUNC_IMPL(map_hash, 32, 1ULL << 32)
 #endif
 
 /* allocate a basic block */
@@ -284,26 +359,120 @@ static block_t *block_alloc(riscv_t *rv)
     INIT_LIST_HEAD(&block->list);
 #if RV32_HAS(T2C)
     block->compiled = false;
+    block->recompile = false;
+    block->n_guard_fail = 0;
 #endif
 #endif
     return block;
 }
 
 #if !RV32_HAS(JIT)
-/* insert a block into block map */
-static void block_insert(block_map_t *map, const block_t *block)
+/* number of slots of the former map moved per insertion while growing */
+#define BLOCK_MAP_MOVE_SLOTS 8
+
+/* the slot where the block starting at @addr is placed first */
+#define MAP_HOME(addr, shift) ((uint32_t) map_hash(addr) >> (shift))
+
+/* Place @block in @map of @capacity slots. The map is a Robin Hood hash table:
+ * an entry takes the slot of a resident closer to its own home, which goes on
+ * probing further, so that the probe sequences are kept short and even.
+ */
+static void map_place(block_t **map,
+                      const uint32_t capacity,
+                      const uint32_t shift,
+                      block_t *block)
 {
-    assert(map && block);
-    const uint32_t mask = map->block_capacity - 1;
-    uint32_t index = map_hash(block->pc_start);
+    const uint32_t mask = capacity - 1;
+    uint32_t dist = 0;
+    for (uint32_t i = MAP_HOME(block->pc_start, shift);;
+         i = (i + 1) & mask, dist++) {
+        block_t *resident = map[i];
+        if (!resident) {
+            map[i] = block;
+            return;
+        }
 
-    /* insert into the block map */
-    for (;; index++) {
-        if (!map->map[index & mask]) {
-            map->map[index & mask] = (block_t *) block;
-            break;
+        const uint32_t d = (i - MAP_HOME(resident->pc_start, shift)) & mask;
+        if (d < dist) {
+            map[i] = block;
+            block = resident;
+            dist = d;
         }
     }
+}
+
+static block_t *map_probe(block_t *const *map,
+                          const uint32_t capacity,
+                          const uint32_t shift,
+                          const uint32_t addr)
+{
+    const uint32_t mask = capacity - 1;
+    uint32_t dist = 0;
+    for (uint32_t i = MAP_HOME(addr, shift);; i = (i + 1) & mask, dist++) {
+        block_t *block = map[i];
+        if (!block)
+            return NULL;
+        if (block->pc_start == addr)
+            return block;
+
+        /* @addr would have taken the slot of a resident closer to its home */
+        if (((i - MAP_HOME(block->pc_start, shift)) & mask) < dist)
+            return NULL;
+    }
+}
+
+/* move up to @n slots of the former map into the current one */
+static void block_map_move(block_map_t *map, uint32_t n)
+{
+    for (; n && map->n_moved < map->old_capacity; n--) {
+        block_t *block = map->old_map[map->n_moved++];
+        if (block)
+            map_place(map->map, map->block_capacity, map->shift, block);
+    }
+    if (map->n_moved == map->old_capacity) {
+        free(map->old_map);
+        map->old_map = NULL;
+    }
+}
+
+uint32_t block_map_probe_length(const block_map_t *map, const uint32_t i)
+{
+    const block_t *block = map->map[i];
+    const uint32_t home = MAP_HOME(block->pc_start, map->shift);
+    return ((i - home) & (map->block_capacity - 1)) + 1;
+}
+
+void block_map_settle(block_map_t *map)
+{
+    if (map->old_map)
+        block_map_move(map, map->old_capacity);
+}
+
+/* Double the capacity of the block map. Rather than rehashing every block at
+ * once, the former map is kept and moved by block_insert() a few slots at a
+ * time, and block_find() looks up both maps meanwhile.
+ */
+static void block_map_grow(block_map_t *map)
+{
+    block_map_settle(map);
+    map->old_map = map->map;
+    map->old_capacity = map->block_capacity;
+    map->n_moved = 0;
+
+    map->block_capacity <<= 1;
+    map->shift--;
+    map->map = calloc(map->block_capacity, sizeof(block_t *));
+    assert(map->map);
+    map->n_grows++;
+}
+
+/* insert a block into block map */
+static void block_insert(block_map_t *map, block_t *block)
+{
+    assert(map && block);
+    if (unlikely(map->old_map))
+        block_map_move(map, BLOCK_MAP_MOVE_SLOTS);
+    map_place(map->map, map->block_capacity, map->shift, block);
     map->size++;
 }
 
@@ -311,21 +480,173 @@ static void block_insert(block_map_t *map, const block_t *block)
 static block_t *block_find(const block_map_t *map, const uint32_t addr)
 {
     assert(map);
-    uint32_t index = map_hash(addr);
-    const uint32_t mask = map->block_capacity - 1;
+    block_t *block = map_probe(map->map, map->block_capacity, map->shift, addr);
+    if (!block && unlikely(map->old_map)) {
+        block = map_probe(map->old_map, map->old_capacity, map->shift + 1,
+                          addr);
+    }
+    return block;
+}
+
+/* tell whether a block is about to be dropped from the block map */
+typedef bool (*block_pred_t)(riscv_t *rv, const block_t *block);
+
+/* test whether the block starting with @ir is going to be dropped */
+static bool ir_is_dropped(riscv_t *rv, const rv_insn_t *ir, block_pred_t drop)
+{
+    const block_t *block = block_find(&rv->block_map, ir->pc);
+    return !block || drop(rv, block);
+}
+
+/* Free the blocks for which @drop holds. The other blocks are kept along with
+ * the chaining and the branch history between them, rather than clearing the
+ * whole block map.
+ */
+static void block_map_drop(riscv_t *rv, block_pred_t drop)
+{
+    block_map_t *map = &rv->block_map;
+    block_map_settle(map);
+
+    /* drop the references from the remaining blocks to the dropped ones */
+    for (uint32_t i = 0; i < map->block_capacity; i++) {
+        block_t *block = map->map[i];
+        if (!block || drop(rv, block))
+            continue;
 
-    /* find block in block map */
-    for (;; index++) {
-        block_t *block = map->map[index & mask];
+        rv_insn_cold_t *cold = rv_insn_cold(block->ir_tail);
+        if (cold->branch_taken && ir_is_dropped(rv, cold->branch_taken, drop))
+            cold->branch_taken = NULL;
+        if (cold->branch_untaken &&
+            ir_is_dropped(rv, cold->branch_untaken, drop))
+            cold->branch_untaken = NULL;
+
+        branch_history_table_t *bt = cold->branch_table;
+        if (!bt)
+            continue;
+        for (int j = 0; j < HISTORY_SIZE; j++) {
+            if (bt->target[j] && ir_is_dropped(rv, bt->target[j], drop)) {
+                bt->PC[j] = ~0U;
+                bt->target[j] = NULL;
+            }
+        }
+    }
+
+    /* free the dropped blocks and rebuild the map, the probe sequences of the
+     * remaining blocks may run through the freed slots
+     */
+    block_t **old = map->map;
+    map->map = calloc(map->block_capacity, sizeof(block_t *));
+    assert(map->map);
+    map->size = 0;
+    for (uint32_t i = 0; i < map->block_capacity; i++) {
+        block_t *block = old[i];
         if (!block)
-            return NULL;
+            continue;
 
-        if (block->pc_start == addr)
-            return block;
+        if (drop(rv, block)) {
+            block_ir_free(block);
+            mpool_free(rv->block_mp, block);
+        } else {
+            block_insert(map, block);
+        }
     }
-    return NULL;
+    free(old);
+}
+
+static bool block_is_idle(riscv_t *rv UNUSED, const block_t *block)
+{
+    return !rv_insn_exit(block->ir_tail)->referenced;
+}
+
+/* forget which blocks of @map have been run */
+static void block_map_age(block_map_t *map)
+{
+    for (uint32_t i = 0; i < map->block_capacity; i++) {
+        if (map->map[i])
+            rv_insn_exit(map->map[i]->ir_tail)->referenced = false;
+    }
+}
+
+/* Make room in a block map which cannot grow any further. Like the CLOCK
+ * approximation of LRU, the blocks not run since the map was 5/8 full are
+ * dropped, and the others are given another chance. A block is marked as run
+ * when it is looked up, when it is left through chaining or its branch
+ * history table, and when it is the last one run before returning to
+ * rv_step(), so that chained loops are kept as well.
+ */
+static void block_map_evict(riscv_t *rv)
+{
+    block_map_t *map = &rv->block_map;
+    const uint32_t size = map->size;
+
+    block_map_drop(rv, block_is_idle);
+    map->n_evictions++;
+    map->n_evicted += size - map->size;
+    block_map_age(map);
+
+    /* too many blocks are in use to make room for long, start over */
+    if (map->size * 8 > map->block_capacity * 5)
+        block_map_clear(rv);
+}
+
+#if RV32_HAS(SMC_DETECT)
+/* record that @block holds the @len bytes of code at physical @paddr */
+static void block_add_code(riscv_t *rv,
+                           block_t *block,
+                           const uint32_t paddr,
+                           const uint32_t len)
+{
+    const uint32_t lo = paddr >> RV_PG_SHIFT;
+    const uint32_t hi = (paddr + len - 1) >> RV_PG_SHIFT;
+    for (uint32_t page = lo; page <= hi; page++)
+        rv->code_bitmap[page >> 5] |= 1U << (page & 31);
+
+    if (lo < block->page_lo)
+        block->page_lo = lo;
+    if (hi > block->page_hi)
+        block->page_hi = hi;
+}
+
+#if RV32_HAS(BLOCK_CHAINING) && !RV32_HAS(GDBSTUB)
+/* The exit of @block is optimized for the code of the block starting with
+ * @ir, see optimize_block_exit(). The pages of that block are added to those
+ * of @block, so that @block is invalidated along with it, even once they are
+ * no longer chained.
+ */
+static void block_add_successor(riscv_t *rv,
+                                block_t *block,
+                                const rv_insn_t *ir)
+{
+    const block_t *succ = block_find(&rv->block_map, ir->pc);
+    assert(succ);
+    if (succ->page_lo < block->page_lo)
+        block->page_lo = succ->page_lo;
+    if (succ->page_hi > block->page_hi)
+        block->page_hi = succ->page_hi;
+}
+#endif
+
+/* test whether @block holds code on the pages stored to */
+static bool block_is_stale(riscv_t *rv, const block_t *block)
+{
+    return block->page_lo <= rv->smc_hi && block->page_hi >= rv->smc_lo;
+}
+
+/* invalidate the blocks holding code on the pages stored to, see
+ * code_page_store()
+ */
+static void block_map_invalidate(riscv_t *rv)
+{
+    block_map_drop(rv, block_is_stale);
+
+    /* the remaining blocks have no code on these pages */
+    for (uint32_t page = rv->smc_lo; page <= rv->smc_hi; page++)
+        rv->code_bitmap[page >> 5] &= ~(1U << (page & 31));
+    rv->smc_lo = ~0U;
+    rv->smc_hi = 0;
 }
 #endif
+#endif
 
 #if !RV32_HAS(EXT_C)
 FORCE_INLINE bool insn_is_misaligned(uint32_t pc)
@@ -352,9 +673,9 @@ enum {
 
 #if RV32_HAS(GDBSTUB)
 #define RVOP_NO_NEXT(ir) \
-    (!ir->next | rv->debug_mode IIF(RV32_HAS(SYSTEM))(| rv->is_trapped, ))
+    (ir->tail | rv->debug_mode IIF(RV32_HAS(SYSTEM))(| rv->is_trapped, ))
 #else
-#define RVOP_NO_NEXT(ir) (!ir->next IIF(RV32_HAS(SYSTEM))(| rv->is_trapped, ))
+#define RVOP_NO_NEXT(ir) (ir->tail IIF(RV32_HAS(SYSTEM))(| rv->is_trapped, ))
 #endif
 
 /* record whether the branch is taken or not during emulation */
@@ -370,165 +691,278 @@ static bool has_loops = false;
 
 #if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
 extern void emu_update_uart_interrupts(riscv_t *rv);
-static uint32_t peripheral_update_ctr = 64;
+extern void emu_update_vblk_interrupts(riscv_t *rv);
+extern void emu_update_vnet_interrupts(riscv_t *rv);
+extern void emu_update_vcon_interrupts(riscv_t *rv);
+static void rv_wait_for_interrupt(riscv_t *rv);
+#else
+/* no interrupt to wait for */
+static inline void rv_wait_for_interrupt(riscv_t *rv UNUSED) {}
+#endif
+
+/* shared by SLLI, SRLI, SRAI and the fused shift operation */
+FORCE_INLINE void shift_func(riscv_t *rv, const rv_insn_t *ir)
+{
+    switch (ir->opcode) {
+    case rv_insn_slli:
+        rv->X[ir->rd] = rv->X[ir->rs1] << (ir->imm & 0x1f);
+        break;
+    case rv_insn_srli:
+        rv->X[ir->rd] = rv->X[ir->rs1] >> (ir->imm & 0x1f);
+        break;
+    case rv_insn_srai:
+        rv->X[ir->rd] = ((int32_t) rv->X[ir->rs1]) >> (ir->imm & 0x1f);
+        break;
+    default:
+        __UNREACHABLE;
+        break;
+    }
+}
+
+/* Interpreter-based execution path
+ *
+ * Two dispatch engines share the handlers in rv32_template.c. By default,
+ * each instruction is a standalone function and RVOP_CHAIN tail-calls the
+ * handler of the following instruction. With THREADED_CODE, all handlers are
+ * expanded as labelled blocks inside do_threaded() and RVOP_CHAIN jumps to
+ * the next one through a label table (GNU "labels as values"), which keeps
+ * rv, ir, cycle and PC in host registers across the whole block. It does not
+ * depend on the compiler turning the chaining into tail calls, which GCC
+ * without 'musttail' only does when optimizing.
+ */
+#if RV32_HAS(THREADED_CODE)
+#define RVOP_CHAIN(target)                 \
+    do {                                   \
+        ir = (target);                     \
+        goto *dispatch_labels[ir->opcode]; \
+    } while (0)
+#else
+#define RVOP_CHAIN(target) \
+    MUST_TAIL return (target)->impl(rv, (target), cycle, PC)
+#endif
+
+/* leave the block of @ir for the block starting at @target, which is the same
+ * as chaining, but marks the block as run for block_map_evict()
+ */
+#if !RV32_HAS(JIT)
+#define RVOP_CHAIN_EXIT(target)              \
+    do {                                     \
+        rv_insn_exit(ir)->referenced = true; \
+        RVOP_CHAIN(target);                  \
+    } while (0)
+#else
+#define RVOP_CHAIN_EXIT(target) RVOP_CHAIN(target)
 #endif
 
-/* Interpreter-based execution path */
+#define RVOP_BODY(inst, code)                       \
+    IIF(RV32_HAS(SYSTEM))                           \
+    (IIF(RV32_HAS(HOST_TIMER))(, rv->timer++;), );  \
+    cycle++;                                        \
+    code;                                           \
+    IIF(RV32_HAS(SYSTEM))                           \
+    (                                               \
+        if (need_handle_signal) {                   \
+            need_handle_signal = false;             \
+            return true;                            \
+        }, ) nextop : PC += __rv_insn_##inst##_len; \
+    IIF(RV32_HAS(SYSTEM))                           \
+    (IIF(RV32_HAS(JIT))(                            \
+         , if (unlikely(need_clear_block_map)) {    \
+             block_map_clear(rv);                   \
+             need_clear_block_map = false;          \
+             rv->csr_cycle = cycle;                 \
+             rv->PC = PC;                           \
+             return false;                          \
+         }), );                                     \
+    if (unlikely(RVOP_NO_NEXT(ir)))                 \
+        goto end_op;                                \
+    RVOP_CHAIN(ir + 1);                             \
+    end_op:                                         \
+    rv->csr_cycle = cycle;                          \
+    rv->PC = PC;                                    \
+    return true;
+
+/* fused operations account for cycles and PC by themselves */
+#define RVOP_FUSE_BODY(code)            \
+    code;                               \
+    IIF(RV32_HAS(SYSTEM))               \
+    (                                   \
+        if (need_handle_signal) {       \
+            need_handle_signal = false; \
+            return true;                \
+        }, );                           \
+    if (unlikely(RVOP_NO_NEXT(ir))) {   \
+        rv->csr_cycle = cycle;          \
+        rv->PC = PC;                    \
+        return true;                    \
+    }                                   \
+    RVOP_CHAIN(ir + 1);
+
+#if RV32_HAS(THREADED_CODE)
+/* every handler becomes a block with its own 'nextop' and 'end_op' labels */
+#define RVOP(inst, code, asm)     \
+    op_##inst : {                 \
+        __label__ nextop, end_op; \
+        RVOP_BODY(inst, code)     \
+    }
+
+#define RVOP_FUSE(inst, code) \
+    op_##inst : {             \
+        RVOP_FUSE_BODY(code)  \
+    }
+
+static bool do_threaded(riscv_t *rv,
+                        const rv_insn_t *ir,
+                        uint64_t cycle,
+                        uint32_t PC)
+{
+    /* clang-format off */
+    static const void *const dispatch_labels[] = {
+#define _(inst, can_branch, insn_len, translatable, reg_mask) [rv_insn_##inst] = &&op_##inst,
+        RV_INSN_LIST
+#undef _
+#define _(inst) [rv_insn_##inst] = &&op_##inst,
+        FUSE_INSN_LIST
+#undef _
+    };
+    /* clang-format on */
+
+    goto *dispatch_labels[ir->opcode];
+#else
 #define RVOP(inst, code, asm)                                               \
     static bool do_##inst(riscv_t *rv, const rv_insn_t *ir, uint64_t cycle, \
                           uint32_t PC)                                      \
     {                                                                       \
-        IIF(RV32_HAS(SYSTEM))(rv->timer++;, ) cycle++;                      \
-        code;                                                               \
-        IIF(RV32_HAS(SYSTEM))                                               \
-        (                                                                   \
-            if (need_handle_signal) {                                       \
-                need_handle_signal = false;                                 \
-                return true;                                                \
-            }, ) nextop : PC += __rv_insn_##inst##_len;                     \
-        IIF(RV32_HAS(SYSTEM))                                               \
-        (IIF(RV32_HAS(JIT))(                                                \
-             , if (unlikely(need_clear_block_map)) {                        \
-                 block_map_clear(rv);                                       \
-                 need_clear_block_map = false;                              \
-                 rv->csr_cycle = cycle;                                     \
-                 rv->PC = PC;                                               \
-                 return false;                                              \
-             }), );                                                         \
-        if (unlikely(RVOP_NO_NEXT(ir)))                                     \
-            goto end_op;                                                    \
-        const rv_insn_t *next = ir->next;                                   \
-        MUST_TAIL return next->impl(rv, next, cycle, PC);                   \
-    end_op:                                                                 \
-        rv->csr_cycle = cycle;                                              \
-        rv->PC = PC;                                                        \
-        return true;                                                        \
+        RVOP_BODY(inst, code)                                               \
+    }
+
+#define RVOP_FUSE(inst, code)                                               \
+    static bool do_##inst(riscv_t *rv, const rv_insn_t *ir, uint64_t cycle, \
+                          uint32_t PC)                                      \
+    {                                                                       \
+        RVOP_FUSE_BODY(code)                                                \
     }
+#endif
 
 #include "rv32_template.c"
 #undef RVOP
 
 /* multiple LUI */
-static bool do_fuse1(riscv_t *rv,
-                     const rv_insn_t *ir,
-                     uint64_t cycle,
-                     uint32_t PC)
-{
-    cycle += ir->imm2;
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++)
+RVOP_FUSE(fuse1, {
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    cycle += cold->imm2;
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++)
         rv->X[fuse[i].rd] = fuse[i].imm;
-    PC += ir->imm2 * 4;
-    if (unlikely(RVOP_NO_NEXT(ir))) {
-        rv->csr_cycle = cycle;
-        rv->PC = PC;
-        return true;
-    }
-    const rv_insn_t *next = ir->next;
-    MUST_TAIL return next->impl(rv, next, cycle, PC);
-}
+    PC += cold->imm2 * 4;
+})
 
 /* LUI + ADD */
-static bool do_fuse2(riscv_t *rv,
-                     const rv_insn_t *ir,
-                     uint64_t cycle,
-                     uint32_t PC)
-{
+RVOP_FUSE(fuse2, {
     cycle += 2;
     rv->X[ir->rd] = ir->imm;
     rv->X[ir->rs2] = rv->X[ir->rd] + rv->X[ir->rs1];
     PC += 8;
-    if (unlikely(RVOP_NO_NEXT(ir))) {
-        rv->csr_cycle = cycle;
-        rv->PC = PC;
-        return true;
-    }
-    const rv_insn_t *next = ir->next;
-    MUST_TAIL return next->impl(rv, next, cycle, PC);
-}
+})
 
 /* multiple SW */
-static bool do_fuse3(riscv_t *rv,
-                     const rv_insn_t *ir,
-                     uint64_t cycle,
-                     uint32_t PC)
-{
-    cycle += ir->imm2;
-    opcode_fuse_t *fuse = ir->fuse;
+RVOP_FUSE(fuse3, {
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    cycle += cold->imm2;
+    opcode_fuse_t *fuse = cold->fuse;
     /* The memory addresses of the sw instructions are contiguous, thus only
      * the first SW instruction needs to be checked to determine if its memory
      * address is misaligned or if the memory chunk does not exist.
      */
-    for (int i = 0; i < ir->imm2; i++) {
+    for (int i = 0; i < cold->imm2; i++) {
         uint32_t addr = rv->X[fuse[i].rs1] + fuse[i].imm;
         RV_EXC_MISALIGN_HANDLER(3, STORE, false, 1);
         rv->io.mem_write_w(rv, addr, rv->X[fuse[i].rs2]);
     }
-    PC += ir->imm2 * 4;
-    if (unlikely(RVOP_NO_NEXT(ir))) {
-        rv->csr_cycle = cycle;
-        rv->PC = PC;
-        return true;
-    }
-    const rv_insn_t *next = ir->next;
-    MUST_TAIL return next->impl(rv, next, cycle, PC);
-}
+    PC += cold->imm2 * 4;
+    RV_SMC_EXIT(0);
+})
 
 /* multiple LW */
-static bool do_fuse4(riscv_t *rv,
-                     const rv_insn_t *ir,
-                     uint64_t cycle,
-                     uint32_t PC)
-{
-    cycle += ir->imm2;
-    opcode_fuse_t *fuse = ir->fuse;
+RVOP_FUSE(fuse4, {
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    cycle += cold->imm2;
+    opcode_fuse_t *fuse = cold->fuse;
     /* The memory addresses of the lw instructions are contiguous, therefore
      * only the first LW instruction needs to be checked to determine if its
      * memory address is misaligned or if the memory chunk does not exist.
      */
-    for (int i = 0; i < ir->imm2; i++) {
+    for (int i = 0; i < cold->imm2; i++) {
         uint32_t addr = rv->X[fuse[i].rs1] + fuse[i].imm;
         RV_EXC_MISALIGN_HANDLER(3, LOAD, false, 1);
         rv->X[fuse[i].rd] = rv->io.mem_read_w(rv, addr);
     }
-    PC += ir->imm2 * 4;
-    if (unlikely(RVOP_NO_NEXT(ir))) {
-        rv->csr_cycle = cycle;
-        rv->PC = PC;
-        return true;
-    }
-    const rv_insn_t *next = ir->next;
-    MUST_TAIL return next->impl(rv, next, cycle, PC);
-}
+    PC += cold->imm2 * 4;
+})
 
 /* multiple shift immediate */
-static bool do_fuse5(riscv_t *rv,
-                     const rv_insn_t *ir,
-                     uint64_t cycle,
-                     uint32_t PC)
-{
-    cycle += ir->imm2;
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++)
+RVOP_FUSE(fuse5, {
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    cycle += cold->imm2;
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++)
         shift_func(rv, (const rv_insn_t *) (&fuse[i]));
-    PC += ir->imm2 * 4;
-    if (unlikely(RVOP_NO_NEXT(ir))) {
-        rv->csr_cycle = cycle;
-        rv->PC = PC;
-        return true;
-    }
-    const rv_insn_t *next = ir->next;
-    MUST_TAIL return next->impl(rv, next, cycle, PC);
-}
+    PC += cold->imm2 * 4;
+})
+
+/* LUI + LW, loading from an address known at translation time, which is how
+ * AUIPC + LW reaches here after constant propagation.
+ */
+RVOP_FUSE(fuse6, {
+    cycle += 2;
+    rv->X[ir->rs1] = rv_insn_cold(ir)->fuse[0].imm;
+    rv->X[ir->rd] = rv->io.mem_read_w(rv, ir->imm);
+    PC += 8;
+})
+
+/* SLLI + ADD, indexing an array */
+RVOP_FUSE(fuse7, {
+    cycle += 2;
+    rv->X[ir->rd] = (rv->X[ir->rs1] << (ir->imm & 0x1f)) + rv->X[ir->rs2];
+    PC += 8;
+})
+
+/* LB/LBU + ANDI 0xff, i.e., a zero-extended byte load */
+RVOP_FUSE(fuse8, {
+    cycle += 2;
+    const uint32_t addr = rv->X[ir->rs1] + ir->imm;
+    rv->X[ir->rd] = rv->io.mem_read_b(rv, addr);
+    PC += 8;
+})
+
+/* LH/LHU + SLLI 16 + SRLI 16, i.e., a zero-extended halfword load */
+RVOP_FUSE(fuse9, {
+    cycle++;
+    const uint32_t addr = rv->X[ir->rs1] + ir->imm;
+    RV_EXC_MISALIGN_HANDLER(1, LOAD, false, 1);
+    rv->X[ir->rd] = rv->io.mem_read_s(rv, addr);
+    cycle += 2;
+    PC += 12;
+})
+#undef RVOP_FUSE
+
+#if RV32_HAS(THREADED_CODE)
+} /* do_threaded */
+
+/* all instructions enter the threaded engine, which dispatches on opcode */
+#define RVOP_IMPL(inst) do_threaded
+#else
+#define RVOP_IMPL(inst) do_##inst
+#endif
 
 /* clang-format off */
 static const void *dispatch_table[] = {
     /* RV32 instructions */
-#define _(inst, can_branch, insn_len, translatable, reg_mask) [rv_insn_##inst] = do_##inst,
+#define _(inst, can_branch, insn_len, translatable, reg_mask) [rv_insn_##inst] = RVOP_IMPL(inst),
     RV_INSN_LIST
 #undef _
     /* Macro operation fusion instructions */
-#define _(inst) [rv_insn_##inst] = do_##inst,
+#define _(inst) [rv_insn_##inst] = RVOP_IMPL(inst),
     FUSE_INSN_LIST
 #undef _
 };
@@ -619,22 +1053,182 @@ FORCE_INLINE bool insn_is_indirect_branch(uint8_t opcode)
     }
 }
 
+/* Allocate the IR array of n instructions, n_cold of which have a cold
+ * record, see rv_insn_t for the layout.
+ */
+static rv_insn_t *block_ir_alloc(uint32_t n, uint32_t n_cold)
+{
+    rv_insn_cold_t **ref =
+        malloc(n * (sizeof(rv_insn_cold_t *) + sizeof(rv_insn_t)) +
+               n_cold * sizeof(rv_insn_cold_t));
+    assert(ref);
+    return (rv_insn_t *) (ref + n);
+}
+
+/* the reference to the cold record of the i-th instruction from @head */
+static inline rv_insn_cold_t **block_ir_ref(rv_insn_t *head, uint32_t i)
+{
+    return (rv_insn_cold_t **) head - i - 1;
+}
+
+void block_ir_free(block_t *block)
+{
+    for (uint32_t i = 0; i < block->n_insn; i++) {
+        rv_insn_cold_t *cold = *block_ir_ref(block->ir_head, i);
+        if (!cold)
+            continue;
+        free(cold->fuse);
+        free(cold->branch_table);
+    }
+    free(block_ir_ref(block->ir_head, block->n_insn - 1));
+}
+
+/* The block under translation is built in a scratch IR array, which is reused
+ * across translations. Every instruction in it has a cold record. Once the
+ * block is optimized, block_ir_commit() moves it into an array of the exact
+ * size, keeping only the cold records in use.
+ */
+static rv_insn_t *ir_scratch = NULL;
+static uint32_t ir_scratch_capacity = 0;
+
+/* Attach the i-th cold record of the scratch array to its i-th instruction.
+ * Fusion moves the references along with the instructions, see
+ * remove_next_nth_ir(), hence they are attached again on each translation.
+ */
+static rv_insn_cold_t *ir_scratch_cold(uint32_t i)
+{
+    rv_insn_cold_t *cold =
+        (rv_insn_cold_t *) (ir_scratch + ir_scratch_capacity);
+    *block_ir_ref(ir_scratch, i) = cold + i;
+    return cold + i;
+}
+
+static rv_insn_t *ir_scratch_reserve(uint32_t n)
+{
+    if (likely(n <= ir_scratch_capacity))
+        return ir_scratch;
+
+    uint32_t capacity = ir_scratch_capacity ? ir_scratch_capacity : 64;
+    while (capacity < n)
+        capacity <<= 1;
+    rv_insn_t *ir = block_ir_alloc(capacity, capacity);
+    rv_insn_cold_t *cold = (rv_insn_cold_t *) (ir + capacity);
+    if (ir_scratch) {
+        memcpy(ir, ir_scratch, ir_scratch_capacity * sizeof(rv_insn_t));
+        for (uint32_t i = 0; i < ir_scratch_capacity; i++)
+            cold[i] = **block_ir_ref(ir_scratch, i);
+        free(block_ir_ref(ir_scratch, ir_scratch_capacity - 1));
+    }
+    ir_scratch = ir;
+    ir_scratch_capacity = capacity;
+    for (uint32_t i = 0; i < capacity; i++)
+        *block_ir_ref(ir, i) = cold + i;
+    return ir;
+}
+
+/* Only the final instruction, which may branch, and the fused ones carry
+ * data in their cold records.
+ */
+static inline bool ir_has_cold(const rv_insn_t *ir)
+{
+    return ir->tail || rv_insn_cold(ir)->fuse;
+}
+
+static void block_ir_commit(block_t *block)
+{
+    rv_insn_t *src = block->ir_head;
+    uint32_t n_cold = 0;
+    for (uint32_t i = 0; i < block->n_insn; i++)
+        n_cold += ir_has_cold(src + i);
+
+    rv_insn_t *ir = block_ir_alloc(block->n_insn, n_cold);
+    memcpy(ir, src, block->n_insn * sizeof(rv_insn_t));
+    /* the cold record of the final instruction comes first */
+    rv_insn_cold_t *cold = rv_insn_exit(ir + block->n_insn - 1);
+    *cold = *rv_insn_cold(block->ir_tail);
+    *block_ir_ref(ir, block->n_insn - 1) = cold++;
+    for (uint32_t i = 0; i < block->n_insn - 1; i++) {
+        rv_insn_cold_t **ref = block_ir_ref(ir, i);
+        *ref = NULL;
+        if (ir_has_cold(src + i)) {
+            *cold = *rv_insn_cold(src + i);
+            *ref = cold++;
+        }
+    }
+    block->ir_head = ir;
+    block->ir_tail = ir + block->n_insn - 1;
+}
+
+#if RV32_HAS(SYSTEM)
+extern uint32_t mmu_ifetch_paddr(riscv_t *rv,
+                                 const uint32_t vaddr,
+                                 uint32_t *paddr);
+
+/* virtual page number and physical address of the last instruction fetched by
+ * block_fetch(), the page number is ~0U if there is none
+ */
+static uint32_t fetch_vpage = ~0U, fetch_paddr;
+#endif
+
+/* Fetch the instruction at @pc for translation and store its physical address
+ * in @paddr. Under SYSTEM, the page table is walked once per page of the block
+ * being translated rather than once per instruction.
+ */
+static uint32_t block_fetch(riscv_t *rv, uint32_t pc, uint32_t *paddr)
+{
+#if RV32_HAS(SYSTEM)
+    const uint32_t offset = pc & (RV_PG_SIZE - 1);
+    if ((pc >> RV_PG_SHIFT) == fetch_vpage && offset <= RV_PG_SIZE - 4) {
+        *paddr = (fetch_paddr & ~(RV_PG_SIZE - 1)) | offset;
+        return memory_ifetch(*paddr);
+    }
+
+    const uint32_t insn = mmu_ifetch_paddr(rv, pc, paddr);
+    fetch_vpage = insn ? pc >> RV_PG_SHIFT : ~0U;
+    fetch_paddr = *paddr;
+    return insn;
+#else
+    *paddr = pc;
+    return rv->io.mem_ifetch(rv, pc);
+#endif
+}
+
+/* decode @insn fetched from @paddr, reusing the previous decoding if any */
+FORCE_INLINE bool insn_decode(riscv_t *rv UNUSED,
+                              rv_insn_t *ir,
+                              uint32_t insn,
+                              uint32_t paddr UNUSED)
+{
+#if RV32_HAS(DECODE_CACHE)
+    return rv_decode_cached(rv->decode_cache, ir, insn, paddr);
+#else
+    return rv_decode(ir, insn);
+#endif
+}
+
 static void block_translate(riscv_t *rv, block_t *block)
 {
 retranslate:
     block->pc_start = block->pc_end = rv->PC;
-
-    rv_insn_t *prev_ir = NULL;
-    rv_insn_t *ir = mpool_calloc(rv->block_ir_mp);
-    block->ir_head = ir;
+#if RV32_HAS(SYSTEM)
+    /* the page tables may have changed since the last block */
+    fetch_vpage = ~0U;
+#endif
+#if RV32_HAS(SMC_DETECT)
+    block->page_lo = ~0U;
+    block->page_hi = 0;
+#endif
 
     /* translate the basic block */
     while (true) {
-        if (prev_ir)
-            prev_ir->next = ir;
+        rv_insn_t *ir = ir_scratch_reserve(block->n_insn + 1) + block->n_insn;
+        memset(ir, 0, sizeof(rv_insn_t));
+        ir->idx = block->n_insn;
+        memset(ir_scratch_cold(ir->idx), 0, sizeof(rv_insn_cold_t));
 
         /* fetch the next instruction */
-        uint32_t insn = rv->io.mem_ifetch(rv, block->pc_end);
+        uint32_t paddr;
+        uint32_t insn = block_fetch(rv, block->pc_end, &paddr);
 
 #if RV32_HAS(SYSTEM)
         if (!insn && need_retranslate) {
@@ -647,7 +1241,7 @@ retranslate:
         assert(insn);
 
         /* decode the instruction */
-        if (!rv_decode(ir, insn)) {
+        if (!insn_decode(rv, ir, insn, paddr)) {
             rv->compressed = is_compressed(insn);
             SET_CAUSE_AND_TVAL_THEN_TRAP(rv, ILLEGAL_INSN, insn);
             break;
@@ -655,8 +1249,10 @@ retranslate:
         ir->impl = dispatch_table[ir->opcode];
         ir->pc = block->pc_end; /* compute the end of pc */
         block->pc_end += is_compressed(insn) ? 2 : 4;
+#if RV32_HAS(SMC_DETECT)
+        block_add_code(rv, block, paddr, is_compressed(insn) ? 2 : 4);
+#endif
         block->n_insn++;
-        prev_ir = ir;
 #if RV32_HAS(JIT)
         if (!insn_is_translatable(ir->opcode))
             block->translatable = false;
@@ -664,155 +1260,319 @@ retranslate:
         /* stop on branch */
         if (insn_is_branch(ir->opcode)) {
             if (insn_is_indirect_branch(ir->opcode)) {
-                ir->branch_table = calloc(1, sizeof(branch_history_table_t));
-                assert(ir->branch_table);
-                memset(ir->branch_table->PC, -1,
+                rv_insn_cold_t *cold = rv_insn_cold(ir);
+                cold->branch_table = calloc(1, sizeof(branch_history_table_t));
+                assert(cold->branch_table);
+                memset(cold->branch_table->PC, -1,
                        sizeof(uint32_t) * HISTORY_SIZE);
             }
             break;
         }
 
-        ir = mpool_calloc(rv->block_ir_mp);
-    }
-
-    assert(prev_ir);
-    block->ir_tail = prev_ir;
-    block->ir_tail->next = NULL;
-}
-
-#if RV32_HAS(MOP_FUSION)
-#define COMBINE_MEM_OPS(RW)                                       \
-    next_ir = ir->next;                                           \
-    count = 1;                                                    \
-    while (1) {                                                   \
-        if (next_ir->opcode != IIF(RW)(rv_insn_lw, rv_insn_sw))   \
-            break;                                                \
-        count++;                                                  \
-        if (!next_ir->next)                                       \
-            break;                                                \
-        next_ir = next_ir->next;                                  \
-    }                                                             \
-    if (count > 1) {                                              \
-        ir->opcode = IIF(RW)(rv_insn_fuse4, rv_insn_fuse3);       \
-        ir->fuse = malloc(count * sizeof(opcode_fuse_t));         \
-        assert(ir->fuse);                                         \
-        ir->imm2 = count;                                         \
-        memcpy(ir->fuse, ir, sizeof(opcode_fuse_t));              \
-        ir->impl = dispatch_table[ir->opcode];                    \
-        next_ir = ir->next;                                       \
-        for (int j = 1; j < count; j++, next_ir = next_ir->next)  \
-            memcpy(ir->fuse + j, next_ir, sizeof(opcode_fuse_t)); \
-        remove_next_nth_ir(rv, ir, block, count - 1);             \
-    }
-
-static inline void remove_next_nth_ir(const riscv_t *rv,
-                                      rv_insn_t *ir,
+        /* The length of a block is bounded by the width of rv_insn_t::idx.
+         * The remaining instructions form the next block. The JIT compilers
+         * expect a block to end with a branch, so they leave this one alone.
+         */
+        if (unlikely(block->n_insn == 1U << RV_INSN_IDX_BITS)) {
+#if RV32_HAS(JIT)
+            block->translatable = false;
+#endif
+            break;
+        }
+    }
+
+    assert(block->n_insn);
+    block->ir_head = ir_scratch;
+    block->ir_tail = ir_scratch + block->n_insn - 1;
+    block->ir_tail->tail = true;
+}
+
+#if RV32_HAS(MOP_FUSION)
+static inline void remove_next_nth_ir(rv_insn_t *ir,
                                       block_t *block,
-                                      uint8_t n)
+                                      uint32_t n)
 {
-    for (uint8_t i = 0; i < n; i++) {
-        rv_insn_t *next = ir->next;
-        ir->next = ir->next->next;
-        mpool_free(rv->block_ir_mp, next);
-    }
-    if (!ir->next)
-        block->ir_tail = ir;
+    rv_insn_t *head = block->ir_head;
+    uint32_t pos = ir - head + 1, n_moved = block->n_insn - pos - n;
+    memmove(head + pos, head + pos + n, n_moved * sizeof(rv_insn_t));
+    /* the references to cold records are in reverse order, see rv_insn_t */
+    memmove(block_ir_ref(head, pos + n_moved - 1),
+            block_ir_ref(head, pos + n + n_moved - 1),
+            n_moved * sizeof(rv_insn_cold_t *));
     block->n_insn -= n;
+    for (uint32_t i = pos; i < block->n_insn; i++)
+        head[i].idx = i;
+    block->ir_tail = head + block->n_insn - 1;
+    block->ir_tail->tail = true;
 }
 
-/* Check if instructions in a block match a specific pattern. If they do,
- * rewrite them as fused instructions.
- *
- * Strategies are being devised to increase the number of instructions that
- * match the pattern, including possible instruction reordering.
+/* Replace the n instructions starting at @ir with the fused operation
+ * @opcode. The original instructions are kept in the cold record, where the
+ * handlers of runs and the code generators find them, see rv_insn_unfuse().
+ */
+static void mop_fuse(block_t *block, rv_insn_t *ir, uint32_t n, uint8_t opcode)
+{
+    rv_insn_cold_t *cold = rv_insn_cold(ir);
+    cold->fuse = malloc(n * sizeof(opcode_fuse_t));
+    assert(cold->fuse);
+    for (uint32_t i = 0; i < n; i++) {
+        cold->fuse[i] = (opcode_fuse_t){
+            .imm = ir[i].imm,
+            .rd = ir[i].rd,
+            .rs1 = ir[i].rs1,
+            .rs2 = ir[i].rs2,
+            .opcode = ir[i].opcode,
+        };
+    }
+    cold->imm2 = n;
+    ir->opcode = opcode;
+    ir->impl = dispatch_table[ir->opcode];
+    remove_next_nth_ir(ir, block, n - 1);
+}
+
+/* LUI + ADD, where ADD consumes the constant */
+static bool mop_match_lui_add(const rv_insn_t *ir)
+{
+    return ir[0].rd == ir[1].rs1 || ir[0].rd == ir[1].rs2;
+}
+
+static void mop_rewrite_lui_add(rv_insn_t *ir)
+{
+    const opcode_fuse_t *fuse = rv_insn_cold(ir)->fuse;
+    ir->rs1 = fuse[0].rd == fuse[1].rs2 ? fuse[1].rs1 : fuse[1].rs2;
+    ir->rs2 = fuse[1].rd;
+}
+
+/* LUI + LW from the constant, whose address must be aligned so that fuse6
+ * does not need to check it.
+ */
+static bool mop_match_lui_lw(const rv_insn_t *ir)
+{
+    return ir[0].rd == ir[1].rs1 && ir[1].rd != rv_reg_zero &&
+           !((ir[0].imm + ir[1].imm) & 3);
+}
+
+static void mop_rewrite_lui_lw(rv_insn_t *ir)
+{
+    const opcode_fuse_t *fuse = rv_insn_cold(ir)->fuse;
+    ir->imm = fuse[0].imm + fuse[1].imm;
+    ir->rs1 = fuse[0].rd;
+    ir->rd = fuse[1].rd;
+}
+
+/* LUI + JALR through the constant, i.e., AUIPC + JALR for a far call or a
+ * tail call. The target is known, hence JALR turns into JAL, which the block
+ * chaining and the JIT compilers resolve without the branch history table.
+ * C.JR turns into C.J instead, as it does not link and its decoding sets rd
+ * to rs1. C.JALR links to pc + 2 and is left alone.
+ */
+static bool mop_match_lui_jalr(const rv_insn_t *ir)
+{
+    return ir[0].rd == ir[1].rs1;
+}
+
+static void mop_rewrite_lui_jalr(rv_insn_t *ir)
+{
+    rv_insn_t *jalr = ir + 1;
+    rv_insn_cold_t *cold = rv_insn_cold(jalr);
+    jalr->imm = ((ir->imm + jalr->imm) & ~1U) - jalr->pc;
+#if RV32_HAS(EXT_C)
+    jalr->opcode = jalr->opcode == rv_insn_cjr ? rv_insn_cj : rv_insn_jal;
+#else
+    jalr->opcode = rv_insn_jal;
+#endif
+    jalr->impl = dispatch_table[jalr->opcode];
+    free(cold->branch_table);
+    cold->branch_table = NULL;
+}
+
+/* SLLI + ADD of the shifted value to another register, in place */
+static bool mop_match_slli_add(const rv_insn_t *ir)
+{
+    return ir[0].rd == ir[1].rd &&
+           (ir[0].rd == ir[1].rs1) != (ir[0].rd == ir[1].rs2);
+}
+
+static void mop_rewrite_slli_add(rv_insn_t *ir)
+{
+    const opcode_fuse_t *fuse = rv_insn_cold(ir)->fuse;
+    ir->rs2 = fuse[0].rd == fuse[1].rs1 ? fuse[1].rs2 : fuse[1].rs1;
+}
+
+/* SLT/SLTU + BEQZ/BNEZ on the result. The branch compares the operands of
+ * SLT/SLTU directly, which removes the dependency between the two, while
+ * SLT/SLTU is kept for its result. The compressed branches are shorter than
+ * their replacement and are left alone.
+ */
+static bool mop_match_slt_branch(const rv_insn_t *ir)
+{
+    const rv_insn_t *br = ir + 1;
+    if (ir->rd == ir->rs1 || ir->rd == ir->rs2)
+        return false;
+    return (br->rs1 == ir->rd && IF_rs2(br, zero)) ||
+           (br->rs2 == ir->rd && IF_rs1(br, zero));
+}
+
+static void mop_rewrite_slt_branch(rv_insn_t *ir)
+{
+    rv_insn_t *br = ir + 1;
+    if (IF_insn(ir, slt))
+        br->opcode = IF_insn(br, bne) ? rv_insn_blt : rv_insn_bge;
+    else
+        br->opcode = IF_insn(br, bne) ? rv_insn_bltu : rv_insn_bgeu;
+    br->rs1 = ir->rs1;
+    br->rs2 = ir->rs2;
+    br->impl = dispatch_table[br->opcode];
+}
+
+/* LB/LBU + ANDI 0xff on the loaded register */
+static bool mop_match_lb_zext(const rv_insn_t *ir)
+{
+    return ir[1].rd == ir[0].rd && ir[1].rs1 == ir[0].rd && ir[1].imm == 0xff;
+}
+
+/* LH/LHU + SLLI 16 + SRLI 16 on the loaded register */
+static bool mop_match_lh_zext(const rv_insn_t *ir)
+{
+    for (int i = 1; i < 3; i++) {
+        if (ir[i].rd != ir[0].rd || ir[i].rs1 != ir[0].rd ||
+            (ir[i].imm & 0x1f) != 16)
+            return false;
+    }
+    return true;
+}
+
+#define MOP_SLOT_MAX 3
+#define MOP_SLOT_WIDTH 4
+
+/* A pattern is a sequence of instructions, each of which is one of the
+ * opcodes listed in its slot (rv_insn_nop terminates a short list). A pattern
+ * without slot count is a run of at least two instructions from the first
+ * slot. On a match, the instructions are replaced with the fused operation,
+ * if any, and then handed to the rewrite hook.
+ */
+typedef struct {
+    uint8_t n_slot;
+    uint8_t slot[MOP_SLOT_MAX][MOP_SLOT_WIDTH];
+    bool (*match)(const rv_insn_t *ir);
+    uint8_t fused;
+    void (*rewrite)(rv_insn_t *ir);
+} mop_pattern_t;
+
+/* Constant propagation runs first. It turns AUIPC into LUI and folds the
+ * ADDI of LUI + ADDI and AUIPC + ADDI, hence these idioms show up here as a
+ * run of LUI or as LUI followed by the user of the constant.
+ */
+static const mop_pattern_t mop_patterns[] = {
+    [mop_lui_add] = {
+        .n_slot = 2,
+        .slot = {{rv_insn_lui}, {rv_insn_add}},
+        .match = mop_match_lui_add,
+        .fused = rv_insn_fuse2,
+        .rewrite = mop_rewrite_lui_add,
+    },
+    [mop_lui_lw] = {
+        .n_slot = 2,
+        .slot = {{rv_insn_lui}, {rv_insn_lw}},
+        .match = mop_match_lui_lw,
+        .fused = rv_insn_fuse6,
+        .rewrite = mop_rewrite_lui_lw,
+    },
+    [mop_lui_jalr] = {
+        .n_slot = 2,
+#if RV32_HAS(EXT_C)
+        .slot = {{rv_insn_lui}, {rv_insn_jalr, rv_insn_cjr}},
+#else
+        .slot = {{rv_insn_lui}, {rv_insn_jalr}},
+#endif
+        .match = mop_match_lui_jalr,
+        .rewrite = mop_rewrite_lui_jalr,
+    },
+    [mop_lui_run] = {
+        .slot = {{rv_insn_lui}},
+        .fused = rv_insn_fuse1,
+    },
+    [mop_sw_run] = {
+        .slot = {{rv_insn_sw}},
+        .fused = rv_insn_fuse3,
+    },
+    [mop_lw_run] = {
+        .slot = {{rv_insn_lw}},
+        .fused = rv_insn_fuse4,
+    },
+    [mop_slli_add] = {
+        .n_slot = 2,
+        .slot = {{rv_insn_slli}, {rv_insn_add}},
+        .match = mop_match_slli_add,
+        .fused = rv_insn_fuse7,
+        .rewrite = mop_rewrite_slli_add,
+    },
+    [mop_shift_run] = {
+        .slot = {{rv_insn_slli, rv_insn_srli, rv_insn_srai}},
+        .fused = rv_insn_fuse5,
+    },
+    [mop_slt_branch] = {
+        .n_slot = 2,
+        .slot = {{rv_insn_slt, rv_insn_sltu}, {rv_insn_beq, rv_insn_bne}},
+        .match = mop_match_slt_branch,
+        .rewrite = mop_rewrite_slt_branch,
+    },
+    [mop_lb_zext] = {
+        .n_slot = 2,
+        .slot = {{rv_insn_lb, rv_insn_lbu}, {rv_insn_andi}},
+        .match = mop_match_lb_zext,
+        .fused = rv_insn_fuse8,
+    },
+    [mop_lh_zext] = {
+        .n_slot = 3,
+        .slot = {{rv_insn_lh, rv_insn_lhu}, {rv_insn_slli}, {rv_insn_srli}},
+        .match = mop_match_lh_zext,
+        .fused = rv_insn_fuse9,
+    },
+};
+
+static bool mop_slot_has(const uint8_t *slot, uint8_t opcode)
+{
+    for (int i = 0; i < MOP_SLOT_WIDTH && slot[i] != rv_insn_nop; i++) {
+        if (slot[i] == opcode)
+            return true;
+    }
+    return false;
+}
+
+/* return the number of instructions matched by @pattern at @ir, or 0 */
+static uint32_t mop_match(const mop_pattern_t *pattern, const rv_insn_t *ir)
+{
+    const bool run = !pattern->n_slot;
+    uint32_t n = 0;
+    while (mop_slot_has(pattern->slot[run ? 0 : n], ir[n].opcode)) {
+        n++;
+        if (ir[n - 1].tail || n == pattern->n_slot)
+            break;
+    }
+    if (n < (run ? 2 : pattern->n_slot))
+        return 0;
+    return !pattern->match || pattern->match(ir) ? n : 0;
+}
+
+/* Check if instructions in a block match one of the patterns above. If they
+ * do, rewrite them as fused instructions.
  */
 static void match_pattern(riscv_t *rv, block_t *block)
 {
     uint32_t i;
     rv_insn_t *ir;
-    for (i = 0, ir = block->ir_head; i < block->n_insn - 1;
-         i++, ir = ir->next) {
-        assert(ir);
-        rv_insn_t *next_ir = NULL;
-        int32_t count = 0;
-        switch (ir->opcode) {
-        case rv_insn_lui:
-            next_ir = ir->next;
-            switch (next_ir->opcode) {
-            case rv_insn_add:
-                if (ir->rd == next_ir->rs2 || ir->rd == next_ir->rs1) {
-                    ir->opcode = rv_insn_fuse2;
-                    ir->rs2 = next_ir->rd;
-                    if (ir->rd == next_ir->rs2)
-                        ir->rs1 = next_ir->rs1;
-                    else
-                        ir->rs1 = next_ir->rs2;
-                    ir->impl = dispatch_table[ir->opcode];
-                    remove_next_nth_ir(rv, ir, block, 1);
-                }
-                break;
-            case rv_insn_lui:
-                count = 1;
-                while (1) {
-                    if (!IF_insn(next_ir, lui))
-                        break;
-                    count++;
-                    if (!next_ir->next)
-                        break;
-                    next_ir = next_ir->next;
-                }
-                if (count > 1) {
-                    ir->opcode = rv_insn_fuse1;
-                    ir->fuse = malloc(count * sizeof(opcode_fuse_t));
-                    assert(ir->fuse);
-                    ir->imm2 = count;
-                    memcpy(ir->fuse, ir, sizeof(opcode_fuse_t));
-                    ir->impl = dispatch_table[ir->opcode];
-                    next_ir = ir->next;
-                    for (int j = 1; j < count; j++, next_ir = next_ir->next)
-                        memcpy(ir->fuse + j, next_ir, sizeof(opcode_fuse_t));
-                    remove_next_nth_ir(rv, ir, block, count - 1);
-                }
-                break;
-            }
-            break;
-        /* If the memory addresses of a sequence of store or load instructions
-         * are contiguous, combine these instructions.
-         */
-        case rv_insn_sw:
-            COMBINE_MEM_OPS(0);
-            break;
-        case rv_insn_lw:
-            COMBINE_MEM_OPS(1);
-            break;
-            /* TODO: mixture of SW and LW */
-            /* TODO: reorder insturction to match pattern */
-        case rv_insn_slli:
-        case rv_insn_srli:
-        case rv_insn_srai:
-            count = 1;
-            next_ir = ir->next;
-            while (1) {
-                if (!IF_insn(next_ir, slli) && !IF_insn(next_ir, srli) &&
-                    !IF_insn(next_ir, srai))
-                    break;
-                count++;
-                if (!next_ir->next)
-                    break;
-                next_ir = next_ir->next;
-            }
-            if (count > 1) {
-                ir->fuse = malloc(count * sizeof(opcode_fuse_t));
-                assert(ir->fuse);
-                memcpy(ir->fuse, ir, sizeof(opcode_fuse_t));
-                ir->opcode = rv_insn_fuse5;
-                ir->imm2 = count;
-                ir->impl = dispatch_table[ir->opcode];
-                next_ir = ir->next;
-                for (int j = 1; j < count; j++, next_ir = next_ir->next)
-                    memcpy(ir->fuse + j, next_ir, sizeof(opcode_fuse_t));
-                remove_next_nth_ir(rv, ir, block, count - 1);
-            }
+    for (i = 0, ir = block->ir_head; i < block->n_insn - 1; i++, ir++) {
+        for (int p = 0; p < N_MOP_PATTERNS; p++) {
+            const mop_pattern_t *pattern = &mop_patterns[p];
+            uint32_t n = mop_match(pattern, ir);
+            if (!n)
+                continue;
+            if (pattern->fused != rv_insn_nop)
+                mop_fuse(block, ir, n, pattern->fused);
+            if (pattern->rewrite)
+                pattern->rewrite(ir);
+            rv->mop_hits[p]++;
             break;
         }
     }
@@ -841,17 +1601,417 @@ static const void *constopt_table[] = {
 #undef CONSTOPT
 
 typedef void (*constopt_func_t)(rv_insn_t *, constopt_info_t *);
+
+#define REG_BIT(r) (1U << (r))
+
+/* length of the guest instruction an IR is decoded from */
+FORCE_INLINE uint8_t insn_length(uint8_t opcode)
+{
+    switch (opcode) {
+#define _(inst, can_branch, insn_len, translatable, reg_mask) \
+    case rv_insn_##inst:                                      \
+        return __rv_insn_##inst##_len;
+        RV_INSN_LIST
+#undef _
+    }
+    return 4;
+}
+
+/* Register fields of the 32-bit instructions which only operate on the integer
+ * register file. Returns F_none for everything else.
+ */
+static uint8_t insn_int_fields(uint8_t opcode)
+{
+    switch (opcode) {
+    case rv_insn_lui:
+    case rv_insn_auipc:
+    case rv_insn_jal:
+        return F_rd;
+    case rv_insn_jalr:
+    case rv_insn_addi:
+    case rv_insn_slti:
+    case rv_insn_sltiu:
+    case rv_insn_xori:
+    case rv_insn_ori:
+    case rv_insn_andi:
+    case rv_insn_slli:
+    case rv_insn_srli:
+    case rv_insn_srai:
+#if RV32_HAS(Zbb)
+    case rv_insn_clz:
+    case rv_insn_ctz:
+    case rv_insn_cpop:
+    case rv_insn_sextb:
+    case rv_insn_sexth:
+    case rv_insn_zexth:
+    case rv_insn_rori:
+    case rv_insn_orcb:
+    case rv_insn_rev8:
+#endif
+#if RV32_HAS(Zbs)
+    case rv_insn_bclri:
+    case rv_insn_bexti:
+    case rv_insn_binvi:
+    case rv_insn_bseti:
+#endif
+        return F_rs1 | F_rd;
+    case rv_insn_beq:
+    case rv_insn_bne:
+    case rv_insn_blt:
+    case rv_insn_bge:
+    case rv_insn_bltu:
+    case rv_insn_bgeu:
+        return F_rs1 | F_rs2;
+    case rv_insn_add:
+    case rv_insn_sub:
+    case rv_insn_sll:
+    case rv_insn_slt:
+    case rv_insn_sltu:
+    case rv_insn_xor:
+    case rv_insn_srl:
+    case rv_insn_sra:
+    case rv_insn_or:
+    case rv_insn_and:
+#if RV32_HAS(EXT_M)
+    case rv_insn_mul:
+    case rv_insn_mulh:
+    case rv_insn_mulhsu:
+    case rv_insn_mulhu:
+    case rv_insn_div:
+    case rv_insn_divu:
+    case rv_insn_rem:
+    case rv_insn_remu:
+#endif
+#if RV32_HAS(Zba)
+    case rv_insn_sh1add:
+    case rv_insn_sh2add:
+    case rv_insn_sh3add:
+#endif
+#if RV32_HAS(Zbb)
+    case rv_insn_andn:
+    case rv_insn_orn:
+    case rv_insn_xnor:
+    case rv_insn_max:
+    case rv_insn_maxu:
+    case rv_insn_min:
+    case rv_insn_minu:
+    case rv_insn_rol:
+    case rv_insn_ror:
+#endif
+#if RV32_HAS(Zbc)
+    case rv_insn_clmul:
+    case rv_insn_clmulh:
+    case rv_insn_clmulr:
+#endif
+#if RV32_HAS(Zbs)
+    case rv_insn_bclr:
+    case rv_insn_bext:
+    case rv_insn_binv:
+    case rv_insn_bset:
+#endif
+        return F_rs1 | F_rs2 | F_rd;
+    default:
+        return F_none;
+    }
+}
+
+/* Collect the integer registers read (@use) and written (@def) by @ir. Returns
+ * false for the instructions with any other effect, i.e. memory accesses, CSR
+ * and floating-point operations and everything that may trap. The registers
+ * can be observed at such instructions, so all of them are live there.
+ */
+static bool insn_reg_effect(const rv_insn_t *ir, uint32_t *use, uint32_t *def)
+{
+    const uint8_t fields = insn_int_fields(ir->opcode);
+
+    *use = *def = 0;
+    if (fields != F_none) {
+        if (fields & F_rs1)
+            *use |= REG_BIT(ir->rs1);
+        if (fields & F_rs2)
+            *use |= REG_BIT(ir->rs2);
+        if (fields & F_rd)
+            *def = REG_BIT(ir->rd);
+        return true;
+    }
+
+    /* the compressed instructions implicitly read their destination */
+    switch (ir->opcode) {
+    case rv_insn_nop:
+        return true;
+#if RV32_HAS(EXT_C)
+    case rv_insn_cnop:
+    case rv_insn_cj:
+        return true;
+    case rv_insn_caddi4spn:
+        *use = REG_BIT(rv_reg_sp);
+        *def = REG_BIT(ir->rd);
+        return true;
+    case rv_insn_caddi:
+    case rv_insn_caddi16sp:
+    case rv_insn_cslli:
+        *use = *def = REG_BIT(ir->rd);
+        return true;
+    case rv_insn_cli:
+    case rv_insn_clui:
+        *def = REG_BIT(ir->rd);
+        return true;
+    case rv_insn_csrli:
+    case rv_insn_csrai:
+    case rv_insn_candi:
+        *use = *def = REG_BIT(ir->rs1);
+        return true;
+    case rv_insn_csub:
+    case rv_insn_cxor:
+    case rv_insn_cor:
+    case rv_insn_cand:
+    case rv_insn_cadd:
+        *use = REG_BIT(ir->rs1) | REG_BIT(ir->rs2);
+        *def = REG_BIT(ir->rd);
+        return true;
+    case rv_insn_cmv:
+        *use = REG_BIT(ir->rs2);
+        *def = REG_BIT(ir->rd);
+        return true;
+    case rv_insn_cjal:
+        *def = REG_BIT(rv_reg_ra);
+        return true;
+    case rv_insn_cjr:
+        *use = REG_BIT(ir->rs1);
+        return true;
+    case rv_insn_cjalr:
+        *use = REG_BIT(ir->rs1);
+        *def = REG_BIT(rv_reg_ra);
+        return true;
+    case rv_insn_cbeqz:
+    case rv_insn_cbnez:
+        *use = REG_BIT(ir->rs1);
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/* turn @ir into a no-op of the same length, so that the PC keeps advancing
+ * the same way
+ */
+static void insn_make_nop(rv_insn_t *ir)
+{
+#if RV32_HAS(EXT_C)
+    ir->opcode = insn_length(ir->opcode) == 2 ? rv_insn_cnop : rv_insn_nop;
+#else
+    ir->opcode = rv_insn_nop;
+#endif
+    ir->impl = dispatch_table[ir->opcode];
+    ir->rd = ir->rs1 = ir->rs2 = 0;
+}
+
+#if !RV32_HAS(GDBSTUB)
+/* Registers live before @ir given the registers @live after it. The effect of
+ * the block exit is limited to its reads: it may trap before writing the link
+ * register.
+ */
+static uint32_t insn_live_in(const rv_insn_t *ir, uint32_t live)
+{
+    uint32_t use, def;
+
+#if RV32_HAS(MOP_FUSION)
+    if (ir->opcode >= rv_insn_fuse1) {
+        const rv_insn_cold_t *cold = rv_insn_cold(ir);
+        for (int i = cold->imm2 - 1; i >= 0; i--) {
+            rv_insn_t insn;
+            rv_insn_unfuse(ir, i, &insn);
+            if (!insn_reg_effect(&insn, &use, &def))
+                return ~0U;
+            live = (live & ~def) | use;
+        }
+        return live;
+    }
+#endif
+    if (!insn_reg_effect(ir, &use, &def))
+        return ~0U;
+    return ir->tail ? live | use : (live & ~def) | use;
+}
+
+/* Dead write elimination: walk the block backwards and turn the instructions
+ * whose result is overwritten before being read into no-ops, given the
+ * registers @live on exit of the block. Fused operations are kept as a whole.
+ * No-ops still account for a cycle, thus the instruction count and the PC are
+ * unchanged. This is not done under GDBSTUB, where registers can be inspected
+ * at any instruction.
+ */
+static void eliminate_dead_writes(block_t *block, uint32_t live)
+{
+    for (rv_insn_t *ir = block->ir_tail;; ir--) {
+        uint32_t use, def;
+        if (!ir->tail && insn_reg_effect(ir, &use, &def) && def &&
+            !(def & live))
+            insn_make_nop(ir);
+        else
+            live = insn_live_in(ir, live);
+        if (ir == block->ir_head)
+            break;
+    }
+}
+#endif
+
+/* Constant and copy propagation over a block. Sources of the 32-bit integer
+ * instructions are renamed to the oldest register holding the same value,
+ * which may leave the intermediate moves dead. Writes to x0 as well as
+ * constants assigned to a register already holding them are dropped.
+ */
 static void optimize_constant(riscv_t *rv UNUSED, block_t *block)
 {
     constopt_info_t info = {.is_constant[0] = true};
+    uint8_t copy_of[N_RV_REGS];
     assert(rv->X[0] == 0);
 
+    for (int r = 0; r < N_RV_REGS; r++)
+        copy_of[r] = r;
+
     uint32_t i;
     rv_insn_t *ir;
-    for (i = 0, ir = block->ir_head; i < block->n_insn; i++, ir = ir->next)
+    for (i = 0, ir = block->ir_head; i < block->n_insn; i++, ir++) {
+        const uint8_t fields = insn_int_fields(ir->opcode);
+        if (fields & F_rs1)
+            ir->rs1 = copy_of[ir->rs1];
+        if (fields & F_rs2)
+            ir->rs2 = copy_of[ir->rs2];
+
+        uint32_t use, def;
+        uint8_t rd = 0;
+        if (insn_reg_effect(ir, &use, &def) && def)
+            rd = rv_ctz(def);
+        const bool was_constant = rd && info.is_constant[rd];
+        const uint32_t old_val = info.const_val[rd];
+
         ((constopt_func_t) constopt_table[ir->opcode])(ir, &info);
+        info.is_constant[0] = true;
+        info.const_val[0] = 0;
+
+        if (!insn_reg_effect(ir, &use, &def)) {
+            for (int r = 0; r < N_RV_REGS; r++)
+                copy_of[r] = r;
+            continue;
+        }
+        if (!def || ir->tail)
+            continue;
+
+        bool redundant = def == REG_BIT(rv_reg_zero);
+        if (was_constant && (uint32_t) ir->imm == old_val) {
+            redundant |= ir->opcode == rv_insn_lui;
+#if RV32_HAS(EXT_C)
+            redundant |= ir->opcode == rv_insn_clui;
+#endif
+        }
+        if (redundant) {
+            insn_make_nop(ir);
+            continue;
+        }
+
+        rd = rv_ctz(def);
+        uint8_t src = rd;
+        if (ir->opcode == rv_insn_addi && !ir->imm)
+            src = ir->rs1;
+#if RV32_HAS(EXT_C)
+        else if (ir->opcode == rv_insn_cmv)
+            src = copy_of[ir->rs2];
+#endif
+        for (int r = 0; r < N_RV_REGS; r++) {
+            if (copy_of[r] == rd)
+                copy_of[r] = r;
+        }
+        copy_of[rd] = src;
+    }
+}
+
+#if RV32_HAS(BLOCK_CHAINING) && !RV32_HAS(GDBSTUB)
+/* Registers which may be read by the block starting at @ir before it writes
+ * them. The block exits to unknown code, hence all the registers it does not
+ * write are accounted for as well.
+ */
+static uint32_t block_live_in(const rv_insn_t *ir)
+{
+    uint32_t use = 0, def = 0;
+
+    for (;; ir++) {
+        /* what is live before @ir when nothing is live after it is what @ir
+         * reads, and when everything is, what it does not overwrite
+         */
+        const uint32_t read = insn_live_in(ir, 0);
+        use |= read & ~def;
+        def |= ~insn_live_in(ir, ~0U);
+        if (ir->tail || read == ~0U)
+            break;
+    }
+    return use | ~def;
 }
 
+/* Once every successor of a block ending with a direct branch is chained,
+ * the registers they read are known and the block exit no longer needs to
+ * keep all of them live. Each successor is checked to be the branch target,
+ * as chaining alone does not guarantee it.
+ */
+static void optimize_block_exit(riscv_t *rv UNUSED, block_t *block)
+{
+    const rv_insn_t *tail = block->ir_tail;
+    const rv_insn_cold_t *cold = rv_insn_cold(tail);
+    const rv_insn_t *taken = cold->branch_taken;
+    const rv_insn_t *untaken = cold->branch_untaken;
+    uint32_t live;
+
+    if (!taken || taken->pc != tail->pc + tail->imm)
+        return;
+
+    switch (tail->opcode) {
+    case rv_insn_jal:
+#if RV32_HAS(EXT_C)
+    case rv_insn_cj:
+    case rv_insn_cjal:
+#endif
+        live = block_live_in(taken);
+        untaken = NULL;
+        break;
+    case rv_insn_beq:
+    case rv_insn_bne:
+    case rv_insn_blt:
+    case rv_insn_bge:
+    case rv_insn_bltu:
+    case rv_insn_bgeu:
+#if RV32_HAS(EXT_C)
+    case rv_insn_cbeqz:
+    case rv_insn_cbnez:
+#endif
+        if (!untaken ||
+            untaken->pc != tail->pc + insn_length(tail->opcode))
+            return;
+        live = block_live_in(taken) | block_live_in(untaken);
+        break;
+    default:
+        return;
+    }
+
+#if RV32_HAS(SMC_DETECT)
+    block_add_successor(rv, block, taken);
+    if (untaken)
+        block_add_successor(rv, block, untaken);
+#endif
+#if RV32_HAS(T2C)
+    /* the tier-2 compiler reads the IR with cache_lock held */
+    pthread_mutex_lock(&rv->cache_lock);
+#endif
+    eliminate_dead_writes(block, live);
+#if RV32_HAS(T2C)
+    pthread_mutex_unlock(&rv->cache_lock);
+#endif
+}
+#elif RV32_HAS(BLOCK_CHAINING)
+#define optimize_block_exit(rv, block) \
+    do {                               \
+    } while (0)
+#endif
+
 static block_t *prev = NULL;
 static block_t *block_find_or_translate(riscv_t *rv)
 {
@@ -869,14 +2029,26 @@ static block_t *block_find_or_translate(riscv_t *rv)
 #endif
 #endif
 
-    if (next_blk)
+    if (next_blk) {
+#if !RV32_HAS(JIT)
+        rv_insn_exit(next_blk->ir_tail)->referenced = true;
+#endif
         return next_blk;
+    }
 
 #if !RV32_HAS(JIT)
-    /* clear block list if it is going to be filled */
+    /* make room in the block map if it is going to be filled */
     if (map->size * 1.25 > map->block_capacity) {
-        block_map_clear(rv);
-        prev = NULL;
+        if (map->block_capacity < 1U << BLOCK_MAP_MAX_CAPACITY_BITS) {
+            block_map_grow(map);
+        } else {
+            block_map_evict(rv);
+            prev = NULL;
+        }
+    } else if (map->size * 8 == map->block_capacity * 5 &&
+               map->block_capacity == 1U << BLOCK_MAP_MAX_CAPACITY_BITS) {
+        /* from now on, tell the blocks still in use from the idle ones */
+        block_map_age(map);
     }
 #endif
     /* allocate a new block */
@@ -893,10 +2065,15 @@ static block_t *block_find_or_translate(riscv_t *rv)
 #endif
 
     optimize_constant(rv, next_blk);
+#if !RV32_HAS(GDBSTUB)
+    /* the successors are unknown yet, see optimize_block_exit() */
+    eliminate_dead_writes(next_blk, ~0U);
+#endif
 #if RV32_HAS(MOP_FUSION)
     /* macro operation fusion */
     match_pattern(rv, next_blk);
 #endif
+    block_ir_commit(next_blk);
 
 #if !RV32_HAS(JIT)
     /* insert the block into block map */
@@ -927,18 +2104,19 @@ static block_t *block_find_or_translate(riscv_t *rv)
     /* TODO: record parents of each block to avoid traversing all blocks */
     block_t *entry;
     list_for_each_entry (entry, &rv->block_list, list) {
-        rv_insn_t *taken = entry->ir_tail->branch_taken,
-                  *untaken = entry->ir_tail->branch_untaken;
+        rv_insn_cold_t *cold = rv_insn_cold(entry->ir_tail);
+        rv_insn_t *taken = cold->branch_taken,
+                  *untaken = cold->branch_untaken;
 
         if (taken == replaced_blk_entry) {
-            entry->ir_tail->branch_taken = NULL;
+            cold->branch_taken = NULL;
         }
         if (untaken == replaced_blk_entry) {
-            entry->ir_tail->branch_untaken = NULL;
+            cold->branch_untaken = NULL;
         }
 
         /* upadte JALR LUT */
-        if (!entry->ir_tail->branch_table) {
+        if (!cold->branch_table) {
             continue;
         }
 
@@ -949,15 +2127,7 @@ static block_t *block_find_or_translate(riscv_t *rv)
     }
 
     /* free IRs in replaced block */
-    for (rv_insn_t *ir = replaced_blk->ir_head, *next_ir; ir != NULL;
-         ir = next_ir) {
-        next_ir = ir->next;
-
-        if (ir->fuse)
-            free(ir->fuse);
-
-        mpool_free(rv->block_ir_mp, ir);
-    }
+    block_ir_free(replaced_blk);
 
     list_del_init(&replaced_blk->list);
     mpool_free(rv->block_mp, replaced_blk);
@@ -1003,24 +2173,276 @@ static bool rv_has_plic_trap(riscv_t *rv)
             (rv->csr_sip & rv->csr_sie));
 }
 
-static void rv_check_interrupt(riscv_t *rv)
+static void rv_poll_peripherals(riscv_t *rv)
 {
     vm_attr_t *attr = PRIV(rv);
-    if (peripheral_update_ctr-- == 0) {
-        peripheral_update_ctr = 64;
 
-#if defined(__EMSCRIPTEN__)
-    escape_seq:
-#endif
+    /* write out the rest of a line of the UART once idle */
+    if (attr->uart->out_len)
+        u8250_flush_idle(attr->uart);
+
+    /* the virtio-console, if any, takes the input in place of the UART, and
+     * writes out the output it buffered
+     */
+    if (attr->vcon) {
+        if (virtio_console_poll(attr->vcon))
+            emu_update_vcon_interrupts(rv);
+    } else {
         u8250_check_ready(PRIV(rv)->uart);
         if (PRIV(rv)->uart->in_ready)
             emu_update_uart_interrupts(rv);
     }
 
-    if (rv->timer > attr->timer)
+    /* complete the requests of the asynchronous block device */
+    if (attr->vblk && virtio_blk_poll(attr->vblk))
+        emu_update_vblk_interrupts(rv);
+
+    /* pass the frames received to the network device */
+    if (attr->vnet && virtio_net_poll(attr->vnet))
+        emu_update_vnet_interrupts(rv);
+}
+
+static void rv_update_timer_interrupt(riscv_t *rv)
+{
+    if (rv->timer > PRIV(rv)->timer)
         rv->csr_sip |= RV_INT_STI;
     else
         rv->csr_sip &= ~RV_INT_STI;
+}
+
+/* the longest sleep in WFI, after which the devices are polled anyway */
+#ifndef WFI_SLEEP_MAX_MS
+#define WFI_SLEEP_MAX_MS 1000
+#endif
+
+/* the sleep in WFI while a device cannot wake the hart, and is polled */
+#ifndef WFI_POLL_MS
+#define WFI_POLL_MS 1
+#endif
+
+/* WFI: sleep the host until an interrupt enabled in sie is pending, that is,
+ * until the deadline of the SBI timer or until a device has something for
+ * the guest, while the guest time goes on with the host time. The devices
+ * served on threads write to wake_fd, and the others hand their file
+ * descriptor to poll() or, failing that, are polled every WFI_POLL_MS.
+ */
+#if !defined(__EMSCRIPTEN__)
+static void rv_wait_for_interrupt(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    for (;;) {
+        /* from here on the threads of the devices wake the hart */
+        __atomic_store_n(&attr->sleeping, true, __ATOMIC_SEQ_CST);
+        rv_poll_peripherals(rv);
+#if RV32_HAS(HOST_TIMER)
+        rv_sample_timer(rv);
+#endif
+        rv_update_timer_interrupt(rv);
+        if ((rv->csr_sip & rv->csr_sie) || rv_has_halted(rv) ||
+            __atomic_load_n(&attr->snapshot_req, __ATOMIC_RELAXED))
+            break;
+
+        /* the deadline of the timer, rounded up to milliseconds */
+        const uint64_t ticks = attr->timer - rv->timer + 1;
+        int timeout = WFI_SLEEP_MAX_MS;
+        if (ticks < (uint64_t) TIMEBASE_FREQ * WFI_SLEEP_MAX_MS / 1000)
+            timeout = (ticks * 1000 + TIMEBASE_FREQ - 1) / TIMEBASE_FREQ;
+
+        struct pollfd pfd[3] = {{attr->wake_fd[0], POLLIN, 0}};
+        nfds_t n = 1;
+        if (!attr->vcon && !attr->uart->reader && timeout > WFI_POLL_MS)
+            timeout = WFI_POLL_MS; /* the UART polls its input by itself */
+        if (attr->vcon) {
+            pfd[n].fd = virtio_console_wait_fd(attr->vcon);
+            pfd[n].events = POLLIN;
+            n += pfd[n].fd >= 0;
+        }
+        if (attr->vnet) {
+            pfd[n].fd = virtio_net_wait_fd(attr->vnet);
+            pfd[n].events = POLLIN;
+            if (pfd[n].fd >= 0)
+                n++;
+            else if (timeout > WFI_POLL_MS)
+                timeout = WFI_POLL_MS;
+        }
+
+#if RV32_HAS(HOST_TIMER)
+        /* the guest time is sampled again at the top of the loop */
+        poll(pfd, n, timeout);
+#else
+        struct timespec t0, t1;
+        rv_clock_gettime(&t0);
+        const int ret = poll(pfd, n, timeout);
+        rv_clock_gettime(&t1);
+#endif
+
+        /* drain the wakeups */
+        uint8_t buf[64];
+        while (read(attr->wake_fd[0], buf, sizeof(buf)) > 0)
+            ;
+
+#if !RV32_HAS(HOST_TIMER)
+        /* the guest time goes on with the time of the host */
+        const uint64_t ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL +
+                            t1.tv_nsec - t0.tv_nsec;
+        rv->timer += ns / 1000000000 * TIMEBASE_FREQ +
+                     ns % 1000000000 * TIMEBASE_FREQ / 1000000000;
+        if (!ret && ticks <= (uint64_t) TIMEBASE_FREQ * timeout / 1000 &&
+            rv->timer <= attr->timer)
+            rv->timer = attr->timer + 1; /* the deadline has passed */
+#endif
+    }
+    __atomic_store_n(&attr->sleeping, false, __ATOMIC_RELAXED);
+    rv_raise_event(rv); /* take the interrupt before the next block */
+}
+#else
+/* the main loop of the browser must not block, so WFI returns at once */
+static void rv_wait_for_interrupt(riscv_t *rv UNUSED) {}
+#endif
+
+/* the interval of the poll of the peripherals, in ticks of the timer */
+#ifndef PERIPHERAL_POLL_TICKS
+#define PERIPHERAL_POLL_TICKS (TIMEBASE_FREQ / 1000)
+#endif
+
+#if RV32_HAS(HOST_TIMER)
+/* As rv->timer only moves when it is sampled, a thread waits for the host
+ * time to reach rv->event_deadline in its place, and lowers it to 0.
+ */
+struct rv_alarm {
+    riscv_t *rv;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t at; /* the deadline waited for, or 0 while idle */
+    bool stop;
+};
+
+static void *rv_alarm_thread(void *arg)
+{
+    struct rv_alarm *alarm = arg;
+    riscv_t *rv = alarm->rv;
+
+    pthread_mutex_lock(&alarm->lock);
+    while (!alarm->stop) {
+        const uint64_t deadline =
+            __atomic_load_n(&rv->event_deadline, __ATOMIC_SEQ_CST);
+        const uint64_t now = deadline ? rv_host_ticks(PRIV(rv)) : 0;
+        if (deadline && now >= deadline) {
+            /* unless the hart has moved the deadline in the meantime */
+            uint64_t expected = deadline;
+            __atomic_compare_exchange_n(&rv->event_deadline, &expected, 0,
+                                        false, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        alarm->at = deadline;
+        if (!deadline) {
+            /* an event is pending already, wait for the next deadline */
+            pthread_cond_wait(&alarm->cond, &alarm->lock);
+            continue;
+        }
+
+        /* pthread_cond_timedwait() takes the wall clock, and the wait is
+         * cut at a second so that a change of it does no harm
+         */
+        uint64_t ns = 1000000000;
+        if (deadline - now < (uint64_t) TIMEBASE_FREQ)
+            ns = (deadline - now) * 1000000000 / TIMEBASE_FREQ + 1;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ns += ts.tv_nsec;
+        ts.tv_sec += ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        pthread_cond_timedwait(&alarm->cond, &alarm->lock, &ts);
+    }
+    pthread_mutex_unlock(&alarm->lock);
+    return NULL;
+}
+
+void rv_alarm_start(riscv_t *rv)
+{
+    struct rv_alarm *alarm = calloc(1, sizeof(struct rv_alarm));
+    assert(alarm);
+    alarm->rv = rv;
+    pthread_mutex_init(&alarm->lock, NULL);
+    pthread_cond_init(&alarm->cond, NULL);
+    if (pthread_create(&alarm->thread, NULL, rv_alarm_thread, alarm)) {
+        rv_log_fatal("Failed to create the thread of the timer");
+        exit(EXIT_FAILURE);
+    }
+    PRIV(rv)->alarm = alarm;
+}
+
+void rv_alarm_stop(riscv_t *rv)
+{
+    struct rv_alarm *alarm = PRIV(rv)->alarm;
+    pthread_mutex_lock(&alarm->lock);
+    alarm->stop = true;
+    pthread_cond_signal(&alarm->cond);
+    pthread_mutex_unlock(&alarm->lock);
+    pthread_join(alarm->thread, NULL);
+    pthread_mutex_destroy(&alarm->lock);
+    pthread_cond_destroy(&alarm->cond);
+    free(alarm);
+    PRIV(rv)->alarm = NULL;
+}
+
+/* have the thread wait for @deadline, just stored in rv->event_deadline */
+static void rv_alarm_set(riscv_t *rv, uint64_t deadline)
+{
+    struct rv_alarm *alarm = PRIV(rv)->alarm;
+    pthread_mutex_lock(&alarm->lock);
+    if (!alarm->at || deadline < alarm->at)
+        pthread_cond_signal(&alarm->cond);
+    pthread_mutex_unlock(&alarm->lock);
+}
+#endif
+
+/* Lower rv->event_deadline to whatever the hart has to look at next: the
+ * poll of the peripherals, or the deadline of the SBI timer until it passes.
+ * A device may have raised an event meanwhile, which is caught by reading
+ * attr->woken after the store, see emu_wakeup().
+ */
+static void rv_arm_event(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    uint64_t deadline = attr->poll_deadline;
+    if (!(rv->csr_sip & RV_INT_STI) && attr->timer < deadline)
+        deadline = attr->timer + 1;
+
+    __atomic_store_n(&rv->event_deadline, deadline, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&attr->woken, __ATOMIC_SEQ_CST))
+        rv_raise_event(rv);
+#if RV32_HAS(HOST_TIMER)
+    rv_alarm_set(rv, deadline);
+#endif
+}
+
+/* called by rv_step() once an event is pending, see rv_event_pending() */
+static void rv_check_interrupt(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+
+#if RV32_HAS(HOST_TIMER)
+    rv_sample_timer(rv);
+#endif
+    if (__atomic_exchange_n(&attr->snapshot_req, false, __ATOMIC_SEQ_CST))
+        rv_snapshot_save(rv, attr->data.system.snapshot);
+
+    if (__atomic_exchange_n(&attr->woken, false, __ATOMIC_SEQ_CST) ||
+        rv->timer >= attr->poll_deadline) {
+        attr->poll_deadline = rv->timer + PERIPHERAL_POLL_TICKS;
+
+#if defined(__EMSCRIPTEN__)
+    escape_seq:
+#endif
+        rv_poll_peripherals(rv);
+    }
+
+    rv_update_timer_interrupt(rv);
+    rv_arm_event(rv);
 
     if (rv_has_plic_trap(rv)) {
         uint32_t intr_applicable = rv->csr_sip & rv->csr_sie;
@@ -1061,8 +2483,17 @@ void rv_step(void *arg)
     /* loop until hitting the cycle target */
     while (rv->csr_cycle < cycles_target && !rv->halt) {
 #if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
-        /* check for any interrupt after every block emulation */
-        rv_check_interrupt(rv);
+        /* check for any interrupt once an event is pending */
+        if (rv_event_pending(rv))
+            rv_check_interrupt(rv);
+#endif
+
+#if RV32_HAS(SMC_DETECT)
+        /* the previous block may have been left before its branch */
+        if (unlikely(rv->smc_lo <= rv->smc_hi)) {
+            block_map_invalidate(rv);
+            prev = NULL;
+        }
 #endif
 
         if (prev && prev->pc_start != last_pc) {
@@ -1073,6 +2504,11 @@ void rv_step(void *arg)
             prev = cache_get(rv->block_cache, last_pc, false);
 #endif
         }
+#if !RV32_HAS(JIT)
+        /* the last block run may have been reached through chaining */
+        if (prev)
+            rv_insn_exit(prev->ir_tail)->referenced = true;
+#endif
         /* lookup the next block in block map or translate a new block,
          * and move onto the next block.
          */
@@ -1103,18 +2539,25 @@ void rv_step(void *arg)
 #endif
         ) {
             rv_insn_t *last_ir = prev->ir_tail;
+            rv_insn_cold_t *cold = rv_insn_cold(last_ir);
+            bool chained = false;
             /* chain block */
             if (!insn_is_unconditional_branch(last_ir->opcode)) {
-                if (is_branch_taken && !last_ir->branch_taken) {
-                    last_ir->branch_taken = block->ir_head;
-                } else if (!is_branch_taken && !last_ir->branch_untaken) {
-                    last_ir->branch_untaken = block->ir_head;
+                if (is_branch_taken && !cold->branch_taken) {
+                    cold->branch_taken = block->ir_head;
+                    chained = true;
+                } else if (!is_branch_taken && !cold->branch_untaken) {
+                    cold->branch_untaken = block->ir_head;
+                    chained = true;
                 }
             } else if (insn_is_direct_branch(last_ir->opcode)) {
-                if (!last_ir->branch_taken) {
-                    last_ir->branch_taken = block->ir_head;
+                if (!cold->branch_taken) {
+                    cold->branch_taken = block->ir_head;
+                    chained = true;
                 }
             }
+            if (chained)
+                optimize_block_exit(rv, prev);
         }
 #endif
         last_pc = rv->PC;
@@ -1128,11 +2571,7 @@ void rv_step(void *arg)
         } /* check if invoking times of t1 generated code exceed threshold */
         else if (!block->compiled && block->n_invoke >= THRESHOLD) {
             block->compiled = true;
-            queue_entry_t *entry = malloc(sizeof(queue_entry_t));
-            entry->block = block;
-            pthread_mutex_lock(&rv->wait_queue_lock);
-            list_add(&entry->list, &rv->wait_queue);
-            pthread_mutex_unlock(&rv->wait_queue_lock);
+            t2c_enqueue(rv, block);
         }
 #endif
         /* executed through the tier-1 JIT compiler */
@@ -1196,10 +2635,13 @@ void rv_step_debug(void *arg)
     rv_check_interrupt(rv);
 #endif
 
-    rv_insn_t ir;
+    rv_insn_single_t single;
+    rv_insn_t *ir = &single.ir;
 
 retranslate:
-    memset(&ir, 0, sizeof(rv_insn_t));
+    memset(&single, 0, sizeof(single));
+    single.ref = &single.cold;
+    ir->tail = true;
 
     /* fetch the next instruction */
     uint32_t insn = rv->io.mem_ifetch(rv, rv->PC);
@@ -1212,31 +2654,32 @@ retranslate:
     assert(insn);
 
     /* decode the instruction */
-    if (!rv_decode(&ir, insn)) {
+    if (!rv_decode(ir, insn)) {
         rv->compressed = is_compressed(insn);
         SET_CAUSE_AND_TVAL_THEN_TRAP(rv, ILLEGAL_INSN, insn);
         return;
     }
 
-    ir.impl = dispatch_table[ir.opcode];
-    ir.pc = rv->PC;
-    ir.next = NULL;
-    ir.impl(rv, &ir, rv->csr_cycle, rv->PC);
+    ir->impl = dispatch_table[ir->opcode];
+    ir->pc = rv->PC;
+    ir->impl(rv, ir, rv->csr_cycle, rv->PC);
     return;
 }
 
 #if RV32_HAS(SYSTEM)
 static void __trap_handler(riscv_t *rv)
 {
-    rv_insn_t *ir = mpool_calloc(rv->block_ir_mp);
-    assert(ir);
+    rv_insn_single_t single = {.ir.tail = true};
+    rv_insn_t *ir = &single.ir;
+    single.ref = &single.cold;
 
     /* set to false by sret implementation */
     while (rv->is_trapped && !rv_has_halted(rv)) {
-        uint32_t insn = rv->io.mem_ifetch(rv, rv->PC);
+        uint32_t paddr;
+        uint32_t insn = mmu_ifetch_paddr(rv, rv->PC, &paddr);
         assert(insn);
 
-        rv_decode(ir, insn);
+        insn_decode(rv, ir, insn, paddr);
         reloc_enable_mmu_jalr_addr = rv->PC;
 
         ir->impl = dispatch_table[ir->opcode];
@@ -1312,6 +2755,8 @@ static void _trap_handler(riscv_t *rv)
             return;
         }
     }
+    /* the privilege mode might be switched */
+    dtlb_flush(rv);
     switch (mode) {
     /* DIRECT: All traps set PC to base */
     case 0:
@@ -88,6 +88,17 @@
 #define RV32_FEATURE_T2C 0
 #endif
 
+/* Record the lookups of the block cache */
+#ifndef RV32_FEATURE_CACHE_TRACE
+#define RV32_FEATURE_CACHE_TRACE 0
+#endif
+
+/* only the JIT compilers use the block cache */
+#if !RV32_FEATURE_JIT
+#undef RV32_FEATURE_CACHE_TRACE
+#define RV32_FEATURE_CACHE_TRACE 0
+#endif
+
 /* System */
 #ifndef RV32_FEATURE_SYSTEM
 #define RV32_FEATURE_SYSTEM 0
@@ -98,16 +109,48 @@
 #define RV32_FEATURE_ELF_LOADER 0
 #endif
 
+/* Guest time follows the host clock instead of the count of instructions */
+#ifndef RV32_FEATURE_HOST_TIMER
+#define RV32_FEATURE_HOST_TIMER 0
+#endif
+
+/* Only the system emulation with a kernel has a timebase */
+#if !RV32_FEATURE_SYSTEM || RV32_FEATURE_ELF_LOADER
+#undef RV32_FEATURE_HOST_TIMER
+#define RV32_FEATURE_HOST_TIMER 0
+#endif
+
 /* MOP fusion */
 #ifndef RV32_FEATURE_MOP_FUSION
 #define RV32_FEATURE_MOP_FUSION 1
 #endif
 
+/* Physically indexed cache of decoded instructions */
+#ifndef RV32_FEATURE_DECODE_CACHE
+#define RV32_FEATURE_DECODE_CACHE 1
+#endif
+
+/* Self-modifying code detection */
+#ifndef RV32_FEATURE_SMC_DETECT
+#define RV32_FEATURE_SMC_DETECT 1
+#endif
+
+/* The JIT compilers link the generated code of blocks statically */
+#if RV32_FEATURE_JIT
+#undef RV32_FEATURE_SMC_DETECT
+#define RV32_FEATURE_SMC_DETECT 0
+#endif
+
 /* Block chaining */
 #ifndef RV32_FEATURE_BLOCK_CHAINING
 #define RV32_FEATURE_BLOCK_CHAINING 1
 #endif
 
+/* Direct-threaded (computed goto) interpreter dispatch */
+#ifndef RV32_FEATURE_THREADED_CODE
+#define RV32_FEATURE_THREADED_CODE 0
+#endif
+
 /* Logging with color */
 #ifndef RV32_FEATURE_LOG_COLOR
 #define RV32_FEATURE_LOG_COLOR 1
@@ -1644,8 +1644,8 @@ static inline void liveness_calc(block_t *block)
     rv_insn_t *ir;
 
     /* follow the order of operator in "src/rc32_template.c" */
-    for (idx = 0, ir = block->ir_head; idx < block->n_insn;
-         idx++, ir = ir->next) {
+    for (idx = 0, ir = block->ir_head; idx < block->n_insn; idx++, ir++) {
+        const rv_insn_cold_t *cold = rv_insn_cold(ir);
         switch (ir->opcode) {
         case rv_insn_nop:
         case rv_insn_lui:
@@ -1783,23 +1783,32 @@ static inline void liveness_calc(block_t *block)
             break;
 #endif
         case rv_insn_fuse1:
-            for (int i = 0; i < ir->imm2; i++) {
-                liveness[ir->fuse[i].rd] = idx;
+            for (int i = 0; i < cold->imm2; i++) {
+                liveness[cold->fuse[i].rd] = idx;
             }
             break;
         case rv_insn_fuse2:
             liveness[ir->rs1] = idx;
             break;
         case rv_insn_fuse3:
-            for (int i = 0; i < ir->imm2; i++) {
-                liveness[ir->fuse[i].rs1] = idx;
-                liveness[ir->fuse[i].rs2] = idx;
+            for (int i = 0; i < cold->imm2; i++) {
+                liveness[cold->fuse[i].rs1] = idx;
+                liveness[cold->fuse[i].rs2] = idx;
             }
             break;
         case rv_insn_fuse4:
         case rv_insn_fuse5:
-            for (int i = 0; i < ir->imm2; i++) {
-                liveness[ir->fuse[i].rs1] = idx;
+            for (int i = 0; i < cold->imm2; i++) {
+                liveness[cold->fuse[i].rs1] = idx;
+            }
+            break;
+        case rv_insn_fuse6:
+        case rv_insn_fuse7:
+        case rv_insn_fuse8:
+        case rv_insn_fuse9:
+            for (int i = 0; i < cold->imm2; i++) {
+                liveness[cold->fuse[i].rs1] = idx;
+                liveness[cold->fuse[i].rs2] = idx;
             }
             break;
         default:
@@ -2010,7 +2019,7 @@ void parse_branch_history_table(struct jit_state *state,
                                 rv_insn_t *ir)
 {
     int max_idx = 0;
-    branch_history_table_t *bt = ir->branch_table;
+    branch_history_table_t *bt = rv_insn_cold(ir)->branch_table;
     for (int i = 0; i < HISTORY_SIZE; i++) {
         if (!bt->times[i])
             break;
@@ -2038,7 +2047,10 @@ void parse_branch_history_table(struct jit_state *state,
 
 void emit_jit_inc_timer(struct jit_state *state)
 {
-#if defined(__x86_64__)
+#if RV32_HAS(HOST_TIMER)
+    /* rv->timer is sampled from the host clock instead */
+    (void) state;
+#elif defined(__x86_64__)
     /* Increment rv->timer. *rv pointer is stored in RDI register */
     /* INC RDI, [rv + offsetof(riscv_t, timer)] */
     emit_rex(state, 1, 0, 0, 0);
@@ -2053,6 +2065,39 @@ void emit_jit_inc_timer(struct jit_state *state)
 #endif
 }
 
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+/* Leave at the start of @block once an event is pending, as the blocks chained
+ * together would otherwise never return to rv_step(), see rv_event_pending().
+ * It runs before any guest register is mapped to a host one.
+ */
+static void emit_jit_check_event(struct jit_state *state, block_t *block)
+{
+#if defined(__x86_64__)
+    /* MOV temp_reg, [rv + offsetof(riscv_t, event_deadline)] */
+    emit_basic_rex(state, 1, temp_reg, parameter_reg[0]);
+    emit1(state, 0x8b);
+    emit_modrm_and_displacement(state, temp_reg, parameter_reg[0],
+                                offsetof(riscv_t, event_deadline));
+    /* CMP [rv + offsetof(riscv_t, timer)], temp_reg */
+    emit_basic_rex(state, 1, temp_reg, parameter_reg[0]);
+    emit1(state, 0x39);
+    emit_modrm_and_displacement(state, temp_reg, parameter_reg[0],
+                                offsetof(riscv_t, timer));
+#elif defined(__aarch64__)
+    emit_load(state, S64, parameter_reg[0], temp_reg, offsetof(riscv_t, timer));
+    emit_load(state, S64, parameter_reg[0], R10,
+              offsetof(riscv_t, event_deadline));
+    emit_addsub_register(state, true, AS_SUBS, RZ, temp_reg, R10);
+#endif
+    uint32_t jump_loc_0 = state->offset;
+    emit_jcc_offset(state, 0x82);
+    emit_load_imm(state, temp_reg, block->pc_start);
+    emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
+    emit_exit(state);
+    emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
+}
+#endif
+
 #define GEN(inst, code)                                                       \
     static void do_##inst(struct jit_state *state UNUSED, riscv_t *rv UNUSED, \
                           rv_insn_t *ir UNUSED)                               \
@@ -2065,8 +2110,9 @@ void emit_jit_inc_timer(struct jit_state *state)
 
 static void do_fuse1(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
 {
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++) {
         vm_reg[0] = map_vm_reg(state, fuse[i].rd);
         emit_load_imm(state, vm_reg[0], fuse[i].imm);
     }
@@ -2086,8 +2132,9 @@ static void do_fuse2(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
 static void do_fuse3(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
 {
     memory_t *m = PRIV(rv)->mem;
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++) {
         vm_reg[0] = ra_load(state, fuse[i].rs1);
         emit_load_imm_sext(state, temp_reg,
                            (intptr_t) (m->mem_base + fuse[i].imm));
@@ -2100,8 +2147,9 @@ static void do_fuse3(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
 static void do_fuse4(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
 {
     memory_t *m = PRIV(rv)->mem;
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++) {
         vm_reg[0] = ra_load(state, fuse[i].rs1);
         emit_load_imm_sext(state, temp_reg,
                            (intptr_t) (m->mem_base + fuse[i].imm));
@@ -2113,8 +2161,9 @@ static void do_fuse4(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
 
 static void do_fuse5(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
 {
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++) {
         switch (fuse[i].opcode) {
         case rv_insn_slli:
             vm_reg[0] = ra_load(state, fuse[i].rs1);
@@ -2144,6 +2193,34 @@ static void do_fuse5(struct jit_state *state, riscv_t *rv UNUSED, rv_insn_t *ir)
     }
 }
 
+/* The remaining fused operations are emitted as their original instructions,
+ * which leaves the register allocator to keep the intermediate values in host
+ * registers.
+ */
+static void do_fuse_expand(struct jit_state *state,
+                           riscv_t *rv,
+                           rv_insn_t *ir);
+
+static void do_fuse6(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+{
+    do_fuse_expand(state, rv, ir);
+}
+
+static void do_fuse7(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+{
+    do_fuse_expand(state, rv, ir);
+}
+
+static void do_fuse8(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+{
+    do_fuse_expand(state, rv, ir);
+}
+
+static void do_fuse9(struct jit_state *state, riscv_t *rv, rv_insn_t *ir)
+{
+    do_fuse_expand(state, rv, ir);
+}
+
 /* clang-format off */
 static const void *dispatch_table[] = {
     /* RV32 instructions */
@@ -2157,6 +2234,22 @@ static const void *dispatch_table[] = {
 };
 /* clang-format on */
 
+typedef void (*codegen_block_func_t)(struct jit_state *,
+                                     riscv_t *,
+                                     rv_insn_t *);
+
+static void do_fuse_expand(struct jit_state *state,
+                           riscv_t *rv,
+                           rv_insn_t *ir)
+{
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    for (int i = 0; i < cold->imm2; i++) {
+        rv_insn_t insn;
+        rv_insn_unfuse(ir, i, &insn);
+        ((codegen_block_func_t) dispatch_table[insn.opcode])(state, rv, &insn);
+    }
+}
+
 void clear_hot(block_t *block)
 {
     block->hot = false;
@@ -2170,25 +2263,26 @@ static void code_cache_flush(struct jit_state *state, riscv_t *rv)
     set_reset(&state->set);
     clear_cache_hot(rv->block_cache, (clear_func_t) clear_hot);
 #if RV32_HAS(T2C)
+    /* the T2C thread updates the jit-cache with cache_lock held */
+    pthread_mutex_lock(&rv->cache_lock);
     jit_cache_clear(rv->jit_cache);
+    pthread_mutex_unlock(&rv->cache_lock);
 #endif
     return;
 }
 
-typedef void (*codegen_block_func_t)(struct jit_state *,
-                                     riscv_t *,
-                                     rv_insn_t *);
-
 static void translate(struct jit_state *state, riscv_t *rv, block_t *block)
 {
     uint32_t idx;
-    rv_insn_t *ir, *next;
+    rv_insn_t *ir;
     reset_reg();
     liveness_reset();
     liveness_calc(block);
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+    emit_jit_check_event(state, block);
+#endif
     for (idx = 0, ir = block->ir_head; idx < block->n_insn && !should_flush;
-         idx++, ir = next) {
-        next = ir->next;
+         idx++, ir++) {
         regs_refresh(idx);
         ((codegen_block_func_t) dispatch_table[ir->opcode])(state, rv, ir);
     }
@@ -2251,19 +2345,20 @@ static void translate_chained_block(struct jit_state *state,
     translate(state, rv, block);
     if (unlikely(should_flush))
         return;
-    rv_insn_t *ir = block->ir_tail;
-    if (ir->branch_untaken && !set_has(&state->set, ir->branch_untaken->pc)) {
+    rv_insn_cold_t *cold = rv_insn_cold(block->ir_tail);
+    if (cold->branch_untaken &&
+        !set_has(&state->set, cold->branch_untaken->pc)) {
         block_t *block1 =
-            cache_get(rv->block_cache, ir->branch_untaken->pc, false);
+            cache_get(rv->block_cache, cold->branch_untaken->pc, false);
         if (block1->translatable) {
             IIF(RV32_HAS(SYSTEM))
             (if (block1->satp == rv->csr_satp), )
                 translate_chained_block(state, rv, block1);
         }
     }
-    if (ir->branch_taken && !set_has(&state->set, ir->branch_taken->pc)) {
+    if (cold->branch_taken && !set_has(&state->set, cold->branch_taken->pc)) {
         block_t *block1 =
-            cache_get(rv->block_cache, ir->branch_taken->pc, false);
+            cache_get(rv->block_cache, cold->branch_taken->pc, false);
         if (block1->translatable) {
             IIF(RV32_HAS(SYSTEM))
             (if (block1->satp == rv->csr_satp), )
@@ -2271,7 +2366,7 @@ static void translate_chained_block(struct jit_state *state,
         }
     }
 
-    branch_history_table_t *bt = ir->branch_table;
+    branch_history_table_t *bt = cold->branch_table;
     if (bt) {
         int max_idx = 0;
         for (int i = 0; i < HISTORY_SIZE; i++) {
@@ -58,26 +58,74 @@ typedef void (*exec_block_func_t)(riscv_t *rv, uintptr_t);
 
 #if RV32_HAS(T2C)
 void t2c_compile(riscv_t *, block_t *);
+/* enqueue the block to be compiled by the background T2C thread */
+void t2c_enqueue(riscv_t *, block_t *);
+/* compile the block requested by @entry, if it is still cached */
+void t2c_compile_queued(riscv_t *, queue_entry_t *);
 typedef void (*exec_t2c_func_t)(riscv_t *);
 
 /* The jit-cache records the program counters and the entries of executable
- * instructions generated by T2C. Like hardware cache, the old jit-cache will be
- * replaced by the new one which uses the same slot.
+ * instructions generated by T2C. The table is set-associative: a key is hashed
+ * to one set, and the JIT-ed code probes every way of that set. Unlike the
+ * former direct-mapped table, hot functions whose program counters share the
+ * same low bits no longer thrash each other, and the hash mixes the satp into
+ * the set index in system simulation.
+ *
+ * The ways keep no hit counts, which would cost a store on every lookup of
+ * the JIT-ed code. An update takes the way holding the same key, or else an
+ * empty one; in a full set, the ways are replaced in turn, round-robin per
+ * set. The table is written by the T2C thread with cache_lock held, and read
+ * by the JIT-ed code without, see jit_cache_update().
  */
 
-/* The size of jit-cache table should be the power of 2, thus, we can easily
- * access the element by masking the program counter.
+/* The number of sets is 2^JIT_CACHE_SIZE_BITS, and both macros can be
+ * overridden from the build configuration (e.g., CFLAGS).
  */
-#define N_JIT_CACHE_ENTRIES (1 << 12)
+#ifndef JIT_CACHE_SIZE_BITS
+#define JIT_CACHE_SIZE_BITS 10
+#endif
+#ifndef N_JIT_CACHE_WAYS
+#define N_JIT_CACHE_WAYS 4
+#endif
 
-struct jit_cache {
+/* Keep the layout in sync with the LLVM type built in t2c_compile(). */
+struct jit_cache_entry {
     uint64_t key; /* program counter, composed to satp if it's in system
                      simulation */
     void *entry;  /* entry of JIT-ed code */
 };
 
-struct jit_cache *jit_cache_init();
+struct jit_cache {
+    struct jit_cache_entry *table; /* n_sets * N_JIT_CACHE_WAYS entries */
+    uint8_t *victim;               /* next way replaced, for each set */
+    uint32_t size_bits;            /* number of sets is 2^size_bits */
+    uint64_t hit;                  /* lookups served, counted if profiling */
+    uint64_t miss;                 /* lookups failed in JIT-ed code */
+    uint64_t conflict;             /* live entries evicted by an update */
+};
+
+/* hash the composed key into the index of a set */
+FORCE_INLINE uint32_t jit_cache_set_index(const struct jit_cache *cache,
+                                          uint64_t key)
+{
+    /* 0x61c8864680b583eb is 64-bit golden ratio */
+    return (key * 0x61c8864680b583ebull) >> (64 - cache->size_bits);
+}
+
+struct jit_cache *jit_cache_init(uint32_t size_bits);
 void jit_cache_exit(struct jit_cache *cache);
 void jit_cache_update(struct jit_cache *cache, uint64_t key, void *entry);
 void jit_cache_clear(struct jit_cache *cache);
+
+/**
+ * jit_cache_stats - report the counters of the jit-cache
+ * @cache: a pointer points to target jit-cache
+ * @hit: number of lookups served, only counted with RV_RUN_PROFILE set
+ * @miss: number of failed lookups
+ * @conflict: number of live entries replaced by other keys
+ */
+void jit_cache_stats(const struct jit_cache *cache,
+                     uint64_t *hit,
+                     uint64_t *miss,
+                     uint64_t *conflict);
 #endif
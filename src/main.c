@@ -46,7 +46,7 @@ static char *opt_prog_name;
 /* target argc and argv */
 static int prog_argc;
 static char **prog_args;
-static const char *optstr = "tgqmhpd:a:k:i:b:x:";
+static const char *optstr = "tgqmhpd:a:k:i:b:x:s:r:c:";
 
 /* enable misaligned memory access */
 static bool opt_misaligned = false;
@@ -55,12 +55,22 @@ static bool opt_misaligned = false;
 static bool opt_prof_data = false;
 static char *prof_out_file;
 
+#if RV32_HAS(CACHE_TRACE)
+/* record the lookups of the block cache */
+static char *opt_cache_trace;
+#endif
+
 #if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
 /* Linux kernel data */
 static char *opt_kernel_img;
 static char *opt_rootfs_img;
 static char *opt_bootargs;
 static char *opt_virtio_blk_img;
+static char *opt_virtio_net;
+static bool opt_virtio_console;
+static char *opt_uart;
+static char *opt_snapshot;
+static char *opt_resume;
 #endif
 
 static void print_usage(const char *filename)
@@ -78,9 +88,21 @@ static void print_usage(const char *filename)
 #if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
         "  -k <image> : use <image> as kernel image\n"
         "  -i <image> : use <image> as rootfs\n"
-        "  -x vblk:<image>[,readonly] : use <image> as virtio-blk disk image "
-        "(default read and write)\n"
+        "  -x vblk:<image>[,readonly][,async][,overlay=<file>] : use <image> "
+        "as virtio-blk disk image (default read and write, served "
+        "synchronously), or as the base of the copy-on-write overlay <file>\n"
+        "  -x vnet:<backend>[,pcap=<file>] : attach a virtio-net device to "
+        "<backend>, one of shm=<file>, socket=<path> and replay=<pcap file>, "
+        "and record its frames to <file>\n"
+        "  -x vcon : use a virtio-console as the console of the kernel in "
+        "place of the UART\n"
+        "  -x uart:[unbuffered][,stats] : take a system call per byte of the "
+        "UART output and per poll of its input (unbuffered), and report the "
+        "host system calls per guest second (stats)\n"
         "  -b <bootargs> : use customized <bootargs> for the kernel\n"
+        "  -s <file> : save a snapshot of the machine to <file> on SIGUSR1\n"
+        "  -r <file> : resume from the snapshot <file> in place of booting, "
+        "ignoring -k, -i and -b\n"
 #endif
         "  -d [filename]: dump registers as JSON to the "
         "given file or `-` (STDOUT)\n"
@@ -89,6 +111,9 @@ static void print_usage(const char *filename)
         "required by arch-test test\n"
         "  -m : enable misaligned memory access\n"
         "  -p : generate profiling data\n"
+#if RV32_HAS(CACHE_TRACE)
+        "  -c <file> : record the lookups of the block cache to <file>\n"
+#endif
         "  -h : show this message",
         filename);
 }
@@ -125,9 +150,23 @@ static bool parse_args(int argc, char **args)
             opt_bootargs = optarg;
             emu_argc++;
             break;
+        case 's':
+            opt_snapshot = optarg;
+            emu_argc++;
+            break;
+        case 'r':
+            opt_resume = optarg;
+            emu_argc++;
+            break;
         case 'x':
             if (!strncmp("vblk:", optarg, 5))
                 opt_virtio_blk_img = optarg + 5; /* strlen("vblk:") */
+            else if (!strncmp("vnet:", optarg, 5))
+                opt_virtio_net = optarg + 5; /* strlen("vnet:") */
+            else if (!strcmp("vcon", optarg))
+                opt_virtio_console = true;
+            else if (!strncmp("uart:", optarg, 5))
+                opt_uart = optarg + 5; /* strlen("uart:") */
             else
                 return false;
             emu_argc++;
@@ -144,6 +183,12 @@ static bool parse_args(int argc, char **args)
         case 'p':
             opt_prof_data = true;
             break;
+#if RV32_HAS(CACHE_TRACE)
+        case 'c':
+            opt_cache_trace = optarg;
+            emu_argc++;
+            break;
+#endif
         case 'd':
             opt_dump_regs = true;
             registers_out_file = optarg;
@@ -269,11 +314,19 @@ int main(int argc, char **args)
         .cycle_per_step = CYCLE_PER_STEP,
         .allow_misalign = opt_misaligned,
     };
+#if RV32_HAS(CACHE_TRACE)
+    attr.cache_trace_file = opt_cache_trace;
+#endif
 #if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
     attr.data.system.kernel = opt_kernel_img;
     attr.data.system.initrd = opt_rootfs_img;
     attr.data.system.bootargs = opt_bootargs;
     attr.data.system.vblk_device = opt_virtio_blk_img;
+    attr.data.system.vnet_device = opt_virtio_net;
+    attr.data.system.vcon_device = opt_virtio_console;
+    attr.data.system.uart_opts = opt_uart;
+    attr.data.system.snapshot = opt_snapshot;
+    attr.data.system.resume = opt_resume;
 #else
     attr.data.user.elf_program = opt_prog_name;
 #endif
@@ -6,6 +6,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,6 +14,7 @@
 #include <sys/stat.h>
 
 #if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+#include <signal.h>
 #include <termios.h>
 #include "dtc/libfdt/libfdt.h"
 #endif
@@ -45,49 +47,59 @@
 #define CODE_CACHE_SIZE (4 * 1024 * 1024)
 #endif
 
-#define BLOCK_IR_MAP_CAPACITY_BITS 10
-
 #if !RV32_HAS(JIT)
 /* initialize the block map */
 static void block_map_init(block_map_t *map, const uint8_t bits)
 {
+    memset(map, 0, sizeof(block_map_t));
     map->block_capacity = 1 << bits;
-    map->size = 0;
+    map->shift = 32 - bits;
     map->map = calloc(map->block_capacity, sizeof(struct block *));
     assert(map->map);
 }
 
+#if RV32_HAS(SMC_DETECT)
+/* size in bytes of the bitmap with one bit per physical page of the memory */
+static size_t code_bitmap_size(const riscv_t *rv)
+{
+    const uint32_t n_pages = PRIV(rv)->mem_size >> RV_PG_SHIFT;
+    /* a store at the end of the memory may test the page that follows */
+    return ((n_pages >> 5) + 1) * sizeof(uint32_t);
+}
+#endif
+
 /* clear all block in the block map */
 void block_map_clear(riscv_t *rv)
 {
     block_map_t *map = &rv->block_map;
+    block_map_settle(map);
     for (uint32_t i = 0; i < map->block_capacity; i++) {
         block_t *block = map->map[i];
         if (!block)
             continue;
 
-        uint32_t idx;
-        rv_insn_t *ir, *next;
-        for (idx = 0, ir = block->ir_head; idx < block->n_insn;
-             idx++, ir = next) {
-            free(ir->fuse);
-            free(ir->branch_table);
-            next = ir->next;
-            mpool_free(rv->block_ir_mp, ir);
-        }
+        block_ir_free(block);
         mpool_free(rv->block_mp, block);
         map->map[i] = NULL;
     }
     map->size = 0;
+    map->n_clears++;
+#if RV32_HAS(SMC_DETECT)
+    memset(rv->code_bitmap, 0, code_bitmap_size(rv));
+    rv->smc_lo = ~0U;
+    rv->smc_hi = 0;
+#endif
 }
 
 static void block_map_destroy(riscv_t *rv)
 {
     block_map_clear(rv);
     free(rv->block_map.map);
+#if RV32_HAS(SMC_DETECT)
+    free(rv->code_bitmap);
+#endif
 
     mpool_destroy(rv->block_mp);
-    mpool_destroy(rv->block_ir_mp);
 }
 #endif
 
@@ -173,15 +185,18 @@ void rv_remap_stdstream(riscv_t *rv, fd_stream_pair_t *fsp, uint32_t fsp_size)
 }
 
 #define MEMIO(op) on_mem_##op
-#define IO_HANDLER_IMPL(type, op, RW)                                     \
-    static IIF(RW)(                                                       \
-        /* W */ void MEMIO(op)(UNUSED riscv_t * rv, riscv_word_t addr,    \
-                               riscv_##type##_t data),                    \
-        /* R */ riscv_##type##_t MEMIO(op)(UNUSED riscv_t * rv,           \
-                                           riscv_word_t addr))            \
-    {                                                                     \
-        IIF(RW)                                                           \
-        (memory_##op(addr, (uint8_t *) &data), return memory_##op(addr)); \
+#define IO_HANDLER_IMPL(type, op, RW)                                  \
+    static IIF(RW)(                                                    \
+        /* W */ void MEMIO(op)(UNUSED riscv_t * rv, riscv_word_t addr, \
+                               riscv_##type##_t data),                 \
+        /* R */ riscv_##type##_t MEMIO(op)(UNUSED riscv_t * rv,        \
+                                           riscv_word_t addr))         \
+    {                                                                  \
+        IIF(RW)                                                        \
+        (memory_##op(addr, (uint8_t *) &data);                         \
+         IIF(RV32_HAS(SMC_DETECT))(                                    \
+             code_page_store(rv, addr, sizeof(data)), ),               \
+         return memory_##op(addr));                                    \
     }
 
 #if !RV32_HAS(SYSTEM)
@@ -213,9 +228,7 @@ static void *t2c_runloop(void *arg)
             pthread_mutex_lock(&rv->wait_queue_lock);
             list_del_init(&entry->list);
             pthread_mutex_unlock(&rv->wait_queue_lock);
-            pthread_mutex_lock(&rv->cache_lock);
-            t2c_compile(rv, entry->block);
-            pthread_mutex_unlock(&rv->cache_lock);
+            t2c_compile_queued(rv, entry);
             free(entry);
         }
     }
@@ -294,6 +307,8 @@ static void load_dtb(char **ram_loc, vm_attr_t *attr)
 #include "minimal_dtb.h"
     char *bootargs = attr->data.system.bootargs;
     char *vblk = attr->data.system.vblk_device;
+    char *vnet = attr->data.system.vnet_device;
+    bool vcon = attr->data.system.vcon_device;
     char *blob = *ram_loc;
     char *buf;
     size_t len;
@@ -302,6 +317,10 @@ static void load_dtb(char **ram_loc, vm_attr_t *attr)
 
     memcpy(blob, minimal, sizeof(minimal));
 
+    /* the console moves from the UART to the virtio-console after boot */
+    if (!bootargs && vcon)
+        bootargs = "earlycon console=hvc0";
+
     if (bootargs) {
         node = fdt_path_offset(blob, "/chosen");
         assert(node > 0);
@@ -310,8 +329,8 @@ static void load_dtb(char **ram_loc, vm_attr_t *attr)
         buf = malloc(len);
         assert(buf);
         memcpy(buf, bootargs, len - 1);
-        buf[len] = 0;
-        err = fdt_setprop(blob, node, "bootargs", buf, len + 1);
+        buf[len - 1] = 0;
+        err = fdt_setprop(blob, node, "bootargs", buf, len);
         if (err == -FDT_ERR_NOSPACE) {
             blob = realloc_property(blob, node, "bootargs", len);
             err = fdt_setprop(blob, node, "bootargs", buf, len);
@@ -332,6 +351,30 @@ static void load_dtb(char **ram_loc, vm_attr_t *attr)
         assert(fdt_del_node(blob, subnode) == 0);
     }
 
+    /* likewise for the vnet node */
+    if (!vnet) {
+        int subnode;
+        node = fdt_path_offset(blob, "/soc@F0000000");
+        assert(node >= 0);
+
+        subnode = fdt_subnode_offset(blob, node, "virtio@4300000");
+        assert(subnode >= 0);
+
+        assert(fdt_del_node(blob, subnode) == 0);
+    }
+
+    /* likewise for the vcon node */
+    if (!vcon) {
+        int subnode;
+        node = fdt_path_offset(blob, "/soc@F0000000");
+        assert(node >= 0);
+
+        subnode = fdt_subnode_offset(blob, node, "virtio@4400000");
+        assert(subnode >= 0);
+
+        assert(fdt_del_node(blob, subnode) == 0);
+    }
+
     totalsize = fdt_totalsize(blob);
     *ram_loc += totalsize;
     return;
@@ -407,6 +450,7 @@ static void rv_fsync_device()
      * vblk is optional, so it could be NULL
      */
     if (attr->vblk) {
+        /* the asynchronous backend writes the disk back in vblk_delete() */
         if (attr->vblk->disk_fd >= 3) {
             if (attr->vblk->device_features & VIRTIO_BLK_F_RO) /* readonly */
                 goto end;
@@ -430,6 +474,52 @@ static void rv_fsync_device()
         vblk_delete(attr->vblk);
     }
 }
+
+/* Report the host system calls taken by the UART per guest second, which
+ * the option -x uart:stats asks for.
+ */
+static void rv_report_uart(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    if (!attr->uart_stats)
+        return;
+
+    const u8250_state_t *uart = attr->uart;
+    const uint64_t reader = u8250_reader_syscalls(uart);
+    const double secs = (double) rv->timer / TIMEBASE_FREQ;
+    rv_log_info("UART (%s): %" PRIu64 " host syscalls (%" PRIu64
+                " on the reader thread) in %.3f guest seconds, %.1f per "
+                "guest second",
+                uart->unbuffered ? "unbuffered" : "buffered",
+                uart->n_syscalls + reader, reader, secs,
+                secs > 0 ? (uart->n_syscalls + reader) / secs : 0.0);
+}
+
+extern void emu_wakeup(void *arg);
+#if RV32_HAS(HOST_TIMER)
+extern void rv_alarm_start(riscv_t *rv);
+extern void rv_alarm_stop(riscv_t *rv);
+#endif
+
+/* write out the console and report on it for CTRL+a+x exit */
+static void rv_uart_exit()
+{
+    if (!rv)
+        return;
+
+    u8250_flush(PRIV(rv)->uart);
+    rv_report_uart(rv);
+}
+
+/* SIGUSR1 asks for a snapshot, which the hart saves before the next block */
+static void rv_snapshot_signal(int sig UNUSED)
+{
+    if (!rv)
+        return;
+
+    __atomic_store_n(&PRIV(rv)->snapshot_req, true, __ATOMIC_SEQ_CST);
+    emu_wakeup(rv);
+}
 #endif /* RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER) */
 
 riscv_t *rv_create(riscv_user_t rv_attr)
@@ -444,6 +534,8 @@ riscv_t *rv_create(riscv_user_t rv_attr)
     atexit(rv_async_block_clear);
     /* register device sync callback for CTRL+a+x exit */
     atexit(rv_fsync_device);
+    /* register console callback for CTRL+a+x exit */
+    atexit(rv_uart_exit);
 #endif
 
     /* copy over the attr */
@@ -548,23 +640,26 @@ riscv_t *rv_create(riscv_user_t rv_attr)
      * *----------------*----------------*-------*
      */
 
-    char *ram_loc = (char *) attr->mem->mem_base;
-    map_file(&ram_loc, attr->data.system.kernel);
-    rv_log_info("Kernel loaded");
-
     uint32_t dtb_addr = attr->mem->mem_size - DTB_SIZE;
-    ram_loc = ((char *) attr->mem->mem_base) + dtb_addr;
-    load_dtb(&ram_loc, attr);
-    rv_log_info("DTB loaded");
-    /*
-     * Load optional initrd image at last 8 MiB before the dtb region to
-     * prevent kernel from overwritting it
-     */
-    if (attr->data.system.initrd) {
-        uint32_t initrd_addr = dtb_addr - INITRD_SIZE;
-        ram_loc = ((char *) attr->mem->mem_base) + initrd_addr;
-        map_file(&ram_loc, attr->data.system.initrd);
-        rv_log_info("Rootfs loaded");
+    /* a snapshot to resume from brings the RAM instead, see below */
+    if (!attr->data.system.resume) {
+        char *ram_loc = (char *) attr->mem->mem_base;
+        map_file(&ram_loc, attr->data.system.kernel);
+        rv_log_info("Kernel loaded");
+
+        ram_loc = ((char *) attr->mem->mem_base) + dtb_addr;
+        load_dtb(&ram_loc, attr);
+        rv_log_info("DTB loaded");
+        /*
+         * Load optional initrd image at last 8 MiB before the dtb region to
+         * prevent kernel from overwritting it
+         */
+        if (attr->data.system.initrd) {
+            uint32_t initrd_addr = dtb_addr - INITRD_SIZE;
+            ram_loc = ((char *) attr->mem->mem_base) + initrd_addr;
+            map_file(&ram_loc, attr->data.system.initrd);
+            rv_log_info("Rootfs loaded");
+        }
     }
 
     /* this variable has external linkage to mmu_io defined in system.c */
@@ -577,6 +672,26 @@ riscv_t *rv_create(riscv_user_t rv_attr)
 
     /* setup timer */
     attr->timer = 0xFFFFFFFFFFFFFFF;
+#if RV32_HAS(HOST_TIMER)
+    rv_clock_gettime(&attr->timer_epoch);
+#endif
+
+    /* the first block looks at the interrupts and polls the peripherals */
+    rv->event_deadline = 0;
+    attr->poll_deadline = 0;
+    attr->woken = false;
+#if RV32_HAS(HOST_TIMER)
+    rv_alarm_start(rv);
+#endif
+
+    /* setup the wakeup of WFI by the threads of the devices */
+    attr->sleeping = false;
+    if (pipe(attr->wake_fd) == -1) {
+        rv_log_error("Failed to create the wakeup pipe: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fcntl(attr->wake_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(attr->wake_fd[1], F_SETFL, O_NONBLOCK);
 
     /* setup PLIC */
     attr->plic = plic_new();
@@ -588,12 +703,31 @@ riscv_t *rv_create(riscv_user_t rv_attr)
     assert(attr->uart);
     attr->uart->in_fd = attr->fd_stdin;
     attr->uart->out_fd = attr->fd_stdout;
+    attr->uart_stats = false;
+    if (attr->data.system.uart_opts) {
+        char *opt = strtok(attr->data.system.uart_opts, ",");
+        for (; opt; opt = strtok(NULL, ",")) {
+            if (!strcmp(opt, "unbuffered")) {
+                attr->uart->unbuffered = true;
+            } else if (!strcmp(opt, "stats")) {
+                attr->uart_stats = true;
+            } else {
+                rv_log_error("Unknown uart option: %s", opt);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    /* the virtio-console, if any, takes the input instead */
+    attr->uart->wake = emu_wakeup;
+    attr->uart->wake_arg = rv;
+    if (!attr->data.system.vcon_device)
+        u8250_start_reader(attr->uart);
 
     /* setup virtio-blk */
     attr->vblk = NULL;
     if (attr->data.system.vblk_device) {
-/* Currently, only used for block image path and permission */
-#define MAX_OPTS 2
+/* Currently, only used for block image path, permission, backend and overlay */
+#define MAX_OPTS 4
         char *vblk_opts[MAX_OPTS] = {NULL};
         int vblk_opt_idx = 0;
         char *opt = strtok(attr->data.system.vblk_device, ",");
@@ -606,42 +740,88 @@ riscv_t *rv_create(riscv_user_t rv_attr)
             opt = strtok(NULL, ",");
         }
         char *vblk_device = vblk_opts[0];
-        char *vblk_readonly = vblk_opts[1];
 
-        bool readonly = false;
-        if (vblk_readonly) {
-            if (strcmp(vblk_readonly, "readonly") != 0) {
-                rv_log_error("Unknown vblk option: %s", vblk_readonly);
+        bool readonly = false, async = false;
+        char *overlay = NULL;
+        for (int i = 1; i < vblk_opt_idx; i++) {
+            if (!strcmp(vblk_opts[i], "readonly")) {
+                readonly = true;
+            } else if (!strcmp(vblk_opts[i], "async")) {
+                async = true;
+            } else if (!strncmp(vblk_opts[i], "overlay=", 8)) {
+                overlay = vblk_opts[i] + 8; /* strlen("overlay=") */
+            } else {
+                rv_log_error("Unknown vblk option: %s", vblk_opts[i]);
                 exit(EXIT_FAILURE);
             }
-            readonly = true;
         }
 
         attr->vblk = vblk_new();
         attr->vblk->ram = (uint32_t *) attr->mem->mem_base;
-        attr->disk = virtio_blk_init(attr->vblk, vblk_device, readonly);
+        attr->vblk->wake = emu_wakeup;
+        attr->vblk->wake_arg = rv;
+        attr->disk = virtio_blk_init(attr->vblk, vblk_device, overlay,
+                                     readonly, async);
+    }
+
+    /* setup virtio-net */
+    attr->vnet = NULL;
+    if (attr->data.system.vnet_device) {
+        attr->vnet = vnet_new();
+        attr->vnet->ram = (uint32_t *) attr->mem->mem_base;
+        virtio_net_init(attr->vnet, attr->data.system.vnet_device);
+    }
+
+    /* setup virtio-console */
+    attr->vcon = NULL;
+    if (attr->data.system.vcon_device) {
+        attr->vcon = vcon_new();
+        attr->vcon->ram = (uint32_t *) attr->mem->mem_base;
+        attr->vcon->in_fd = attr->fd_stdin;
+        attr->vcon->out_fd = attr->fd_stdout;
+        virtio_console_init(attr->vcon);
+    }
+
+    /* resume from a snapshot, with the devices set up as above */
+    attr->snapshot_req = false;
+    if (attr->data.system.resume &&
+        !rv_snapshot_load(rv, attr->data.system.resume))
+        exit(EXIT_FAILURE);
+    if (attr->data.system.snapshot) {
+        struct sigaction sa = {.sa_handler = rv_snapshot_signal,
+                               .sa_flags = SA_RESTART};
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR1, &sa, NULL);
     }
 
     capture_keyboard_input();
 #endif /* !RV32_HAS(SYSTEM) || (RV32_HAS(SYSTEM) && RV32_HAS(ELF_LOADER)) */
 
-    /* create block and IRs memory pool */
+    /* create block memory pool */
     rv->block_mp = mpool_create(sizeof(block_t) << BLOCK_MAP_CAPACITY_BITS,
                                 sizeof(block_t));
-    rv->block_ir_mp = mpool_create(
-        sizeof(rv_insn_t) << BLOCK_IR_MAP_CAPACITY_BITS, sizeof(rv_insn_t));
+#if RV32_HAS(DECODE_CACHE)
+    rv->decode_cache = decode_cache_new();
+#endif
 
 #if !RV32_HAS(JIT)
     /* initialize the block map */
     block_map_init(&rv->block_map, BLOCK_MAP_CAPACITY_BITS);
+#if RV32_HAS(SMC_DETECT)
+    rv->code_bitmap = calloc(1, code_bitmap_size(rv));
+    assert(rv->code_bitmap);
+    rv->smc_lo = ~0U;
+    rv->smc_hi = 0;
+#endif
 #else
     INIT_LIST_HEAD(&rv->block_list);
     rv->jit_state = jit_state_init(CODE_CACHE_SIZE);
-    rv->block_cache = cache_create(BLOCK_MAP_CAPACITY_BITS);
+    rv->block_cache = cache_create(BLOCK_CACHE_CAPACITY_BITS);
     assert(rv->block_cache);
 #if RV32_HAS(T2C)
     rv->quit = false;
-    rv->jit_cache = jit_cache_init();
+    rv->jit_cache = jit_cache_init(JIT_CACHE_SIZE_BITS);
+    assert(rv->jit_cache);
     /* prepare wait queue. */
     pthread_mutex_init(&rv->wait_queue_lock, NULL);
     pthread_mutex_init(&rv->cache_lock, NULL);
@@ -690,6 +870,20 @@ void rv_debug(riscv_t *rv);
 
 void rv_profile(riscv_t *rv, char *out_file_path);
 
+#if RV32_HAS(CACHE_TRACE)
+/* Record the lookups of the block cache to @path, to be replayed by
+ * tests/cache/test-cache.
+ */
+static FILE *rv_trace_open(riscv_t *rv, const char *path)
+{
+    FILE *trace = fopen(path, "wb");
+    if (!trace)
+        rv_log_error("Cannot open trace file %s", path);
+    cache_trace(rv->block_cache, trace);
+    return trace;
+}
+#endif
+
 void rv_run(riscv_t *rv)
 {
     assert(rv);
@@ -697,12 +891,19 @@ void rv_run(riscv_t *rv)
     vm_attr_t *attr = PRIV(rv);
     assert(attr &&
 #if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
-           attr->data.system.kernel && attr->data.system.initrd
+           ((attr->data.system.kernel && attr->data.system.initrd) ||
+            attr->data.system.resume)
 #else
            attr->data.user.elf_program
 #endif
     );
 
+#if RV32_HAS(CACHE_TRACE)
+    FILE *trace = NULL;
+    if (attr->cache_trace_file)
+        trace = rv_trace_open(rv, attr->cache_trace_file);
+#endif
+
     if (!(attr->run_flag & (RV_RUN_TRACE | RV_RUN_GDBSTUB))) {
 #ifdef __EMSCRIPTEN__
         emscripten_set_main_loop_arg(rv_step, (void *) rv, 0, 1);
@@ -725,6 +926,12 @@ void rv_run(riscv_t *rv)
         assert(attr->profile_output_file);
         rv_profile(rv, attr->profile_output_file);
     }
+#if RV32_HAS(CACHE_TRACE)
+    if (trace) {
+        cache_trace(rv->block_cache, NULL);
+        fclose(trace);
+    }
+#endif
 }
 
 void rv_halt(riscv_t *rv)
@@ -757,12 +964,29 @@ void rv_delete(riscv_t *rv)
 #endif
     jit_state_exit(rv->jit_state);
     cache_free(rv->block_cache);
+    block_t *block;
+    list_for_each_entry (block, &rv->block_list, list)
+        block_ir_free(block);
+    mpool_destroy(rv->block_mp);
+#endif
+#if RV32_HAS(DECODE_CACHE)
+    decode_cache_free(rv->decode_cache);
 #endif
 #if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+#if RV32_HAS(HOST_TIMER)
+    rv_alarm_stop(rv);
+#endif
+    rv_report_uart(rv);
     u8250_delete(attr->uart);
     plic_delete(attr->plic);
+    if (attr->vnet)
+        vnet_delete(attr->vnet);
+    if (attr->vcon)
+        vcon_delete(attr->vcon);
     /* sync device, cleanup inside the callee */
     rv_fsync_device();
+    close(attr->wake_fd[0]);
+    close(attr->wake_fd[1]);
 #endif
     free(rv);
 }
@@ -881,6 +1105,8 @@ void rv_reset(riscv_t *rv, riscv_word_t pc)
 
     /* not being trapped */
     rv->is_trapped = false;
+
+    dtlb_flush(rv);
 #else
     /* ISA simulation defaults to M-mode */
     rv->priv_mode = RV_PRIV_M_MODE;
@@ -929,6 +1155,14 @@ static const char *insn_name_table[] = {
 #undef _
 };
 
+#if RV32_HAS(MOP_FUSION)
+static const char *mop_name_table[] = {
+#define _(pattern) [mop_##pattern] = #pattern,
+    MOP_PATTERN_LIST
+#undef _
+};
+#endif
+
 #if RV32_HAS(JIT)
 static void profile(block_t *block, uint32_t freq, FILE *output_file)
 {
@@ -937,8 +1171,8 @@ static void profile(block_t *block, uint32_t freq, FILE *output_file)
     fprintf(output_file, " %-10u|", freq);
     fprintf(output_file, " %-5s |", block->hot ? "true" : "false");
     fprintf(output_file, " %-6s |", block->has_loops ? "true" : "false");
-    rv_insn_t *taken = block->ir_tail->branch_taken,
-              *untaken = block->ir_tail->branch_untaken;
+    rv_insn_cold_t *cold = rv_insn_cold(block->ir_tail);
+    rv_insn_t *taken = cold->branch_taken, *untaken = cold->branch_untaken;
     if (untaken)
         fprintf(output_file, "%#-9x|", untaken->pc);
     else
@@ -949,11 +1183,10 @@ static void profile(block_t *block, uint32_t freq, FILE *output_file)
         fprintf(output_file, "%-8s|", "NULL");
     rv_insn_t *ir = block->ir_head;
     while (1) {
-        assert(ir);
         fprintf(output_file, "%s", insn_name_table[ir->opcode]);
-        if (!ir->next)
+        if (ir->tail)
             break;
-        ir = ir->next;
+        ir++;
         fprintf(output_file, " - ");
     }
     fprintf(output_file, "\n");
@@ -976,17 +1209,26 @@ void rv_profile(riscv_t *rv, char *out_file_path)
             "PC start |PC end  | frequency |  hot  | loop  | untaken | taken | "
             "IR list \n");
     cache_profile(rv->block_cache, f, (prof_func_t) profile);
+#if RV32_HAS(T2C)
+    uint64_t hit, miss, conflict;
+    jit_cache_stats(rv->jit_cache, &hit, &miss, &conflict);
+    fprintf(f,
+            "\njit-cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64
+            " conflicts\n",
+            hit, miss, conflict);
+#endif
 #else
     fprintf(f, "PC start |PC end  | untaken | taken  | IR list \n");
     block_map_t *map = &rv->block_map;
+    block_map_settle(map);
     for (uint32_t i = 0; i < map->block_capacity; i++) {
         block_t *block = map->map[i];
         if (!block)
             continue;
         fprintf(f, "%#-9x|", block->pc_start);
         fprintf(f, "%#-8x|", block->pc_end);
-        rv_insn_t *taken = block->ir_tail->branch_taken,
-                  *untaken = block->ir_tail->branch_untaken;
+        rv_insn_cold_t *cold = rv_insn_cold(block->ir_tail);
+        rv_insn_t *taken = cold->branch_taken, *untaken = cold->branch_untaken;
         if (untaken)
             fprintf(f, "%#-9x|", untaken->pc);
         else
@@ -997,14 +1239,38 @@ void rv_profile(riscv_t *rv, char *out_file_path)
             fprintf(f, "%-8s|", "NULL");
         rv_insn_t *ir = block->ir_head;
         while (1) {
-            assert(ir);
             fprintf(f, "%s", insn_name_table[ir->opcode]);
-            if (!ir->next)
+            if (ir->tail)
                 break;
-            ir = ir->next;
+            ir++;
             fprintf(f, " - ");
         }
         fprintf(f, "\n");
     }
+
+    uint64_t probes = 0;
+    uint32_t max_probe = 0;
+    for (uint32_t i = 0; i < map->block_capacity; i++) {
+        if (!map->map[i])
+            continue;
+        const uint32_t n = block_map_probe_length(map, i);
+        probes += n;
+        if (n > max_probe)
+            max_probe = n;
+    }
+    fprintf(f,
+            "\nblock-map: %u blocks in %u slots, %.2f probes on average, %u "
+            "at most\n",
+            map->size, map->block_capacity,
+            map->size ? (double) probes / map->size : 0.0, max_probe);
+    fprintf(f,
+            "block-map: %u grows, %u evictions of %u blocks in total, %u "
+            "clears\n",
+            map->n_grows, map->n_evictions, map->n_evicted, map->n_clears);
+#endif
+#if RV32_HAS(MOP_FUSION)
+    fprintf(f, "\nmacro-op fusion | hits\n");
+    for (int i = 0; i < N_MOP_PATTERNS; i++)
+        fprintf(f, "%-16s| %u\n", mop_name_table[i], rv->mop_hits[i]);
 #endif
 }
@@ -8,6 +8,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "io.h"
 #include "log.h"
@@ -285,6 +286,18 @@ enum TRAP_CODE {
 
 #define BLOCK_MAP_CAPACITY_BITS 10
 
+/* The block cache of the JIT compiler holds 2^BLOCK_CACHE_CAPACITY_BITS
+ * blocks, and can be overridden from the build configuration (e.g., CFLAGS).
+ */
+#ifndef BLOCK_CACHE_CAPACITY_BITS
+#define BLOCK_CACHE_CAPACITY_BITS BLOCK_MAP_CAPACITY_BITS
+#endif
+
+/* The block map of the interpreter grows up to this size, then the idle
+ * blocks are evicted.
+ */
+#define BLOCK_MAP_MAX_CAPACITY_BITS 16
+
 /* forward declaration for internal structure */
 typedef struct riscv_internal riscv_t;
 typedef void *riscv_user_t;
@@ -437,6 +450,18 @@ void trap_handler(riscv_t *rv);
 /* halt the core */
 void rv_halt(riscv_t *rv);
 
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+/* Save the hart, the guest RAM and the devices to the snapshot file @path
+ * between two blocks, and return false on failure
+ */
+bool rv_snapshot_save(riscv_t *rv, const char *path);
+
+/* Restore the snapshot file @path into the emulator just created with the
+ * same devices, and return false on failure
+ */
+bool rv_snapshot_load(riscv_t *rv, const char *path);
+#endif
+
 /* return the halt state */
 bool rv_has_halted(riscv_t *rv);
 
@@ -462,6 +487,11 @@ typedef struct {
     char *initrd;
     char *bootargs;
     char *vblk_device;
+    char *vnet_device;
+    bool vcon_device;
+    char *uart_opts;
+    char *snapshot; /* written on SIGUSR1, or NULL */
+    char *resume;   /* restored in place of booting the kernel, or NULL */
 } vm_system_t;
 #endif /* RV32_HAS(SYSTEM) */
 
@@ -474,10 +504,18 @@ typedef struct {
 
 } vm_data_t;
 
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+/* timebase-frequency of minimal.dts, at which rv->timer ticks */
+#ifndef TIMEBASE_FREQ
+#define TIMEBASE_FREQ 65000000
+#endif
+#endif
+
 typedef struct {
 #if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
     /* uart object */
     u8250_state_t *uart;
+    bool uart_stats; /* report its system calls, see rv_report_uart() */
 
     /* plic object */
     plic_t *plic;
@@ -485,6 +523,29 @@ typedef struct {
     /* virtio-blk device */
     uint32_t *disk;
     virtio_blk_state_t *vblk;
+
+    /* virtio-net device */
+    virtio_net_state_t *vnet;
+
+    /* virtio-console device, which takes over the input of the UART */
+    virtio_console_state_t *vcon;
+
+    /* the hart sleeping in WFI is woken by a byte on wake_fd, written by
+     * the threads of the devices, see emu_wakeup()
+     */
+    int wake_fd[2];
+    bool sleeping;
+
+    /* set by the threads of the devices along with rv->event_deadline, so
+     * that the hart polls the peripherals before the next block
+     */
+    bool woken;
+
+    /* value of rv->timer from which the peripherals are polled again */
+    uint64_t poll_deadline;
+
+    /* set on SIGUSR1 to save a snapshot before the next block */
+    bool snapshot_req;
 #endif /* RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER) */
 
     /* vm memory object */
@@ -537,6 +598,11 @@ typedef struct {
     /* profiling output file if RV_RUN_PROFILE is set in run_flag */
     char *profile_output_file;
 
+#if RV32_HAS(CACHE_TRACE)
+    /* file recording the lookups of the block cache, or NULL */
+    char *cache_trace_file;
+#endif
+
     /* set by rv_create during initialization.
      * use rv_remap_stdstream to overwrite them
      */
@@ -558,6 +624,14 @@ typedef struct {
 
     /* SBI timer */
     uint64_t timer;
+
+#if RV32_HAS(HOST_TIMER)
+    /* host time at which rv->timer reads 0 */
+    struct timespec timer_epoch;
+
+    /* thread raising the events when the host time reaches them */
+    struct rv_alarm *alarm;
+#endif
 } vm_attr_t;
 
 #ifdef __cplusplus
@@ -5,6 +5,7 @@
 
 #pragma once
 #include <stdbool.h>
+#include <string.h>
 
 #if RV32_HAS(GDBSTUB)
 #include "breakpoint.h"
@@ -84,6 +85,9 @@ typedef struct block {
     uint32_t pc_start, pc_end; /**< address range of the basic block */
 
     rv_insn_t *ir_head, *ir_tail; /**< the first and last ir for this block */
+#if RV32_HAS(SMC_DETECT)
+    uint32_t page_lo, page_hi; /**< range of physical pages holding the code */
+#endif
 #if RV32_HAS(JIT)
     bool hot;  /**< Determine the block is potential hotspot or not */
     bool hot2; /**< Determine the block is strong hotspot or not */
@@ -94,7 +98,9 @@ typedef struct block {
     uint32_t satp;
 #endif
 #if RV32_HAS(T2C)
-    bool compiled; /**< The T2C request is enqueued or not */
+    bool compiled;  /**< The T2C request is enqueued or not */
+    bool recompile; /**< The T2C recompilation is enqueued or not */
+    uint32_t n_guard_fail; /**< failures of the speculation in its trace */
 #endif
     uint32_t offset;   /**< The machine code offset in T1 code cache */
     uint32_t n_invoke; /**< The invoking times of T1 machine code */
@@ -104,21 +110,60 @@ typedef struct block {
 } block_t;
 
 #if RV32_HAS(JIT) && RV32_HAS(T2C)
+/* The block is named by its PC and satp rather than pointed to, as it may be
+ * evicted before the T2C thread takes the request.
+ */
 typedef struct {
-    block_t *block;
+    uint32_t pc;
+#if RV32_HAS(SYSTEM)
+    uint32_t satp;
+#endif
     struct list_head list;
 } queue_entry_t;
 #endif
 
 typedef struct {
-    uint32_t block_capacity; /**< max number of entries in the block map */
+    uint32_t block_capacity; /**< number of slots, a power of 2 */
     uint32_t size;           /**< number of entries currently in the map */
+    uint32_t shift;          /**< turns a hash into a slot, see map_hash() */
     block_t **map;           /**< block map */
+
+    /* the map being moved into the current one while growing */
+    block_t **old_map;
+    uint32_t old_capacity; /**< number of slots of the former map */
+    uint32_t n_moved;      /**< number of slots moved so far */
+
+    /* statistics, see rv_profile() */
+    uint32_t n_grows;     /**< times the capacity was doubled */
+    uint32_t n_evictions; /**< times the idle blocks were evicted */
+    uint32_t n_evicted;   /**< number of blocks evicted */
+    uint32_t n_clears;    /**< times all the blocks were dropped */
 } block_map_t;
 
 /* clear all block in the block map */
 void block_map_clear(riscv_t *rv);
 
+/* finish moving the entries of the former map while growing */
+void block_map_settle(block_map_t *map);
+
+/* number of slots probed to look up the block in slot @i of the block map */
+uint32_t block_map_probe_length(const block_map_t *map, const uint32_t i);
+
+/* free the IR array of a block along with the fused operations it owns */
+void block_ir_free(block_t *block);
+
+#if RV32_HAS(SYSTEM) && RV32_HAS(T2C)
+#ifndef N_DTLB_ENTRIES
+#define N_DTLB_ENTRIES 64 /* must be a power of two */
+#endif
+
+/* data TLB entry consulted by the tier-2 generated code */
+typedef struct {
+    uint32_t tag;     /**< virtual page address, ~0U if invalid */
+    uintptr_t addend; /**< host address minus virtual address */
+} dtlb_entry_t;
+#endif
+
 struct riscv_internal {
     bool halt; /* indicate whether the core is halted */
 
@@ -132,6 +177,14 @@ struct riscv_internal {
 
     uint64_t timer; /* strictly increment timer */
 
+#if RV32_HAS(SYSTEM)
+    /* Once the timer reaches this value, rv_step() looks at the interrupts and
+     * the peripherals before the next block, see rv_check_interrupt(). Any
+     * event lowers it to 0.
+     */
+    uint64_t event_deadline;
+#endif
+
 #if RV32_HAS(JIT) && RV32_HAS(SYSTEM)
     /*
      * Aarch64 encoder only accepts 9 bits signed offset. Do not put this
@@ -191,6 +244,10 @@ struct riscv_internal {
     bool compressed; /**< current instruction is compressed or not */
 #if !RV32_HAS(JIT)
     block_map_t block_map; /**< basic block map */
+#if RV32_HAS(SMC_DETECT)
+    uint32_t *code_bitmap;   /**< physical pages holding translated code */
+    uint32_t smc_lo, smc_hi; /**< code pages stored to, none if lo > hi */
+#endif
 #else
     struct cache *block_cache;
     struct list_head block_list; /**< list of all translated blocks */
@@ -202,7 +259,13 @@ struct riscv_internal {
     void *jit_state;
     void *jit_cache;
 #endif
-    struct mpool *block_mp, *block_ir_mp;
+    struct mpool *block_mp;
+#if RV32_HAS(DECODE_CACHE)
+    decode_cache_t *decode_cache; /**< decoded instructions per physical page */
+#endif
+#if RV32_HAS(MOP_FUSION)
+    uint32_t mop_hits[N_MOP_PATTERNS]; /**< applied fusion patterns */
+#endif
 
 #if RV32_HAS(GDBSTUB)
     /* gdbstub instance */
@@ -228,9 +291,79 @@ struct riscv_internal {
      * executing signal handler.
      */
     uint32_t last_csr_sepc;
+
+#if RV32_HAS(T2C)
+    /* separate data TLBs for loads and stores, see dtlb_flush() */
+    dtlb_entry_t dtlb_read[N_DTLB_ENTRIES];
+    dtlb_entry_t dtlb_write[N_DTLB_ENTRIES];
+#endif
 #endif
 };
 
+#if RV32_HAS(SYSTEM) && RV32_HAS(T2C)
+/* Invalidate the data TLBs. This must be done whenever the outcome of the
+ * address translation may change: on writes to satp or sstatus, on sfence.vma
+ * and on privilege mode switches.
+ */
+FORCE_INLINE void dtlb_flush(riscv_t *rv)
+{
+    memset(rv->dtlb_read, 0xff, sizeof(rv->dtlb_read));
+    memset(rv->dtlb_write, 0xff, sizeof(rv->dtlb_write));
+}
+#else
+#define dtlb_flush(rv) \
+    do {               \
+    } while (0)
+#endif
+
+#if RV32_HAS(SYSTEM)
+/* Have rv_step() look at the interrupts before the next block, since the hart
+ * changed something they depend on. The threads of the devices go through
+ * emu_wakeup() instead.
+ */
+FORCE_INLINE void rv_raise_event(riscv_t *rv)
+{
+    __atomic_store_n(&rv->event_deadline, 0, __ATOMIC_RELAXED);
+}
+#endif
+
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+/* test whether an event is pending, which ends the chaining of the blocks */
+FORCE_INLINE bool rv_event_pending(const riscv_t *rv)
+{
+    return rv->timer >= __atomic_load_n(&rv->event_deadline, __ATOMIC_RELAXED);
+}
+#else
+#define rv_event_pending(rv) false
+#endif
+
+#if RV32_HAS(SMC_DETECT)
+/* test whether the physical page @page holds translated code */
+FORCE_INLINE bool code_page_test(const riscv_t *rv, const uint32_t page)
+{
+    return rv->code_bitmap[page >> 5] & (1U << (page & 31));
+}
+
+/* Record a store of @len bytes to the physical address @addr. If it modifies
+ * translated code, the current block is left after the store and the blocks
+ * on the page are invalidated, see block_map_invalidate().
+ */
+FORCE_INLINE void code_page_store(riscv_t *rv,
+                                  const uint32_t addr,
+                                  const uint32_t len)
+{
+    const uint32_t lo = addr >> RV_PG_SHIFT;
+    const uint32_t hi = (addr + len - 1) >> RV_PG_SHIFT;
+    if (likely(!code_page_test(rv, lo) && !code_page_test(rv, hi)))
+        return;
+
+    if (lo < rv->smc_lo)
+        rv->smc_lo = lo;
+    if (hi > rv->smc_hi)
+        rv->smc_hi = hi;
+}
+#endif
+
 /* sign extend a 16 bit value */
 FORCE_INLINE uint32_t sign_extend_h(const uint32_t x)
 {
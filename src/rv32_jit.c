@@ -38,14 +38,14 @@ GEN(beq, {
     store_back(state);
     uint32_t jump_loc_0 = state->offset;
     emit_jcc_offset(state, 0x84);
-    if (ir->branch_untaken) {
+    if (rv_insn_cold(ir)->branch_untaken) {
         emit_jmp(state, ir->pc + 4, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + 4);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
-    if (ir->branch_taken) {
+    if (rv_insn_cold(ir)->branch_taken) {
         emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
@@ -58,14 +58,14 @@ GEN(bne, {
     store_back(state);
     uint32_t jump_loc_0 = state->offset;
     emit_jcc_offset(state, 0x85);
-    if (ir->branch_untaken) {
+    if (rv_insn_cold(ir)->branch_untaken) {
         emit_jmp(state, ir->pc + 4, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + 4);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
-    if (ir->branch_taken) {
+    if (rv_insn_cold(ir)->branch_taken) {
         emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
@@ -78,14 +78,14 @@ GEN(blt, {
     store_back(state);
     uint32_t jump_loc_0 = state->offset;
     emit_jcc_offset(state, 0x8c);
-    if (ir->branch_untaken) {
+    if (rv_insn_cold(ir)->branch_untaken) {
         emit_jmp(state, ir->pc + 4, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + 4);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
-    if (ir->branch_taken) {
+    if (rv_insn_cold(ir)->branch_taken) {
         emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
@@ -98,14 +98,14 @@ GEN(bge, {
     store_back(state);
     uint32_t jump_loc_0 = state->offset;
     emit_jcc_offset(state, 0x8d);
-    if (ir->branch_untaken) {
+    if (rv_insn_cold(ir)->branch_untaken) {
         emit_jmp(state, ir->pc + 4, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + 4);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
-    if (ir->branch_taken) {
+    if (rv_insn_cold(ir)->branch_taken) {
         emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
@@ -118,14 +118,14 @@ GEN(bltu, {
     store_back(state);
     uint32_t jump_loc_0 = state->offset;
     emit_jcc_offset(state, 0x82);
-    if (ir->branch_untaken) {
+    if (rv_insn_cold(ir)->branch_untaken) {
         emit_jmp(state, ir->pc + 4, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + 4);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
-    if (ir->branch_taken) {
+    if (rv_insn_cold(ir)->branch_taken) {
         emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
@@ -138,14 +138,14 @@ GEN(bgeu, {
     store_back(state);
     uint32_t jump_loc_0 = state->offset;
     emit_jcc_offset(state, 0x83);
-    if (ir->branch_untaken) {
+    if (rv_insn_cold(ir)->branch_untaken) {
         emit_jmp(state, ir->pc + 4, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + 4);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
-    if (ir->branch_taken) {
+    if (rv_insn_cold(ir)->branch_taken) {
         emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
@@ -957,14 +957,14 @@ GEN(cbeqz, {
     store_back(state);
     uint32_t jump_loc_0 = state->offset;
     emit_jcc_offset(state, 0x84);
-    if (ir->branch_untaken) {
+    if (rv_insn_cold(ir)->branch_untaken) {
         emit_jmp(state, ir->pc + 2, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + 2);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
-    if (ir->branch_taken) {
+    if (rv_insn_cold(ir)->branch_taken) {
         emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
@@ -977,14 +977,14 @@ GEN(cbnez, {
     store_back(state);
     uint32_t jump_loc_0 = state->offset;
     emit_jcc_offset(state, 0x85);
-    if (ir->branch_untaken) {
+    if (rv_insn_cold(ir)->branch_untaken) {
         emit_jmp(state, ir->pc + 2, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + 2);
     emit_store(state, S32, temp_reg, parameter_reg[0], offsetof(riscv_t, PC));
     emit_exit(state);
     emit_jump_target_offset(state, JUMP_LOC_0, state->offset);
-    if (ir->branch_taken) {
+    if (rv_insn_cold(ir)->branch_taken) {
         emit_jmp(state, ir->pc + ir->imm, rv->csr_satp);
     }
     emit_load_imm(state, temp_reg, ir->pc + ir->imm);
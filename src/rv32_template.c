@@ -165,7 +165,7 @@ RVOP(
 #if !RV32_HAS(EXT_C)
         RV_EXC_MISALIGN_HANDLER(pc, INSN, false, 0);
 #endif
-        struct rv_insn *taken = ir->branch_taken;
+        struct rv_insn *taken = rv_insn_exit(ir)->branch_taken;
         if (taken) {
 #if RV32_HAS(JIT)
             IIF(RV32_HAS(SYSTEM)(if (!rv->is_trapped && !reloc_enable_mmu), ))
@@ -182,7 +182,7 @@ RVOP(
             }
 #endif
 #if RV32_HAS(SYSTEM)
-            if (!rv->is_trapped)
+            if (!rv->is_trapped && !rv_event_pending(rv))
 #endif
             {
                 /*
@@ -198,7 +198,7 @@ RVOP(
                  */
                 last_pc = PC;
 
-                MUST_TAIL return taken->impl(rv, taken, cycle, PC);
+                RVOP_CHAIN_EXIT(taken);
             }
         }
         goto end_op;
@@ -234,64 +234,63 @@ RVOP(
      */                                                                        \
     IIF(RV32_HAS(GDBSTUB)(if (!rv->debug_mode), ))                             \
     {                                                                          \
-        IIF(RV32_HAS(SYSTEM)(if (!rv->is_trapped && !reloc_enable_mmu), ))     \
+        IIF(RV32_HAS(SYSTEM)(if (!rv->is_trapped && !reloc_enable_mmu &&       \
+                                 !rv_event_pending(rv)), ))                    \
         {                                                                      \
+            branch_history_table_t *bt = rv_insn_exit(ir)->branch_table;       \
             for (int i = 0; i < HISTORY_SIZE; i++) {                           \
-                if (ir->branch_table->PC[i] == PC) {                           \
-                    MUST_TAIL return ir->branch_table->target[i]->impl(        \
-                        rv, ir->branch_table->target[i], cycle, PC);           \
+                if (bt->PC[i] == PC) {                                         \
+                    RVOP_CHAIN_EXIT(bt->target[i]);                            \
                 }                                                              \
             }                                                                  \
             block_t *block = block_find(&rv->block_map, PC);                   \
             if (block) {                                                       \
                 /* update branch history table */                              \
-                ir->branch_table->PC[ir->branch_table->idx] = PC;              \
-                ir->branch_table->target[ir->branch_table->idx] =              \
-                    block->ir_head;                                            \
-                ir->branch_table->idx =                                        \
-                    (ir->branch_table->idx + 1) % HISTORY_SIZE;                \
-                MUST_TAIL return block->ir_head->impl(rv, block->ir_head,      \
-                                                      cycle, PC);              \
+                bt->PC[bt->idx] = PC;                                          \
+                bt->target[bt->idx] = block->ir_head;                          \
+                bt->idx = (bt->idx + 1) % HISTORY_SIZE;                        \
+                RVOP_CHAIN_EXIT(block->ir_head);                               \
             }                                                                  \
         }                                                                      \
     }
 #else
-#define LOOKUP_OR_UPDATE_BRANCH_HISTORY_TABLE()                              \
-    IIF(RV32_HAS(SYSTEM))(if (!rv->is_trapped && !reloc_enable_mmu), )       \
-    {                                                                        \
-        block_t *block = cache_get(rv->block_cache, PC, true);               \
-        if (block) {                                                         \
-            for (int i = 0; i < HISTORY_SIZE; i++) {                         \
-                if (ir->branch_table->PC[i] == PC) {                         \
-                    IIF(RV32_HAS(SYSTEM))                                    \
-                    (if (ir->branch_table->satp[i] == rv->csr_satp), )       \
-                    {                                                        \
-                        ir->branch_table->times[i]++;                        \
-                        if (cache_hot(rv->block_cache, PC))                  \
-                            goto end_op;                                     \
-                    }                                                        \
-                }                                                            \
-            }                                                                \
-            /* update branch history table */                                \
-            int min_idx = 0;                                                 \
-            for (int i = 0; i < HISTORY_SIZE; i++) {                         \
-                if (!ir->branch_table->times[i]) {                           \
-                    min_idx = i;                                             \
-                    break;                                                   \
-                } else if (ir->branch_table->times[min_idx] >                \
-                           ir->branch_table->times[i]) {                     \
-                    min_idx = i;                                             \
-                }                                                            \
-            }                                                                \
-            ir->branch_table->times[min_idx] = 1;                            \
-            ir->branch_table->PC[min_idx] = PC;                              \
-            IIF(RV32_HAS(SYSTEM))                                            \
-            (ir->branch_table->satp[min_idx] = rv->csr_satp, );              \
-            if (cache_hot(rv->block_cache, PC))                              \
-                goto end_op;                                                 \
-            MUST_TAIL return block->ir_head->impl(rv, block->ir_head, cycle, \
-                                                  PC);                       \
-        }                                                                    \
+#define LOOKUP_OR_UPDATE_BRANCH_HISTORY_TABLE()                        \
+    IIF(RV32_HAS(SYSTEM))                                              \
+    (if (!rv->is_trapped && !reloc_enable_mmu &&                       \
+         !rv_event_pending(rv)), )                                     \
+    {                                                                  \
+        branch_history_table_t *bt = rv_insn_exit(ir)->branch_table;   \
+        block_t *block = cache_get(rv->block_cache, PC, true);         \
+        if (block) {                                                   \
+            for (int i = 0; i < HISTORY_SIZE; i++) {                   \
+                if (bt->PC[i] == PC) {                                 \
+                    IIF(RV32_HAS(SYSTEM))                              \
+                    (if (bt->satp[i] == rv->csr_satp), )               \
+                    {                                                  \
+                        bt->times[i]++;                                \
+                        if (cache_hot(rv->block_cache, PC))            \
+                            goto end_op;                               \
+                    }                                                  \
+                }                                                      \
+            }                                                          \
+            /* update branch history table */                          \
+            int min_idx = 0;                                           \
+            for (int i = 0; i < HISTORY_SIZE; i++) {                   \
+                if (!bt->times[i]) {                                   \
+                    min_idx = i;                                       \
+                    break;                                             \
+                } else if (bt->times[min_idx] > bt->times[i]) {        \
+                    min_idx = i;                                       \
+                }                                                      \
+            }                                                          \
+            bt->times[min_idx] = 1;                                    \
+            bt->PC[min_idx] = PC;                                      \
+            IIF(RV32_HAS(SYSTEM))                                      \
+            (bt->satp[min_idx] = rv->csr_satp, );                      \
+            if (cache_hot(rv->block_cache, PC))                        \
+                goto end_op;                                           \
+            RVOP_CHAIN_EXIT(block->ir_head);                           \
+        }                                                              \
     }
 #endif
 
@@ -364,78 +363,78 @@ RVOP(
     (type) x cond (type) y
 /* clang-format on */
 
-#define BRANCH_FUNC(type, cond)                                             \
-    IIF(RV32_HAS(EXT_C))(, const uint32_t pc = PC;);                        \
-    if (BRANCH_COND(type, rv->X[ir->rs1], rv->X[ir->rs2], cond)) {          \
-        IIF(RV32_HAS(SYSTEM))                                               \
-        (                                                                   \
-            {                                                               \
-                if (!rv->is_trapped) {                                      \
-                    is_branch_taken = false;                                \
-                }                                                           \
-            },                                                              \
-            is_branch_taken = false;);                                      \
-        struct rv_insn *untaken = ir->branch_untaken;                       \
-        if (!untaken)                                                       \
-            goto nextop;                                                    \
-        IIF(RV32_HAS(JIT))                                                  \
-        (                                                                   \
-            {                                                               \
-                block_t *next = cache_get(rv->block_cache, PC + 4, true);   \
-                if (next IIF(RV32_HAS(SYSTEM))(                             \
-                        &&next->satp == rv->csr_satp, )) {                  \
-                    if (!set_add(&pc_set, PC + 4))                          \
-                        has_loops = true;                                   \
-                    if (cache_hot(rv->block_cache, PC + 4))                 \
-                        goto nextop;                                        \
-                }                                                           \
-            }, );                                                           \
-        PC += 4;                                                            \
-        IIF(RV32_HAS(SYSTEM))                                               \
-        (                                                                   \
-            {                                                               \
-                if (!rv->is_trapped) {                                      \
-                    last_pc = PC;                                           \
-                    MUST_TAIL return untaken->impl(rv, untaken, cycle, PC); \
-                }                                                           \
-            }, );                                                           \
-        goto end_op;                                                        \
-    }                                                                       \
-    IIF(RV32_HAS(SYSTEM))                                                   \
-    (                                                                       \
-        {                                                                   \
-            if (!rv->is_trapped) {                                          \
-                is_branch_taken = true;                                     \
-            }                                                               \
-        },                                                                  \
-        is_branch_taken = true;);                                           \
-    PC += ir->imm;                                                          \
-    /* check instruction misaligned */                                      \
-    IIF(RV32_HAS(EXT_C))                                                    \
-    (, RV_EXC_MISALIGN_HANDLER(pc, INSN, false, 0););                       \
-    struct rv_insn *taken = ir->branch_taken;                               \
-    if (taken) {                                                            \
-        IIF(RV32_HAS(JIT))                                                  \
-        (                                                                   \
-            {                                                               \
-                block_t *next = cache_get(rv->block_cache, PC, true);       \
-                if (next IIF(RV32_HAS(SYSTEM))(                             \
-                        &&next->satp == rv->csr_satp, )) {                  \
-                    if (!set_add(&pc_set, PC))                              \
-                        has_loops = true;                                   \
-                    if (cache_hot(rv->block_cache, PC))                     \
-                        goto end_op;                                        \
-                }                                                           \
-            }, );                                                           \
-        IIF(RV32_HAS(SYSTEM))                                               \
-        (                                                                   \
-            {                                                               \
-                if (!rv->is_trapped) {                                      \
-                    last_pc = PC;                                           \
-                    MUST_TAIL return taken->impl(rv, taken, cycle, PC);     \
-                }                                                           \
-            }, );                                                           \
-    }                                                                       \
+#define BRANCH_FUNC(type, cond)                                           \
+    IIF(RV32_HAS(EXT_C))(, const uint32_t pc = PC;);                      \
+    if (BRANCH_COND(type, rv->X[ir->rs1], rv->X[ir->rs2], cond)) {        \
+        IIF(RV32_HAS(SYSTEM))                                             \
+        (                                                                 \
+            {                                                             \
+                if (!rv->is_trapped) {                                    \
+                    is_branch_taken = false;                              \
+                }                                                         \
+            },                                                            \
+            is_branch_taken = false;);                                    \
+        struct rv_insn *untaken = rv_insn_exit(ir)->branch_untaken;       \
+        if (!untaken)                                                     \
+            goto nextop;                                                  \
+        IIF(RV32_HAS(JIT))                                                \
+        (                                                                 \
+            {                                                             \
+                block_t *next = cache_get(rv->block_cache, PC + 4, true); \
+                if (next IIF(RV32_HAS(SYSTEM))(                           \
+                        &&next->satp == rv->csr_satp, )) {                \
+                    if (!set_add(&pc_set, PC + 4))                        \
+                        has_loops = true;                                 \
+                    if (cache_hot(rv->block_cache, PC + 4))               \
+                        goto nextop;                                      \
+                }                                                         \
+            }, );                                                         \
+        PC += 4;                                                          \
+        IIF(RV32_HAS(SYSTEM))                                             \
+        (                                                                 \
+            {                                                             \
+                if (!rv->is_trapped && !rv_event_pending(rv)) {           \
+                    last_pc = PC;                                         \
+                    RVOP_CHAIN_EXIT(untaken);                             \
+                }                                                         \
+            }, );                                                         \
+        goto end_op;                                                      \
+    }                                                                     \
+    IIF(RV32_HAS(SYSTEM))                                                 \
+    (                                                                     \
+        {                                                                 \
+            if (!rv->is_trapped) {                                        \
+                is_branch_taken = true;                                   \
+            }                                                             \
+        },                                                                \
+        is_branch_taken = true;);                                         \
+    PC += ir->imm;                                                        \
+    /* check instruction misaligned */                                    \
+    IIF(RV32_HAS(EXT_C))                                                  \
+    (, RV_EXC_MISALIGN_HANDLER(pc, INSN, false, 0););                     \
+    struct rv_insn *taken = rv_insn_exit(ir)->branch_taken;               \
+    if (taken) {                                                          \
+        IIF(RV32_HAS(JIT))                                                \
+        (                                                                 \
+            {                                                             \
+                block_t *next = cache_get(rv->block_cache, PC, true);     \
+                if (next IIF(RV32_HAS(SYSTEM))(                           \
+                        &&next->satp == rv->csr_satp, )) {                \
+                    if (!set_add(&pc_set, PC))                            \
+                        has_loops = true;                                 \
+                    if (cache_hot(rv->block_cache, PC))                   \
+                        goto end_op;                                      \
+                }                                                         \
+            }, );                                                         \
+        IIF(RV32_HAS(SYSTEM))                                             \
+        (                                                                 \
+            {                                                             \
+                if (!rv->is_trapped && !rv_event_pending(rv)) {           \
+                    last_pc = PC;                                         \
+                    RVOP_CHAIN_EXIT(taken);                               \
+                }                                                         \
+            }, );                                                         \
+    }                                                                     \
     goto end_op;
 
 /* In RV32I and RV64I, if the branch is taken, set pc = pc + offset, where
@@ -706,6 +705,7 @@ RVOP(
     {
         const uint32_t addr = rv->X[ir->rs1] + ir->imm;
         rv->io.mem_write_b(rv, addr, rv->X[ir->rs2]);
+        RV_SMC_EXIT(__rv_insn_sb_len);
     },
     GEN({
         mem;
@@ -723,6 +723,7 @@ RVOP(
         const uint32_t addr = rv->X[ir->rs1] + ir->imm;
         RV_EXC_MISALIGN_HANDLER(1, STORE, false, 1);
         rv->io.mem_write_s(rv, addr, rv->X[ir->rs2]);
+        RV_SMC_EXIT(__rv_insn_sh_len);
     },
     GEN({
         mem;
@@ -740,6 +741,7 @@ RVOP(
         const uint32_t addr = rv->X[ir->rs1] + ir->imm;
         RV_EXC_MISALIGN_HANDLER(3, STORE, false, 1);
         rv->io.mem_write_w(rv, addr, rv->X[ir->rs2]);
+        RV_SMC_EXIT(__rv_insn_sw_len);
     },
     GEN({
         mem;
@@ -843,24 +845,6 @@ RVOP(
         alu32imm, 32, 0x81, 4, VR1, imm;
     }))
 
-FORCE_INLINE void shift_func(riscv_t *rv, const rv_insn_t *ir)
-{
-    switch (ir->opcode) {
-    case rv_insn_slli:
-        rv->X[ir->rd] = rv->X[ir->rs1] << (ir->imm & 0x1f);
-        break;
-    case rv_insn_srli:
-        rv->X[ir->rd] = rv->X[ir->rs1] >> (ir->imm & 0x1f);
-        break;
-    case rv_insn_srai:
-        rv->X[ir->rd] = ((int32_t) rv->X[ir->rs1]) >> (ir->imm & 0x1f);
-        break;
-    default:
-        __UNREACHABLE;
-        break;
-    }
-};
-
 /* SLLI performs logical left shift on the value in register rs1 by the shift
  * amount held in the lower 5 bits of the immediate.
  */
@@ -1099,7 +1083,7 @@ RVOP(
     wfi,
     {
         PC += 4;
-        /* FIXME: Implement */
+        rv_wait_for_interrupt(rv);
         goto end_op;
     },
     GEN({
@@ -1130,6 +1114,8 @@ RVOP(
             (rv->csr_sstatus & SSTATUS_SPIE) >> SSTATUS_SPIE_SHIFT;
         rv->csr_sstatus |= (sstatus_spie << SSTATUS_SIE_SHIFT);
         rv->csr_sstatus |= SSTATUS_SPIE;
+        dtlb_flush(rv);
+        rv_raise_event(rv);
 
         rv->PC = rv->csr_sepc;
 
@@ -1162,6 +1148,7 @@ RVOP(
             (rv->csr_mstatus & MSTATUS_MPIE) >> MSTATUS_MPIE_SHIFT;
         rv->csr_mstatus |= (mstatus_mpie << MSTATUS_MIE_SHIFT);
         rv->csr_mstatus |= MSTATUS_MPIE;
+        dtlb_flush(rv);
 
         rv->PC = rv->csr_mepc;
         return true;
@@ -1178,6 +1165,7 @@ RVOP(
     {
         PC += 4;
         /* FIXME: fill real implementations */
+        dtlb_flush(rv);
         goto end_op;
     },
     GEN({
@@ -1503,6 +1491,7 @@ RVOP(
         RV_EXC_MISALIGN_HANDLER(3, STORE, false, 1);
         rv->io.mem_write_w(rv, addr, rv->X[ir->rs2]);
         rv->X[ir->rd] = 0;
+        RV_SMC_EXIT(__rv_insn_scw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1519,6 +1508,7 @@ RVOP(
         if (ir->rd)
             rv->X[ir->rd] = value1;
         rv->io.mem_write_w(rv, addr, value2);
+        RV_SMC_EXIT(__rv_insn_amoswapw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1536,6 +1526,7 @@ RVOP(
             rv->X[ir->rd] = value1;
         const uint32_t res = value1 + value2;
         rv->io.mem_write_w(rv, addr, res);
+        RV_SMC_EXIT(__rv_insn_amoaddw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1553,6 +1544,7 @@ RVOP(
             rv->X[ir->rd] = value1;
         const uint32_t res = value1 ^ value2;
         rv->io.mem_write_w(rv, addr, res);
+        RV_SMC_EXIT(__rv_insn_amoxorw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1570,6 +1562,7 @@ RVOP(
             rv->X[ir->rd] = value1;
         const uint32_t res = value1 & value2;
         rv->io.mem_write_w(rv, addr, res);
+        RV_SMC_EXIT(__rv_insn_amoandw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1587,6 +1580,7 @@ RVOP(
             rv->X[ir->rd] = value1;
         const uint32_t res = value1 | value2;
         rv->io.mem_write_w(rv, addr, res);
+        RV_SMC_EXIT(__rv_insn_amoorw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1606,6 +1600,7 @@ RVOP(
         const int32_t b = value2;
         const uint32_t res = a < b ? value1 : value2;
         rv->io.mem_write_w(rv, addr, res);
+        RV_SMC_EXIT(__rv_insn_amominw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1625,6 +1620,7 @@ RVOP(
         const int32_t b = value2;
         const uint32_t res = a > b ? value1 : value2;
         rv->io.mem_write_w(rv, addr, res);
+        RV_SMC_EXIT(__rv_insn_amomaxw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1642,6 +1638,7 @@ RVOP(
             rv->X[ir->rd] = value1;
         const uint32_t ures = value1 < value2 ? value1 : value2;
         rv->io.mem_write_w(rv, addr, ures);
+        RV_SMC_EXIT(__rv_insn_amominuw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1659,6 +1656,7 @@ RVOP(
             rv->X[ir->rd] = value1;
         const uint32_t ures = value1 > value2 ? value1 : value2;
         rv->io.mem_write_w(rv, addr, ures);
+        RV_SMC_EXIT(__rv_insn_amomaxuw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -1689,6 +1687,7 @@ RVOP(
         const uint32_t addr = rv->X[ir->rs1] + ir->imm;
         RV_EXC_MISALIGN_HANDLER(3, STORE, false, 1);
         rv->io.mem_write_w(rv, addr, rv->F[ir->rs2].v);
+        RV_SMC_EXIT(__rv_insn_fsw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -2071,6 +2070,7 @@ RVOP(
         const uint32_t addr = rv->X[ir->rs1] + (uint32_t) ir->imm;
         RV_EXC_MISALIGN_HANDLER(3, STORE, true, 1);
         rv->io.mem_write_w(rv, addr, rv->X[ir->rs2]);
+        RV_SMC_EXIT(__rv_insn_csw_len);
     },
     GEN({
         mem;
@@ -2104,7 +2104,7 @@ RVOP(
     {
         rv->X[rv_reg_ra] = PC + 2;
         PC += ir->imm;
-        struct rv_insn *taken = ir->branch_taken;
+        struct rv_insn *taken = rv_insn_exit(ir)->branch_taken;
         if (taken) {
 #if RV32_HAS(JIT)
             IIF(RV32_HAS(SYSTEM))
@@ -2119,11 +2119,11 @@ RVOP(
 #endif
 
 #if RV32_HAS(SYSTEM)
-            if (!rv->is_trapped)
+            if (!rv->is_trapped && !rv_event_pending(rv))
 #endif
             {
                 last_pc = PC;
-                MUST_TAIL return taken->impl(rv, taken, cycle, PC);
+                RVOP_CHAIN_EXIT(taken);
             }
         }
         goto end_op;
@@ -2275,7 +2275,7 @@ RVOP(
     cj,
     {
         PC += ir->imm;
-        struct rv_insn *taken = ir->branch_taken;
+        struct rv_insn *taken = rv_insn_exit(ir)->branch_taken;
         if (taken) {
 #if RV32_HAS(JIT)
             IIF(RV32_HAS(SYSTEM))
@@ -2289,11 +2289,11 @@ RVOP(
             }
 #endif
 #if RV32_HAS(SYSTEM)
-            if (!rv->is_trapped)
+            if (!rv->is_trapped && !rv_event_pending(rv))
 #endif
             {
                 last_pc = PC;
-                MUST_TAIL return taken->impl(rv, taken, cycle, PC);
+                RVOP_CHAIN_EXIT(taken);
             }
         }
         goto end_op;
@@ -2316,7 +2316,7 @@ RVOP(
     {
         if (rv->X[ir->rs1]) {
             is_branch_taken = false;
-            struct rv_insn *untaken = ir->branch_untaken;
+            struct rv_insn *untaken = rv_insn_exit(ir)->branch_untaken;
             if (!untaken)
                 goto nextop;
 #if RV32_HAS(JIT)
@@ -2332,18 +2332,18 @@ RVOP(
 #endif
             PC += 2;
 #if RV32_HAS(SYSTEM)
-            if (!rv->is_trapped)
+            if (!rv->is_trapped && !rv_event_pending(rv))
 #endif
             {
                 last_pc = PC;
-                MUST_TAIL return untaken->impl(rv, untaken, cycle, PC);
+                RVOP_CHAIN_EXIT(untaken);
             }
 
             goto end_op;
         }
         is_branch_taken = true;
         PC += ir->imm;
-        struct rv_insn *taken = ir->branch_taken;
+        struct rv_insn *taken = rv_insn_exit(ir)->branch_taken;
         if (taken) {
 #if RV32_HAS(JIT)
             IIF(RV32_HAS(SYSTEM))
@@ -2357,11 +2357,11 @@ RVOP(
             }
 #endif
 #if RV32_HAS(SYSTEM)
-            if (!rv->is_trapped)
+            if (!rv->is_trapped && !rv_event_pending(rv))
 #endif
             {
                 last_pc = PC;
-                MUST_TAIL return taken->impl(rv, taken, cycle, PC);
+                RVOP_CHAIN_EXIT(taken);
             }
         }
         goto end_op;
@@ -2393,7 +2393,7 @@ RVOP(
     {
         if (!rv->X[ir->rs1]) {
             is_branch_taken = false;
-            struct rv_insn *untaken = ir->branch_untaken;
+            struct rv_insn *untaken = rv_insn_exit(ir)->branch_untaken;
             if (!untaken)
                 goto nextop;
 #if RV32_HAS(JIT)
@@ -2409,18 +2409,18 @@ RVOP(
 #endif
             PC += 2;
 #if RV32_HAS(SYSTEM)
-            if (!rv->is_trapped)
+            if (!rv->is_trapped && !rv_event_pending(rv))
 #endif
             {
                 last_pc = PC;
-                MUST_TAIL return untaken->impl(rv, untaken, cycle, PC);
+                RVOP_CHAIN_EXIT(untaken);
             }
 
             goto end_op;
         }
         is_branch_taken = true;
         PC += ir->imm;
-        struct rv_insn *taken = ir->branch_taken;
+        struct rv_insn *taken = rv_insn_exit(ir)->branch_taken;
         if (taken) {
 #if RV32_HAS(JIT)
             IIF(RV32_HAS(SYSTEM))
@@ -2434,11 +2434,11 @@ RVOP(
             }
 #endif
 #if RV32_HAS(SYSTEM)
-            if (!rv->is_trapped)
+            if (!rv->is_trapped && !rv_event_pending(rv))
 #endif
             {
                 last_pc = PC;
-                MUST_TAIL return taken->impl(rv, taken, cycle, PC);
+                RVOP_CHAIN_EXIT(taken);
             }
         }
         goto end_op;
@@ -2592,6 +2592,7 @@ RVOP(
         const uint32_t addr = rv->X[rv_reg_sp] + ir->imm;
         RV_EXC_MISALIGN_HANDLER(3, STORE, true, 1);
         rv->io.mem_write_w(rv, addr, rv->X[ir->rs2]);
+        RV_SMC_EXIT(__rv_insn_cswsp_len);
     },
     GEN({
         mem;
@@ -2623,6 +2624,7 @@ RVOP(
         const uint32_t addr = rv->X[rv_reg_sp] + ir->imm;
         RV_EXC_MISALIGN_HANDLER(3, STORE, false, 1);
         rv->io.mem_write_w(rv, addr, rv->F[ir->rs2].v);
+        RV_SMC_EXIT(__rv_insn_cfswsp_len);
     },
     GEN({
         assert; /* FIXME: Implement */
@@ -2647,6 +2649,7 @@ RVOP(
         const uint32_t addr = rv->X[ir->rs1] + (uint32_t) ir->imm;
         RV_EXC_MISALIGN_HANDLER(3, STORE, false, 1);
         rv->io.mem_write_w(rv, addr, rv->F[ir->rs2].v);
+        RV_SMC_EXIT(__rv_insn_cfsw_len);
     },
     GEN({
         assert; /* FIXME: Implement */
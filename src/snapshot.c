@@ -0,0 +1,329 @@
+/*
+ * rv32emu is freely redistributable under the MIT License. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * A snapshot holds the state of the machine between two blocks: the hart,
+ * the registers of the PLIC, the UART and virtio-blk, then the guest RAM. The
+ * devices are settled first, so that no request of virtio-blk is in flight
+ * and the output of the UART is written out.
+ *
+ * The RAM starts at a fixed offset, aligned to the largest page size of the
+ * hosts, and is written page by page where not zero, the zero pages being
+ * left as holes of a sparse file. On restore, the file is mapped privately
+ * in place of the RAM, so that the pages are read on first access and copied
+ * on first write, and resuming costs no more than mapping the file. The disk
+ * of virtio-blk is not part of the snapshot, and should be kept unchanged, by
+ * the option readonly or a copy-on-write overlay, to resume more than once.
+ *
+ * All fields are stored in the byte order of the host.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "system.h"
+
+#if !RV32_HAS(ELF_LOADER)
+#define SNAPSHOT_MAGIC 0x50414e5332335652ULL /* "RV32SNAP" */
+#define SNAPSHOT_VERSION 1
+
+/* where the RAM starts in the file, aligned to 64 KiB pages of the host */
+#define SNAPSHOT_RAM_OFFSET 0x10000
+
+/* the devices and the extensions the snapshot was taken with */
+#define SNAPSHOT_F_EXT_F 1
+#define SNAPSHOT_F_VBLK 2
+#define SNAPSHOT_F_VNET 4
+#define SNAPSHOT_F_VCON 8
+
+PACKED(struct snapshot_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t features; /* SNAPSHOT_F_* */
+    uint32_t mem_size;
+    uint32_t timebase_freq;
+    uint64_t ram_offset;
+});
+
+/* the state of the hart, taken field by field as riscv_t holds host pointers
+ * as well
+ */
+#define SNAPSHOT_HART_LIST                                              \
+    _(X) _(PC) _(timer) _(csr_cycle) _(csr_time) _(csr_mstatus)         \
+    _(csr_mtvec) _(csr_misa) _(csr_mtval) _(csr_mcause) _(csr_mscratch) \
+    _(csr_mepc) _(csr_mip) _(csr_mie) _(csr_mideleg) _(csr_medeleg)     \
+    _(csr_mvendorid) _(csr_marchid) _(csr_mimpid) _(csr_mbadaddr)       \
+    _(csr_sstatus) _(csr_stvec) _(csr_sip) _(csr_sie)                   \
+    _(csr_scounteren) _(csr_sscratch) _(csr_sepc) _(csr_scause)         \
+    _(csr_stval) _(csr_satp) _(priv_mode) _(last_csr_sepc)
+
+#define SNAPSHOT_FP_LIST _(F) _(csr_fcsr)
+
+/* the deadline of the SBI timer */
+#define SNAPSHOT_VM_LIST _(timer)
+
+#define SNAPSHOT_PLIC_LIST _(masked) _(ip) _(ie) _(active)
+
+#define SNAPSHOT_UART_LIST \
+    _(dll) _(dlh) _(lcr) _(ier) _(current_intr) _(pending_intrs) _(mcr)
+
+/* no request is in flight, see virtio_blk_quiesce() */
+#define SNAPSHOT_VBLK_LIST                                              \
+    _(device_features_sel) _(driver_features) _(driver_features_sel)    \
+    _(queue_sel) _(queues) _(status) _(interrupt_status)
+
+static uint32_t snapshot_features(const vm_attr_t *attr)
+{
+    return (RV32_HAS(EXT_F) ? SNAPSHOT_F_EXT_F : 0) |
+           (attr->vblk ? SNAPSHOT_F_VBLK : 0) |
+           (attr->vnet ? SNAPSHOT_F_VNET : 0) |
+           (attr->vcon ? SNAPSHOT_F_VCON : 0);
+}
+
+/* write @size bytes at @p to @file, or read them from it */
+static bool snapshot_rw(FILE *file, void *p, size_t size, bool save)
+{
+    if (save)
+        return fwrite(p, size, 1, file) == 1;
+    return fread(p, size, 1, file) == 1;
+}
+
+/* save the state of the hart and the devices in @file, or restore it */
+static bool snapshot_state(FILE *file, riscv_t *rv, bool save)
+{
+    vm_attr_t *attr = PRIV(rv);
+    bool ok = true;
+
+#define SNAPSHOT_RW(lval) \
+    ok = ok && snapshot_rw(file, &(lval), sizeof(lval), save);
+#define _(field) SNAPSHOT_RW(rv->field)
+    SNAPSHOT_HART_LIST
+#if RV32_HAS(EXT_F)
+    SNAPSHOT_FP_LIST
+#endif
+#undef _
+#define _(field) SNAPSHOT_RW(attr->field)
+    SNAPSHOT_VM_LIST
+#undef _
+#define _(field) SNAPSHOT_RW(attr->plic->field)
+    SNAPSHOT_PLIC_LIST
+#undef _
+#define _(field) SNAPSHOT_RW(attr->uart->field)
+    SNAPSHOT_UART_LIST
+#undef _
+    if (attr->vblk) {
+#define _(field) SNAPSHOT_RW(attr->vblk->field)
+        SNAPSHOT_VBLK_LIST
+#undef _
+    }
+#undef SNAPSHOT_RW
+
+    return ok;
+}
+
+static bool snapshot_page_is_zero(const uint8_t *page)
+{
+    const uint64_t *word = (const uint64_t *) page;
+    for (uint32_t i = 0; i < RV_PG_SIZE / sizeof(uint64_t); i++) {
+        if (word[i])
+            return false;
+    }
+    return true;
+}
+
+static bool snapshot_pwrite(int fd, const uint8_t *buf, size_t len, off_t off)
+{
+    while (len) {
+        const ssize_t n = pwrite(fd, buf, len, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n, len -= n, off += n;
+    }
+    return true;
+}
+
+/* write the pages of the RAM which are not zero, the others being holes */
+static bool snapshot_save_ram(int fd, const vm_attr_t *attr, off_t offset)
+{
+    const uint8_t *ram = attr->mem->mem_base;
+    const uint32_t size = attr->mem_size;
+
+    for (uint32_t addr = 0; addr < size;) {
+        while (addr < size && snapshot_page_is_zero(ram + addr))
+            addr += RV_PG_SIZE;
+        uint32_t end = addr;
+        while (end < size && !snapshot_page_is_zero(ram + end))
+            end += RV_PG_SIZE;
+        if (!snapshot_pwrite(fd, ram + addr, end - addr, offset + addr))
+            return false;
+        addr = end;
+    }
+    return !ftruncate(fd, offset + size);
+}
+
+static bool snapshot_load_ram(int fd, vm_attr_t *attr, off_t offset)
+{
+    uint8_t *ram = attr->mem->mem_base;
+    const uint32_t size = attr->mem_size;
+
+    struct stat st;
+    if (fstat(fd, &st))
+        return false;
+    if (st.st_size < offset + size) {
+        errno = 0; /* truncated */
+        return false;
+    }
+
+#if HAVE_MMAP
+    /* map the file in place of the RAM, which memory_delete() unmaps */
+    if (!(offset % sysconf(_SC_PAGESIZE)))
+        return mmap(ram, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                    fd, offset) != MAP_FAILED;
+#endif
+
+    for (uint32_t addr = 0; addr < size;) {
+        const ssize_t n = pread(fd, ram + addr, size - addr, offset + addr);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (!n)
+                errno = 0;
+            return false;
+        }
+        addr += n;
+    }
+    return true;
+}
+
+#if RV32_HAS(HOST_TIMER)
+/* move the epoch of the host clock back, so that rv->timer goes on from the
+ * value restored
+ */
+static void snapshot_set_epoch(riscv_t *rv)
+{
+    const uint64_t ns =
+        rv->timer / TIMEBASE_FREQ * 1000000000ULL +
+        rv->timer % TIMEBASE_FREQ * 1000000000ULL / TIMEBASE_FREQ;
+    struct timespec *epoch = &PRIV(rv)->timer_epoch;
+    rv_clock_gettime(epoch);
+    epoch->tv_sec -= ns / 1000000000;
+    epoch->tv_nsec -= ns % 1000000000;
+    if (epoch->tv_nsec < 0) {
+        epoch->tv_nsec += 1000000000;
+        epoch->tv_sec--;
+    }
+}
+#endif
+
+bool rv_snapshot_save(riscv_t *rv, const char *path)
+{
+    vm_attr_t *attr = PRIV(rv);
+    if (attr->vnet || attr->vcon) {
+        rv_log_error("Snapshots do not cover virtio-net and virtio-console");
+        return false;
+    }
+
+    /* settle the devices, so that only their registers are left */
+    u8250_flush(attr->uart);
+    if (attr->vblk && virtio_blk_quiesce(attr->vblk))
+        emu_update_vblk_interrupts(rv);
+
+    /* write another file and rename it, as the RAM may be mapped from the
+     * one at @path
+     */
+    char *tmp = malloc(strlen(path) + sizeof(".tmp"));
+    assert(tmp);
+    sprintf(tmp, "%s.tmp", path);
+
+    bool ok = false;
+    FILE *file = fopen(tmp, "wb");
+    if (file) {
+        struct snapshot_header hdr = {
+            .magic = SNAPSHOT_MAGIC,
+            .version = SNAPSHOT_VERSION,
+            .features = snapshot_features(attr),
+            .mem_size = attr->mem_size,
+            .timebase_freq = TIMEBASE_FREQ,
+            .ram_offset = SNAPSHOT_RAM_OFFSET,
+        };
+        ok = fwrite(&hdr, sizeof(hdr), 1, file) == 1 &&
+             snapshot_state(file, rv, true) && !fflush(file) &&
+             ftell(file) <= SNAPSHOT_RAM_OFFSET &&
+             snapshot_save_ram(fileno(file), attr, SNAPSHOT_RAM_OFFSET);
+        ok = !fclose(file) && ok;
+    }
+    if (ok)
+        ok = !rename(tmp, path);
+
+    if (ok) {
+        rv_log_info("Snapshot saved to %s", path);
+    } else {
+        rv_log_error("Failed to save the snapshot %s: %s", path,
+                     strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+bool rv_snapshot_load(riscv_t *rv, const char *path)
+{
+    vm_attr_t *attr = PRIV(rv);
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        rv_log_error("Failed to open the snapshot %s: %s", path,
+                     strerror(errno));
+        return false;
+    }
+
+    struct snapshot_header hdr;
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+        hdr.magic != SNAPSHOT_MAGIC || hdr.version != SNAPSHOT_VERSION) {
+        rv_log_error("%s is not a snapshot of this emulator", path);
+        fclose(file);
+        return false;
+    }
+    if (hdr.features != snapshot_features(attr) ||
+        hdr.mem_size != attr->mem_size ||
+        hdr.timebase_freq != TIMEBASE_FREQ) {
+        rv_log_error("The snapshot %s was taken with other devices, "
+                     "memory size or timebase",
+                     path);
+        fclose(file);
+        return false;
+    }
+
+    const bool ok = snapshot_state(file, rv, false) &&
+                    snapshot_load_ram(fileno(file), attr, hdr.ram_offset);
+    if (!ok)
+        rv_log_error("Failed to restore the snapshot %s: %s", path,
+                     feof(file) || !errno ? "truncated" : strerror(errno));
+    fclose(file);
+    if (!ok)
+        return false;
+
+    /* nothing of the guest is cached by the emulator yet, but the TLB */
+    dtlb_flush(rv);
+    attr->uart->in_ready = false;
+#if RV32_HAS(HOST_TIMER)
+    snapshot_set_epoch(rv);
+#endif
+    attr->poll_deadline = 0;
+    rv_raise_event(rv);
+
+    rv_log_info("Snapshot %s restored", path);
+    return true;
+}
+#endif /* !RV32_HAS(ELF_LOADER) */
@@ -413,6 +413,7 @@ static void syscall_sbi_timer(riscv_t *rv)
     switch (fid) {
     case SBI_TIMER_SET_TIMER:
         attr->timer = (((uint64_t) a1) << 32) | (uint64_t) (a0);
+        rv_raise_event(rv); /* move the deadline and clear the interrupt */
         rv_set_reg(rv, rv_reg_a0, SBI_SUCCESS);
         rv_set_reg(rv, rv_reg_a1, 0);
         break;
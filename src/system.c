@@ -4,6 +4,9 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "system.h"
 
@@ -28,6 +31,47 @@ void emu_update_vblk_interrupts(riscv_t *rv)
         attr->plic->active &= ~IRQ_VBLK_BIT;
     plic_update_interrupts(attr->plic);
 }
+
+void emu_update_vnet_interrupts(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    if (attr->vnet->interrupt_status)
+        attr->plic->active |= IRQ_VNET_BIT;
+    else
+        attr->plic->active &= ~IRQ_VNET_BIT;
+    plic_update_interrupts(attr->plic);
+}
+
+void emu_wakeup(void *arg)
+{
+    riscv_t *rv = arg;
+    vm_attr_t *attr = PRIV(rv);
+
+    /* have the running hart poll the peripherals before the next block */
+    __atomic_store_n(&attr->woken, true, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&rv->event_deadline, 0, __ATOMIC_SEQ_CST);
+
+    /* pairs with the store of attr->sleeping in the hart, so that either the
+     * hart sees what the device did before, or the device sees it sleeping
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&attr->sleeping, __ATOMIC_RELAXED))
+        return;
+
+    const uint8_t wake = 0;
+    if (write(attr->wake_fd[1], &wake, 1) < 0 && errno != EAGAIN)
+        rv_log_error("Failed to wake the hart: %s", strerror(errno));
+}
+
+void emu_update_vcon_interrupts(riscv_t *rv)
+{
+    vm_attr_t *attr = PRIV(rv);
+    if (attr->vcon->interrupt_status)
+        attr->plic->active |= IRQ_VCON_BIT;
+    else
+        attr->plic->active &= ~IRQ_VCON_BIT;
+    plic_update_interrupts(attr->plic);
+}
 #endif
 
 static bool ppn_is_valid(riscv_t *rv, uint32_t ppn)
@@ -186,7 +230,7 @@ MMU_FAULT_CHECK_IMPL(write, pagefault_store)
  * - mmu_write_b
  */
 extern bool need_retranslate;
-static uint32_t mmu_ifetch(riscv_t *rv, const uint32_t vaddr)
+uint32_t mmu_ifetch_paddr(riscv_t *rv, const uint32_t vaddr, uint32_t *paddr)
 {
     /*
      * Do not call rv->io.mem_translate() because the basic block might be
@@ -194,8 +238,10 @@ static uint32_t mmu_ifetch(riscv_t *rv, const uint32_t vaddr)
      * cannot work on a NULL PTE.
      */
 
-    if (!rv->csr_satp)
+    if (!rv->csr_satp) {
+        *paddr = vaddr;
         return memory_ifetch(vaddr);
+    }
 
     uint32_t level;
     pte_t *pte = mmu_walk(rv, vaddr, &level);
@@ -213,7 +259,14 @@ static uint32_t mmu_ifetch(riscv_t *rv, const uint32_t vaddr)
         return 0;
 
     get_ppn_and_offset();
-    return memory_ifetch(ppn | offset);
+    *paddr = ppn | offset;
+    return memory_ifetch(*paddr);
+}
+
+static uint32_t mmu_ifetch(riscv_t *rv, const uint32_t vaddr)
+{
+    uint32_t paddr;
+    return mmu_ifetch_paddr(rv, vaddr, &paddr);
 }
 
 uint32_t mmu_read_w(riscv_t *rv, const uint32_t vaddr)
@@ -244,7 +297,14 @@ uint16_t mmu_read_s(riscv_t *rv, const uint32_t vaddr)
         return 0;
 #endif
 
-    return memory_read_s(addr);
+    if (addr == vaddr || addr < PRIV(rv)->mem->mem_size)
+        return memory_read_s(addr);
+
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+    MMIO_READ();
+#endif
+
+    __UNREACHABLE;
 }
 
 uint8_t mmu_read_b(riscv_t *rv, const uint32_t vaddr)
@@ -277,6 +337,9 @@ void mmu_write_w(riscv_t *rv, const uint32_t vaddr, const uint32_t val)
 
     if (addr == vaddr || addr < PRIV(rv)->mem->mem_size) {
         memory_write_w(addr, (uint8_t *) &val);
+#if RV32_HAS(SMC_DETECT)
+        code_page_store(rv, addr, sizeof(val));
+#endif
         return;
     }
 
@@ -294,10 +357,17 @@ void mmu_write_s(riscv_t *rv, const uint32_t vaddr, const uint16_t val)
         return;
 #endif
 
-    if (addr == vaddr)
-        return memory_write_s(addr, (uint8_t *) &val);
+    if (addr == vaddr || addr < PRIV(rv)->mem->mem_size) {
+        memory_write_s(addr, (uint8_t *) &val);
+#if RV32_HAS(SMC_DETECT)
+        code_page_store(rv, addr, sizeof(val));
+#endif
+        return;
+    }
 
-    memory_write_s(addr, (uint8_t *) &val);
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+    MMIO_WRITE();
+#endif
 }
 
 void mmu_write_b(riscv_t *rv, const uint32_t vaddr, const uint8_t val)
@@ -311,6 +381,9 @@ void mmu_write_b(riscv_t *rv, const uint32_t vaddr, const uint8_t val)
 
     if (addr == vaddr || addr < PRIV(rv)->mem->mem_size) {
         memory_write_b(addr, (uint8_t *) &val);
+#if RV32_HAS(SMC_DETECT)
+        code_page_store(rv, addr, sizeof(val));
+#endif
         return;
     }
 
@@ -319,6 +392,19 @@ void mmu_write_b(riscv_t *rv, const uint32_t vaddr, const uint8_t val)
 #endif
 }
 
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+uint32_t mmio_read(riscv_t *rv, const uint32_t addr)
+{
+    MMIO_READ();
+    __UNREACHABLE;
+}
+
+void mmio_write(riscv_t *rv, const uint32_t addr, const uint32_t val)
+{
+    MMIO_WRITE();
+}
+#endif
+
 /*
  * TODO: dTLB can be introduced here to
  * cache the gVA to gPA tranlation.
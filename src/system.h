@@ -25,6 +25,8 @@ enum SUPPORTED_MMIO {
     MMIO_PLIC,
     MMIO_UART,
     MMIO_VIRTIOBLK,
+    MMIO_VIRTIONET,
+    MMIO_VIRTIOCON,
 };
 
 /* clang-format off */
@@ -63,6 +65,29 @@ enum SUPPORTED_MMIO {
                 return;                                                          \
             )                                                                    \
             break;                                                               \
+        case MMIO_VIRTIONET:                                                     \
+            IIF(rw)( /* read */                                                  \
+                mmio_read_val = virtio_net_read(PRIV(rv)->vnet, addr & 0xFFFFF); \
+                emu_update_vnet_interrupts(rv);                                  \
+                return mmio_read_val;                                            \
+                ,    /* write */                                                 \
+                virtio_net_write(PRIV(rv)->vnet, addr & 0xFFFFF, val);           \
+                emu_update_vnet_interrupts(rv);                                  \
+                return;                                                          \
+            )                                                                    \
+            break;                                                               \
+        case MMIO_VIRTIOCON:                                                     \
+            IIF(rw)( /* read */                                                  \
+                mmio_read_val =                                                  \
+                    virtio_console_read(PRIV(rv)->vcon, addr & 0xFFFFF);         \
+                emu_update_vcon_interrupts(rv);                                  \
+                return mmio_read_val;                                            \
+                ,    /* write */                                                 \
+                virtio_console_write(PRIV(rv)->vcon, addr & 0xFFFFF, val);       \
+                emu_update_vcon_interrupts(rv);                                  \
+                return;                                                          \
+            )                                                                    \
+            break;                                                               \
         default:                                                                 \
             rv_log_error("unknown MMIO type %d\n", io);                          \
             break;                                                               \
@@ -85,6 +110,12 @@ enum SUPPORTED_MMIO {
             case 0x42: /* Virtio-blk */                     \
                 MMIO_OP(MMIO_VIRTIOBLK, MMIO_R);            \
                 break;                                      \
+            case 0x43: /* Virtio-net */                     \
+                MMIO_OP(MMIO_VIRTIONET, MMIO_R);            \
+                break;                                      \
+            case 0x44: /* Virtio-console */                 \
+                MMIO_OP(MMIO_VIRTIOCON, MMIO_R);            \
+                break;                                      \
             default:                                        \
                 __UNREACHABLE;                              \
                 break;                                      \
@@ -107,6 +138,12 @@ enum SUPPORTED_MMIO {
             case 0x42: /* Virtio-blk */                     \
                 MMIO_OP(MMIO_VIRTIOBLK, MMIO_W);            \
                 break;                                      \
+            case 0x43: /* Virtio-net */                     \
+                MMIO_OP(MMIO_VIRTIONET, MMIO_W);            \
+                break;                                      \
+            case 0x44: /* Virtio-console */                 \
+                MMIO_OP(MMIO_VIRTIOCON, MMIO_W);            \
+                break;                                      \
             default:                                        \
                 __UNREACHABLE;                              \
                 break;                                      \
@@ -117,6 +154,14 @@ enum SUPPORTED_MMIO {
 void emu_update_uart_interrupts(riscv_t *rv);
 void emu_update_vblk_interrupts(riscv_t *rv);
 
+void emu_update_vnet_interrupts(riscv_t *rv);
+void emu_update_vcon_interrupts(riscv_t *rv);
+
+/* Have the hart poll the peripherals, and wake it if it sleeps in WFI, called
+ * by the threads of the devices with the riscv_t of the hart
+ */
+void emu_wakeup(void *arg);
+
 /*
  * Linux kernel might create signal frame when returning from trap
  * handling, which modifies the SEPC CSR. Thus, the fault instruction
@@ -174,9 +219,24 @@ uint32_t *mmu_walk(riscv_t *rv, const uint32_t addr, uint32_t *level);
                             : vaddr & MASK(RV_PG_SHIFT);       \
     } while (0)
 
+/* Fetch the instruction at @vaddr as the mem_ifetch handler does, and store
+ * its physical address in @paddr, so that the rest of the page can be read
+ * without walking the page table again.
+ */
+uint32_t mmu_ifetch_paddr(riscv_t *rv, const uint32_t vaddr, uint32_t *paddr);
+
 uint8_t mmu_read_b(riscv_t *rv, const uint32_t vaddr);
 uint16_t mmu_read_s(riscv_t *rv, const uint32_t vaddr);
 uint32_t mmu_read_w(riscv_t *rv, const uint32_t vaddr);
 void mmu_write_b(riscv_t *rv, const uint32_t vaddr, const uint8_t val);
 void mmu_write_s(riscv_t *rv, const uint32_t vaddr, const uint16_t val);
 void mmu_write_w(riscv_t *rv, const uint32_t vaddr, const uint32_t val);
+
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+/* Access the device at the physical address @addr, already translated by
+ * mem_translate, as the MMIO paths of mmu_read_* and mmu_write_* do. Reads
+ * return the whole register, to be truncated to the width of the access.
+ */
+uint32_t mmio_read(riscv_t *rv, const uint32_t addr);
+void mmio_write(riscv_t *rv, const uint32_t addr, const uint32_t val);
+#endif
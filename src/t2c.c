@@ -9,7 +9,9 @@
 #include <llvm-c/ExecutionEngine.h>
 #include <llvm-c/Target.h>
 #include <llvm-c/Transforms/PassBuilder.h>
+#include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "jit.h"
 #include "riscv_private.h"
@@ -49,6 +51,21 @@ FORCE_INLINE LLVMBasicBlockRef t2c_block_map_search(struct LLVM_block_map *map,
     return NULL;
 }
 
+#if RV32_HAS(HOST_TIMER)
+/* rv->timer is sampled from the host clock instead */
+#define T2C_INC_TIMER()
+#else
+#define T2C_INC_TIMER()                                                    \
+    do {                                                                   \
+        LLVMValueRef timer_ptr = t2c_gen_timer_addr(start, builder, ir);   \
+        LLVMValueRef timer =                                               \
+            LLVMBuildLoad2(*builder, LLVMInt64Type(), timer_ptr, "");      \
+        timer = LLVMBuildAdd(*builder, timer,                              \
+                             LLVMConstInt(LLVMInt64Type(), 1, false), ""); \
+        LLVMBuildStore(*builder, timer, timer_ptr);                        \
+    } while (0)
+#endif
+
 #define T2C_OP(inst, code)                                                     \
     static void t2c_##inst(                                                    \
         LLVMBuilderRef *builder UNUSED, LLVMTypeRef *param_types UNUSED,       \
@@ -57,35 +74,48 @@ FORCE_INLINE LLVMBasicBlockRef t2c_block_map_search(struct LLVM_block_map *map,
         LLVMBuilderRef *untaken_builder UNUSED, riscv_t *rv UNUSED,            \
         uint64_t mem_base UNUSED, block_t *block UNUSED, rv_insn_t *ir UNUSED) \
     {                                                                          \
-        LLVMValueRef timer_ptr = t2c_gen_timer_addr(start, builder, ir);       \
-        LLVMValueRef timer =                                                   \
-            LLVMBuildLoad2(*builder, LLVMInt64Type(), timer_ptr, "");          \
-        timer = LLVMBuildAdd(*builder, timer,                                  \
-                             LLVMConstInt(LLVMInt64Type(), 1, false), "");     \
-        LLVMBuildStore(*builder, timer, timer_ptr);                            \
+        T2C_INC_TIMER();                                                       \
         code;                                                                  \
     }
 
-#define T2C_LLVM_GEN_ADDR(reg, rv_member, ir_member)                          \
-    FORCE_INLINE LLVMValueRef t2c_gen_##reg##_addr(                           \
-        LLVMValueRef start, LLVMBuilderRef *builder, UNUSED rv_insn_t *ir)    \
-    {                                                                         \
-        LLVMValueRef offset = LLVMConstInt(                                   \
-            LLVMInt32Type(),                                                  \
-            offsetof(riscv_t, rv_member) / sizeof(int) + ir_member, true);    \
-        return LLVMBuildInBoundsGEP2(*builder, LLVMInt32Type(),               \
-                                     LLVMGetParam(start, 0), &offset, 1, ""); \
+/* Return the address of a riscv_t member as a pointer to an integer of the
+ * given width. The generated code sees riscv_t as an opaque byte array, so
+ * the offset must come from offsetof() rather than a mirrored LLVM structure
+ * which would go stale as soon as the configuration changes the layout.
+ */
+FORCE_INLINE LLVMValueRef t2c_gen_member_addr(LLVMValueRef start,
+                                              LLVMBuilderRef *builder,
+                                              size_t offset,
+                                              unsigned bits)
+{
+    LLVMValueRef idx = LLVMConstInt(LLVMInt64Type(), offset, false);
+    LLVMValueRef addr = LLVMBuildInBoundsGEP2(
+        *builder, LLVMInt8Type(), LLVMGetParam(start, 0), &idx, 1, "");
+    return LLVMBuildBitCast(*builder, addr,
+                            LLVMPointerType(LLVMIntType(bits), 0), "");
+}
+
+#define T2C_LLVM_GEN_ADDR(reg, rv_member, ir_member, bits)                  \
+    FORCE_INLINE LLVMValueRef t2c_gen_##reg##_addr(                         \
+        LLVMValueRef start, LLVMBuilderRef *builder, UNUSED rv_insn_t *ir)  \
+    {                                                                       \
+        return t2c_gen_member_addr(                                         \
+            start, builder,                                                 \
+            offsetof(riscv_t, rv_member) + (ir_member) * ((bits) / 8), bits); \
     }
 
-T2C_LLVM_GEN_ADDR(rs1, X, ir->rs1);
-T2C_LLVM_GEN_ADDR(rs2, X, ir->rs2);
-T2C_LLVM_GEN_ADDR(rd, X, ir->rd);
+T2C_LLVM_GEN_ADDR(rs1, X, ir->rs1, 32);
+T2C_LLVM_GEN_ADDR(rs2, X, ir->rs2, 32);
+T2C_LLVM_GEN_ADDR(rd, X, ir->rd, 32);
 #if RV32_HAS(EXT_C)
-T2C_LLVM_GEN_ADDR(ra, X, rv_reg_ra);
-T2C_LLVM_GEN_ADDR(sp, X, rv_reg_sp);
+T2C_LLVM_GEN_ADDR(ra, X, rv_reg_ra, 32);
+T2C_LLVM_GEN_ADDR(sp, X, rv_reg_sp, 32);
+#endif
+T2C_LLVM_GEN_ADDR(PC, PC, 0, 32);
+T2C_LLVM_GEN_ADDR(timer, timer, 0, 64);
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+T2C_LLVM_GEN_ADDR(event_deadline, event_deadline, 0, 64);
 #endif
-T2C_LLVM_GEN_ADDR(PC, PC, 0);
-T2C_LLVM_GEN_ADDR(timer, timer, 0);
 
 #define T2C_LLVM_GEN_STORE_IMM32(builder, val, addr) \
     LLVMBuildStore(builder, LLVMConstInt(LLVMInt32Type(), val, true), addr)
@@ -128,28 +158,138 @@ FORCE_INLINE LLVMValueRef t2c_gen_mem_loc(LLVMValueRef start,
 FORCE_INLINE void t2c_gen_call_io_func(LLVMValueRef start,
                                        LLVMBuilderRef *builder,
                                        LLVMTypeRef *param_types,
-                                       int offset)
+                                       size_t offset)
 {
-    LLVMValueRef func_offset = LLVMConstInt(LLVMInt32Type(), offset, true);
-    LLVMValueRef addr_io_func = LLVMBuildInBoundsGEP2(
-        *builder, LLVMPointerType(LLVMVoidType(), 0), LLVMGetParam(start, 0),
-        &func_offset, 1, "addr_io_func");
-    LLVMValueRef io_func = LLVMBuildLoad2(
+    LLVMTypeRef io_func_type =
+        LLVMFunctionType(LLVMVoidType(), param_types, 1, 0);
+    LLVMValueRef idx = LLVMConstInt(LLVMInt64Type(), offset, false);
+    LLVMValueRef addr_io_func = LLVMBuildBitCast(
         *builder,
-        LLVMPointerType(LLVMFunctionType(LLVMVoidType(), param_types, 1, 0), 0),
-        addr_io_func, "io_func");
+        LLVMBuildInBoundsGEP2(*builder, LLVMInt8Type(), LLVMGetParam(start, 0),
+                              &idx, 1, ""),
+        LLVMPointerType(LLVMPointerType(io_func_type, 0), 0), "addr_io_func");
+    LLVMValueRef io_func =
+        LLVMBuildLoad2(*builder, LLVMPointerType(io_func_type, 0),
+                       addr_io_func, "io_func");
     LLVMValueRef io_param = LLVMGetParam(start, 0);
-    LLVMBuildCall2(*builder,
-                   LLVMFunctionType(LLVMVoidType(), param_types, 1, 0), io_func,
-                   &io_param, 1, "");
+    LLVMBuildCall2(*builder, io_func_type, io_func, &io_param, 1, "");
 }
 
 static LLVMTypeRef t2c_jit_cache_func_type;
 static LLVMTypeRef t2c_jit_cache_struct_type;
 
+/* The target of an indirect jump is speculated once its branch history table
+ * shows that at least T2C_SPEC_BIAS percent of the recorded jumps went to the
+ * same block. The speculation is given up for the whole trace after its
+ * guards have failed T2C_DEOPT_THRESHOLD times.
+ */
+#define T2C_SPEC_BIAS 90
+#define T2C_DEOPT_THRESHOLD 256
+
+/* T2C compiles on a single thread, so the state of the trace in progress is
+ * kept here instead of being passed through every T2C_OP().
+ */
+static struct {
+    block_t *root;        /**< the block which the trace is compiled for */
+    block_t *spec_target; /**< speculated target of the last indirect jump */
+} t2c_trace;
+
+void t2c_enqueue(riscv_t *rv, block_t *block)
+{
+    queue_entry_t *entry = malloc(sizeof(queue_entry_t));
+    assert(entry);
+    entry->pc = block->pc_start;
+#if RV32_HAS(SYSTEM)
+    entry->satp = block->satp;
+#endif
+    pthread_mutex_lock(&rv->wait_queue_lock);
+    list_add(&entry->list, &rv->wait_queue);
+    pthread_mutex_unlock(&rv->wait_queue_lock);
+}
+
+/* Look up the block at @pc and @satp, with cache_lock held */
+static block_t *t2c_find_block(riscv_t *rv,
+                               uint32_t pc,
+                               uint32_t satp UNUSED)
+{
+    block_t *block = cache_get(rv->block_cache, pc, false);
+#if RV32_HAS(SYSTEM)
+    if (block && block->satp != satp)
+        return NULL;
+#endif
+    return block;
+}
+
+/* Invoked by the generated code when a speculation guard fails. Once the
+ * guards of the trace rooted at @pc have failed too often, the trace is
+ * recompiled without the speculation, see t2c_predict_target().
+ *
+ * The generated code outlives the blocks, which may be evicted meanwhile, so
+ * the root is looked up again. The counters are shared with the T2C thread,
+ * which holds cache_lock while compiling; a failure met then is not counted,
+ * rather than stalling the hart for the whole compilation.
+ */
+static void t2c_guard_fail(riscv_t *rv, uint32_t pc, uint32_t satp)
+{
+    if (pthread_mutex_trylock(&rv->cache_lock))
+        return;
+
+    block_t *root = t2c_find_block(rv, pc, satp);
+    if (root && ++root->n_guard_fail >= T2C_DEOPT_THRESHOLD &&
+        !root->recompile) {
+        root->recompile = true;
+        t2c_enqueue(rv, root);
+    }
+    pthread_mutex_unlock(&rv->cache_lock);
+}
+
+void t2c_compile_queued(riscv_t *rv, queue_entry_t *entry)
+{
+    pthread_mutex_lock(&rv->cache_lock);
+#if RV32_HAS(SYSTEM)
+    block_t *block = t2c_find_block(rv, entry->pc, entry->satp);
+#else
+    block_t *block = t2c_find_block(rv, entry->pc, 0);
+#endif
+    if (block)
+        t2c_compile(rv, block);
+    pthread_mutex_unlock(&rv->cache_lock);
+}
+
 #include "t2c_template.c"
 #undef T2C_OP
 
+static void t2c_fuse_expand(LLVMBuilderRef *builder,
+                            LLVMTypeRef *param_types,
+                            LLVMValueRef start,
+                            LLVMBasicBlockRef *entry,
+                            LLVMBuilderRef *taken_builder,
+                            LLVMBuilderRef *untaken_builder,
+                            riscv_t *rv,
+                            uint64_t mem_base,
+                            block_t *block,
+                            rv_insn_t *ir);
+
+/* The remaining fused operations are emitted as their original instructions,
+ * each of which advances the timer by itself.
+ */
+#define T2C_FUSE_EXPAND(inst)                                                  \
+    static void t2c_##inst(                                                    \
+        LLVMBuilderRef *builder, LLVMTypeRef *param_types, LLVMValueRef start, \
+        LLVMBasicBlockRef *entry, LLVMBuilderRef *taken_builder,               \
+        LLVMBuilderRef *untaken_builder, riscv_t *rv, uint64_t mem_base,       \
+        block_t *block, rv_insn_t *ir)                                         \
+    {                                                                          \
+        t2c_fuse_expand(builder, param_types, start, entry, taken_builder,     \
+                        untaken_builder, rv, mem_base, block, ir);             \
+    }
+
+T2C_FUSE_EXPAND(fuse6)
+T2C_FUSE_EXPAND(fuse7)
+T2C_FUSE_EXPAND(fuse8)
+T2C_FUSE_EXPAND(fuse9)
+#undef T2C_FUSE_EXPAND
+
 static const void *dispatch_table[] = {
 /* RV32 instructions */
 #define _(inst, can_branch, insn_len, translatable, reg_mask) \
@@ -193,6 +333,59 @@ typedef void (*t2c_codegen_block_func_t)(LLVMBuilderRef *builder UNUSED,
                                          block_t *block UNUSED,
                                          rv_insn_t *ir UNUSED);
 
+static void t2c_fuse_expand(LLVMBuilderRef *builder,
+                            LLVMTypeRef *param_types,
+                            LLVMValueRef start,
+                            LLVMBasicBlockRef *entry,
+                            LLVMBuilderRef *taken_builder,
+                            LLVMBuilderRef *untaken_builder,
+                            riscv_t *rv,
+                            uint64_t mem_base,
+                            block_t *block,
+                            rv_insn_t *ir)
+{
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    for (int i = 0; i < cold->imm2; i++) {
+        rv_insn_t insn;
+        rv_insn_unfuse(ir, i, &insn);
+        ((t2c_codegen_block_func_t) dispatch_table[insn.opcode])(
+            builder, param_types, start, entry, taken_builder, untaken_builder,
+            rv, mem_base, block, &insn);
+    }
+}
+
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+/* Leave at the start of the block of @ir once an event is pending, as the
+ * blocks traced together would otherwise never return to rv_step(), see
+ * rv_event_pending(). The deadline is lowered by other threads, hence the
+ * volatile load.
+ */
+static void t2c_check_event(LLVMBuilderRef *builder,
+                            LLVMValueRef start,
+                            rv_insn_t *ir)
+{
+    LLVMValueRef timer = LLVMBuildLoad2(
+        *builder, LLVMInt64Type(), t2c_gen_timer_addr(start, builder, ir), "");
+    LLVMValueRef deadline =
+        LLVMBuildLoad2(*builder, LLVMInt64Type(),
+                       t2c_gen_event_deadline_addr(start, builder, ir), "");
+    LLVMSetVolatile(deadline, true);
+    LLVMValueRef pending =
+        LLVMBuildICmp(*builder, LLVMIntUGE, timer, deadline, "");
+
+    LLVMBasicBlockRef event_exit = LLVMAppendBasicBlock(start, "event_exit");
+    LLVMBasicBlockRef event_cont = LLVMAppendBasicBlock(start, "event_cont");
+    LLVMBuildCondBr(*builder, pending, event_exit, event_cont);
+
+    LLVMBuilderRef exit_builder = LLVMCreateBuilder();
+    LLVMPositionBuilderAtEnd(exit_builder, event_exit);
+    T2C_LLVM_GEN_STORE_IMM32(exit_builder, ir->pc,
+                             t2c_gen_PC_addr(start, &exit_builder, ir));
+    LLVMBuildRetVoid(exit_builder);
+    LLVMPositionBuilderAtEnd(*builder, event_cont);
+}
+#endif
+
 static void t2c_trace_ebb(LLVMBuilderRef *builder,
                           LLVMTypeRef *param_types UNUSED,
                           LLVMValueRef start,
@@ -208,25 +401,30 @@ static void t2c_trace_ebb(LLVMBuilderRef *builder,
         return;
     set_add(set, ir->pc);
     t2c_block_map_insert(map, entry, ir->pc);
+#if RV32_HAS(SYSTEM) && !RV32_HAS(ELF_LOADER)
+    t2c_check_event(builder, start, ir);
+#endif
     LLVMBuilderRef tk, utk;
+    t2c_trace.spec_target = NULL;
 
     while (1) {
         ((t2c_codegen_block_func_t) dispatch_table[ir->opcode])(
             builder, param_types, start, entry, &tk, &utk, rv,
             (uint64_t) ((memory_t *) PRIV(rv)->mem)->mem_base, block, ir);
-        if (!ir->next)
+        if (ir->tail)
             break;
-        ir = ir->next;
+        ir++;
     }
 
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
     if (!t2c_insn_is_terminal(ir->opcode)) {
-        if (ir->branch_untaken) {
-            if (set_has(set, ir->branch_untaken->pc))
-                LLVMBuildBr(utk,
-                            t2c_block_map_search(map, ir->branch_untaken->pc));
+        if (cold->branch_untaken) {
+            if (set_has(set, cold->branch_untaken->pc))
+                LLVMBuildBr(
+                    utk, t2c_block_map_search(map, cold->branch_untaken->pc));
             else {
                 block_t *blk =
-                    cache_get(rv->block_cache, ir->branch_untaken->pc, false);
+                    cache_get(rv->block_cache, cold->branch_untaken->pc, false);
                 if (blk && blk->translatable
 #if RV32_HAS(SYSTEM)
                     && blk->satp == block->satp
@@ -242,13 +440,13 @@ static void t2c_trace_ebb(LLVMBuilderRef *builder,
                 }
             }
         }
-        if (ir->branch_taken) {
-            if (set_has(set, ir->branch_taken->pc))
+        if (cold->branch_taken) {
+            if (set_has(set, cold->branch_taken->pc))
                 LLVMBuildBr(tk,
-                            t2c_block_map_search(map, ir->branch_taken->pc));
+                            t2c_block_map_search(map, cold->branch_taken->pc));
             else {
                 block_t *blk =
-                    cache_get(rv->block_cache, ir->branch_taken->pc, false);
+                    cache_get(rv->block_cache, cold->branch_taken->pc, false);
                 if (blk && blk->translatable
 #if RV32_HAS(SYSTEM)
                     && blk->satp == block->satp
@@ -264,28 +462,30 @@ static void t2c_trace_ebb(LLVMBuilderRef *builder,
                 }
             }
         }
+    } else if (t2c_trace.spec_target) {
+        /* follow the speculated target of the indirect jump */
+        block_t *blk = t2c_trace.spec_target;
+        if (set_has(set, blk->pc_start)) {
+            LLVMBuildBr(tk, t2c_block_map_search(map, blk->pc_start));
+        } else {
+            LLVMBasicBlockRef spec_entry =
+                LLVMAppendBasicBlock(start, "spec_entry");
+            LLVMBuilderRef spec_builder = LLVMCreateBuilder();
+            LLVMPositionBuilderAtEnd(spec_builder, spec_entry);
+            LLVMBuildBr(tk, spec_entry);
+            t2c_trace_ebb(&spec_builder, param_types, start, &spec_entry, rv,
+                          blk, set, map);
+        }
     }
 }
 
 void t2c_compile(riscv_t *rv, block_t *block)
 {
     LLVMModuleRef module = LLVMModuleCreateWithName("my_module");
-    /* FIXME: riscv_t structure would change according to different
-     * configuration. The linked block might jump to the wrong function pointer.
+    /* riscv_t is passed as an opaque pointer, and its members are reached
+     * through offsetof(), see t2c_gen_member_addr().
      */
-    LLVMTypeRef io_members[] = {
-        LLVMPointerType(LLVMVoidType(), 0), LLVMPointerType(LLVMVoidType(), 0),
-        LLVMPointerType(LLVMVoidType(), 0), LLVMPointerType(LLVMVoidType(), 0),
-        LLVMPointerType(LLVMVoidType(), 0), LLVMPointerType(LLVMVoidType(), 0),
-        LLVMPointerType(LLVMVoidType(), 0), LLVMPointerType(LLVMVoidType(), 0),
-        LLVMPointerType(LLVMVoidType(), 0), LLVMPointerType(LLVMVoidType(), 0),
-        LLVMPointerType(LLVMVoidType(), 0), LLVMInt8Type()};
-    LLVMTypeRef struct_io = LLVMStructType(io_members, 12, false);
-    LLVMTypeRef arr_X = LLVMArrayType(LLVMInt32Type(), 32);
-    LLVMTypeRef rv_members[] = {LLVMInt8Type(), struct_io, arr_X,
-                                LLVMInt32Type()};
-    LLVMTypeRef struct_rv = LLVMStructType(rv_members, 4, false);
-    LLVMTypeRef param_types[] = {LLVMPointerType(struct_rv, 0)};
+    LLVMTypeRef param_types[] = {LLVMPointerType(LLVMInt8Type(), 0)};
     LLVMValueRef start = LLVMAddFunction(
         module, "start", LLVMFunctionType(LLVMVoidType(), param_types, 1, 0));
 
@@ -293,7 +493,7 @@ void t2c_compile(riscv_t *rv, block_t *block)
     t2c_jit_cache_func_type =
         LLVMFunctionType(LLVMVoidType(), t2c_args, 1, false);
 
-    /* Notice to the alignment */
+    /* Notice to the alignment, see struct jit_cache_entry */
     LLVMTypeRef jit_cache_memb[2] = {LLVMInt64Type(),
                                      LLVMPointerType(LLVMVoidType(), 0)};
     t2c_jit_cache_struct_type = LLVMStructType(jit_cache_memb, 2, false);
@@ -309,6 +509,7 @@ void t2c_compile(riscv_t *rv, block_t *block)
     set_reset(&set);
     struct LLVM_block_map map;
     map.count = 0;
+    t2c_trace.root = block;
     /* Translate custon IR into LLVM IR */
     t2c_trace_ebb(&builder, param_types, start, &entry, rv, block, &set, &map);
     /* Offload LLVM IR to LLVM backend */
@@ -347,27 +548,85 @@ void t2c_compile(riscv_t *rv, block_t *block)
     jit_cache_update(rv->jit_cache, key, block->func);
 
     block->hot2 = true;
+    block->recompile = false;
 }
 
-struct jit_cache *jit_cache_init()
+struct jit_cache *jit_cache_init(uint32_t size_bits)
 {
-    return calloc(N_JIT_CACHE_ENTRIES, sizeof(struct jit_cache));
+    struct jit_cache *cache = calloc(1, sizeof(struct jit_cache));
+    if (!cache)
+        return NULL;
+
+    cache->size_bits = size_bits;
+    cache->table = calloc((size_t) N_JIT_CACHE_WAYS << size_bits,
+                          sizeof(struct jit_cache_entry));
+    cache->victim = calloc((size_t) 1 << size_bits, sizeof(uint8_t));
+    if (!cache->table || !cache->victim) {
+        jit_cache_exit(cache);
+        return NULL;
+    }
+    return cache;
 }
 
 void jit_cache_exit(struct jit_cache *cache)
 {
+    free(cache->victim);
+    free(cache->table);
     free(cache);
 }
 
 void jit_cache_update(struct jit_cache *cache, uint64_t key, void *entry)
 {
-    uint32_t pos = key & (N_JIT_CACHE_ENTRIES - 1);
+    const uint32_t set_idx = jit_cache_set_index(cache, key);
+    struct jit_cache_entry *set = &cache->table[set_idx * N_JIT_CACHE_WAYS];
+
+    /* prefer the way holding the same key, then an empty way, and then the
+     * ways of a full set in turn.
+     */
+    int victim = -1, empty = -1;
+    for (int i = 0; i < N_JIT_CACHE_WAYS; i++) {
+        if (set[i].entry && set[i].key == key) {
+            victim = i;
+            break;
+        }
+        if (!set[i].entry && empty < 0)
+            empty = i;
+    }
 
-    cache[pos].key = key;
-    cache[pos].entry = entry;
+    if (victim < 0 && empty >= 0)
+        victim = empty;
+
+    if (victim < 0) {
+        victim = cache->victim[set_idx]++ % N_JIT_CACHE_WAYS;
+        cache->conflict++;
+    }
+
+    /* The JIT-ed code runs on another thread, and checks the key again after
+     * loading the entry, see t2c_jit_cache_helper(). Invalidate the key before
+     * replacing the entry, and publish the key after it, so that a lookup
+     * never dispatches a key to the entry of another.
+     */
+    __atomic_store_n(&set[victim].key, ~0ULL, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&set[victim].entry, entry, __ATOMIC_RELAXED);
+    __atomic_store_n(&set[victim].key, key, __ATOMIC_RELEASE);
 }
 
+/* The caller holds cache_lock, so that no update of the T2C thread is
+ * interleaved with the clearing, see jit_cache_update().
+ */
 void jit_cache_clear(struct jit_cache *cache)
 {
-    memset(cache, 0, N_JIT_CACHE_ENTRIES * sizeof(struct jit_cache));
+    const uint32_t n_entries = (uint32_t) N_JIT_CACHE_WAYS << cache->size_bits;
+    memset(cache->table, 0, n_entries * sizeof(struct jit_cache_entry));
+}
+
+void jit_cache_stats(const struct jit_cache *cache,
+                     uint64_t *hit,
+                     uint64_t *miss,
+                     uint64_t *conflict)
+{
+    *hit = cache->hit;
+    *miss = cache->miss;
+    *conflict = cache->conflict;
 }
@@ -38,8 +38,8 @@ T2C_OP(jal, {
         T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc + 4,
                                  t2c_gen_rd_addr(start, builder, ir));
 
-    if (ir->branch_taken &&
-        t2c_check_valid_blk(rv, block, ir->branch_taken->pc)) {
+    const rv_insn_t *taken = rv_insn_cold(ir)->branch_taken;
+    if (taken && t2c_check_valid_blk(rv, block, taken->pc)) {
         *taken_builder = *builder;
     } else {
         T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc + ir->imm,
@@ -55,65 +55,211 @@ FORCE_INLINE void t2c_jit_cache_helper(LLVMBuilderRef *builder,
                                        block_t *block UNUSED,
                                        rv_insn_t *ir)
 {
-    LLVMBasicBlockRef true_path = LLVMAppendBasicBlock(start, "");
-    LLVMBuilderRef true_builder = LLVMCreateBuilder();
-    LLVMPositionBuilderAtEnd(true_builder, true_path);
+    struct jit_cache *cache = rv->jit_cache;
 
-    LLVMBasicBlockRef false_path = LLVMAppendBasicBlock(start, "");
-    LLVMBuilderRef false_builder = LLVMCreateBuilder();
-    LLVMPositionBuilderAtEnd(false_builder, false_path);
+    /* compose the key, see jit_cache_update() */
+    LLVMValueRef key = LLVMBuildZExt(*builder, addr, LLVMInt64Type(), "");
+#if RV32_HAS(SYSTEM)
+    key = T2C_LLVM_GEN_ALU64_IMM(Or, key, (uint64_t) block->satp << 32);
+#endif
 
-    /* get jit-cache base address */
+    /* get the first way of the set, see jit_cache_set_index() */
+    LLVMValueRef idx = LLVMBuildLShr(
+        *builder,
+        LLVMBuildMul(*builder, key,
+                     LLVMConstInt(LLVMInt64Type(), 0x61c8864680b583ebull,
+                                  false),
+                     ""),
+        LLVMConstInt(LLVMInt64Type(), 64 - cache->size_bits, false), "");
+    idx = T2C_LLVM_GEN_ALU64_IMM(Mul, idx, N_JIT_CACHE_WAYS);
     LLVMValueRef base = LLVMConstIntToPtr(
-        LLVMConstInt(LLVMInt64Type(), (long) rv->jit_cache, false),
+        LLVMConstInt(LLVMInt64Type(), (uintptr_t) cache->table, false),
         LLVMPointerType(t2c_jit_cache_struct_type, 0));
+    LLVMValueRef set = LLVMBuildInBoundsGEP2(
+        *builder, t2c_jit_cache_struct_type, base, &idx, 1, "");
+
+    /* probe every way of the set */
+    LLVMBuilderRef probe_builder = *builder;
+    for (int i = 0; i < N_JIT_CACHE_WAYS; i++) {
+        LLVMBasicBlockRef hit_path = LLVMAppendBasicBlock(start, "");
+        LLVMBuilderRef hit_builder = LLVMCreateBuilder();
+        LLVMPositionBuilderAtEnd(hit_builder, hit_path);
+
+        LLVMBasicBlockRef next_path = LLVMAppendBasicBlock(start, "");
+        LLVMBuilderRef next_builder = LLVMCreateBuilder();
+        LLVMPositionBuilderAtEnd(next_builder, next_path);
+
+        LLVMValueRef way_idx = LLVMConstInt(LLVMInt64Type(), i, false);
+        LLVMValueRef way = LLVMBuildInBoundsGEP2(
+            probe_builder, t2c_jit_cache_struct_type, set, &way_idx, 1, "");
+
+        /* compare jit_cache_entry::key with calculated destination */
+        LLVMValueRef key_ptr = LLVMBuildStructGEP2(
+            probe_builder, t2c_jit_cache_struct_type, way, 0, "");
+        LLVMValueRef way_key =
+            LLVMBuildLoad2(probe_builder, LLVMInt64Type(), key_ptr, "");
+        LLVMSetOrdering(way_key, LLVMAtomicOrderingAcquire);
+        LLVMSetAlignment(way_key, 8);
+        LLVMValueRef cmp =
+            LLVMBuildICmp(probe_builder, LLVMIntEQ, way_key, key, "");
+        LLVMBuildCondBr(probe_builder, cmp, hit_path, next_path);
+
+        /* get jit_cache_entry::entry, and check the key again in case the
+         * entry is being replaced, see jit_cache_update()
+         */
+        LLVMValueRef entry_ptr = LLVMBuildStructGEP2(
+            hit_builder, t2c_jit_cache_struct_type, way, 1, "");
+        LLVMValueRef entry =
+            LLVMBuildLoad2(hit_builder,
+                           LLVMPointerType(t2c_jit_cache_func_type, 0),
+                           entry_ptr, "");
+        LLVMSetOrdering(entry, LLVMAtomicOrderingMonotonic);
+        LLVMSetAlignment(entry, 8);
+        LLVMBuildFence(hit_builder, LLVMAtomicOrderingAcquire, false, "");
+        way_key = LLVMBuildLoad2(hit_builder, LLVMInt64Type(), key_ptr, "");
+        LLVMSetOrdering(way_key, LLVMAtomicOrderingMonotonic);
+        LLVMSetAlignment(way_key, 8);
+        cmp = LLVMBuildICmp(hit_builder, LLVMIntEQ, way_key, key, "");
+
+        LLVMBasicBlockRef call_path = LLVMAppendBasicBlock(start, "");
+        LLVMBuilderRef call_builder = LLVMCreateBuilder();
+        LLVMPositionBuilderAtEnd(call_builder, call_path);
+        LLVMBuildCondBr(hit_builder, cmp, call_path, next_path);
+
+        /* count the hit only when profiling, which leaves the lookups of a
+         * normal run without a store
+         */
+        if (PRIV(rv)->run_flag & RV_RUN_PROFILE) {
+            LLVMValueRef hit_ptr = LLVMConstIntToPtr(
+                LLVMConstInt(LLVMInt64Type(), (uintptr_t) &cache->hit, false),
+                LLVMPointerType(LLVMInt64Type(), 0));
+            LLVMValueRef hit =
+                LLVMBuildLoad2(call_builder, LLVMInt64Type(), hit_ptr, "");
+            hit = LLVMBuildAdd(call_builder, hit,
+                               LLVMConstInt(LLVMInt64Type(), 1, false), "");
+            LLVMBuildStore(call_builder, hit, hit_ptr);
+        }
 
-    /* get index */
-    LLVMValueRef hash = LLVMBuildAnd(
-        *builder, addr,
-        LLVMConstInt(LLVMInt32Type(), N_JIT_CACHE_ENTRIES - 1, false), "");
+        /* invoke T2C JIT-ed code */
+        LLVMValueRef t2c_args[1] = {
+            LLVMConstInt(LLVMInt64Type(), (long) rv, false)};
+        LLVMBuildCall2(call_builder, t2c_jit_cache_func_type, entry, t2c_args,
+                       1, "");
+        LLVMBuildRetVoid(call_builder);
 
-    /* get jit_cache_t::key */
-    LLVMValueRef cast =
-        LLVMBuildIntCast2(*builder, hash, LLVMInt64Type(), false, "");
-    LLVMValueRef element_ptr = LLVMBuildInBoundsGEP2(
-        *builder, t2c_jit_cache_struct_type, base, &cast, 1, "");
-    LLVMValueRef pc_ptr = LLVMBuildStructGEP2(
-        *builder, t2c_jit_cache_struct_type, element_ptr, 0, "");
+        probe_builder = next_builder;
+    }
 
-    /* compare with calculated destination */
+    /* increase jit_cache::miss and return to interpreter if cache-miss */
+    LLVMValueRef miss_ptr = LLVMConstIntToPtr(
+        LLVMConstInt(LLVMInt64Type(), (uintptr_t) &cache->miss, false),
+        LLVMPointerType(LLVMInt64Type(), 0));
+    LLVMValueRef miss =
+        LLVMBuildLoad2(probe_builder, LLVMInt64Type(), miss_ptr, "");
+    miss = LLVMBuildAdd(probe_builder, miss,
+                        LLVMConstInt(LLVMInt64Type(), 1, false), "");
+    LLVMBuildStore(probe_builder, miss, miss_ptr);
+    LLVMBuildStore(probe_builder, addr,
+                   t2c_gen_PC_addr(start, &probe_builder, ir));
+    LLVMBuildRetVoid(probe_builder);
+}
 
+/* Speculate on the target of the indirect jump @ir if its branch history is
+ * biased enough and the speculation has not been given up yet.
+ */
+static block_t *t2c_predict_target(riscv_t *rv, block_t *block, rv_insn_t *ir)
+{
+    branch_history_table_t *bt = rv_insn_cold(ir)->branch_table;
+    if (!bt || t2c_trace.root->n_guard_fail >= T2C_DEOPT_THRESHOLD)
+        return NULL;
+
+    /* A target may be recorded in several entries, as the interpreter adds
+     * one each time the target is not hot yet, so add them up.
+     */
+    int max_idx = 0;
+    uint64_t total = 0, max_times = 0;
+    for (int i = 0; i < HISTORY_SIZE; i++) {
+        total += bt->times[i];
+        uint64_t times = 0;
+        for (int j = 0; j < HISTORY_SIZE; j++) {
+            if (bt->PC[j] == bt->PC[i]
 #if RV32_HAS(SYSTEM)
-    LLVMValueRef pc = LLVMBuildLoad2(*builder, LLVMInt64Type(), pc_ptr, "");
-    LLVMValueRef key = T2C_LLVM_GEN_ALU64_IMM(
-        Add, LLVMBuildIntCast2(*builder, addr, LLVMInt64Type(), false, ""),
-        (uint64_t) block->satp << 32);
-#else
-    LLVMValueRef pc = LLVMBuildLoad2(*builder, LLVMInt32Type(), pc_ptr, "");
-    LLVMValueRef key = addr;
+                && bt->satp[j] == bt->satp[i]
 #endif
+            )
+                times += bt->times[j];
+        }
+        if (max_times < times) {
+            max_times = times;
+            max_idx = i;
+        }
+    }
+    if (!total || max_times * 100 < total * T2C_SPEC_BIAS)
+        return NULL;
 
-    LLVMValueRef cmp = LLVMBuildICmp(*builder, LLVMIntEQ, pc, key, "");
+#if RV32_HAS(SYSTEM)
+    if (bt->satp[max_idx] != block->satp)
+        return NULL;
+#endif
 
-    LLVMBuildCondBr(*builder, cmp, true_path, false_path);
+    if (!t2c_check_valid_blk(rv, block, bt->PC[max_idx]))
+        return NULL;
 
-    /* get jit_cache_t::entry */
-    LLVMValueRef entry_ptr = LLVMBuildStructGEP2(
-        true_builder, t2c_jit_cache_struct_type, element_ptr, 1, "");
+    return cache_get(rv->block_cache, bt->PC[max_idx], false);
+}
 
-    /* invoke T2C JIT-ed code */
-    LLVMValueRef t2c_args[1] = {
-        LLVMConstInt(LLVMInt64Type(), (long) rv, false)};
+/* Jump to the address @addr. If the target is speculated, a guard compares
+ * @addr against it and, on success, @taken_builder continues the trace into
+ * the speculated block (see t2c_trace_ebb()). Otherwise, the guard failure is
+ * counted and the jump goes through the jit-cache, which exits to the
+ * dispatcher with the precise PC on a miss.
+ */
+FORCE_INLINE void t2c_gen_indirect_jump(LLVMBuilderRef *builder,
+                                        LLVMValueRef start,
+                                        LLVMValueRef addr,
+                                        LLVMBuilderRef *taken_builder,
+                                        riscv_t *rv,
+                                        block_t *block,
+                                        rv_insn_t *ir)
+{
+    block_t *target = t2c_predict_target(rv, block, ir);
+    if (!target) {
+        t2c_jit_cache_helper(builder, start, addr, rv, block, ir);
+        return;
+    }
 
-    LLVMBuildCall2(true_builder, t2c_jit_cache_func_type,
-                   LLVMBuildLoad2(true_builder, LLVMInt64Type(), entry_ptr, ""),
-                   t2c_args, 1, "");
-    LLVMBuildRetVoid(true_builder);
+    LLVMBasicBlockRef spec_path = LLVMAppendBasicBlock(start, "spec");
+    LLVMBuilderRef spec_builder = LLVMCreateBuilder();
+    LLVMPositionBuilderAtEnd(spec_builder, spec_path);
+    LLVMBasicBlockRef deopt_path = LLVMAppendBasicBlock(start, "deopt");
+    LLVMBuilderRef deopt_builder = LLVMCreateBuilder();
+    LLVMPositionBuilderAtEnd(deopt_builder, deopt_path);
+    T2C_LLVM_GEN_CMP_IMM32(EQ, addr, target->pc_start);
+    LLVMBuildCondBr(*builder, cmp, spec_path, deopt_path);
+
+    /* count the failure, see t2c_guard_fail() */
+    LLVMTypeRef param_types[3] = {LLVMInt64Type(), LLVMInt32Type(),
+                                  LLVMInt32Type()};
+    LLVMTypeRef guard_fail_type =
+        LLVMFunctionType(LLVMVoidType(), param_types, 3, 0);
+    LLVMValueRef guard_fail_ptr = LLVMConstIntToPtr(
+        LLVMConstInt(LLVMInt64Type(), (uintptr_t) t2c_guard_fail, false),
+        LLVMPointerType(guard_fail_type, 0));
+    LLVMValueRef params[3] = {
+        LLVMConstInt(LLVMInt64Type(), (uintptr_t) rv, false),
+        LLVMConstInt(LLVMInt32Type(), t2c_trace.root->pc_start, false),
+#if RV32_HAS(SYSTEM)
+        LLVMConstInt(LLVMInt32Type(), t2c_trace.root->satp, false),
+#else
+        LLVMConstInt(LLVMInt32Type(), 0, false),
+#endif
+    };
+    LLVMBuildCall2(deopt_builder, guard_fail_type, guard_fail_ptr, params, 3,
+                   "");
+    t2c_jit_cache_helper(&deopt_builder, start, addr, rv, block, ir);
 
-    /* return to interpreter if cache-miss */
-    LLVMBuildStore(false_builder, addr,
-                   t2c_gen_PC_addr(start, &false_builder, ir));
-    LLVMBuildRetVoid(false_builder);
+    *taken_builder = spec_builder;
+    t2c_trace.spec_target = target;
 }
 
 T2C_OP(jalr, {
@@ -128,11 +274,13 @@ T2C_OP(jalr, {
         T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc + 4,
                                  t2c_gen_rd_addr(start, builder, ir));
 
-    t2c_jit_cache_helper(builder, start, val_rs1, rv, block, ir);
+    t2c_gen_indirect_jump(builder, start, val_rs1, taken_builder, rv, block,
+                          ir);
 })
 
 #define BRANCH_FUNC(type, cond)                                             \
     T2C_OP(type, {                                                          \
+        const rv_insn_cold_t *cold = rv_insn_cold(ir);                      \
         LLVMValueRef addr_PC = t2c_gen_PC_addr(start, builder, ir);         \
         T2C_LLVM_GEN_LOAD_VMREG(rs1, 32,                                    \
                                 t2c_gen_rs1_addr(start, builder, ir));      \
@@ -142,8 +290,8 @@ T2C_OP(jalr, {
         LLVMBasicBlockRef taken = LLVMAppendBasicBlock(start, "taken");     \
         LLVMBuilderRef builder2 = LLVMCreateBuilder();                      \
         LLVMPositionBuilderAtEnd(builder2, taken);                          \
-        if (ir->branch_taken &&                                             \
-            t2c_check_valid_blk(rv, block, ir->branch_taken->pc)) {         \
+        if (cold->branch_taken &&                                           \
+            t2c_check_valid_blk(rv, block, cold->branch_taken->pc)) {       \
             *taken_builder = builder2;                                      \
         } else {                                                            \
             T2C_LLVM_GEN_STORE_IMM32(builder2, ir->pc + ir->imm, addr_PC);  \
@@ -152,8 +300,8 @@ T2C_OP(jalr, {
         LLVMBasicBlockRef untaken = LLVMAppendBasicBlock(start, "untaken"); \
         LLVMBuilderRef builder3 = LLVMCreateBuilder();                      \
         LLVMPositionBuilderAtEnd(builder3, untaken);                        \
-        if (ir->branch_untaken &&                                           \
-            t2c_check_valid_blk(rv, block, ir->branch_untaken->pc)) {       \
+        if (cold->branch_untaken &&                                         \
+            t2c_check_valid_blk(rv, block, cold->branch_untaken->pc)) {     \
             *untaken_builder = builder3;                                    \
         } else {                                                            \
             T2C_LLVM_GEN_STORE_IMM32(builder3, ir->pc + 4, addr_PC);        \
@@ -173,74 +321,248 @@ BRANCH_FUNC(bgeu, UGE)
 
 #include "system.h"
 
-#define t2c_mmu_wrapper(opcode) t2c_mmu_wrapper_##opcode
-
-#define T2C_MMU_LOAD(opcode, fn, bits, is_signed)                             \
-    static void t2c_mmu_wrapper_##opcode(LLVMBuilderRef *builder,             \
-                                         LLVMValueRef start, rv_insn_t *ir)   \
-    {                                                                         \
-        LLVMValueRef val_rs1 =                                                \
-            LLVMBuildLoad2(*builder, LLVMInt32Type(),                         \
-                           t2c_gen_rs1_addr(start, builder, ir), "");         \
-        LLVMValueRef vaddr = T2C_LLVM_GEN_ALU32_IMM(Add, val_rs1, ir->imm);   \
-        vaddr = LLVMBuildZExt(*builder, vaddr, LLVMInt64Type(), "");          \
-        LLVMTypeRef param_types[] = {LLVMPointerType(LLVMInt64Type(), 0),     \
-                                     LLVMInt64Type()};                        \
-        LLVMTypeRef mmu_fn_type =                                             \
-            LLVMFunctionType(LLVMInt##bits##Type(), param_types, 2, 0);       \
-        LLVMValueRef mmu_fn_addr =                                            \
-            LLVMConstInt(LLVMInt64Type(), (uintptr_t) fn, false);             \
-        LLVMValueRef mmu_fn_ptr = LLVMBuildIntToPtr(                          \
-            *builder, mmu_fn_addr, LLVMPointerType(mmu_fn_type, 0), "");      \
-        LLVMValueRef params[] = {LLVMGetParam(start, 0), vaddr};              \
-        LLVMValueRef ret =                                                    \
-            LLVMBuildCall2(*builder, mmu_fn_type, mmu_fn_ptr, params, 2, ""); \
-        ret =                                                                 \
-            LLVMBuildIntCast2(*builder, ret, LLVMInt32Type(), is_signed, ""); \
-        LLVMBuildStore(*builder, ret, t2c_gen_rd_addr(start, builder, ir));   \
+/* Record the translation of @vaddr into @tlb if it is backed by guest RAM. */
+static void t2c_dtlb_refill(riscv_t *rv,
+                            dtlb_entry_t *tlb,
+                            uint32_t vaddr,
+                            uint32_t addr)
+{
+    const memory_t *mem = PRIV(rv)->mem;
+    if (addr >= mem->mem_size)
+        return;
+
+    dtlb_entry_t *entry = &tlb[(vaddr >> RV_PG_SHIFT) & (N_DTLB_ENTRIES - 1)];
+    entry->tag = vaddr & ~MASK(RV_PG_SHIFT);
+    entry->addend = (uintptr_t) mem->mem_base +
+                    (addr & ~MASK(RV_PG_SHIFT)) - entry->tag;
+}
+
+/* The slow paths taken on a data TLB miss. They behave exactly as the
+ * mmu_read_* and mmu_write_* handlers do, and refill the data TLB when the
+ * access turns out to hit guest RAM rather than MMIO. The address is
+ * translated once, and MMIO goes to the device at the translated address.
+ */
+#if RV32_HAS(ELF_LOADER)
+#define T2C_MMIO_READ(size, type) return mmu_read_##size(rv, vaddr);
+#define T2C_MMIO_WRITE(size, type) mmu_write_##size(rv, vaddr, val);
+#else
+#define T2C_MMIO_READ(size, type) return (type) mmio_read(rv, addr);
+#define T2C_MMIO_WRITE(size, type) mmio_write(rv, addr, (type) val);
+#endif
+
+#define T2C_MMU_READ_IMPL(size, type)                                    \
+    static uint32_t t2c_mmu_read_##size(riscv_t *rv, const uint32_t vaddr) \
+    {                                                                    \
+        const uint32_t addr = rv->io.mem_translate(rv, vaddr, R);        \
+        IIF(RV32_HAS(ELF_LOADER))(, if (need_handle_signal) return 0;)   \
+        if (addr >= PRIV(rv)->mem->mem_size)                             \
+            T2C_MMIO_READ(size, type)                                    \
+        t2c_dtlb_refill(rv, rv->dtlb_read, vaddr, addr);                 \
+        return memory_read_##size(addr);                                 \
     }
 
-#define T2C_MMU_STORE(opcode, fn)                                            \
-    static void t2c_mmu_wrapper_##opcode(LLVMBuilderRef *builder,            \
-                                         LLVMValueRef start, rv_insn_t *ir)  \
-    {                                                                        \
-        LLVMValueRef val_rs1 =                                               \
-            LLVMBuildLoad2(*builder, LLVMInt32Type(),                        \
-                           t2c_gen_rs1_addr(start, builder, ir), "");        \
-        LLVMValueRef vaddr = T2C_LLVM_GEN_ALU32_IMM(Add, val_rs1, ir->imm);  \
-        vaddr = LLVMBuildZExt(*builder, vaddr, LLVMInt64Type(), "");         \
-        LLVMTypeRef param_types[] = {LLVMPointerType(LLVMInt64Type(), 0),    \
-                                     LLVMInt64Type(), LLVMInt64Type()};      \
-        LLVMTypeRef mmu_fn_type =                                            \
-            LLVMFunctionType(LLVMVoidType(), param_types, 3, 0);             \
-        LLVMValueRef mmu_fn_addr =                                           \
-            LLVMConstInt(LLVMInt64Type(), (uintptr_t) fn, false);            \
-        T2C_LLVM_GEN_LOAD_VMREG(rs2, 32,                                     \
-                                t2c_gen_rs2_addr(start, builder, ir));       \
-        val_rs2 =                                                            \
-            LLVMBuildIntCast2(*builder, val_rs2, LLVMInt64Type(), true, ""); \
-        LLVMValueRef mmu_fn_ptr = LLVMBuildIntToPtr(                         \
-            *builder, mmu_fn_addr, LLVMPointerType(mmu_fn_type, 0), "");     \
-        LLVMValueRef params[] = {LLVMGetParam(start, 0), vaddr, val_rs2};    \
-        LLVMBuildCall2(*builder, mmu_fn_type, mmu_fn_ptr, params, 3, "");    \
+#define T2C_MMU_WRITE_IMPL(size, type)                                    \
+    static void t2c_mmu_write_##size(riscv_t *rv, const uint32_t vaddr,   \
+                                     const uint32_t val)                  \
+    {                                                                     \
+        const uint32_t addr = rv->io.mem_translate(rv, vaddr, W);         \
+        IIF(RV32_HAS(ELF_LOADER))(, if (need_handle_signal) return;)      \
+        if (addr >= PRIV(rv)->mem->mem_size) {                            \
+            T2C_MMIO_WRITE(size, type)                                    \
+            return;                                                       \
+        }                                                                 \
+        t2c_dtlb_refill(rv, rv->dtlb_write, vaddr, addr);                 \
+        const type data = val;                                            \
+        memory_write_##size(addr, (const uint8_t *) &data);               \
     }
 
-T2C_MMU_LOAD(lb, mmu_read_b, 8, true);
-T2C_MMU_LOAD(lbu, mmu_read_b, 8, false);
-T2C_MMU_LOAD(lh, mmu_read_s, 16, true);
-T2C_MMU_LOAD(lhu, mmu_read_s, 16, false);
-T2C_MMU_LOAD(lw, mmu_read_w, 32, true);
+T2C_MMU_READ_IMPL(b, uint8_t)
+T2C_MMU_READ_IMPL(s, uint16_t)
+T2C_MMU_READ_IMPL(w, uint32_t)
+T2C_MMU_WRITE_IMPL(b, uint8_t)
+T2C_MMU_WRITE_IMPL(s, uint16_t)
+T2C_MMU_WRITE_IMPL(w, uint32_t)
+
+/* Emit a guest memory access of @bits wide at the virtual address @vaddr,
+ * which belongs to the instruction at @pc. The data TLB is probed inline and
+ * a hit accesses the host memory directly. On a miss, rv->PC is set to @pc
+ * before calling the slow path, so a page fault raised there records the
+ * precise sepc. If the guest kernel then redirects the faulting context, e.g.,
+ * to deliver a signal, the generated code returns to the dispatcher at once.
+ * Return the loaded value, or NULL if @val is stored.
+ */
+static LLVMValueRef t2c_gen_mmu_access(LLVMBuilderRef *builder,
+                                       LLVMValueRef start,
+                                       uint32_t pc,
+                                       LLVMValueRef vaddr,
+                                       unsigned bits,
+                                       LLVMValueRef val)
+{
+    LLVMTypeRef type = LLVMIntType(bits);
+    LLVMValueRef rv_param = LLVMGetParam(start, 0);
+
+    /* locate the data TLB entry, see dtlb_entry_t */
+    LLVMValueRef idx = LLVMBuildAnd(
+        *builder, T2C_LLVM_GEN_ALU32_IMM(LShr, vaddr, RV_PG_SHIFT),
+        LLVMConstInt(LLVMInt32Type(), N_DTLB_ENTRIES - 1, false), "");
+    idx = LLVMBuildZExt(*builder, idx, LLVMInt64Type(), "");
+    idx = T2C_LLVM_GEN_ALU64_IMM(Mul, idx, sizeof(dtlb_entry_t));
+    idx = T2C_LLVM_GEN_ALU64_IMM(Add, idx,
+                                 val ? offsetof(riscv_t, dtlb_write)
+                                     : offsetof(riscv_t, dtlb_read));
+    LLVMValueRef entry = LLVMBuildInBoundsGEP2(*builder, LLVMInt8Type(),
+                                               rv_param, &idx, 1, "");
+    LLVMValueRef field_idx =
+        LLVMConstInt(LLVMInt64Type(), offsetof(dtlb_entry_t, tag), false);
+    LLVMValueRef tag_ptr = LLVMBuildBitCast(
+        *builder,
+        LLVMBuildInBoundsGEP2(*builder, LLVMInt8Type(), entry, &field_idx, 1,
+                              ""),
+        LLVMPointerType(LLVMInt32Type(), 0), "");
+    field_idx =
+        LLVMConstInt(LLVMInt64Type(), offsetof(dtlb_entry_t, addend), false);
+    LLVMValueRef addend_ptr = LLVMBuildBitCast(
+        *builder,
+        LLVMBuildInBoundsGEP2(*builder, LLVMInt8Type(), entry, &field_idx, 1,
+                              ""),
+        LLVMPointerType(LLVMInt64Type(), 0), "");
 
-T2C_MMU_STORE(sb, mmu_write_b);
-T2C_MMU_STORE(sh, mmu_write_s);
-T2C_MMU_STORE(sw, mmu_write_w);
+    /* A misaligned access never matches the tag and takes the slow path,
+     * thus the fast path does not have to care about page crossing.
+     */
+    LLVMValueRef key = T2C_LLVM_GEN_ALU32_IMM(
+        And, vaddr, ~MASK(RV_PG_SHIFT) | (bits / 8 - 1));
+    LLVMValueRef cmp = LLVMBuildICmp(
+        *builder, LLVMIntEQ, key,
+        LLVMBuildLoad2(*builder, LLVMInt32Type(), tag_ptr, ""), "");
+
+    LLVMBasicBlockRef hit_path = LLVMAppendBasicBlock(start, "dtlb_hit");
+    LLVMBuilderRef hit_builder = LLVMCreateBuilder();
+    LLVMPositionBuilderAtEnd(hit_builder, hit_path);
+    LLVMBasicBlockRef miss_path = LLVMAppendBasicBlock(start, "dtlb_miss");
+    LLVMBuilderRef miss_builder = LLVMCreateBuilder();
+    LLVMPositionBuilderAtEnd(miss_builder, miss_path);
+    LLVMBasicBlockRef done = LLVMAppendBasicBlock(start, "");
+    LLVMBuildCondBr(*builder, cmp, hit_path, miss_path);
+
+    /* fast path: access the host memory directly */
+    LLVMValueRef host = LLVMBuildAdd(
+        hit_builder, LLVMBuildZExt(hit_builder, vaddr, LLVMInt64Type(), ""),
+        LLVMBuildLoad2(hit_builder, LLVMInt64Type(), addend_ptr, ""), "");
+    host = LLVMBuildIntToPtr(hit_builder, host, LLVMPointerType(type, 0), "");
+    LLVMValueRef hit_val = NULL;
+    if (val)
+        LLVMBuildStore(hit_builder,
+                       LLVMBuildTrunc(hit_builder, val, type, ""), host);
+    else
+        hit_val = LLVMBuildLoad2(hit_builder, type, host, "");
+    LLVMBuildBr(hit_builder, done);
+
+    /* slow path: go through the MMU */
+    T2C_LLVM_GEN_STORE_IMM32(miss_builder, pc,
+                             t2c_gen_PC_addr(start, &miss_builder, NULL));
+    void *slow_path;
+    switch (bits) {
+    case 8:
+        slow_path = val ? (void *) t2c_mmu_write_b : (void *) t2c_mmu_read_b;
+        break;
+    case 16:
+        slow_path = val ? (void *) t2c_mmu_write_s : (void *) t2c_mmu_read_s;
+        break;
+    default:
+        slow_path = val ? (void *) t2c_mmu_write_w : (void *) t2c_mmu_read_w;
+        break;
+    }
+    LLVMTypeRef param_types[] = {LLVMTypeOf(rv_param), LLVMInt32Type(),
+                                 LLVMInt32Type()};
+    LLVMTypeRef slow_path_type = LLVMFunctionType(
+        val ? LLVMVoidType() : LLVMInt32Type(), param_types, val ? 3 : 2, 0);
+    LLVMValueRef slow_path_ptr = LLVMConstIntToPtr(
+        LLVMConstInt(LLVMInt64Type(), (uintptr_t) slow_path, false),
+        LLVMPointerType(slow_path_type, 0));
+    LLVMValueRef params[] = {rv_param, vaddr, val};
+    LLVMValueRef miss_val = LLVMBuildCall2(miss_builder, slow_path_type,
+                                           slow_path_ptr, params,
+                                           val ? 3 : 2, "");
+    if (!val)
+        miss_val = LLVMBuildTrunc(miss_builder, miss_val, type, "");
+
+#if !RV32_HAS(ELF_LOADER)
+    /* see need_handle_signal in the RVOP() of the interpreter */
+    LLVMValueRef signal_ptr = LLVMConstIntToPtr(
+        LLVMConstInt(LLVMInt64Type(), (uintptr_t) &need_handle_signal, false),
+        LLVMPointerType(LLVMInt8Type(), 0));
+    LLVMValueRef signal =
+        LLVMBuildLoad2(miss_builder, LLVMInt8Type(), signal_ptr, "");
+    LLVMBasicBlockRef signal_path = LLVMAppendBasicBlock(start, "");
+    LLVMBuilderRef signal_builder = LLVMCreateBuilder();
+    LLVMPositionBuilderAtEnd(signal_builder, signal_path);
+    LLVMBuildStore(signal_builder, LLVMConstInt(LLVMInt8Type(), 0, false),
+                   signal_ptr);
+    LLVMBuildRetVoid(signal_builder);
+    LLVMBasicBlockRef resume_path = LLVMAppendBasicBlock(start, "");
+    LLVMBuildCondBr(miss_builder,
+                    LLVMBuildICmp(miss_builder, LLVMIntNE, signal,
+                                  LLVMConstInt(LLVMInt8Type(), 0, false), ""),
+                    signal_path, resume_path);
+    LLVMPositionBuilderAtEnd(miss_builder, resume_path);
+#endif
+    LLVMBasicBlockRef miss_end = LLVMGetInsertBlock(miss_builder);
+    LLVMBuildBr(miss_builder, done);
+
+    LLVMPositionBuilderAtEnd(*builder, done);
+    if (val)
+        return NULL;
+
+    LLVMValueRef res = LLVMBuildPhi(*builder, type, "");
+    LLVMValueRef incoming_vals[] = {hit_val, miss_val};
+    LLVMBasicBlockRef incoming_blocks[] = {hit_path, miss_end};
+    LLVMAddIncoming(res, incoming_vals, incoming_blocks, 2);
+    return res;
+}
+
+/* load into rd from the address in the register at @addr_base plus ir->imm */
+static void t2c_gen_mmu_load(LLVMBuilderRef *builder,
+                             LLVMValueRef start,
+                             rv_insn_t *ir,
+                             uint32_t pc,
+                             LLVMValueRef addr_base,
+                             unsigned bits,
+                             bool is_signed)
+{
+    LLVMValueRef vaddr = T2C_LLVM_GEN_ALU32_IMM(
+        Add, LLVMBuildLoad2(*builder, LLVMInt32Type(), addr_base, ""),
+        ir->imm);
+    LLVMValueRef res =
+        t2c_gen_mmu_access(builder, start, pc, vaddr, bits, NULL);
+    res = LLVMBuildIntCast2(*builder, res, LLVMInt32Type(), is_signed, "");
+    LLVMBuildStore(*builder, res, t2c_gen_rd_addr(start, builder, ir));
+}
+
+/* store rs2 to the address in the register at @addr_base plus ir->imm */
+static void t2c_gen_mmu_store(LLVMBuilderRef *builder,
+                              LLVMValueRef start,
+                              rv_insn_t *ir,
+                              uint32_t pc,
+                              LLVMValueRef addr_base,
+                              unsigned bits)
+{
+    LLVMValueRef vaddr = T2C_LLVM_GEN_ALU32_IMM(
+        Add, LLVMBuildLoad2(*builder, LLVMInt32Type(), addr_base, ""),
+        ir->imm);
+    T2C_LLVM_GEN_LOAD_VMREG(rs2, 32, t2c_gen_rs2_addr(start, builder, ir));
+    t2c_gen_mmu_access(builder, start, pc, vaddr, bits, val_rs2);
+}
 
 #endif
 
 T2C_OP(lb, {
     IIF(RV32_HAS(SYSTEM))
     (
-        { t2c_mmu_wrapper(lb)(builder, start, ir); },
+        {
+            t2c_gen_mmu_load(builder, start, ir, ir->pc,
+                             t2c_gen_rs1_addr(start, builder, ir), 8, true);
+        },
         {
             LLVMValueRef mem_loc =
                 t2c_gen_mem_loc(start, builder, ir, mem_base);
@@ -255,7 +577,10 @@ T2C_OP(lb, {
 T2C_OP(lh, {
     IIF(RV32_HAS(SYSTEM))
     (
-        { t2c_mmu_wrapper(lh)(builder, start, ir); },
+        {
+            t2c_gen_mmu_load(builder, start, ir, ir->pc,
+                             t2c_gen_rs1_addr(start, builder, ir), 16, true);
+        },
         {
             LLVMValueRef mem_loc =
                 t2c_gen_mem_loc(start, builder, ir, mem_base);
@@ -271,7 +596,10 @@ T2C_OP(lh, {
 T2C_OP(lw, {
     IIF(RV32_HAS(SYSTEM))
     (
-        { t2c_mmu_wrapper(lw)(builder, start, ir); },
+        {
+            t2c_gen_mmu_load(builder, start, ir, ir->pc,
+                             t2c_gen_rs1_addr(start, builder, ir), 32, true);
+        },
         {
             LLVMValueRef mem_loc =
                 t2c_gen_mem_loc(start, builder, ir, mem_base);
@@ -284,7 +612,10 @@ T2C_OP(lw, {
 T2C_OP(lbu, {
     IIF(RV32_HAS(SYSTEM))
     (
-        { t2c_mmu_wrapper(lbu)(builder, start, ir); },
+        {
+            t2c_gen_mmu_load(builder, start, ir, ir->pc,
+                             t2c_gen_rs1_addr(start, builder, ir), 8, false);
+        },
         {
             LLVMValueRef mem_loc =
                 t2c_gen_mem_loc(start, builder, ir, mem_base);
@@ -299,7 +630,10 @@ T2C_OP(lbu, {
 T2C_OP(lhu, {
     IIF(RV32_HAS(SYSTEM))
     (
-        { t2c_mmu_wrapper(lhu)(builder, start, ir); },
+        {
+            t2c_gen_mmu_load(builder, start, ir, ir->pc,
+                             t2c_gen_rs1_addr(start, builder, ir), 16, false);
+        },
         {
             LLVMValueRef mem_loc =
                 t2c_gen_mem_loc(start, builder, ir, mem_base);
@@ -314,7 +648,10 @@ T2C_OP(lhu, {
 T2C_OP(sb, {
     IIF(RV32_HAS(SYSTEM))
     (
-        { t2c_mmu_wrapper(sb)(builder, start, ir); },
+        {
+            t2c_gen_mmu_store(builder, start, ir, ir->pc,
+                              t2c_gen_rs1_addr(start, builder, ir), 8);
+        },
         {
             LLVMValueRef mem_loc =
                 t2c_gen_mem_loc(start, builder, ir, mem_base);
@@ -327,7 +664,10 @@ T2C_OP(sb, {
 T2C_OP(sh, {
     IIF(RV32_HAS(SYSTEM))
     (
-        { t2c_mmu_wrapper(sh)(builder, start, ir); },
+        {
+            t2c_gen_mmu_store(builder, start, ir, ir->pc,
+                              t2c_gen_rs1_addr(start, builder, ir), 16);
+        },
         {
             LLVMValueRef mem_loc =
                 t2c_gen_mem_loc(start, builder, ir, mem_base);
@@ -340,7 +680,10 @@ T2C_OP(sh, {
 T2C_OP(sw, {
     IIF(RV32_HAS(SYSTEM))
     (
-        { t2c_mmu_wrapper(sw)(builder, start, ir); },
+        {
+            t2c_gen_mmu_store(builder, start, ir, ir->pc,
+                              t2c_gen_rs1_addr(start, builder, ir), 32);
+        },
         {
             LLVMValueRef mem_loc =
                 t2c_gen_mem_loc(start, builder, ir, mem_base);
@@ -498,14 +841,16 @@ T2C_OP(fence, { __UNREACHABLE; })
 T2C_OP(ecall, {
     T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc,
                              t2c_gen_PC_addr(start, builder, ir));
-    t2c_gen_call_io_func(start, builder, param_types, 8);
+    t2c_gen_call_io_func(start, builder, param_types,
+                         offsetof(riscv_t, io.on_ecall));
     LLVMBuildRetVoid(*builder);
 })
 
 T2C_OP(ebreak, {
     T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc,
                              t2c_gen_PC_addr(start, builder, ir));
-    t2c_gen_call_io_func(start, builder, param_types, 9);
+    t2c_gen_call_io_func(start, builder, param_types,
+                         offsetof(riscv_t, io.on_ebreak));
     LLVMBuildRetVoid(*builder);
 })
 
@@ -700,16 +1045,35 @@ T2C_OP(caddi4spn, {
     LLVMBuildStore(*builder, res, t2c_gen_rd_addr(start, builder, ir));
 })
 T2C_OP(clw, {
-    LLVMValueRef mem_loc = t2c_gen_mem_loc(start, builder, ir, mem_base);
-    LLVMValueRef res =
-        LLVMBuildLoad2(*builder, LLVMInt32Type(), mem_loc, "res");
-    LLVMBuildStore(*builder, res, t2c_gen_rd_addr(start, builder, ir));
+    IIF(RV32_HAS(SYSTEM))
+    (
+        {
+            t2c_gen_mmu_load(builder, start, ir, ir->pc,
+                             t2c_gen_rs1_addr(start, builder, ir), 32, true);
+        },
+        {
+            LLVMValueRef mem_loc =
+                t2c_gen_mem_loc(start, builder, ir, mem_base);
+            LLVMValueRef res =
+                LLVMBuildLoad2(*builder, LLVMInt32Type(), mem_loc, "res");
+            LLVMBuildStore(*builder, res, t2c_gen_rd_addr(start, builder, ir));
+        });
 })
 
 T2C_OP(csw, {
-    LLVMValueRef mem_loc = t2c_gen_mem_loc(start, builder, ir, mem_base);
-    T2C_LLVM_GEN_LOAD_VMREG(rs2, 32, t2c_gen_rs2_addr(start, builder, ir));
-    LLVMBuildStore(*builder, val_rs2, mem_loc);
+    IIF(RV32_HAS(SYSTEM))
+    (
+        {
+            t2c_gen_mmu_store(builder, start, ir, ir->pc,
+                              t2c_gen_rs1_addr(start, builder, ir), 32);
+        },
+        {
+            LLVMValueRef mem_loc =
+                t2c_gen_mem_loc(start, builder, ir, mem_base);
+            T2C_LLVM_GEN_LOAD_VMREG(rs2, 32,
+                                    t2c_gen_rs2_addr(start, builder, ir));
+            LLVMBuildStore(*builder, val_rs2, mem_loc);
+        });
 })
 
 T2C_OP(cnop, { return; })
@@ -724,7 +1088,7 @@ T2C_OP(caddi, {
 T2C_OP(cjal, {
     T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc + 2,
                              t2c_gen_ra_addr(start, builder, ir));
-    if (ir->branch_taken)
+    if (rv_insn_cold(ir)->branch_taken)
         *taken_builder = *builder;
     else {
         T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc + ir->imm,
@@ -800,7 +1164,7 @@ T2C_OP(cand, {
 })
 
 T2C_OP(cj, {
-    if (ir->branch_taken)
+    if (rv_insn_cold(ir)->branch_taken)
         *taken_builder = *builder;
     else {
         T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc + ir->imm,
@@ -816,7 +1180,7 @@ T2C_OP(cbeqz, {
     LLVMBasicBlockRef taken = LLVMAppendBasicBlock(start, "taken");
     LLVMBuilderRef builder2 = LLVMCreateBuilder();
     LLVMPositionBuilderAtEnd(builder2, taken);
-    if (ir->branch_taken)
+    if (rv_insn_cold(ir)->branch_taken)
         *taken_builder = builder2;
     else {
         T2C_LLVM_GEN_STORE_IMM32(builder2, ir->pc + ir->imm, addr_PC);
@@ -826,7 +1190,7 @@ T2C_OP(cbeqz, {
     LLVMBasicBlockRef untaken = LLVMAppendBasicBlock(start, "untaken");
     LLVMBuilderRef builder3 = LLVMCreateBuilder();
     LLVMPositionBuilderAtEnd(builder3, untaken);
-    if (ir->branch_untaken)
+    if (rv_insn_cold(ir)->branch_untaken)
         *untaken_builder = builder3;
     else {
         T2C_LLVM_GEN_STORE_IMM32(builder3, ir->pc + 2, addr_PC);
@@ -842,7 +1206,7 @@ T2C_OP(cbnez, {
     LLVMBasicBlockRef taken = LLVMAppendBasicBlock(start, "taken");
     LLVMBuilderRef builder2 = LLVMCreateBuilder();
     LLVMPositionBuilderAtEnd(builder2, taken);
-    if (ir->branch_taken)
+    if (rv_insn_cold(ir)->branch_taken)
         *taken_builder = builder2;
     else {
         T2C_LLVM_GEN_STORE_IMM32(builder2, ir->pc + ir->imm, addr_PC);
@@ -852,7 +1216,7 @@ T2C_OP(cbnez, {
     LLVMBasicBlockRef untaken = LLVMAppendBasicBlock(start, "untaken");
     LLVMBuilderRef builder3 = LLVMCreateBuilder();
     LLVMPositionBuilderAtEnd(builder3, untaken);
-    if (ir->branch_untaken)
+    if (rv_insn_cold(ir)->branch_untaken)
         *untaken_builder = builder3;
     else {
         T2C_LLVM_GEN_STORE_IMM32(builder3, ir->pc + 2, addr_PC);
@@ -869,24 +1233,34 @@ T2C_OP(cslli, {
 })
 
 T2C_OP(clwsp, {
-    LLVMValueRef val_sp = LLVMBuildZExt(
-        *builder,
-        LLVMBuildLoad2(*builder, LLVMInt32Type(),
-                       t2c_gen_sp_addr(start, builder, ir), "val_sp"),
-        LLVMInt64Type(), "zext32to64");
-    LLVMValueRef addr = LLVMBuildAdd(
-        *builder, val_sp,
-        LLVMConstInt(LLVMInt64Type(), ir->imm + mem_base, true), "addr");
-    LLVMValueRef cast_addr = LLVMBuildIntToPtr(
-        *builder, addr, LLVMPointerType(LLVMInt32Type(), 0), "cast");
-    LLVMValueRef res =
-        LLVMBuildLoad2(*builder, LLVMInt32Type(), cast_addr, "res");
-    LLVMBuildStore(*builder, res, t2c_gen_rd_addr(start, builder, ir));
+    IIF(RV32_HAS(SYSTEM))
+    (
+        {
+            t2c_gen_mmu_load(builder, start, ir, ir->pc,
+                             t2c_gen_sp_addr(start, builder, ir), 32, true);
+        },
+        {
+            LLVMValueRef val_sp = LLVMBuildZExt(
+                *builder,
+                LLVMBuildLoad2(*builder, LLVMInt32Type(),
+                               t2c_gen_sp_addr(start, builder, ir), "val_sp"),
+                LLVMInt64Type(), "zext32to64");
+            LLVMValueRef addr = LLVMBuildAdd(
+                *builder, val_sp,
+                LLVMConstInt(LLVMInt64Type(), ir->imm + mem_base, true),
+                "addr");
+            LLVMValueRef cast_addr = LLVMBuildIntToPtr(
+                *builder, addr, LLVMPointerType(LLVMInt32Type(), 0), "cast");
+            LLVMValueRef res =
+                LLVMBuildLoad2(*builder, LLVMInt32Type(), cast_addr, "res");
+            LLVMBuildStore(*builder, res, t2c_gen_rd_addr(start, builder, ir));
+        });
 })
 
 T2C_OP(cjr, {
     T2C_LLVM_GEN_LOAD_VMREG(rs1, 32, t2c_gen_rs1_addr(start, builder, ir));
-    t2c_jit_cache_helper(builder, start, val_rs1, rv, block, ir);
+    t2c_gen_indirect_jump(builder, start, val_rs1, taken_builder, rv, block,
+                          ir);
 })
 
 T2C_OP(cmv, {
@@ -897,7 +1271,8 @@ T2C_OP(cmv, {
 T2C_OP(cebreak, {
     T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc,
                              t2c_gen_PC_addr(start, builder, ir));
-    t2c_gen_call_io_func(start, builder, param_types, 9);
+    t2c_gen_call_io_func(start, builder, param_types,
+                         offsetof(riscv_t, io.on_ebreak));
     LLVMBuildRetVoid(*builder);
 })
 
@@ -908,7 +1283,8 @@ T2C_OP(cjalr, {
     T2C_LLVM_GEN_LOAD_VMREG(rs1, 32, t2c_gen_rs1_addr(start, builder, ir));
     T2C_LLVM_GEN_STORE_IMM32(*builder, ir->pc + 2,
                              t2c_gen_ra_addr(start, builder, ir));
-    t2c_jit_cache_helper(builder, start, val_rs1, rv, block, ir);
+    t2c_gen_indirect_jump(builder, start, val_rs1, taken_builder, rv, block,
+                          ir);
 })
 
 T2C_OP(cadd, {
@@ -919,19 +1295,28 @@ T2C_OP(cadd, {
 })
 
 T2C_OP(cswsp, {
-    LLVMValueRef addr_rs2 = t2c_gen_rs2_addr(start, builder, ir);
-    LLVMValueRef val_sp = LLVMBuildZExt(
-        *builder,
-        LLVMBuildLoad2(*builder, LLVMInt32Type(),
-                       t2c_gen_sp_addr(start, builder, ir), "val_sp"),
-        LLVMInt64Type(), "zext32to64");
-    T2C_LLVM_GEN_LOAD_VMREG(rs2, 32, addr_rs2);
-    LLVMValueRef addr = LLVMBuildAdd(
-        *builder, val_sp,
-        LLVMConstInt(LLVMInt64Type(), ir->imm + mem_base, true), "addr");
-    LLVMValueRef cast_addr = LLVMBuildIntToPtr(
-        *builder, addr, LLVMPointerType(LLVMInt32Type(), 0), "cast");
-    LLVMBuildStore(*builder, val_rs2, cast_addr);
+    IIF(RV32_HAS(SYSTEM))
+    (
+        {
+            t2c_gen_mmu_store(builder, start, ir, ir->pc,
+                              t2c_gen_sp_addr(start, builder, ir), 32);
+        },
+        {
+            LLVMValueRef addr_rs2 = t2c_gen_rs2_addr(start, builder, ir);
+            LLVMValueRef val_sp = LLVMBuildZExt(
+                *builder,
+                LLVMBuildLoad2(*builder, LLVMInt32Type(),
+                               t2c_gen_sp_addr(start, builder, ir), "val_sp"),
+                LLVMInt64Type(), "zext32to64");
+            T2C_LLVM_GEN_LOAD_VMREG(rs2, 32, addr_rs2);
+            LLVMValueRef addr = LLVMBuildAdd(
+                *builder, val_sp,
+                LLVMConstInt(LLVMInt64Type(), ir->imm + mem_base, true),
+                "addr");
+            LLVMValueRef cast_addr = LLVMBuildIntToPtr(
+                *builder, addr, LLVMPointerType(LLVMInt32Type(), 0), "cast");
+            LLVMBuildStore(*builder, val_rs2, cast_addr);
+        });
 })
 #endif
 
@@ -1018,17 +1403,12 @@ T2C_OP(bseti, { __UNREACHABLE; })
 #endif
 
 T2C_OP(fuse1, {
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
-        LLVMValueRef rd_offset =
-            LLVMConstInt(LLVMInt32Type(),
-                         offsetof(riscv_t, X) / sizeof(int) + fuse[i].rd, true);
-        LLVMValueRef addr_rd = LLVMBuildInBoundsGEP2(*builder, LLVMInt32Type(),
-                                                     LLVMGetParam(start, 0),
-                                                     &rd_offset, 1, "addr_rd");
-        LLVMBuildStore(*builder,
-                       LLVMConstInt(LLVMInt32Type(), fuse[i].imm, true),
-                       addr_rd);
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++) {
+        T2C_LLVM_GEN_STORE_IMM32(
+            *builder, fuse[i].imm,
+            t2c_gen_rd_addr(start, builder, (rv_insn_t *) (&fuse[i])));
     }
 })
 
@@ -1041,34 +1421,57 @@ T2C_OP(fuse2, {
     LLVMBuildStore(*builder, res, t2c_gen_rs2_addr(start, builder, ir));
 })
 
+/* The fused SW/LW instructions are contiguous, thus the i-th one is located at
+ * ir->pc + 4 * i.
+ */
 T2C_OP(fuse3, {
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
-        LLVMValueRef mem_loc =
-            t2c_gen_mem_loc(start, builder, (rv_insn_t *) (&fuse[i]), mem_base);
-        T2C_LLVM_GEN_LOAD_VMREG(
-            rs2, 32,
-            t2c_gen_rs2_addr(start, builder, (rv_insn_t *) (&fuse[i])));
-        LLVMBuildStore(*builder, val_rs2, mem_loc);
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++) {
+        rv_insn_t *sw = (rv_insn_t *) (&fuse[i]);
+        IIF(RV32_HAS(SYSTEM))
+        (
+            {
+                t2c_gen_mmu_store(builder, start, sw, ir->pc + 4 * i,
+                                  t2c_gen_rs1_addr(start, builder, sw), 32);
+            },
+            {
+                LLVMValueRef mem_loc =
+                    t2c_gen_mem_loc(start, builder, sw, mem_base);
+                T2C_LLVM_GEN_LOAD_VMREG(rs2, 32,
+                                        t2c_gen_rs2_addr(start, builder, sw));
+                LLVMBuildStore(*builder, val_rs2, mem_loc);
+            });
     }
 })
 
 T2C_OP(fuse4, {
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
-        LLVMValueRef mem_loc =
-            t2c_gen_mem_loc(start, builder, (rv_insn_t *) (&fuse[i]), mem_base);
-        LLVMValueRef res =
-            LLVMBuildLoad2(*builder, LLVMInt32Type(), mem_loc, "res");
-        LLVMBuildStore(
-            *builder, res,
-            t2c_gen_rd_addr(start, builder, (rv_insn_t *) (&fuse[i])));
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++) {
+        rv_insn_t *lw = (rv_insn_t *) (&fuse[i]);
+        IIF(RV32_HAS(SYSTEM))
+        (
+            {
+                t2c_gen_mmu_load(builder, start, lw, ir->pc + 4 * i,
+                                 t2c_gen_rs1_addr(start, builder, lw), 32,
+                                 true);
+            },
+            {
+                LLVMValueRef mem_loc =
+                    t2c_gen_mem_loc(start, builder, lw, mem_base);
+                LLVMValueRef res =
+                    LLVMBuildLoad2(*builder, LLVMInt32Type(), mem_loc, "res");
+                LLVMBuildStore(*builder, res,
+                               t2c_gen_rd_addr(start, builder, lw));
+            });
     }
 })
 
 T2C_OP(fuse5, {
-    opcode_fuse_t *fuse = ir->fuse;
-    for (int i = 0; i < ir->imm2; i++) {
+    const rv_insn_cold_t *cold = rv_insn_cold(ir);
+    opcode_fuse_t *fuse = cold->fuse;
+    for (int i = 0; i < cold->imm2; i++) {
         switch (fuse[i].opcode) {
         case rv_insn_slli:
             t2c_slli(builder, param_types, start, entry, taken_builder,
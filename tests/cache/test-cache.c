@@ -2,15 +2,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "cache.h"
 
-static void print_value(int *val, int freq)
+struct cache *cache_legacy_create(uint32_t size_bits);
+void *cache_legacy_get(const struct cache *cache, uint32_t key, bool update);
+void *cache_legacy_put(struct cache *cache, uint32_t key, void *value);
+void cache_legacy_free(struct cache *cache);
+
+static void print_value(int *val, uint32_t freq)
 {
     if (val)
-        printf("%d %d\n", *val, freq);
+        printf("%d %u\n", *val, freq);
     else
-        printf("NULL %d\n", freq);
+        printf("NULL %u\n", freq);
 }
 
 static void split(char **arr, char *str, const char *del)
@@ -25,18 +31,217 @@ static void split(char **arr, char *str, const char *del)
 
 #define N_CACHE_BITS 4
 
+static uint32_t seed = 2463534242;
+
+static uint32_t xorshift32(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/* the size of the block cache of the emulator, see BLOCK_MAP_CAPACITY_BITS */
+enum { N_BENCH_BITS = 10, N_BENCH_KEYS = 4 << N_BENCH_BITS };
+enum { N_BENCH_LOOKUPS = 1 << 22, N_BENCH_ROUNDS = 20 };
+
+/* Put and look up random block addresses, several times more of them than the
+ * capacity so that the ghosts are revived too, and check that a lookup
+ * returns the value put last for the key, and that an insertion evicts a live
+ * entry once the cache is full. Return 0 on success; non-zero values on
+ * failure.
+ */
+static int test_policy(uint32_t *keys, int *values)
+{
+    struct cache *cache = cache_create(N_BENCH_BITS);
+    int n_live = 0, n_failed = 0;
+
+    for (int i = 0; i < N_BENCH_KEYS; i++)
+        keys[i] = 0x10000 + (xorshift32() & 0xffffc);
+    for (int i = 0; i < N_BENCH_LOOKUPS / 16; i++) {
+        const int k = xorshift32() % N_BENCH_KEYS;
+        int *got = cache_get(cache, keys[k], true);
+        if (got) {
+            /* the keys may collide, then the later one is put */
+            if (keys[got - values] != keys[k] && n_failed++ < 16)
+                fprintf(stderr, "key %#x: got the value of %#x\n", keys[k],
+                        keys[got - values]);
+            continue;
+        }
+
+        int *replaced = cache_put(cache, keys[k], &values[k]);
+        if (!replaced) {
+            n_live++;
+        } else if (cache_get(cache, keys[replaced - values], false) ==
+                   replaced) {
+            if (n_failed++ < 16)
+                fprintf(stderr, "key %#x: still holds the evicted value\n",
+                        keys[replaced - values]);
+        }
+        if (n_live > 1 << N_BENCH_BITS && n_failed++ < 16)
+            fprintf(stderr, "%d entries in the cache\n", n_live);
+    }
+
+    cache_free(cache);
+    return n_failed != 0;
+}
+
+static double bench(void *(*get)(const struct cache *, uint32_t, bool),
+                    const struct cache *cache,
+                    const uint32_t *lookups)
+{
+    struct timespec start, end;
+    uintptr_t sum = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < N_BENCH_LOOKUPS; i++)
+        sum += (uintptr_t) get(cache, lookups[i], true);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* keep the results alive */
+    if (sum == 1)
+        printf(" ");
+    return ((end.tv_sec - start.tv_sec) * 1e9 +
+            (end.tv_nsec - start.tv_nsec)) /
+           N_BENCH_LOOKUPS;
+}
+
+/* Compare the lookup latency of both caches, filled up with random block
+ * addresses, for lookups which hit in 90% of the cases.
+ */
+static int bench_cache(void)
+{
+    uint32_t *keys = malloc(sizeof(uint32_t) * N_BENCH_KEYS);
+    uint32_t *lookups = malloc(sizeof(uint32_t) * N_BENCH_LOOKUPS);
+    int *values = malloc(sizeof(int) * N_BENCH_KEYS);
+    assert(keys && lookups && values);
+
+    if (test_policy(keys, values)) {
+        fprintf(stderr, "Inconsistent cache\n");
+        return 1;
+    }
+
+    struct cache *cache = cache_create(N_BENCH_BITS);
+    struct cache *legacy = cache_legacy_create(N_BENCH_BITS);
+    const uint32_t n = 1 << N_BENCH_BITS;
+    for (uint32_t i = 0; i < n; i++) {
+        cache_put(cache, keys[i], &values[i]);
+        cache_legacy_put(legacy, keys[i], &values[i]);
+    }
+    for (int i = 0; i < N_BENCH_LOOKUPS; i++) {
+        const uint32_t r = xorshift32();
+        lookups[i] = keys[r % 10 ? r / 16 % n : n + r / 16 % (N_BENCH_KEYS - n)];
+    }
+
+    /* alternate between both caches, and keep the best round of each to
+     * filter out the noise from the host
+     */
+    double t_legacy = 1e9, t_cache = 1e9;
+    for (int r = 0; r < N_BENCH_ROUNDS; r++) {
+        double t = bench(cache_legacy_get, legacy, lookups);
+        if (t < t_legacy)
+            t_legacy = t;
+        t = bench(cache_get, cache, lookups);
+        if (t < t_cache)
+            t_cache = t;
+    }
+
+    printf("%d entries, %d lookups\n", n, N_BENCH_LOOKUPS);
+    printf("legacy cache: %.2f ns/lookup\n", t_legacy);
+    printf("flat cache:   %.2f ns/lookup\n", t_cache);
+
+    cache_legacy_free(legacy);
+    cache_free(cache);
+    free(values);
+    free(lookups);
+    free(keys);
+    return 0;
+}
+
+/* the number of hits when the lookups of @trace are replayed into a cache */
+static uint32_t replay(struct cache *(*create)(uint32_t),
+                       void *(*get)(const struct cache *, uint32_t, bool),
+                       void *(*put)(struct cache *, uint32_t, void *),
+                       void (*free_cache)(struct cache *),
+                       const uint32_t *trace,
+                       uint32_t n,
+                       uint32_t bits)
+{
+    static int value;
+    struct cache *cache = create(bits);
+    assert(cache);
+
+    /* like block_find_or_translate(), which translates the block on a miss */
+    uint32_t n_hits = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (get(cache, trace[i], true))
+            n_hits++;
+        else
+            put(cache, trace[i], &value);
+    }
+
+    free_cache(cache);
+    return n_hits;
+}
+
+/* Replay the lookups of the block cache recorded by "rv32emu -p" in
+ * @path, and report the hit rates of both replacement policies.
+ */
+static int replay_trace(const char *path, uint32_t bits)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    const uint32_t n = ftell(fp) / sizeof(uint32_t);
+    fseek(fp, 0, SEEK_SET);
+    uint32_t *trace = malloc(sizeof(uint32_t) * (n ? n : 1));
+    assert(trace);
+    if (fread(trace, sizeof(uint32_t), n, fp) != n) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        fclose(fp);
+        free(trace);
+        return 1;
+    }
+    fclose(fp);
+
+    const uint32_t legacy =
+        replay(cache_legacy_create, cache_legacy_get, cache_legacy_put,
+               cache_legacy_free, trace, n, bits);
+    const uint32_t arc =
+        replay(cache_create, cache_get, cache_put, cache_free, trace, n, bits);
+
+    printf("%u lookups, %u entries\n", n, 1U << bits);
+    printf("legacy cache: %.2f%% hits\n", n ? 100.0 * legacy / n : 0);
+    printf("ARC cache:    %.2f%% hits\n", n ? 100.0 * arc / n : 0);
+    free(trace);
+    return 0;
+}
+
 /*
  * Commands of test-cache:
  * 1. NEW: cache_create(N_CACHE_BITS), the cache size is set to pow(2,
  *         N_CACHE_BITS).
- * 2. GET key: cache_get(cache, key, true)
+ * 2. GET key [n]: cache_get(cache, key, true), n times (default: 1)
  * 3. PUT key val: cache_put(cache, key, val)
  * 4. FREE: cache_free(cache, free)
+ *
+ * Usage: test-cache file | -b | -r trace [bits]
+ *   -b  check the consistency of the cache, then report the lookup latency of
+ *       both the cache and the former implementation
+ *   -r  replay a trace of block lookups, recorded by "rv32emu -p", into a cache
+ *       of 2^bits entries (default: 10) with either policy
  */
 int main(int argc, char *argv[])
 {
     if (argc < 2)
         return 1; /* Fail */
+    if (!strcmp(argv[1], "-b"))
+        return bench_cache();
+    if (!strcmp(argv[1], "-r") && argc > 2)
+        return replay_trace(argv[2], argc > 3 ? atoi(argv[3]) : N_BENCH_BITS);
 
     FILE *fp = fopen(argv[1], "r");
     assert(fp);
@@ -44,13 +249,16 @@ int main(int argc, char *argv[])
     char *line = NULL;
     size_t len = 0;
     struct cache *cache = NULL;
-    int key, freq, *ans, *val;
+    int key, *ans, *val;
+    uint32_t freq;
     while (getline(&line, &len, fp) != -1) {
-        char *arr[3];
+        char *arr[3] = {NULL};
         split(arr, line, " ");
         if (!strcmp(arr[0], "GET")) {
             key = (int) strtol(arr[1], NULL, 10);
-            ans = cache_get(cache, key, true);
+            long long n = arr[2] ? strtoll(arr[2], NULL, 10) : 1;
+            for (ans = NULL; n > 0; n--)
+                ans = cache_get(cache, key, true);
             freq = cache_freq(cache, key);
             print_value(ans, freq);
         } else if (!strcmp(arr[0], "PUT")) {
@@ -0,0 +1,455 @@
+/*
+ * Test and benchmark of the instruction decoder.
+ *
+ * The table-driven rv_decode() generated from src/rv32_insn.txt is checked
+ * against the operands of encodings produced by an assembler, and against
+ * encodings which have to be rejected.
+ *
+ * Usage: test-decode [-b [file]]
+ *   -b  also report the decoding time per instruction, for a synthetic
+ *       instruction mix, or for the instructions read from @file, e.g., an
+ *       ELF executable.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "decode.h"
+#include "riscv_private.h"
+
+static uint32_t seed = 2463534242;
+
+static uint32_t xorshift32(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/* encoding, opcode, imm, rd, rs1, rs2, shamt, rm */
+static const struct {
+    uint32_t insn;
+    uint8_t opcode;
+    int32_t imm;
+    uint8_t rd, rs1, rs2, shamt, rm;
+} tests[] = {
+    {0x00550013, rv_insn_nop, 5, 0, 10, 0, 0, 0}, /* addi zero, a0, 5 */
+    {0x123450b7, rv_insn_lui, 305418240, 1, 0, 0, 0, 0}, /* lui ra, 0x12345 */
+    {0x12345037, rv_insn_nop, 305418240, 0, 0, 0, 0, 0}, /* lui zero, 0x12345 */
+    {0xfffff817, rv_insn_auipc, -4096, 16, 0, 0, 0, 0}, /* auipc a6, 0xfffff */
+    {0x00001017, rv_insn_nop, 4096, 0, 0, 0, 0, 0}, /* auipc zero, 1 */
+    {0xeefff7ef, rv_insn_jal, -274, 15, 0, 0, 0, 0}, /* jal a5, -274 */
+    {0x7080006f, rv_insn_jal, 1800, 0, 0, 0, 0, 0}, /* jal zero, 1800 */
+    {0xe2010fe7, rv_insn_jalr, -480, 31, 2, 0, 0, 0}, /* jalr t6, -480(sp) */
+    {0x00008067, rv_insn_jalr, 0, 0, 1, 0, 0, 0}, /* jalr zero, 0(ra) */
+    {0xb2f40063, rv_insn_beq, -3296, 0, 8, 15, 0, 0}, /* beq s0, a5, -3296 */
+    {0x1f009463, rv_insn_bne, 488, 0, 1, 16, 0, 0}, /* bne ra, a6, 488 */
+    {0x7a0fc7e3, rv_insn_blt, 4014, 0, 31, 0, 0, 0}, /* blt t6, zero, 4014 */
+    {0xc2805063, rv_insn_bge, -3040, 0, 0, 8, 0, 0}, /* bge zero, s0, -3040 */
+    {0x12ffe7e3, rv_insn_bltu, 2350, 0, 31, 15, 0, 0}, /* bltu t6, a5, 2350 */
+    {0xa90870e3, rv_insn_bgeu, -1408, 0, 16, 16, 0, 0}, /* bgeu a6, a6, -1408 */
+    {0x53f08403, rv_insn_lb, 1343, 8, 1, 0, 0, 0}, /* lb s0, 1343(ra) */
+    {0x21041103, rv_insn_lh, 528, 2, 8, 0, 0, 0}, /* lh sp, 528(s0) */
+    {0xa28fa783, rv_insn_lw, -1496, 15, 31, 0, 0, 0}, /* lw a5, -1496(t6) */
+    {0x5df7c803, rv_insn_lbu, 1503, 16, 15, 0, 0, 0}, /* lbu a6, 1503(a5) */
+    {0xd6845103, rv_insn_lhu, -664, 2, 8, 0, 0, 0}, /* lhu sp, -664(s0) */
+    {0x13f08423, rv_insn_sb, 296, 0, 1, 31, 0, 0}, /* sb t6, 296(ra) */
+    {0x30381c23, rv_insn_sh, 792, 0, 16, 3, 0, 0}, /* sh gp, 792(a6) */
+    {0xbc8820a3, rv_insn_sw, -1087, 0, 16, 8, 0, 0}, /* sw s0, -1087(a6) */
+    {0x30108413, rv_insn_addi, 769, 8, 1, 0, 0, 0}, /* addi s0, ra, 769 */
+    {0x56882093, rv_insn_slti, 1384, 1, 16, 0, 0, 0}, /* slti ra, a6, 1384 */
+    {0xf600b413, rv_insn_sltiu, -160, 8, 1, 0, 0, 0}, /* sltiu s0, ra, -160 */
+    {0xf427c813, rv_insn_xori, -190, 16, 15, 0, 0, 0}, /* xori a6, a5, -190 */
+    {0x7ff36293, rv_insn_ori, 2047, 5, 6, 0, 0, 0}, /* ori t0, t1, 2047 */
+    {0x8005f513, rv_insn_andi, -2048, 10, 11, 0, 0, 0}, /* andi a0, a1, -2048 */
+    {0x01f69613, rv_insn_slli, 31, 12, 13, 0, 0, 0}, /* slli a2, a3, 31 */
+    {0x0077d713, rv_insn_srli, 7, 14, 15, 0, 0, 0}, /* srli a4, a5, 7 */
+    {0x4138d813, rv_insn_srai, 1043, 16, 17, 0, 0, 0}, /* srai a6, a7, 19 */
+    {0x01498933, rv_insn_add, 0, 18, 19, 20, 0, 0}, /* add s2, s3, s4 */
+    {0x01498033, rv_insn_nop, 0, 0, 19, 20, 0, 0}, /* add zero, s3, s4 */
+    {0x417b0ab3, rv_insn_sub, 0, 21, 22, 23, 0, 0}, /* sub s5, s6, s7 */
+    {0x01ac9c33, rv_insn_sll, 0, 24, 25, 26, 0, 0}, /* sll s8, s9, s10 */
+    {0x01de2db3, rv_insn_slt, 0, 27, 28, 29, 0, 0}, /* slt s11, t3, t4 */
+    {0x00afbf33, rv_insn_sltu, 0, 30, 31, 10, 0, 0}, /* sltu t5, t6, a0 */
+    {0x00d645b3, rv_insn_xor, 0, 11, 12, 13, 0, 0}, /* xor a1, a2, a3 */
+    {0x0107d733, rv_insn_srl, 0, 14, 15, 16, 0, 0}, /* srl a4, a5, a6 */
+    {0x409458b3, rv_insn_sra, 0, 17, 8, 9, 0, 0}, /* sra a7, s0, s1 */
+    {0x007362b3, rv_insn_or, 0, 5, 6, 7, 0, 0}, /* or t0, t1, t2 */
+    {0x002271b3, rv_insn_and, 0, 3, 4, 2, 0, 0}, /* and gp, tp, sp */
+    {0x0310000f, rv_insn_fence, 0, 0, 0, 0, 0, 0}, /* fence rw, w */
+    {0x00000073, rv_insn_ecall, 0, 0, 0, 0, 0, 0}, /* ecall */
+    {0x00100073, rv_insn_ebreak, 1, 0, 0, 0, 0, 0}, /* ebreak */
+    {0x10500073, rv_insn_wfi, 261, 0, 0, 0, 0, 0}, /* wfi */
+#if RV32_HAS(SYSTEM)
+    {0x10200073, rv_insn_sret, 258, 0, 0, 0, 0, 0}, /* sret */
+#endif
+    {0x30200073, rv_insn_mret, 770, 0, 0, 0, 0, 0}, /* mret */
+    /* sfence.vma a0, a1 */
+    {0x12b50073, rv_insn_sfencevma, 299, 0, 10, 0, 0, 0},
+#if RV32_HAS(Zifencei)
+    {0x0000100f, rv_insn_fencei, 0, 0, 0, 0, 0, 0}, /* fence.i */
+#endif
+#if RV32_HAS(Zicsr)
+    /* csrrw a0, mstatus, a1 */
+    {0x30059573, rv_insn_csrrw, 768, 10, 11, 0, 0, 0},
+    {0x3416a673, rv_insn_csrrs, 833, 12, 13, 0, 0, 0}, /* csrrs a2, mepc, a3 */
+    /* csrrc a4, 0x800, a5 */
+    {0x8007b773, rv_insn_csrrc, -2048, 14, 15, 0, 0, 0},
+    /* csrrwi a6, mtvec, 17 */
+    {0x3058d873, rv_insn_csrrwi, 773, 16, 17, 0, 0, 0},
+    /* csrrsi a7, cycle, 0 */
+    {0xc00068f3, rv_insn_csrrsi, -1024, 17, 0, 0, 0, 0},
+    {0x304ff473, rv_insn_csrrci, 772, 8, 31, 0, 0, 0}, /* csrrci s0, mie, 31 */
+#endif
+#if RV32_HAS(Zba)
+    {0x20c5a533, rv_insn_sh1add, 0, 10, 11, 12, 0, 0}, /* sh1add a0, a1, a2 */
+    {0x20f746b3, rv_insn_sh2add, 0, 13, 14, 15, 0, 0}, /* sh2add a3, a4, a5 */
+    {0x2088e833, rv_insn_sh3add, 0, 16, 17, 8, 0, 0}, /* sh3add a6, a7, s0 */
+#endif
+#if RV32_HAS(Zbb)
+    {0x413974b3, rv_insn_andn, 0, 9, 18, 19, 0, 0}, /* andn s1, s2, s3 */
+    {0x416aea33, rv_insn_orn, 0, 20, 21, 22, 0, 0}, /* orn s4, s5, s6 */
+    {0x419c4bb3, rv_insn_xnor, 0, 23, 24, 25, 0, 0}, /* xnor s7, s8, s9 */
+    {0x600d9d13, rv_insn_clz, 1536, 26, 27, 0, 0, 0}, /* clz s10, s11 */
+    {0x601e9e13, rv_insn_ctz, 1537, 28, 29, 0, 0, 0}, /* ctz t3, t4 */
+    {0x602f9f13, rv_insn_cpop, 1538, 30, 31, 0, 0, 0}, /* cpop t5, t6 */
+    {0x0ac5e533, rv_insn_max, 0, 10, 11, 12, 0, 0}, /* max a0, a1, a2 */
+    {0x0af776b3, rv_insn_maxu, 0, 13, 14, 15, 0, 0}, /* maxu a3, a4, a5 */
+    {0x0a88c833, rv_insn_min, 0, 16, 17, 8, 0, 0}, /* min a6, a7, s0 */
+    {0x0b3954b3, rv_insn_minu, 0, 9, 18, 19, 0, 0}, /* minu s1, s2, s3 */
+    {0x604a9a13, rv_insn_sextb, 1540, 20, 21, 0, 0, 0}, /* sext.b s4, s5 */
+    {0x605b9b13, rv_insn_sexth, 1541, 22, 23, 0, 0, 0}, /* sext.h s6, s7 */
+    {0x080ccc33, rv_insn_zexth, 0, 24, 25, 0, 0, 0}, /* zext.h s8, s9 */
+    {0x61cd9d33, rv_insn_rol, 0, 26, 27, 28, 0, 0}, /* rol s10, s11, t3 */
+    {0x61ff5eb3, rv_insn_ror, 0, 29, 30, 31, 0, 0}, /* ror t4, t5, t6 */
+    {0x60d5d513, rv_insn_rori, 1549, 10, 11, 0, 0, 0}, /* rori a0, a1, 13 */
+    {0x2876d613, rv_insn_orcb, 647, 12, 13, 0, 0, 0}, /* orc.b a2, a3 */
+    {0x6987d713, rv_insn_rev8, 1688, 14, 15, 0, 0, 0}, /* rev8 a4, a5 */
+#endif
+#if RV32_HAS(Zbc)
+    {0x0a889833, rv_insn_clmul, 0, 16, 17, 8, 0, 0}, /* clmul a6, a7, s0 */
+    {0x0b3934b3, rv_insn_clmulh, 0, 9, 18, 19, 0, 0}, /* clmulh s1, s2, s3 */
+    {0x0b6aaa33, rv_insn_clmulr, 0, 20, 21, 22, 0, 0}, /* clmulr s4, s5, s6 */
+#endif
+#if RV32_HAS(Zbs)
+    {0x499c1bb3, rv_insn_bclr, 0, 23, 24, 25, 0, 0}, /* bclr s7, s8, s9 */
+    {0x485d9d13, rv_insn_bclri, 1157, 26, 27, 0, 0, 0}, /* bclri s10, s11, 5 */
+    {0x49eede33, rv_insn_bext, 0, 28, 29, 30, 0, 0}, /* bext t3, t4, t5 */
+    {0x49e55f93, rv_insn_bexti, 1182, 31, 10, 0, 0, 0}, /* bexti t6, a0, 30 */
+    {0x68d615b3, rv_insn_binv, 0, 11, 12, 13, 0, 0}, /* binv a1, a2, a3 */
+    {0x68179713, rv_insn_binvi, 1665, 14, 15, 0, 0, 0}, /* binvi a4, a5, 1 */
+    {0x28889833, rv_insn_bset, 0, 16, 17, 8, 0, 0}, /* bset a6, a7, s0 */
+    {0x29191493, rv_insn_bseti, 657, 9, 18, 0, 0, 0}, /* bseti s1, s2, 17 */
+#endif
+#if RV32_HAS(EXT_M)
+    {0x02c58533, rv_insn_mul, 0, 10, 11, 12, 0, 0}, /* mul a0, a1, a2 */
+    {0x02f716b3, rv_insn_mulh, 0, 13, 14, 15, 0, 0}, /* mulh a3, a4, a5 */
+    {0x0288a833, rv_insn_mulhsu, 0, 16, 17, 8, 0, 0}, /* mulhsu a6, a7, s0 */
+    {0x033934b3, rv_insn_mulhu, 0, 9, 18, 19, 0, 0}, /* mulhu s1, s2, s3 */
+    {0x036aca33, rv_insn_div, 0, 20, 21, 22, 0, 0}, /* div s4, s5, s6 */
+    {0x039c5bb3, rv_insn_divu, 0, 23, 24, 25, 0, 0}, /* divu s7, s8, s9 */
+    {0x03cded33, rv_insn_rem, 0, 26, 27, 28, 0, 0}, /* rem s10, s11, t3 */
+    {0x03ff7eb3, rv_insn_remu, 0, 29, 30, 31, 0, 0}, /* remu t4, t5, t6 */
+#endif
+#if RV32_HAS(EXT_A)
+    {0x1005a52f, rv_insn_lrw, 0, 10, 11, 0, 0, 0}, /* lr.w a0, (a1) */
+    {0x1cd7262f, rv_insn_scw, 0, 12, 14, 13, 0, 0}, /* sc.w.aq a2, a3, (a4) */
+    /* amoswap.w a5, a6, (a7) */
+    {0x0908a7af, rv_insn_amoswapw, 0, 15, 17, 16, 0, 0},
+    /* amoadd.w.rl s0, s1, (s2) */
+    {0x0299242f, rv_insn_amoaddw, 0, 8, 18, 9, 0, 0},
+    /* amoxor.w s3, s4, (s5) */
+    {0x214aa9af, rv_insn_amoxorw, 0, 19, 21, 20, 0, 0},
+    /* amoand.w.aqrl s6, s7, (s8) */
+    {0x677c2b2f, rv_insn_amoandw, 0, 22, 24, 23, 0, 0},
+    /* amoor.w s9, s10, (s11) */
+    {0x41adacaf, rv_insn_amoorw, 0, 25, 27, 26, 0, 0},
+    /* amomin.w t3, t4, (t5) */
+    {0x81df2e2f, rv_insn_amominw, 0, 28, 30, 29, 0, 0},
+    /* amomax.w t6, a0, (a1) */
+    {0xa0a5afaf, rv_insn_amomaxw, 0, 31, 11, 10, 0, 0},
+    /* amominu.w a2, a3, (a4) */
+    {0xc0d7262f, rv_insn_amominuw, 0, 12, 14, 13, 0, 0},
+    /* amomaxu.w a5, a6, (a7) */
+    {0xe108a7af, rv_insn_amomaxuw, 0, 15, 17, 16, 0, 0},
+#endif
+#if RV32_HAS(EXT_F)
+    {0xff412507, rv_insn_flw, -12, 10, 2, 0, 0, 0}, /* flw fa0, -12(sp) */
+    {0x7e97ac27, rv_insn_fsw, 2040, 0, 15, 9, 0, 0}, /* fsw fs1, 2040(a5) */
+    /* fmadd.s fa1, fa2, fa3, fa4, rne */
+    {0x70d605c3, rv_insn_fmadds, 14, 11, 12, 13, 0, 0},
+    /* fmsub.s fa5, fa6, fa7, fs2, rtz */
+    {0x911817c7, rv_insn_fmsubs, 18, 15, 16, 17, 0, 1},
+    /* fnmsub.s fs3, fs4, fs5, fs6, rdn */
+    {0xb15a29cb, rv_insn_fnmsubs, 22, 19, 20, 21, 0, 2},
+    /* fnmadd.s fs7, fs8, fs9, fs10, dyn */
+    {0xd19c7bcf, rv_insn_fnmadds, 26, 23, 24, 25, 0, 7},
+    /* fadd.s ft0, ft1, ft2, rup */
+    {0x0020b053, rv_insn_fadds, 0, 0, 1, 2, 0, 3},
+    /* fsub.s ft3, ft4, ft5, rmm */
+    {0x085241d3, rv_insn_fsubs, 0, 3, 4, 5, 0, 4},
+    {0x11c3f353, rv_insn_fmuls, 0, 6, 7, 28, 0, 7}, /* fmul.s ft6, ft7, ft8 */
+    /* fdiv.s ft9, ft10, ft11 */
+    {0x19ff7ed3, rv_insn_fdivs, 0, 29, 30, 31, 0, 7},
+    {0x5805f553, rv_insn_fsqrts, 0, 10, 11, 0, 0, 7}, /* fsqrt.s fa0, fa1 */
+    /* fsgnj.s fa2, fa3, fa4 */
+    {0x20e68653, rv_insn_fsgnjs, 0, 12, 13, 14, 0, 0},
+    /* fsgnjn.s fa5, fa6, fa7 */
+    {0x211817d3, rv_insn_fsgnjns, 0, 15, 16, 17, 0, 1},
+    /* fsgnjx.s fs0, fs1, fs2 */
+    {0x2124a453, rv_insn_fsgnjxs, 0, 8, 9, 18, 0, 2},
+    {0x295a09d3, rv_insn_fmins, 0, 19, 20, 21, 0, 0}, /* fmin.s fs3, fs4, fs5 */
+    {0x298b9b53, rv_insn_fmaxs, 0, 22, 23, 24, 0, 1}, /* fmax.s fs6, fs7, fs8 */
+    /* fcvt.w.s a0, fa0, rtz */
+    {0xc0051553, rv_insn_fcvtws, 0, 10, 10, 0, 0, 1},
+    {0xc015f5d3, rv_insn_fcvtwus, 0, 11, 11, 1, 0, 7}, /* fcvt.wu.s a1, fa1 */
+    {0xe0060653, rv_insn_fmvxw, 0, 12, 12, 0, 0, 0}, /* fmv.x.w a2, fa2 */
+    {0xa0e6a6d3, rv_insn_feqs, 0, 13, 13, 14, 0, 2}, /* feq.s a3, fa3, fa4 */
+    {0xa1079753, rv_insn_flts, 0, 14, 15, 16, 0, 1}, /* flt.s a4, fa5, fa6 */
+    {0xa08887d3, rv_insn_fles, 0, 15, 17, 8, 0, 0}, /* fle.s a5, fa7, fs0 */
+    {0xe0049853, rv_insn_fclasss, 0, 16, 9, 0, 0, 1}, /* fclass.s a6, fs1 */
+    {0xd008f953, rv_insn_fcvtsw, 0, 18, 17, 0, 0, 7}, /* fcvt.s.w fs2, a7 */
+    /* fcvt.s.wu fs3, s0, rdn */
+    {0xd01429d3, rv_insn_fcvtswu, 0, 19, 8, 1, 0, 2},
+    {0xf0048a53, rv_insn_fmvwx, 0, 20, 9, 0, 0, 0}, /* fmv.w.x fs4, s1 */
+#endif
+#if RV32_HAS(EXT_C)
+    /* c.addi4spn s0, sp, 1020 */
+    {0x1fe0, rv_insn_caddi4spn, 1020, 8, 0, 0, 0, 0},
+    {0x5d7c, rv_insn_clw, 124, 15, 10, 0, 0, 0}, /* c.lw a5, 124(a0) */
+    {0xc224, rv_insn_csw, 64, 0, 12, 9, 0, 0}, /* c.sw s1, 64(a2) */
+    {0x0001, rv_insn_cnop, 0, 0, 0, 0, 0, 0}, /* c.nop */
+    {0x1501, rv_insn_caddi, -32, 10, 0, 0, 0, 0}, /* c.addi a0, -32 */
+    {0x3001, rv_insn_cjal, -2048, 0, 0, 0, 0, 0}, /* c.jal -2048 */
+    {0x47fd, rv_insn_cli, 31, 15, 0, 0, 0, 0}, /* c.li a5, 31 */
+    {0x7101, rv_insn_caddi16sp, -512, 2, 0, 0, 0, 0}, /* c.addi16sp sp, -512 */
+    {0x647d, rv_insn_clui, 126976, 8, 0, 0, 0, 0}, /* c.lui s0, 0x1f */
+    {0x827d, rv_insn_csrli, 0, 0, 12, 0, 31, 0}, /* c.srli a2, 31 */
+    {0x8685, rv_insn_csrai, 0, 0, 13, 0, 1, 0}, /* c.srai a3, 1 */
+    {0x9b7d, rv_insn_candi, -1, 0, 14, 0, 0, 0}, /* c.andi a4, -1 */
+    {0x8c05, rv_insn_csub, 0, 8, 8, 9, 0, 0}, /* c.sub s0, s1 */
+    {0x8d2d, rv_insn_cxor, 0, 10, 10, 11, 0, 0}, /* c.xor a0, a1 */
+    {0x8e55, rv_insn_cor, 0, 12, 12, 13, 0, 0}, /* c.or a2, a3 */
+    {0x8f7d, rv_insn_cand, 0, 14, 14, 15, 0, 0}, /* c.and a4, a5 */
+    {0xaffd, rv_insn_cj, 2046, 0, 0, 0, 0, 0}, /* c.j 2046 */
+    {0xd081, rv_insn_cbeqz, -256, 0, 9, 0, 0, 0}, /* c.beqz s1, -256 */
+    {0xeffd, rv_insn_cbnez, 254, 0, 15, 0, 0, 0}, /* c.bnez a5, 254 */
+    {0x02c6, rv_insn_cslli, 17, 5, 0, 0, 0, 0}, /* c.slli t0, 17 */
+    {0x50fe, rv_insn_clwsp, 252, 1, 0, 0, 0, 0}, /* c.lwsp ra, 252(sp) */
+    {0x8082, rv_insn_cjr, 0, 1, 1, 0, 0, 0}, /* c.jr ra */
+    {0x857e, rv_insn_cmv, 0, 10, 10, 31, 0, 0}, /* c.mv a0, t6 */
+    {0x9002, rv_insn_ebreak, 0, 0, 0, 0, 0, 0}, /* c.ebreak */
+    {0x9282, rv_insn_cjalr, 0, 5, 5, 0, 0, 0}, /* c.jalr t0 */
+    {0x912e, rv_insn_cadd, 0, 2, 2, 11, 0, 0}, /* c.add sp, a1 */
+    {0xc06e, rv_insn_cswsp, 0, 0, 0, 27, 0, 0}, /* c.swsp s11, 0(sp) */
+#endif
+#if RV32_HAS(EXT_C) && RV32_HAS(EXT_F)
+    {0x6532, rv_insn_cflwsp, 12, 10, 0, 0, 0, 0}, /* c.flwsp fa0, 12(sp) */
+    {0xfea6, rv_insn_cfswsp, 124, 0, 0, 9, 0, 0}, /* c.fswsp fs1, 124(sp) */
+    {0x6050, rv_insn_cflw, 4, 12, 8, 0, 0, 0}, /* c.flw fa2, 4(s0) */
+    {0xffbc, rv_insn_cfsw, 120, 0, 15, 15, 0, 0}, /* c.fsw fa5, 120(a5) */
+#endif
+#if RV32_HAS(EXT_C)
+    {0x0005, rv_insn_cnop, 1, 0, 0, 0, 0, 0}, /* c.addi zero, 1 (HINT) */
+    {0x6005, rv_insn_cnop, 0, 0, 0, 0, 0, 0}, /* c.lui zero, 1 (HINT) */
+    {0x8001, rv_insn_cnop, 0, 0, 8, 0, 0, 0}, /* c.srli s0, 0 (HINT) */
+    {0x0006, rv_insn_cnop, 1, 0, 0, 0, 0, 0}, /* c.slli zero, 1 (HINT) */
+    {0x4002, rv_insn_cnop, 0, 0, 0, 0, 0, 0}, /* c.lwsp zero, 0(sp) (HINT) */
+    {0x802a, rv_insn_cnop, 0, 0, 0, 10, 0, 0}, /* c.mv zero, a0 (HINT) */
+    {0x902a, rv_insn_cnop, 0, 0, 0, 10, 0, 0}, /* c.add zero, a0 (HINT) */
+#endif
+};
+
+static const uint32_t illegal[] = {
+    0xffffffff, /* longer than 32 bits */
+    0x0000001b, /* addiw zero, zero, 0 (RV64) */
+    0x00003003, /* ld zero, 0(zero) (RV64) */
+    0xc001e8f3, /* csrrsi a7, cycle, 3: writes a read-only CSR */
+    0xc0250553, /* fcvt.w.s a0, fa0 with rs2 = 2 */
+#if RV32_HAS(EXT_C)
+    0x0000, /* all zeros */
+    0x6101, /* c.addi16sp sp, 0 */
+    0x6081, /* c.lui ra, 0 */
+    0x9001, /* c.srli s0, 32 (RV64) */
+    0x9c01, /* c.subw s0, s0 (RV64) */
+    0x8002, /* c.jr zero */
+    0x2000, /* c.fld fs0, 0(s0) (RV32DC) */
+#endif
+};
+
+static bool same_insn(const rv_insn_t *ir, int i)
+{
+    return ir->opcode == tests[i].opcode && ir->imm == tests[i].imm &&
+           ir->rd == tests[i].rd && ir->rs1 == tests[i].rs1 &&
+           ir->rs2 == tests[i].rs2
+#if RV32_HAS(EXT_C)
+           && ir->shamt == tests[i].shamt
+#endif
+#if RV32_HAS(EXT_F)
+           && ir->rm == tests[i].rm
+#endif
+        ;
+}
+
+/* return 0 on success; non-zero values on failure */
+static int test_decode(void)
+{
+    const int n_tests = sizeof(tests) / sizeof(tests[0]);
+    const int n_illegal = sizeof(illegal) / sizeof(illegal[0]);
+    int n_checked = 0, n_failed = 0;
+
+    for (int i = 0; i < n_tests; i++) {
+#if RV32_HAS(RV32E)
+        /* x16-x31 are rejected, unless they are floating-point registers */
+        if (tests[i].rd > 15 || tests[i].rs1 > 15 || tests[i].rs2 > 15)
+            continue;
+#endif
+        rv_insn_t ir = {0};
+        n_checked++;
+        if (rv_decode(&ir, tests[i].insn) && same_insn(&ir, i))
+            continue;
+        n_failed++;
+        fprintf(stderr,
+                "insn %08x: expected opcode %d imm %d rd %d rs1 %d rs2 %d, "
+                "got opcode %d imm %d rd %d rs1 %d rs2 %d\n",
+                tests[i].insn, tests[i].opcode, tests[i].imm, tests[i].rd,
+                tests[i].rs1, tests[i].rs2, ir.opcode, ir.imm, ir.rd, ir.rs1,
+                ir.rs2);
+    }
+
+    for (int i = 0; i < n_illegal; i++) {
+        rv_insn_t ir = {0};
+        n_checked++;
+        if (!rv_decode(&ir, illegal[i]))
+            continue;
+        n_failed++;
+        fprintf(stderr, "insn %08x: expected illegal, got opcode %d\n",
+                illegal[i], ir.opcode);
+    }
+
+#if RV32_HAS(EXT_C)
+    /* the upper half of a compressed instruction is ignored */
+    for (uint32_t insn = 0; insn < 0x10000; insn++) {
+        if ((insn & 3) == 3)
+            continue;
+        rv_insn_t expect = {0}, got = {0};
+        bool expect_ok = rv_decode(&expect, insn);
+        bool got_ok = rv_decode(&got, xorshift32() << 16 | insn);
+        if (expect_ok == got_ok && !memcmp(&expect, &got, sizeof(got)))
+            continue;
+        if (n_failed++ < 16)
+            fprintf(stderr, "insn %04x: depends on the upper half\n", insn);
+    }
+#endif
+
+    printf("%d instructions checked, %d failures\n", n_checked, n_failed);
+    return n_failed != 0;
+}
+
+enum { N_BENCH_INSNS = 1 << 16, N_BENCH_ROUNDS = 200 };
+
+static uint32_t *load_insns(const char *path, int *n)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = calloc(1, size + 4);
+    uint32_t *insns = malloc(sizeof(uint32_t) * (size / 2 + 1));
+    if (!buf || !insns || fread(buf, 1, size, f) != (size_t) size) {
+        free(buf);
+        free(insns);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    /* walk the file as an instruction stream */
+    *n = 0;
+    for (long pos = 0; pos < size;) {
+        uint32_t insn;
+        memcpy(&insn, buf + pos, 4);
+        insns[(*n)++] = insn;
+        pos += (insn & 3) == 3 ? 4 : 2;
+    }
+    free(buf);
+    return insns;
+}
+
+static uint32_t *synth_insns(int *n)
+{
+    uint32_t *insns = malloc(sizeof(uint32_t) * N_BENCH_INSNS);
+    if (!insns)
+        return NULL;
+
+    /* legal instructions, a quarter of them being compressed if supported */
+    rv_insn_t ir;
+    for (*n = 0; *n < N_BENCH_INSNS;) {
+        uint32_t insn = xorshift32();
+        if (RV32_HAS(EXT_C) && (*n & 3) == 0)
+            insn &= 0xffff;
+        else
+            insn |= 3;
+        if (rv_decode(&ir, insn))
+            insns[(*n)++] = insn;
+    }
+    return insns;
+}
+
+static double bench(const uint32_t *insns, int n)
+{
+    struct timespec start, end;
+    rv_insn_t ir = {0};
+    unsigned int sum = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+        sum += rv_decode(&ir, insns[i]) + ir.opcode;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* keep the results alive */
+    if (sum == 1)
+        printf(" ");
+    return ((end.tv_sec - start.tv_sec) * 1e9 +
+            (end.tv_nsec - start.tv_nsec)) /
+           n;
+}
+
+static int bench_decode(const char *path)
+{
+    int n;
+    uint32_t *insns = path ? load_insns(path, &n) : synth_insns(&n);
+    if (!insns) {
+        fprintf(stderr, "Failed to load instructions\n");
+        return 1;
+    }
+
+    /* keep the best round to filter out the noise from the host */
+    double best = 1e9;
+    for (int r = 0; r < N_BENCH_ROUNDS; r++) {
+        double t = bench(insns, n);
+        if (t < best)
+            best = t;
+    }
+
+    printf("%d instructions\n", n);
+    printf("%.2f ns/insn\n", best);
+    free(insns);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (test_decode())
+        return 1;
+    if (argc > 1 && !strcmp(argv[1], "-b"))
+        return bench_decode(argc > 2 ? argv[2] : NULL);
+    return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Test of the virtio-blk device, driven through its MMIO registers over the
+ * memory of a fake guest, as the driver of the guest kernel would.
+ *
+ * Usage: test-virtio-blk <image> [async | overlay]
+ *   The image of at least 1 MiB is overwritten. With "async", the requests
+ *   are served by the I/O worker rather than on the mapped image, and their
+ *   completions are collected by virtio_blk_poll(). With "overlay", the image
+ *   is filled with a pattern, and the requests go to the overlay
+ *   <image>.overlay created over it, by the I/O worker as well.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "devices/vblk-overlay.h"
+#include "devices/virtio.h"
+
+#define RAM_SIZE (4 << 20)
+
+/* layout of the guest memory, queue @q has QUEUE_NUM descriptors */
+#define QUEUE_NUM 64
+#define DESC(q) (0x1000 + (q) * 0x4000)
+#define AVAIL(q) (DESC(q) + 0x1000)
+#define USED(q) (DESC(q) + 0x2000)
+#define HEADER(buf) (0x20000 + (buf) * 32) /* followed by the status */
+#define DATA(buf) (0x100000 + (buf) * 0x8000)
+
+static uint32_t ram[RAM_SIZE / 4];
+static virtio_blk_state_t *vblk;
+static uint16_t avail_idx[VBLK_QUEUE_CNT], used_idx[VBLK_QUEUE_CNT];
+static int n_failures;
+
+#define REG_READ(reg) virtio_blk_read(vblk, VIRTIO_##reg << 2)
+#define REG_WRITE(reg, value) virtio_blk_write(vblk, VIRTIO_##reg << 2, value)
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+            n_failures++;                                             \
+        }                                                             \
+    } while (0)
+
+static inline void *guest(uint32_t addr)
+{
+    return (uint8_t *) ram + addr;
+}
+
+static uint8_t status_of(int buf)
+{
+    return *(uint8_t *) guest(HEADER(buf) + 16);
+}
+
+/* the length of the k-th used element of queue @q */
+static uint32_t used_len(int q, uint16_t k)
+{
+    return ((uint32_t *) guest(USED(q) + 4))[2 * (k % QUEUE_NUM) + 1];
+}
+
+static void setup(void)
+{
+    REG_WRITE(Status, 0);
+    memset(guest(DESC(0)), 0, VBLK_QUEUE_CNT * 0x4000);
+    for (int q = 0; q < VBLK_QUEUE_CNT; q++) {
+        REG_WRITE(QueueSel, q);
+        REG_WRITE(QueueNum, QUEUE_NUM);
+        REG_WRITE(QueueDescLow, DESC(q));
+        REG_WRITE(QueueDriverLow, AVAIL(q));
+        REG_WRITE(QueueDeviceLow, USED(q));
+        avail_idx[q] = used_idx[q] = 0;
+        REG_WRITE(QueueReady, 1);
+    }
+    REG_WRITE(Status, 1 | 2 | 4 | 8); /* up to FEATURES_OK and DRIVER_OK */
+}
+
+/* Make available the request of @type on @sector headed by descriptor @head,
+ * whose header is at HEADER(buf), and whose data is split into @n_seg
+ * segments of @seg_len bytes at DATA(buf).
+ */
+static void post(int q,
+                 uint16_t head,
+                 int buf,
+                 uint32_t type,
+                 uint64_t sector,
+                 int n_seg,
+                 uint32_t seg_len)
+{
+    struct virtq_desc *desc = guest(DESC(q));
+    uint8_t *header = guest(HEADER(buf));
+    memset(header, 0, 32);
+    memcpy(header, &type, sizeof(type));
+    memcpy(header + 8, &sector, sizeof(sector));
+    header[16] = 0xff;
+
+    const uint16_t write = type == VIRTIO_BLK_T_IN ? VIRTIO_DESC_F_WRITE : 0;
+    uint16_t i = head;
+    desc[i] = (struct virtq_desc){HEADER(buf), 16, VIRTIO_DESC_F_NEXT, i + 1};
+    for (int s = 0; s < n_seg; s++, i++) {
+        desc[i + 1] = (struct virtq_desc){DATA(buf) + s * seg_len, seg_len,
+                                          VIRTIO_DESC_F_NEXT | write, i + 2};
+    }
+    desc[i + 1] =
+        (struct virtq_desc){HEADER(buf) + 16, 1, VIRTIO_DESC_F_WRITE, 0};
+
+    uint16_t *avail = guest(AVAIL(q));
+    avail[2 + avail_idx[q] % QUEUE_NUM] = head;
+    avail[1] = ++avail_idx[q];
+}
+
+/* wait for @n more used elements in queue @q, and return 0 or -1 */
+static int wait_used(int q, uint16_t n)
+{
+    for (int i = 0; i < 100000; i++) {
+        virtio_blk_poll(vblk);
+        const uint16_t used = ((uint16_t *) guest(USED(q)))[1];
+        if ((uint16_t) (used - used_idx[q]) >= n) {
+            used_idx[q] = used;
+            return 0;
+        }
+        usleep(10);
+    }
+    return -1;
+}
+
+/* write distinct patterns through scattered buffers, then read them back */
+static void test_read_write(void)
+{
+    setup();
+    for (uint16_t r = 0; r < 8; r++) {
+        memset(guest(DATA(r)), 'a' + r, 0x4000);
+        post(0, r * 4, r, VIRTIO_BLK_T_OUT, r * 32, 2, 0x2000);
+    }
+    REG_WRITE(QueueNotify, 0);
+    CHECK(!wait_used(0, 8));
+    CHECK(REG_READ(InterruptStatus) & VIRTIO_INT_USED_RING);
+    REG_WRITE(InterruptACK, VIRTIO_INT_USED_RING);
+
+    for (uint16_t r = 0; r < 8; r++) {
+        CHECK(status_of(r) == VIRTIO_BLK_S_OK);
+        CHECK(used_len(0, r) == 1);
+        memset(guest(DATA(r)), 0, 0x4000);
+        post(0, r * 4, r, VIRTIO_BLK_T_IN, (7 - r) * 32, 2, 0x2000);
+    }
+    REG_WRITE(QueueNotify, 0);
+    CHECK(!wait_used(0, 8));
+
+    for (uint16_t r = 0; r < 8; r++) {
+        const uint8_t *data = guest(DATA(r));
+        bool same = true;
+        for (int j = 0; j < 0x4000; j++)
+            same &= data[j] == 'a' + 7 - r;
+        CHECK(same);
+        CHECK(status_of(r) == VIRTIO_BLK_S_OK);
+        CHECK(used_len(0, 8 + r) == 0x4000 + 1);
+    }
+    CHECK(!(REG_READ(Status) & VIRTIO_STATUS_DEVICE_NEEDS_RESET));
+}
+
+/* the requests beyond the end of the disk fail before any I/O, including
+ * those whose size does not fit in 32 bits
+ */
+static void test_out_of_range(const char *image)
+{
+    struct stat st;
+    CHECK(!stat(image, &st));
+    const uint64_t last = st.st_size / 512 - 1;
+
+    setup();
+    post(0, 0, 0, VIRTIO_BLK_T_OUT, last, 2, 512);
+    post(0, 4, 1, VIRTIO_BLK_T_IN, last + 1, 1, 512);
+    /* 16 buffers of 256 MiB over the same memory, 4 GiB in total */
+    post(0, 8, 2, VIRTIO_BLK_T_OUT, 0, 16, 1 << 28);
+    struct virtq_desc *desc = guest(DESC(0));
+    for (int s = 0; s < 16; s++)
+        desc[9 + s].addr = DATA(2);
+    REG_WRITE(QueueNotify, 0);
+    CHECK(!wait_used(0, 3));
+    for (int r = 0; r < 3; r++) {
+        CHECK(status_of(r) == VIRTIO_BLK_S_IOERR);
+        CHECK(used_len(0, r) == 1);
+    }
+
+    /* the last sector is still within the disk */
+    post(0, 0, 0, VIRTIO_BLK_T_OUT, last, 1, 512);
+    REG_WRITE(QueueNotify, 0);
+    CHECK(!wait_used(0, 1));
+    CHECK(status_of(0) == VIRTIO_BLK_S_OK);
+
+    struct stat st_after;
+    CHECK(!stat(image, &st_after));
+    CHECK(st_after.st_size == st.st_size);
+    CHECK(!(REG_READ(Status) & VIRTIO_STATUS_DEVICE_NEEDS_RESET));
+}
+
+/* a chain made available again before it is used fails the device */
+static void test_reuse_in_flight(void)
+{
+    setup();
+    post(1, 0, 0, VIRTIO_BLK_T_OUT, 0, 4, 0x2000);
+    REG_WRITE(QueueNotify, 1);
+    /* the chain stays in flight until its completion is collected, the
+     * buffers of the request in flight are left alone
+     */
+    post(1, 0, 1, VIRTIO_BLK_T_OUT, 64, 4, 0x2000);
+    REG_WRITE(QueueNotify, 1);
+    CHECK(REG_READ(Status) & VIRTIO_STATUS_DEVICE_NEEDS_RESET);
+    CHECK(REG_READ(InterruptStatus) & VIRTIO_INT_CONF_CHANGE);
+
+    /* the request in flight still completes, and the other one never runs */
+    CHECK(!wait_used(1, 1));
+    CHECK(status_of(0) == VIRTIO_BLK_S_OK);
+    CHECK(status_of(1) == 0xff);
+
+    /* and the device works again once reset */
+    setup();
+    post(1, 0, 0, VIRTIO_BLK_T_IN, 0, 1, 512);
+    REG_WRITE(QueueNotify, 1);
+    CHECK(!wait_used(1, 1));
+    CHECK(status_of(0) == VIRTIO_BLK_S_OK);
+    CHECK(!(REG_READ(Status) & VIRTIO_STATUS_DEVICE_NEEDS_RESET));
+}
+
+/* the byte at @offset of the base image below an overlay */
+static uint8_t base_byte(uint64_t offset)
+{
+    return offset / 512 * 3 + offset % 251;
+}
+
+static bool fill_base(const char *image)
+{
+    struct stat st;
+    uint8_t *data;
+    if (stat(image, &st) || !(data = malloc(st.st_size)))
+        return false;
+    for (off_t i = 0; i < st.st_size; i++)
+        data[i] = base_byte(i);
+    const int fd = open(image, O_WRONLY);
+    const bool ok = fd >= 0 && pwrite(fd, data, st.st_size, 0) == st.st_size;
+    if (fd >= 0)
+        close(fd);
+    free(data);
+    return ok;
+}
+
+/* Sectors of the first cluster of the overlay untouched by the other tests:
+ * OV_SECTOR + 1 and + 2 are written whole, and then + 1 is discarded, and
+ * OV_SECTOR + 5 is written OV_PART bytes. The rest is left to the base image,
+ * but the first sector of the next cluster, written whole.
+ */
+#define OV_SECTOR 512
+#define OV_PART 100
+#define OV_LEN (8 * 512)
+
+/* check @data read from OV_SECTOR on, and return the number of wrong bytes */
+static int check_overlay(const uint8_t *data, bool discarded)
+{
+    int n_wrong = 0;
+    for (int j = 0; j < OV_LEN; j++) {
+        const int sector = j / 512;
+        uint8_t expect = base_byte((uint64_t) OV_SECTOR * 512 + j);
+        if ((sector == 1 && !discarded) || sector == 2)
+            expect = 'w';
+        else if (sector == 5 && j % 512 < OV_PART)
+            expect = 'p';
+        n_wrong += data[j] != expect;
+    }
+    return n_wrong;
+}
+
+/* the writes go to the overlay, sector by sector, and the reads mix the
+ * sectors of the overlay with the ones of the base image
+ */
+static void test_overlay(void)
+{
+    setup();
+    memset(guest(DATA(0)), 'w', 2 * 512);
+    post(0, 0, 0, VIRTIO_BLK_T_OUT, OV_SECTOR + 1, 1, 2 * 512);
+    /* the rest of a sector partly written is kept from the base image */
+    memset(guest(DATA(1)), 'p', OV_PART);
+    post(0, 4, 1, VIRTIO_BLK_T_OUT, OV_SECTOR + 5, 1, OV_PART);
+    memset(guest(DATA(2)), 'w', 512);
+    post(0, 8, 2, VIRTIO_BLK_T_OUT, OV_SECTOR + 64, 1, 512);
+    REG_WRITE(QueueNotify, 0);
+    CHECK(!wait_used(0, 3));
+    for (int r = 0; r < 3; r++)
+        CHECK(status_of(r) == VIRTIO_BLK_S_OK);
+
+    memset(guest(DATA(0)), 0, OV_LEN);
+    post(0, 0, 0, VIRTIO_BLK_T_IN, OV_SECTOR, 1, OV_LEN);
+    REG_WRITE(QueueNotify, 0);
+    CHECK(!wait_used(0, 1));
+    CHECK(status_of(0) == VIRTIO_BLK_S_OK);
+    CHECK(!check_overlay(guest(DATA(0)), false));
+
+    /* a discarded sector is read from the base image again */
+    const uint64_t range[2] = {OV_SECTOR + 1, 1 /* num_sectors */};
+    memcpy(guest(DATA(1)), range, sizeof(range));
+    post(0, 4, 1, VIRTIO_BLK_T_DISCARD, 0, 1, sizeof(range));
+    REG_WRITE(QueueNotify, 0);
+    CHECK(!wait_used(0, 1));
+    CHECK(status_of(1) == VIRTIO_BLK_S_OK);
+
+    memset(guest(DATA(0)), 0, OV_LEN);
+    post(0, 0, 0, VIRTIO_BLK_T_IN, OV_SECTOR, 1, OV_LEN);
+    REG_WRITE(QueueNotify, 0);
+    CHECK(!wait_used(0, 1));
+    CHECK(!check_overlay(guest(DATA(0)), true));
+}
+
+/* once the device is gone, the overlay holds the same data when opened
+ * again, only over a base image of its size, which is left unchanged
+ */
+static void test_overlay_reopen(const char *image, const char *overlay)
+{
+    struct stat st;
+    const int fd = open(image, O_RDONLY);
+    CHECK(fd >= 0 && !fstat(fd, &st));
+
+    vblk_overlay_t *ov = vblk_overlay_open(overlay, fd, st.st_size);
+    CHECK(ov);
+    if (ov) {
+        uint8_t data[OV_LEN];
+        CHECK(!vblk_overlay_read(ov, data, OV_LEN, (uint64_t) OV_SECTOR * 512));
+        CHECK(!check_overlay(data, true));
+        CHECK(!vblk_overlay_read(ov, data, 512,
+                                 (uint64_t) (OV_SECTOR + 64) * 512));
+        bool same = true;
+        for (int j = 0; j < 512; j++)
+            same &= data[j] == 'w';
+        CHECK(same);
+        vblk_overlay_close(ov);
+    }
+    CHECK(!vblk_overlay_open(overlay, fd, st.st_size - 512));
+
+    uint8_t *base = malloc(st.st_size);
+    bool same = base && pread(fd, base, st.st_size, 0) == st.st_size;
+    for (off_t i = 0; same && i < st.st_size; i++)
+        same = base[i] == base_byte(i);
+    CHECK(same);
+    free(base);
+    close(fd);
+}
+
+/* a reset waits for the requests in flight, and drops their completions */
+static void test_reset_in_flight(void)
+{
+    setup();
+    for (uint16_t r = 0; r < 8; r++)
+        post(2, r * 4, r, VIRTIO_BLK_T_IN, r * 32, 2, 0x2000);
+    REG_WRITE(QueueNotify, 2);
+    REG_WRITE(Status, 0);
+    virtio_blk_poll(vblk);
+    CHECK(!REG_READ(InterruptStatus));
+    CHECK(!REG_READ(Status));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <image> [async | overlay]\n", argv[0]);
+        return 1;
+    }
+    const bool overlay = argc > 2 && !strcmp(argv[2], "overlay");
+    const bool async = overlay || (argc > 2 && !strcmp(argv[2], "async"));
+
+    char *overlay_file = NULL;
+    if (overlay) {
+        overlay_file = malloc(strlen(argv[1]) + sizeof(".overlay"));
+        sprintf(overlay_file, "%s.overlay", argv[1]);
+        unlink(overlay_file);
+        if (!fill_base(argv[1])) {
+            fprintf(stderr, "Failed to fill %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    vblk = vblk_new();
+    vblk->ram = ram;
+    /* the path is modified by dirname() */
+    char *image = strdup(argv[1]);
+    virtio_blk_init(vblk, image, overlay_file, false, async);
+
+    test_read_write();
+    test_out_of_range(argv[1]);
+    if (async)
+        test_reuse_in_flight();
+    test_reset_in_flight();
+    if (overlay)
+        test_overlay();
+
+    vblk_delete(vblk);
+    if (overlay) {
+        test_overlay_reopen(argv[1], overlay_file);
+        unlink(overlay_file);
+    }
+    free(overlay_file);
+    free(image);
+    return n_failures ? 1 : 0;
+}
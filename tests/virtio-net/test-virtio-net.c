@@ -0,0 +1,478 @@
+/*
+ * Test of the virtio-net device and of its backends. The device is driven
+ * through its MMIO registers over the memory of a fake guest, as the driver
+ * of the guest kernel would, and the backends through their own interface,
+ * with a peer which may be broken.
+ *
+ * Usage: test-virtio-net <dir>
+ *   The files of the links and the captures are created in <dir>.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "devices/virtio.h"
+#include "devices/vnet-backend.h"
+
+#define RAM_SIZE (4 << 20)
+
+/* layout of the guest memory, queue @q has QUEUE_NUM descriptors */
+#define QUEUE_NUM 16
+#define DESC(q) (0x1000 + (q) * 0x4000)
+#define AVAIL(q) (DESC(q) + 0x1000)
+#define USED(q) (DESC(q) + 0x2000)
+#define INDIRECT 0x40000
+#define BUF(buf) (0x100000 + (buf) * 0x800)
+#define BUF_SIZE 0x800
+
+#define RX_QUEUE 0
+#define TX_QUEUE 1
+
+/* struct virtio_net_hdr of virtio-net.c */
+#define HDR_SIZE 12
+
+static uint32_t ram[RAM_SIZE / 4];
+static virtio_net_state_t *vnet;
+static uint16_t avail_idx[2];
+static int n_failures;
+
+#define REG_READ(reg) virtio_net_read(vnet, VIRTIO_##reg << 2)
+#define REG_WRITE(reg, value) virtio_net_write(vnet, VIRTIO_##reg << 2, value)
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+            n_failures++;                                             \
+        }                                                             \
+    } while (0)
+
+static inline void *guest(uint32_t addr)
+{
+    return (uint8_t *) ram + addr;
+}
+
+/* the byte @j of the test frame @k */
+static uint8_t frame_byte(int k, uint32_t j)
+{
+    return k * 7 + j;
+}
+
+static void fill_frame(uint8_t *frame, int k, uint32_t len)
+{
+    for (uint32_t j = 0; j < len; j++)
+        frame[j] = frame_byte(k, j);
+}
+
+static bool is_frame(const uint8_t *frame, int k, uint32_t len)
+{
+    for (uint32_t j = 0; j < len; j++) {
+        if (frame[j] != frame_byte(k, j))
+            return false;
+    }
+    return true;
+}
+
+/* the k-th used element of queue @q */
+static uint32_t used_id(int q, uint16_t k)
+{
+    return ((uint32_t *) guest(USED(q) + 4))[2 * (k % QUEUE_NUM)];
+}
+
+static uint32_t used_len(int q, uint16_t k)
+{
+    return ((uint32_t *) guest(USED(q) + 4))[2 * (k % QUEUE_NUM) + 1];
+}
+
+static uint16_t used_idx(int q)
+{
+    return ((uint16_t *) guest(USED(q)))[1];
+}
+
+static void setup(void)
+{
+    REG_WRITE(Status, 0);
+    memset(guest(DESC(0)), 0, 2 * 0x4000);
+    for (int q = 0; q < 2; q++) {
+        REG_WRITE(QueueSel, q);
+        REG_WRITE(QueueNum, QUEUE_NUM);
+        REG_WRITE(QueueDescLow, DESC(q));
+        REG_WRITE(QueueDriverLow, AVAIL(q));
+        REG_WRITE(QueueDeviceLow, USED(q));
+        avail_idx[q] = 0;
+        REG_WRITE(QueueReady, 1);
+    }
+    REG_WRITE(Status, 1 | 2 | 4 | 8); /* up to FEATURES_OK and DRIVER_OK */
+}
+
+static void make_avail(int q, uint16_t head)
+{
+    uint16_t *avail = guest(AVAIL(q));
+    avail[2 + avail_idx[q] % QUEUE_NUM] = head;
+    avail[1] = ++avail_idx[q];
+}
+
+/* make the receive buffer @buf of @len bytes available as descriptor @buf */
+static void post_rx(int buf, uint32_t len)
+{
+    struct virtq_desc *desc = guest(DESC(RX_QUEUE));
+    desc[buf] = (struct virtq_desc){BUF(buf), len, VIRTIO_DESC_F_WRITE, 0};
+    make_avail(RX_QUEUE, buf);
+}
+
+static void write_pcap_header(FILE *file)
+{
+    const uint32_t header[6] = {
+        0xa1b2c3d4, 2 | 4 << 16, 0, 0, 65536, 1 /* Ethernet */,
+    };
+    fwrite(header, sizeof(header), 1, file);
+}
+
+static void write_pcap_frame(FILE *file, int k, uint32_t len)
+{
+    uint8_t frame[2048];
+    const uint32_t record[4] = {0, 0, len, len};
+    fill_frame(frame, k, len);
+    fwrite(record, sizeof(record), 1, file);
+    fwrite(frame, 1, len, file);
+}
+
+static char *path_of(const char *dir, const char *name)
+{
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+/* The frames of a capture are passed to the receive buffers in turn, as they
+ * come: the frames larger than an Ethernet frame are skipped, the ones larger
+ * than their buffer are dropped, and the frame without a buffer waits for one.
+ */
+static void test_replay(const char *dir)
+{
+    static const uint32_t lens[] = {60, 1514, 2000, 64, 100};
+    char *capture = path_of(dir, "replay.pcap");
+    FILE *file = fopen(capture, "wb");
+    CHECK(file);
+    if (!file)
+        return;
+    write_pcap_header(file);
+    for (int k = 0; k < 5; k++)
+        write_pcap_frame(file, k, lens[k]);
+    fclose(file);
+
+    char netdev[256];
+    snprintf(netdev, sizeof(netdev), "replay=%s", capture);
+    vnet = vnet_new();
+    vnet->ram = ram;
+    virtio_net_init(vnet, netdev);
+    setup();
+
+    post_rx(0, BUF_SIZE);
+    post_rx(1, BUF_SIZE);
+    CHECK(virtio_net_poll(vnet));
+    CHECK(REG_READ(InterruptStatus) & VIRTIO_INT_USED_RING);
+    REG_WRITE(InterruptACK, VIRTIO_INT_USED_RING);
+    CHECK(used_idx(RX_QUEUE) == 2);
+    for (int k = 0; k < 2; k++) {
+        const uint8_t *buf = guest(BUF(k));
+        CHECK(used_id(RX_QUEUE, k) == (uint32_t) k);
+        CHECK(used_len(RX_QUEUE, k) == HDR_SIZE + lens[k]);
+        CHECK(buf[HDR_SIZE - 2] == 1); /* num_buffers */
+        CHECK(is_frame(buf + HDR_SIZE, k, lens[k]));
+    }
+
+    /* the third frame is skipped, and the fourth does not fit */
+    CHECK(!virtio_net_poll(vnet));
+    post_rx(2, HDR_SIZE + lens[3] - 1);
+    REG_WRITE(QueueNotify, RX_QUEUE);
+    CHECK(REG_READ(InterruptStatus) & VIRTIO_INT_USED_RING);
+    REG_WRITE(InterruptACK, VIRTIO_INT_USED_RING);
+    post_rx(3, BUF_SIZE);
+    post_rx(4, BUF_SIZE);
+    CHECK(virtio_net_poll(vnet));
+    CHECK(used_idx(RX_QUEUE) == 4);
+    CHECK(used_id(RX_QUEUE, 2) == 2 && used_len(RX_QUEUE, 2) == 0);
+    CHECK(used_id(RX_QUEUE, 3) == 3);
+    CHECK(used_len(RX_QUEUE, 3) == HDR_SIZE + lens[4]);
+    CHECK(is_frame((uint8_t *) guest(BUF(3)) + HDR_SIZE, 4, lens[4]));
+
+    /* and the capture is over */
+    REG_WRITE(InterruptACK, VIRTIO_INT_USED_RING);
+    CHECK(!virtio_net_poll(vnet));
+    CHECK(used_idx(RX_QUEUE) == 4);
+    CHECK(!(REG_READ(Status) & VIRTIO_STATUS_DEVICE_NEEDS_RESET));
+
+    vnet_delete(vnet);
+    unlink(capture);
+    free(capture);
+}
+
+/* A frame sent through an indirect table is recorded without its header,
+ * and the malformed chains fail the device.
+ */
+static void test_tx(const char *dir)
+{
+    char *capture = path_of(dir, "empty.pcap");
+    char *record = path_of(dir, "tx.pcap");
+    FILE *file = fopen(capture, "wb");
+    CHECK(file);
+    if (!file)
+        return;
+    write_pcap_header(file);
+    fclose(file);
+
+    char netdev[256];
+    snprintf(netdev, sizeof(netdev), "replay=%s,pcap=%s", capture, record);
+    vnet = vnet_new();
+    vnet->ram = ram;
+    virtio_net_init(vnet, netdev);
+    setup();
+
+    /* the header and the frame, split over three buffers */
+    const uint32_t len = 200;
+    uint8_t *buf = guest(BUF(0));
+    memset(buf, 0, HDR_SIZE);
+    fill_frame(buf + HDR_SIZE, 0, len);
+    struct virtq_desc *table = guest(INDIRECT);
+    table[0] = (struct virtq_desc){BUF(0), HDR_SIZE, VIRTIO_DESC_F_NEXT, 1};
+    table[1] =
+        (struct virtq_desc){BUF(0) + HDR_SIZE, 50, VIRTIO_DESC_F_NEXT, 2};
+    table[2] = (struct virtq_desc){BUF(0) + HDR_SIZE + 50, len - 50, 0, 0};
+    struct virtq_desc *desc = guest(DESC(TX_QUEUE));
+    desc[5] = (struct virtq_desc){INDIRECT, 3 * sizeof(struct virtq_desc),
+                                  VIRTIO_DESC_F_INDIRECT, 0};
+    make_avail(TX_QUEUE, 5);
+    REG_WRITE(QueueNotify, TX_QUEUE);
+    CHECK(used_idx(TX_QUEUE) == 1 && used_id(TX_QUEUE, 0) == 5);
+    CHECK(REG_READ(InterruptStatus) & VIRTIO_INT_USED_RING);
+    CHECK(!(REG_READ(Status) & VIRTIO_STATUS_DEVICE_NEEDS_RESET));
+
+    /* a buffer written by the device on the transmit queue */
+    table[0].flags |= VIRTIO_DESC_F_WRITE;
+    make_avail(TX_QUEUE, 5);
+    REG_WRITE(QueueNotify, TX_QUEUE);
+    CHECK(REG_READ(Status) & VIRTIO_STATUS_DEVICE_NEEDS_RESET);
+    CHECK(REG_READ(InterruptStatus) & VIRTIO_INT_CONF_CHANGE);
+
+    /* a chain looping over its table */
+    setup();
+    table[0].flags &= ~VIRTIO_DESC_F_WRITE;
+    table[2] = (struct virtq_desc){BUF(0), 1, VIRTIO_DESC_F_NEXT, 0};
+    desc = guest(DESC(TX_QUEUE));
+    desc[5] = (struct virtq_desc){INDIRECT, 3 * sizeof(struct virtq_desc),
+                                  VIRTIO_DESC_F_INDIRECT, 0};
+    make_avail(TX_QUEUE, 5);
+    REG_WRITE(QueueNotify, TX_QUEUE);
+    CHECK(REG_READ(Status) & VIRTIO_STATUS_DEVICE_NEEDS_RESET);
+
+    /* an available index beyond the ring */
+    setup();
+    avail_idx[TX_QUEUE] = QUEUE_NUM;
+    make_avail(TX_QUEUE, 0);
+    REG_WRITE(QueueNotify, TX_QUEUE);
+    CHECK(REG_READ(Status) & VIRTIO_STATUS_DEVICE_NEEDS_RESET);
+    CHECK(used_idx(TX_QUEUE) == 0);
+
+    vnet_delete(vnet);
+
+    /* the capture holds the one frame sent */
+    uint8_t data[24 + 16 + 256];
+    file = fopen(record, "rb");
+    CHECK(file);
+    if (file) {
+        CHECK(fread(data, 1, sizeof(data), file) == 24 + 16 + len);
+        fclose(file);
+        uint32_t incl_len;
+        memcpy(&incl_len, data + 24 + 8, sizeof(incl_len));
+        CHECK(incl_len == len);
+        CHECK(is_frame(data + 24 + 16, 0, len));
+    }
+    unlink(capture);
+    unlink(record);
+    free(capture);
+    free(record);
+}
+
+/* length of the k-th frame sent over the socket, large enough for the
+ * socket to take the frame in parts
+ */
+#define SOCKET_FRAME_LEN(k) (40000 + (k) % 20000)
+#define SOCKET_FRAMES 200
+
+static bool socket_sent[SOCKET_FRAMES];
+static int socket_n_sent, socket_n_dropped;
+
+static void socket_send_frame(vnet_backend_t *be, int k)
+{
+    static uint8_t frame[65536];
+    fill_frame(frame, k, SOCKET_FRAME_LEN(k));
+    socket_sent[k] = !vnet_backend_send(be, frame, SOCKET_FRAME_LEN(k));
+    if (socket_sent[k])
+        socket_n_sent++;
+    else
+        socket_n_dropped++;
+}
+
+/* The frames sent while the peer does not read are kept whole: the one the
+ * socket has no room for is sent in part, its rest goes first once the peer
+ * reads again, before the next frame, and the frames are dropped meanwhile.
+ */
+static void test_socket(const char *dir)
+{
+    char *path = path_of(dir, "socket");
+    char spec[256];
+    snprintf(spec, sizeof(spec), "socket=%s", path);
+    vnet_backend_t *a = vnet_backend_open(spec);
+    vnet_backend_t *b = vnet_backend_open(spec);
+    CHECK(a && b);
+    if (!a || !b)
+        return;
+    CHECK(vnet_backend_index(a) == 0 && vnet_backend_index(b) == 1);
+
+    /* the listening end takes the connection as it polls */
+    static uint8_t buf[65536];
+    CHECK(!vnet_backend_recv(a, buf, sizeof(buf)));
+
+    int k_sent = 0;
+    while (k_sent < SOCKET_FRAMES / 2)
+        socket_send_frame(b, k_sent++);
+    CHECK(socket_n_sent && socket_n_dropped);
+
+    /* the frames come in order, each whole, while the next ones are sent */
+    int k = 0, n_received = 0;
+    for (int i = 0; i < 1000000; i++) {
+        const uint32_t len = vnet_backend_recv(a, buf, sizeof(buf));
+        if (!len) {
+            if (k_sent < SOCKET_FRAMES)
+                socket_send_frame(b, k_sent++);
+            else if (n_received < socket_n_sent)
+                vnet_backend_recv(b, buf, sizeof(buf));
+            else
+                break;
+            continue;
+        }
+        while (k < SOCKET_FRAMES && !socket_sent[k])
+            k++;
+        CHECK(k < SOCKET_FRAMES && len == SOCKET_FRAME_LEN((uint32_t) k));
+        CHECK(k < SOCKET_FRAMES && is_frame(buf, k, len));
+        k++;
+        n_received++;
+    }
+    CHECK(n_received == socket_n_sent);
+    CHECK(socket_sent[SOCKET_FRAMES - 1]);
+
+    /* and the frames larger than the buffer of the receiver are dropped */
+    uint8_t frame[100];
+    fill_frame(frame, 1, 100);
+    CHECK(!vnet_backend_send(b, frame, 100));
+    fill_frame(frame, 2, 60);
+    CHECK(!vnet_backend_send(b, frame, 60));
+    CHECK(vnet_backend_recv(a, buf, 99) == 60 && is_frame(buf, 2, 60));
+
+    vnet_backend_close(b);
+    vnet_backend_close(a);
+    unlink(path);
+    free(path);
+}
+
+/* layout of the ring of frames sent by end 1, see vnet-backend.c */
+#define SHM_SLOTS 256
+#define SHM_SLOT_SIZE 2048
+#define SHM_RING_SIZE (128 + SHM_SLOTS * SHM_SLOT_SIZE)
+
+/* The link is taken by two processes, as the ends are locked per process.
+ * The ring written by the peer is then corrupted: a head too far ahead drops
+ * the frames, and a slot of a bogus length is skipped.
+ */
+static void test_shm(const char *dir)
+{
+    char *path = path_of(dir, "shm");
+    char spec[256];
+    snprintf(spec, sizeof(spec), "shm=%s", path);
+    unlink(path);
+    vnet_backend_t *be = vnet_backend_open(spec);
+    CHECK(be && vnet_backend_index(be) == 0);
+    if (!be)
+        return;
+
+    static uint8_t frame[2048], buf[2048];
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (!pid) {
+        vnet_backend_t *peer = vnet_backend_open(spec);
+        if (!peer || vnet_backend_index(peer) != 1)
+            _exit(1);
+        fill_frame(frame, 0, 100);
+        vnet_backend_send(peer, frame, 100);
+        fill_frame(frame, 1, 200);
+        vnet_backend_send(peer, frame, 200);
+        /* larger than a slot */
+        _exit(vnet_backend_send(peer, frame, SHM_SLOT_SIZE) ? 0 : 1);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+          !WEXITSTATUS(status));
+
+    CHECK(vnet_backend_recv(be, buf, sizeof(buf)) == 100 &&
+          is_frame(buf, 0, 100));
+    /* a frame larger than the buffer is dropped */
+    CHECK(!vnet_backend_recv(be, buf, 199));
+    CHECK(!vnet_backend_recv(be, buf, sizeof(buf)));
+
+    const int fd = open(path, O_RDWR);
+    uint8_t *link = mmap(NULL, 2 * SHM_RING_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    CHECK(fd >= 0 && link != MAP_FAILED);
+    if (fd < 0 || link == MAP_FAILED)
+        goto out;
+    uint8_t *ring = link + SHM_RING_SIZE;
+    uint32_t *head = (uint32_t *) ring;
+    uint32_t *tail = (uint32_t *) (ring + 64);
+
+    /* a head further than the ring holds */
+    *head += SHM_SLOTS + 1000;
+    CHECK(!vnet_backend_recv(be, buf, sizeof(buf)));
+    CHECK(*tail == *head);
+
+    /* a slot of a bogus length, followed by a good one */
+    for (int i = 0; i < 2; i++) {
+        uint8_t *slot = ring + 128 + (*head % SHM_SLOTS) * SHM_SLOT_SIZE;
+        const uint32_t len = i ? 60 : 0xffffffff;
+        memcpy(slot, &len, sizeof(len));
+        fill_frame(slot + 4, 2, 60);
+        (*head)++;
+    }
+    CHECK(vnet_backend_recv(be, buf, sizeof(buf)) == 60 &&
+          is_frame(buf, 2, 60));
+    CHECK(*tail == *head);
+    munmap(link, 2 * SHM_RING_SIZE);
+
+out:
+    if (fd >= 0)
+        close(fd);
+    vnet_backend_close(be);
+    unlink(path);
+    free(path);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <dir>\n", argv[0]);
+        return 1;
+    }
+
+    test_replay(argv[1]);
+    test_tx(argv[1]);
+    test_socket(argv[1]);
+    test_shm(argv[1]);
+    return n_failures ? 1 : 0;
+}
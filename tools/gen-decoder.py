@@ -0,0 +1,438 @@
+#!/usr/bin/env python3
+
+"""
+This script generates the instruction list and the decoder tables from the
+instruction description in 'src/rv32_insn.txt', so that both are derived from
+a single source.
+
+Usage: gen-decoder.py --list|--table <description> <output>
+
+  --list   emit RV_INSN_LIST, included by 'src/decode.h'
+  --table  emit the decoder tables, included by 'src/decode.c'
+
+The first level of the decoder tables is indexed by the major opcode and
+funct3 of a 32-bit instruction, or by the quadrant and funct3 of a compressed
+one. Each entry holds the function decoding the instruction, either directly,
+when only one encoding can match, or by looking up the sub-bucket selected by
+another field of the instruction, or else by scanning the list of encodings
+that can match, in the order of the description, and terminated by an illegal
+entry which matches anything.
+"""
+
+import sys
+
+HEADER = """\
+/* This file is generated by tools/gen-decoder.py from src/rv32_insn.txt.
+ * Do not edit it by hand.
+ */
+
+#pragma once
+"""
+
+ILLEGAL = "    {0, 0, {decode_illegal, 0, {0, 0}, false, 0, 0}},"
+NEVER = "    {0, 1, {decode_illegal, 0, {0, 0}, false, 0, 0}},"
+
+REGS = ["rs1", "rs2", "rs3", "rd"]
+
+# rd of both the 32-bit and the compressed instructions
+RD_MASK = 0x00000F80
+
+# the buckets are split by fields of up to 4 bits, at most twice
+MAX_SPLIT_WIDTH = 4
+MAX_SPLIT_DEPTH = 2
+
+
+class Insn:
+    def __init__(self, name, branch, length, translatable, regs, cond, group):
+        self.name = name
+        self.branch = branch
+        self.length = length
+        self.translatable = translatable
+        self.regs = regs
+        self.cond = cond
+        self.group = group
+
+
+class Enc:
+    def __init__(self, name, fmt, mask, match, fpreg, cond, compressed, line):
+        self.name = name
+        self.fmt = fmt
+        self.mask = mask
+        self.match = match
+        self.fpreg = fpreg
+        self.cond = cond
+        self.compressed = compressed
+        self.line = line
+
+
+def fail(lineno, msg):
+    sys.exit(f"{sys.argv[2]}:{lineno}: {msg}")
+
+
+def parse_value(lineno, s):
+    try:
+        return int(s, 0)
+    except ValueError:
+        fail(lineno, f"invalid value '{s}'")
+
+
+def parse_field(lineno, field):
+    bits, _, value = field.partition("=")
+    hi, _, lo = bits.partition("..")
+    hi = parse_value(lineno, hi)
+    lo = parse_value(lineno, lo) if lo else hi
+    value = parse_value(lineno, value)
+    if not 0 <= lo <= hi <= 31:
+        fail(lineno, f"invalid bit range '{bits}'")
+    width = hi - lo + 1
+    if value >> width:
+        fail(lineno, f"value {value:#x} does not fit in bits {hi}..{lo}")
+    return ((1 << width) - 1) << lo, value << lo
+
+
+def parse(path):
+    insns = []
+    encs = []
+    names = {}
+    group = None
+    group_cond = ()
+
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    for lineno, line in enumerate(lines, 1):
+        words = line.split("#", 1)[0].split()
+        if not words:
+            continue
+        kind, args = words[0], words[1:]
+
+        if kind == "group":
+            if len(args) < 2:
+                fail(lineno, "expected 'group <features> <title>'")
+            group_cond = () if args[0] == "-" else tuple(args[0].split(","))
+            group = " ".join(args[1:])
+        elif kind == "insn":
+            cond = group_cond
+            if args and args[-1].startswith("if="):
+                cond += (args.pop()[3:],)
+            if len(args) != 5:
+                fail(lineno, "expected 'insn <name> <can-branch> <insn-len> "
+                             "<translatable> <reg-mask>'")
+            name, branch, length, translatable, regs = args
+            if name in names:
+                fail(lineno, f"duplicated instruction '{name}'")
+            regs = [] if regs == "-" else regs.split(",")
+            for r in regs:
+                if r not in REGS:
+                    fail(lineno, f"unknown register field '{r}'")
+            insn = Insn(name, branch, length, translatable, regs, cond, group)
+            names[name] = insn
+            insns.append(insn)
+        elif kind == "enc":
+            if len(args) < 2:
+                fail(lineno, "expected 'enc <name> <format> <fields>'")
+            name, fmt, fields = args[0], args[1], args[2:]
+            fpreg = "fpreg" in fields
+            fields = [x for x in fields if x != "fpreg"]
+            mask = match = 0
+            for field in fields:
+                m, v = parse_field(lineno, field)
+                if mask & m:
+                    fail(lineno, f"overlapping field '{field}'")
+                mask |= m
+                match |= v
+            compressed = (mask & 3) == 3 and (match & 3) != 3
+            if mask & 3 and not compressed:
+                fail(lineno, "bits 1..0 of a 32-bit instruction are implied")
+            if name == "-":
+                if fmt != "-":
+                    fail(lineno, "an illegal encoding has no format")
+                cond = ()
+            else:
+                if name not in names:
+                    fail(lineno, f"unknown instruction '{name}'")
+                if fmt == "-":
+                    fail(lineno, f"missing format of '{name}'")
+                cond = names[name].cond
+            if compressed:
+                cond = tuple(c for c in cond if c != "EXT_C")
+            encs.append(Enc(name, fmt, mask, match, fpreg, cond, compressed,
+                            lineno))
+        else:
+            fail(lineno, f"unknown directive '{kind}'")
+
+    return insns, encs
+
+
+def has(cond):
+    return " && ".join(f"RV32_HAS({c})" for c in cond)
+
+
+def iif(cond, body):
+    for c in reversed(cond):
+        body = f"IIF(RV32_HAS({c}))({body})"
+    return body
+
+
+def align(lines):
+    width = max(len(x) for x in lines) + 1
+    return "\n".join(x.ljust(width) + "\\" for x in lines[:-1]) + \
+        "\n" + lines[-1]
+
+
+def gen_list(insns):
+    out = [HEADER]
+    out.append("""\
+/* RISC-V instruction list in format _(instruction-name, can-branch, insn_len,
+ *                                     translatable, reg-mask)
+ */
+/* clang-format off */""")
+
+    lines = ["#define RV_INSN_LIST"]
+    group = None
+    opened = ()
+
+    def close(n):
+        for i in range(n):
+            lines.append("    " * (len(opened) - i) + ")")
+
+    for insn in insns:
+        if insn.group != group:
+            close(len(opened))
+            opened = ()
+            group = insn.group
+            lines.append(f"    /* {group} */")
+        # open or close the nested conditions of this instruction
+        common = 0
+        while (common < min(len(opened), len(insn.cond))
+               and opened[common] == insn.cond[common]):
+            common += 1
+        close(len(opened) - common)
+        opened = opened[:common]
+        for c in insn.cond[common:]:
+            lines.append("    " * (len(opened) + 1) +
+                         f"IIF(RV32_HAS({c}))(")
+            opened += (c,)
+        regs = ", ".join(r for r in REGS if r in insn.regs)
+        lines.append("    " * (len(opened) + 1) +
+                     f"_({insn.name}, {insn.branch}, {insn.length}, "
+                     f"{insn.translatable}, ENC({regs}))")
+    close(len(opened))
+    out.append(align(lines))
+    out.append("/* clang-format on */\n")
+    return "\n".join(out)
+
+
+def select(encs, index_mask, value):
+    """
+    Return the encodings which can match an instruction whose bits in
+    index_mask are value, along with their remaining mask and match.
+    """
+    entries = []
+    for enc in encs:
+        fixed = index_mask & enc.mask
+        if value & fixed != enc.match & fixed:
+            continue
+        mask = enc.mask & ~index_mask
+        entries.append((enc, mask, enc.match & mask))
+        # nothing after an unconditional match is reachable
+        if not mask and not enc.cond:
+            break
+    return entries
+
+
+def gen_entry(enc, mask, match):
+    if enc.name == "-":
+        return (f"    {{{mask:#010x}, {match:#010x}, {{decode_illegal, 0, "
+                f"{{0, 0}}, false, 0, 0}}}}, /* rv32_insn.txt:{enc.line} */")
+    fpreg = "true" if enc.fpreg else "false"
+    return (f"    {{{mask:#010x}, {match:#010x}, {{decode_{enc.fmt}_insn, 0, "
+            f"{{rv_insn_{enc.name}, rv_insn_{enc.name}}}, {fpreg}, 0, 0}}}},")
+
+
+def gen_direct(entries):
+    """
+    Return the first-level entry of a bucket that can be decoded without
+    scanning its encodings, i.e., holding a single one, possibly preceded by
+    the same instruction with rd = x0 decoded as another one, e.g., a HINT.
+    """
+    if any(e[0].cond or e[0].name == "-" for e in entries):
+        return None
+    if len(entries) == 1 and not entries[0][1]:
+        insn = insn_rd0 = entries[0][0]
+    elif (len(entries) == 2 and entries[0][1:] == (RD_MASK, 0) and
+          not entries[1][1] and entries[0][0].fmt == entries[1][0].fmt and
+          entries[0][0].fpreg == entries[1][0].fpreg):
+        insn_rd0, insn = entries[0][0], entries[1][0]
+    else:
+        return None
+    fpreg = "true" if insn.fpreg else "false"
+    return (f"{{decode_{insn.fmt}_insn, 0, {{rv_insn_{insn.name}, "
+            f"rv_insn_{insn_rd0.name}}}, {fpreg}, 0, 0}}")
+
+
+def split(encs, index_mask, value, entries):
+    """
+    Return the field (shift, width) splitting a bucket which has to be scanned
+    into the fewest encodings to compare, on average, if it pays off.
+    """
+    top = 16 if entries[0][0].compressed else 32
+    best = None
+    for width in range(1, MAX_SPLIT_WIDTH + 1):
+        for shift in range(top - width + 1):
+            field = ((1 << width) - 1) << shift
+            if index_mask & field:
+                continue
+            cost = 0
+            for sub in range(1 << width):
+                es = select(encs, index_mask | field, value | sub << shift)
+                if es and not gen_direct(es):
+                    cost += len(es) + 1
+            cost /= 1 << width
+            if not best or cost < best[0]:
+                best = (cost, shift, width)
+    # following the index costs about as much as comparing one encoding
+    if best and best[0] + 1 < len(entries):
+        return best[1:]
+    return None
+
+
+def gen_buckets(out, encs, n, index_of, prefix, comment):
+    """
+    Emit the lists of encodings for the first-level indices [0, n) back to
+    back in a single array, sharing the identical ones, then the first-level
+    table pointing to them, or decoding the bucket directly, followed by the
+    second-level tables of the buckets split by another field.
+    """
+    patterns = []
+    offsets = {}
+    table = [None] * n
+
+    def gen_index(index_mask, value, pos, depth):
+        entries = select(encs, index_mask, value)
+        if not entries:
+            return "{decode_illegal, 0, {0, 0}, false, 0, 0}"
+        direct = gen_direct(entries)
+        if direct:
+            return direct
+
+        field = depth < MAX_SPLIT_DEPTH and \
+            split(encs, index_mask, value, entries)
+        if field:
+            # the sub-buckets follow, relative to the entry splitting them
+            shift, width = field
+            sub_pos = len(table)
+            table.extend([None] * (1 << width))
+            for sub in range(1 << width):
+                table[sub_pos + sub] = gen_index(
+                    index_mask | ((1 << width) - 1) << shift,
+                    value | sub << shift, sub_pos + sub, depth + 1)
+            return (f"{{decode_index, {sub_pos - pos}, {{0, 0}}, false, "
+                    f"{shift}, {(1 << width) - 1:#x}}}")
+
+        # the list ends with an unconditional match, or with an illegal one
+        last = entries[-1] if entries else None
+        if not last or last[1] or last[0].cond:
+            entries.append(None)
+        run = tuple(entries)
+        sig = tuple(e and (e[0].line, e[1], e[2]) for e in run)
+        if sig not in offsets:
+            offsets[sig] = len(patterns)
+            patterns.extend(run)
+        return f"{{{prefix}_scan, {offsets[sig]}, {{0, 0}}, false, 0, 0}}"
+
+    for key in range(n):
+        table[key] = gen_index(*index_of(key), key, 0)
+
+    if max(len(patterns), len(table)) > 0xFFFF:
+        sys.exit("too many encodings for 16-bit offsets")
+
+    # Entries of disabled extensions are replaced by one that never matches,
+    # so that the offsets are the same whatever the configuration.
+    out.append(f"static const decode_pattern_t {prefix}_patterns[] = {{")
+    i = 0
+    while i < len(patterns):
+        e = patterns[i]
+        if not e or not e[0].cond:
+            out.append(gen_entry(*e) if e else ILLEGAL)
+            i += 1
+            continue
+        cond = e[0].cond
+        group = []
+        while (i < len(patterns) and patterns[i] and
+               patterns[i][0].cond == cond):
+            group.append(gen_entry(*patterns[i]))
+            i += 1
+        out.append(f"#if {has(cond)}")
+        out += group
+        out.append("#else")
+        out += [NEVER] * len(group)
+        out.append("#endif")
+    out.append("};\n")
+
+    out.append(f"static const decode_index_t {prefix}_table[] = {{")
+    out.append(f"    /* {comment} */")
+    out += [f"    {x}, /* {i:#04x} */" for i, x in enumerate(table[:n])]
+    if len(table) > n:
+        out.append("    /* second level */")
+        out += [f"    {x}, /* {i:#04x} */" for i, x in enumerate(table[n:], n)]
+    out.append("};")
+
+
+def gen_table(encs):
+    out = [HEADER]
+
+    # a format is needed whenever any of the instructions using it is
+    formats = {}
+    for enc in encs:
+        if enc.name == "-":
+            continue
+        cond = enc.cond + (("EXT_C",) if enc.compressed else ())
+        if enc.fmt in formats:
+            formats[enc.fmt] = tuple(c for c in formats[enc.fmt] if c in cond)
+        else:
+            formats[enc.fmt] = cond
+
+    out.append("/* operand extraction templates, see decode_<format>() */")
+    lines = ["#define DECODE_FORMAT_LIST"]
+    lines += [f"    {iif(cond, f'_({fmt})')}" for fmt, cond in formats.items()]
+    out.append(align(lines) + "\n")
+
+    out.append("""\
+#define _(format)                                                    \\
+    static bool decode_##format##_insn(rv_insn_t *ir, uint32_t insn, \\
+                                       const decode_index_t *idx);
+DECODE_FORMAT_LIST
+#undef _
+""")
+
+    # 32-bit instructions: opcode[6:2] and funct3
+    def index32(key):
+        return 0x707C, (key >> 3) << 2 | (key & 7) << 12
+
+    gen_buckets(out, [e for e in encs if not e.compressed], 256, index32,
+                "rv_decode", "indexed by opcode[6:2] << 3 | funct3")
+    out.append("")
+
+    # compressed instructions: funct3 and opcode[1:0]
+    def index16(key):
+        return 0xE003, (key >> 2) << 13 | (key & 3)
+
+    out.append("#if RV32_HAS(EXT_C)")
+    gen_buckets(out, [e for e in encs if e.compressed], 32, index16,
+                "rvc_decode", "indexed by funct3 << 2 | opcode[1:0]")
+    out.append("#endif\n")
+    return "\n".join(out)
+
+
+def main():
+    if len(sys.argv) != 4 or sys.argv[1] not in ("--list", "--table"):
+        sys.exit(__doc__)
+    insns, encs = parse(sys.argv[2])
+    text = gen_list(insns) if sys.argv[1] == "--list" else gen_table(encs)
+    with open(sys.argv[3], "w") as f:
+        f.write(text)
+
+
+if __name__ == "__main__":
+    main()
@@ -187,6 +187,8 @@ fields = {
     "rs2",
     "rd",
     "shamt",
+}
+cold_fields = {
     "branch_taken",
     "branch_untaken",
 }
@@ -204,6 +206,8 @@ for i in range(len(op)):
             for i in range(len(items)):
                 if items[i] in fields:
                     items[i] = "ir->" + items[i]
+                if items[i] in cold_fields:
+                    items[i] = "rv_insn_cold(ir)->" + items[i]
                 if items[i] in virt_regs:
                     items[i] = "vm_reg[" + items[i][-1] + "]"
                 if items[i] == "TMP":